@@ -6,6 +6,18 @@
  *   ./test_protocol cjtag   # two-wire cJTAG OScan1 (CMD_OSCAN1)
  *   ./test_protocol legacy  # legacy 8-byte VPI protocol
  *   ./test_protocol combo   # protocol switching and mixed operations
+ *   ./test_protocol dmi     # CMD_DMI fast path (server run with --dmi-fastpath)
+ *   ./test_protocol gdb     # GDB RSP stub (server run with --gdb-port 3334)
+ *   ./test_protocol tap     # server-side TAP navigation (CMD_TAP_GOTO, CMD_SCAN_IR/DR)
+ *   ./test_protocol stats   # per-command metrics (CMD_STATS)
+ *   ./test_protocol batch   # batched ops in one frame (CMD_BATCH)
+ *   ./test_protocol multi   # several concurrent client sessions
+ *   ./test_protocol bench   # round-trip latency of the transport
+ *   ./test_protocol shm     # shared-memory rings (needs --unix or --abstract)
+ *
+ * Options (before the mode) select the server transport:
+ *   --unix <path>           # server run with --unix <path>
+ *   --abstract <name>       # server run with --abstract <name> (Linux)
  */
 
 #include <arpa/inet.h>
@@ -14,12 +26,17 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "../vpi/jtag_vpi_shm.h"
+
 #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
 #define TO_LE32(x) (x)
 #define FROM_LE32(x) (x)
@@ -31,9 +48,12 @@
 #define VPI_ADDR "127.0.0.1"
 #define VPI_PORT 3333
 #define TIMEOUT_SEC 3
+#define GDB_PORT 3334
 
 /* Common test counters */
 static int sock_fd = -1;
+static const char *vpi_unix_path = NULL; /* --unix / --abstract: AF_UNIX instead of TCP */
+static int vpi_abstract = 0;
 static int test_count = 0;
 static int pass_count = 0;
 static int fail_count = 0;
@@ -133,7 +153,7 @@ static int validate_u16(const char *name, uint16_t actual, uint16_t expected) {
     return 0;
 }
 
-static int connect_vpi(void) {
+static int connect_port(int port) {
     int s = socket(AF_INET, SOCK_STREAM, 0);
     if (s < 0)
         return -1;
@@ -141,7 +161,7 @@ static int connect_vpi(void) {
     struct sockaddr_in addr;
     memset(&addr, 0, sizeof(addr));
     addr.sin_family = AF_INET;
-    addr.sin_port = htons(VPI_PORT);
+    addr.sin_port = htons(port);
     inet_pton(AF_INET, VPI_ADDR, &addr.sin_addr);
 
     if (connect(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
@@ -155,6 +175,41 @@ static int connect_vpi(void) {
     return s;
 }
 
+static int connect_unix(const char *path, int abstract) {
+    struct sockaddr_un addr;
+    size_t n = strlen(path);
+    if (n + 1 > sizeof(addr.sun_path))
+        return -1;
+    int s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    socklen_t len = sizeof(addr);
+    if (abstract) {
+        memcpy(addr.sun_path + 1, path, n);
+        len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 + n);
+    } else {
+        memcpy(addr.sun_path, path, n);
+    }
+    if (connect(s, (struct sockaddr *)&addr, len) < 0) {
+        close(s);
+        return -1;
+    }
+
+    struct timeval tv = {.tv_sec = TIMEOUT_SEC, .tv_usec = 0};
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    return s;
+}
+
+static int connect_vpi(void) {
+    if (vpi_unix_path)
+        return connect_unix(vpi_unix_path, vpi_abstract);
+    return connect_port(VPI_PORT);
+}
+
 static int send_all(int s, const void *buf, size_t len) {
     const uint8_t *p = (const uint8_t *)buf;
     size_t sent = 0;
@@ -755,6 +810,113 @@ static int test_jtag_shift_register_length(void) {
     return 0;
 }
 
+static int test_jtag_streaming_scan(void) {
+    print_test("JTAG Streaming Scan (CMD_SCAN_STREAM, 64 Kbit)");
+    print_info("Shifting 65536 bits through IDCODE in Shift-DR, 1 KiB chunks");
+
+    enum { STREAM_BITS = 65536, STREAM_BYTES = STREAM_BITS / 8, CHUNK = 1024 };
+    struct jtag_vpi_cmd cmd = {0};
+    struct jtag_vpi_resp resp = {0};
+
+    cmd.cmd = 0x00; /* CMD_RESET */
+    cmd.length = htonl(0);
+    if (jtag_send_cmd(&cmd, &resp) != 0 || resp.response != 0x00) {
+        print_fail("Failed to reset TAP before streaming scan");
+        return 0;
+    }
+
+    cmd.cmd = 0x06; /* CMD_SCAN_STREAM */
+    cmd.length = htonl(STREAM_BITS);
+    if (jtag_send_cmd(&cmd, &resp) != 0 || resp.response != 0x00) {
+        print_fail("Streaming scan command rejected");
+        return 0;
+    }
+
+    /* Same TAP walk as the IDCODE test (TMS 0,1,0 then Shift-DR), exit on the last bit.
+     * TDI carries a byte counter so the pattern can be found again on TDO. */
+    static uint8_t tdo[STREAM_BYTES];
+    uint8_t pairs[2 * CHUNK];
+    for (int off = 0; off < STREAM_BYTES; off += CHUNK) {
+        for (int i = 0; i < CHUNK; i++) {
+            int byte = off + i;
+            pairs[2 * i] = (byte == 0) ? 0x02 : (byte == STREAM_BYTES - 1) ? 0x80 : 0x00; /* TMS */
+            pairs[2 * i + 1] = (uint8_t)(byte * 7 + 1);                                   /* TDI */
+        }
+        /* Read each chunk's TDO before sending the next so neither side stalls */
+        if (send_all(sock_fd, pairs, sizeof(pairs)) < 0 || recv_all(sock_fd, tdo + off, CHUNK) < 0) {
+            print_fail("Stream data transfer failed");
+            return 0;
+        }
+    }
+
+    uint32_t idcode = 0;
+    for (int i = 0; i < 32; i++) {
+        int bit = i + 3;
+        if (tdo[bit / 8] & (1 << (bit % 8))) {
+            idcode |= (1U << i);
+        }
+    }
+    if (idcode != 0x1DEAD3FF) {
+        char errmsg[100];
+        snprintf(errmsg, sizeof(errmsg), "IDCODE mismatch in stream: got 0x%08X, expected 0x1DEAD3FF", idcode);
+        print_fail(errmsg);
+        return 0;
+    }
+
+    /* TDI re-emerges on TDO once it has passed through the 32-bit register */
+    for (int delay = 30; delay <= 34; delay++) {
+        int ok = 1;
+        for (int bit = 64; bit < STREAM_BITS - 64 && ok; bit++) {
+            int src = bit - delay;
+            int tdi_bit = ((uint8_t)((src / 8) * 7 + 1) >> (src % 8)) & 1;
+            int tdo_bit = (tdo[bit / 8] >> (bit % 8)) & 1;
+            ok = (tdi_bit == tdo_bit);
+        }
+        if (ok) {
+            char msg[80];
+            snprintf(msg, sizeof(msg), "IDCODE 0x1DEAD3FF, TDI pattern returned intact (delay %d)", delay);
+            print_pass(msg);
+            return 1;
+        }
+    }
+
+    print_fail("TDI pattern not found in streamed TDO");
+    return 0;
+}
+
+static int test_jtag_streaming_scan_max_bits(void) {
+    print_test("JTAG Streaming Scan of 0xFFFFFFFF bits accepts input");
+    print_info("The byte count of a near-2^32-bit stream must not wrap to zero");
+
+    enum { CHUNK = 512 };
+    struct jtag_vpi_cmd cmd = {0};
+    struct jtag_vpi_resp resp = {0};
+    cmd.cmd = 0x06; /* CMD_SCAN_STREAM */
+    cmd.length = htonl(0xFFFFFFFF);
+    if (jtag_send_cmd(&cmd, &resp) != 0 || resp.response != 0x00) {
+        print_fail("Streaming scan command rejected");
+        return 0;
+    }
+    uint8_t pairs[2 * CHUNK] = {0}, tdo[CHUNK];
+    int shifted = send_all(sock_fd, pairs, sizeof(pairs)) >= 0 && recv_all(sock_fd, tdo, sizeof(tdo)) >= 0;
+
+    /* The stream cannot be finished here: drop it and start a new session */
+    close(sock_fd);
+    sock_fd = connect_vpi();
+    if (!shifted) {
+        print_fail("No TDO returned for the first chunk");
+        return 0;
+    }
+    cmd.cmd = 0x00; /* CMD_RESET */
+    cmd.length = htonl(0);
+    if (sock_fd < 0 || jtag_send_cmd(&cmd, &resp) != 0 || resp.response != 0x00) {
+        print_fail("Server unusable after the abandoned stream");
+        return 0;
+    }
+    print_pass("First chunk shifted and returned");
+    return 1;
+}
+
 static int test_jtag_tck_frequency_stress(void) {
     print_test("JTAG Physical: TCK Frequency Stress Test");
     print_info("Rapid TCK toggling with 50 consecutive operations");
@@ -919,6 +1081,8 @@ static int run_jtag_tests(void) {
     ok &= test_jtag_boundary_scan_simulation();
     ok &= test_jtag_idcode_read_simulation();
     ok &= test_jtag_shift_register_length();
+    ok &= test_jtag_streaming_scan();
+    ok &= test_jtag_streaming_scan_max_bits();
     ok &= test_jtag_tck_frequency_stress();
 
     return ok;
@@ -929,6 +1093,7 @@ static int run_jtag_tests(void) {
 /* -------------------------------------------------------------------------- */
 
 #define CMD_OSCAN1 5
+#define CMD_OSCAN1_BULK 9
 #define VPI_MAX_BUF 512
 
 struct cjtag_vpi_cmd {
@@ -1134,6 +1299,145 @@ static int test_cjtag_extended_sf0(void) {
     return 1;
 }
 
+/* One 1036-byte packet out, its reply back with the header in host order */
+static int cjtag_xfer(const struct cjtag_vpi_cmd *cmd, struct cjtag_vpi_cmd *rx) {
+    struct cjtag_vpi_cmd tx = *cmd;
+    tx.cmd = TO_LE32(tx.cmd);
+    tx.length = TO_LE32(tx.length);
+    tx.nb_bits = TO_LE32(tx.nb_bits);
+    if (send_all(sock_fd, &tx, sizeof(tx)) < 0 || recv_all(sock_fd, rx, sizeof(*rx)) < 0)
+        return -1;
+    rx->cmd = FROM_LE32(rx->cmd);
+    rx->length = FROM_LE32(rx->length);
+    rx->nb_bits = FROM_LE32(rx->nb_bits);
+    return 0;
+}
+
+/* OAC + JScan OSCAN_ON as SF0 pairs, edge for edge what the server sends
+ * (next_sf0_edge): 8 pairs with TMSC high, then 5 with TMSC low. It only
+ * lines up with oscan1_controller.sv from power-on, so it has to come before
+ * any other raw edges. Once in SF0 the adapter stays there and the pairs are
+ * ordinary TAP cycles (Test-Logic-Reset, then Run-Test/Idle). */
+static int oscan1_bring_up(void) {
+    for (int i = 0; i < 8; i++) {
+        if (oscan1_edge(1, 1, NULL) != 0)
+            return -1;
+    }
+    for (int i = 0; i < 5; i++) {
+        if (oscan1_edge(0, 0, NULL) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* Pair k: bit 2k = TDI, bit 2k+1 = TMS. Five TMS=1 cycles to Test-Logic-Reset,
+ * 0, 1, 0 to Capture-DR, then 32 cycles in Shift-DR with TDI low: TDO is
+ * sampled after each clock, so pairs 8-39 return IDCODE bits 0-31. */
+#define CJTAG_IDCODE_PAIRS 40
+
+static uint8_t cjtag_idcode_pair(int k) {
+    uint8_t tms = (k < 5 || k == 6) ? 1 : 0;
+    return (uint8_t)(tms << 1);
+}
+
+static int test_cjtag_bulk_sf0(void) {
+    print_test("Bulk SF0 (CMD_OSCAN1_BULK): Reset to Shift-DR reads IDCODE like per-pair CMD_OSCAN1");
+    if (oscan1_bring_up() != 0) {
+        print_fail("OAC + JScan OSCAN_ON failed");
+        return 0;
+    }
+
+    struct cjtag_vpi_cmd cmd = {0}, rx = {0};
+    cmd.cmd = CMD_OSCAN1_BULK;
+    cmd.nb_bits = CJTAG_IDCODE_PAIRS;
+    cmd.length = (2 * CJTAG_IDCODE_PAIRS + 7) / 8;
+    for (int k = 0; k < CJTAG_IDCODE_PAIRS; k++)
+        cmd.buffer_out[k / 4] |= (uint8_t)(cjtag_idcode_pair(k) << (2 * (k % 4)));
+    if (cjtag_xfer(&cmd, &rx) != 0) {
+        print_fail("Bulk SF0 transfer failed");
+        return 0;
+    }
+    if (rx.cmd != CMD_OSCAN1_BULK || rx.nb_bits != CJTAG_IDCODE_PAIRS || rx.length != (CJTAG_IDCODE_PAIRS + 7) / 8) {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "Unexpected response: cmd=%u nb_bits=%u length=%u",
+                 rx.cmd, rx.nb_bits, rx.length);
+        print_fail(msg);
+        return 0;
+    }
+
+    /* The same pairs one CMD_OSCAN1 at a time. The five reset cycles at the
+     * start make it independent of where the bulk packet left the TAP; TDO
+     * before Shift-DR is not, so only bytes 1-4 (pairs 8-39) are compared. */
+    uint8_t per_pair[(CJTAG_IDCODE_PAIRS + 7) / 8] = {0};
+    for (int k = 0; k < CJTAG_IDCODE_PAIRS; k++) {
+        uint8_t pair = cjtag_idcode_pair(k), tdo = 0;
+        if (oscan1_edge(pair & 1, pair >> 1, &tdo) != 0) {
+            print_fail("Per-pair CMD_OSCAN1 replay failed");
+            return 0;
+        }
+        per_pair[k / 8] |= (uint8_t)(tdo << (k % 8));
+    }
+
+    uint32_t idcode = rx.buffer_in[1] | (rx.buffer_in[2] << 8) | (rx.buffer_in[3] << 16) |
+                      ((uint32_t)rx.buffer_in[4] << 24);
+    if (idcode != 0x1DEAD3FF) {
+        char msg[80];
+        snprintf(msg, sizeof(msg), "Bulk IDCODE 0x%08X, expected 0x1DEAD3FF", idcode);
+        print_fail(msg);
+        return 0;
+    }
+    uint32_t replay = per_pair[1] | (per_pair[2] << 8) | (per_pair[3] << 16) | ((uint32_t)per_pair[4] << 24);
+    if (replay != idcode) {
+        char msg[96];
+        snprintf(msg, sizeof(msg), "Per-pair CMD_OSCAN1 read 0x%08X, bulk 0x%08X", replay, idcode);
+        print_fail(msg);
+        return 0;
+    }
+    print_pass("IDCODE 0x1DEAD3FF, same as per-pair CMD_OSCAN1");
+    return 1;
+}
+
+static int test_cjtag_ocd_scan(void) {
+    print_test("cJTAG: OpenOCD CMD_TMS_SEQ + CMD_SCAN_CHAIN encoded as SF0 by the server");
+    /* Standard 1036-byte packets in two-wire mode: the server expands them into
+     * SF0 cycles itself, so the replies are the usual ones. */
+    struct cjtag_vpi_cmd cmd = {0}, rx = {0};
+    cmd.cmd = 1; /* CMD_TMS_SEQ */
+    cmd.length = 1;
+    cmd.nb_bits = 8;
+    cmd.buffer_out[0] = 0x5F; /* 5 x TMS 1 to Test-Logic-Reset, then 0, 1, 0 to Capture-DR */
+    if (cjtag_xfer(&cmd, &rx) != 0 || rx.cmd != 1) {
+        print_fail("CMD_TMS_SEQ failed in cJTAG mode");
+        return 0;
+    }
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.cmd = 2; /* CMD_SCAN_CHAIN, TDI low */
+    cmd.length = 4;
+    cmd.nb_bits = 32;
+    if (cjtag_xfer(&cmd, &rx) != 0) {
+        print_fail("CMD_SCAN_CHAIN transfer failed in cJTAG mode");
+        return 0;
+    }
+    if (rx.cmd != 2 || rx.nb_bits != 32 || rx.length != 4) {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "Unexpected response: cmd=%u nb_bits=%u length=%u",
+                 rx.cmd, rx.nb_bits, rx.length);
+        print_fail(msg);
+        return 0;
+    }
+    uint32_t idcode = rx.buffer_in[0] | (rx.buffer_in[1] << 8) | (rx.buffer_in[2] << 16) |
+                      ((uint32_t)rx.buffer_in[3] << 24);
+    if (idcode != 0x1DEAD3FF) {
+        char msg[80];
+        snprintf(msg, sizeof(msg), "IDCODE 0x%08X over SF0, expected 0x1DEAD3FF", idcode);
+        print_fail(msg);
+        return 0;
+    }
+    print_pass("IDCODE 0x1DEAD3FF from a 32-bit scan");
+    return 1;
+}
+
 static int test_cjtag_cmd_reset(void) {
     print_test("cJTAG: TAP Reset via CMD_RESET");
     struct jtag_vpi_cmd cmd = {0};
@@ -1294,6 +1598,7 @@ static int run_cjtag_tests(void) {
 
     /* OScan1 Protocol Layer Tests */
     print_info("=== OScan1 Protocol Layer Tests (2-Wire) ===");
+    ok &= test_cjtag_bulk_sf0(); /* brings the adapter up, so it goes first */
     ok &= test_cjtag_two_wire_detection();
     ok &= test_cjtag_oac_sequence();
     ok &= test_cjtag_jscan_oscan_on();
@@ -1308,6 +1613,7 @@ static int run_cjtag_tests(void) {
 
     /* Command Protocol Tests (using standard JTAG commands over cJTAG) */
     print_info("=== Command Protocol Tests (JTAG commands over cJTAG) ===");
+    ok &= test_cjtag_ocd_scan();
     ok &= test_cjtag_cmd_reset();
     ok &= test_cjtag_read_idcode();
     ok &= test_cjtag_scan_8bit();
@@ -1961,15 +2267,1336 @@ static int run_combo_tests(void) {
 }
 
 /* -------------------------------------------------------------------------- */
-/* Main                                                                       */
+/* DMI commands (CMD_DMI with --dmi-fastpath; CMD_DMI_POLL either way)        */
 /* -------------------------------------------------------------------------- */
 
-int main(int argc, char **argv) {
-    const char *mode = (argc > 1) ? argv[1] : "jtag";
+#define CMD_DMI 10
+#define DMI_OP_READ 1
+#define DMI_OP_WRITE 2
+#define VPI_CAP_DMI (1u << 4)
+#define CMD_DMI_POLL 14
+#define VPI_CAP_DMI_POLL (1u << 6)
+#define VPI_CAP_SBA (1u << 7)
+#define DMI_POLL_SCAN_TCKS 47 /* TCKs per DTM DMI scan, charged per fast-path read too */
+
+/* Set by test_dmi_caps: the server runs DMI requests on the fast path */
+static int dmi_fastpath;
+
+/* Expected rdata of the jtag_vpi_top DMI responder */
+static uint32_t dmi_pattern(uint8_t addr) {
+    switch (addr) {
+    case 1: return 0xAA55AA55;
+    case 2: return 0x55AA55AA;
+    case 3: return 0xFF00FF00;
+    case 4: return 0x00FF00FF;
+    default: return ((uint32_t)addr << 25) | ((uint32_t)addr << 18) | ((uint32_t)addr << 11) | ((uint32_t)addr << 4);
+    }
+}
+
+static int dmi_xfer(struct cjtag_vpi_cmd *cmd, struct cjtag_vpi_cmd *rx) {
+    struct cjtag_vpi_cmd tx = *cmd;
+    tx.cmd = TO_LE32(tx.cmd);
+    tx.length = TO_LE32(tx.length);
+    tx.nb_bits = TO_LE32(tx.nb_bits);
+    if (send_all(sock_fd, &tx, sizeof(tx)) < 0 || recv_all(sock_fd, rx, sizeof(*rx)) < 0)
+        return -1;
+    rx->cmd = FROM_LE32(rx->cmd);
+    rx->length = FROM_LE32(rx->length);
+    rx->nb_bits = FROM_LE32(rx->nb_bits);
+    return 0;
+}
+
+static void dmi_entry(struct cjtag_vpi_cmd *cmd, int i, uint8_t op, uint8_t addr, uint32_t wdata) {
+    uint8_t *e = cmd->buffer_out + 8 * i;
+    e[0] = op;
+    e[1] = addr;
+    e[4] = wdata & 0xFF;
+    e[5] = (wdata >> 8) & 0xFF;
+    e[6] = (wdata >> 16) & 0xFF;
+    e[7] = (wdata >> 24) & 0xFF;
+}
+
+static uint32_t dmi_rdata(const struct cjtag_vpi_cmd *rx, int i) {
+    const uint8_t *e = rx->buffer_in + 8 * i;
+    return e[4] | (e[5] << 8) | (e[6] << 16) | ((uint32_t)e[7] << 24);
+}
+
+static int test_dmi_caps(void) {
+    print_test("DMI: capability query advertises the DMI commands");
+    struct cjtag_vpi_cmd cmd = {0}, rx = {0};
+    cmd.cmd = 1; /* CMD_TMS_SEQ, nb_bits = 0 */
+    memcpy(cmd.buffer_out, "JVPI_CAPS", 10);
+    if (dmi_xfer(&cmd, &rx) != 0 || memcmp(rx.buffer_in, "JVPI_CAPS", 10) != 0) {
+        print_fail("Capability query failed");
+        return 0;
+    }
+    uint32_t caps = rx.buffer_in[16] | (rx.buffer_in[17] << 8) | (rx.buffer_in[18] << 16) |
+                    ((uint32_t)rx.buffer_in[19] << 24);
+    if (!(caps & VPI_CAP_DMI_POLL)) {
+        print_fail("CMD_DMI_POLL not advertised");
+        return 0;
+    }
+    if (!(caps & VPI_CAP_SBA)) {
+        print_fail("CMD_SBA_* not advertised");
+        return 0;
+    }
+    dmi_fastpath = (caps & VPI_CAP_DMI) != 0;
+    print_pass(dmi_fastpath ? "CMD_DMI, CMD_DMI_POLL and CMD_SBA_* on the fast path"
+                            : "CMD_DMI_POLL and CMD_SBA_* through DTM scans (no fast path)");
+    return 1;
+}
+
+static int test_dmi_read_patterns(void) {
+    print_test("DMI: read test patterns 0x01-0x04 in one CMD_DMI");
+    struct cjtag_vpi_cmd cmd = {0}, rx = {0};
+    cmd.cmd = CMD_DMI;
+    cmd.nb_bits = 4;
+    cmd.length = 32;
+    for (int i = 0; i < 4; i++)
+        dmi_entry(&cmd, i, DMI_OP_READ, i + 1, 0);
+    if (dmi_xfer(&cmd, &rx) != 0 || rx.cmd != CMD_DMI || rx.nb_bits != 4) {
+        print_fail("CMD_DMI transfer failed");
+        return 0;
+    }
+    for (int i = 0; i < 4; i++) {
+        if (rx.buffer_in[8 * i] != 0 || dmi_rdata(&rx, i) != dmi_pattern(i + 1)) {
+            char msg[96];
+            snprintf(msg, sizeof(msg), "addr 0x%02X: resp=%u rdata=0x%08X (expected 0x%08X)",
+                     i + 1, rx.buffer_in[8 * i], dmi_rdata(&rx, i), dmi_pattern(i + 1));
+            print_fail(msg);
+            return 0;
+        }
+    }
+    print_pass("4 DMI reads returned the expected patterns");
+    return 1;
+}
+
+static int test_dmi_bulk(void) {
+    print_test("DMI: 64 mixed writes/reads, then bad transaction count");
+    struct cjtag_vpi_cmd cmd = {0}, rx = {0};
+    cmd.cmd = CMD_DMI;
+    cmd.nb_bits = 64;
+    cmd.length = 512;
+    for (int i = 0; i < 64; i++)
+        dmi_entry(&cmd, i, (i & 1) ? DMI_OP_READ : DMI_OP_WRITE, 0x10 + i, 0x1000 + i);
+    if (dmi_xfer(&cmd, &rx) != 0 || rx.nb_bits != 64) {
+        print_fail("64-entry CMD_DMI failed");
+        return 0;
+    }
+    for (int i = 1; i < 64; i += 2) {
+        if (rx.buffer_in[8 * i] != 0 || rx.buffer_in[8 * i + 1] != 0x10 + i ||
+            dmi_rdata(&rx, i) != dmi_pattern(0x10 + i)) {
+            print_fail("Unexpected read result in 64-entry CMD_DMI");
+            return 0;
+        }
+    }
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.cmd = CMD_DMI;
+    cmd.nb_bits = 65; /* more than fit in buffer_out */
+    if (dmi_xfer(&cmd, &rx) != 0 || rx.cmd != CMD_DMI || rx.nb_bits != 0) {
+        print_fail("Oversized CMD_DMI not answered with an empty response");
+        return 0;
+    }
+    print_pass("64 transactions in one packet, oversized request rejected");
+    return 1;
+}
+
+/* One CMD_DMI_POLL with a budget of max_tcks; returns the number of reads the
+ * server did (TCKs spent in *tcks), or -1 */
+static int dmi_poll(uint8_t addr, uint32_t mask, uint32_t expect, uint32_t max_tcks, uint32_t *tcks,
+                    struct cjtag_vpi_cmd *rx) {
+    struct cjtag_vpi_cmd cmd = {0};
+    cmd.cmd = CMD_DMI_POLL;
+    cmd.nb_bits = max_tcks;
+    cmd.length = 12;
+    dmi_entry(&cmd, 0, DMI_OP_READ, addr, expect);
+    cmd.buffer_out[8] = mask & 0xFF;
+    cmd.buffer_out[9] = (mask >> 8) & 0xFF;
+    cmd.buffer_out[10] = (mask >> 16) & 0xFF;
+    cmd.buffer_out[11] = (mask >> 24) & 0xFF;
+    if (dmi_xfer(&cmd, rx) != 0 || rx->cmd != CMD_DMI_POLL || rx->length != 16)
+        return -1;
+    const uint8_t *r = rx->buffer_in + 8;
+    *tcks = dmi_rdata(rx, 1); /* bytes 12..15 */
+    return (int)(r[0] | (r[1] << 8) | (r[2] << 16) | ((uint32_t)r[3] << 24));
+}
+
+static int test_dmi_poll(void) {
+    print_test("DMI: CMD_DMI_POLL until match, until the TCK budget, then bad budget");
+    struct cjtag_vpi_cmd cmd = {0}, rx = {0};
+    uint32_t tcks = 0;
+    /* Pattern 1 is 0xAA55AA55: low byte 0x55 matches on the first read */
+    int reads = dmi_poll(0x01, 0xFF, 0x55, 1000, &tcks, &rx);
+    if (reads != 1 || rx.buffer_in[0] != 0 || rx.buffer_in[2] != 1 || dmi_rdata(&rx, 0) != 0xAA55AA55 ||
+        tcks > 1000) {
+        char msg[112];
+        snprintf(msg, sizeof(msg), "Matching poll: reads=%d matched=%u rdata=0x%08X tcks=%u",
+                 reads, rx.buffer_in[2], dmi_rdata(&rx, 0), tcks);
+        print_fail(msg);
+        return 0;
+    }
+    /* Never matches: reads go on until another one would overrun the budget,
+     * and the last value comes back (exactly 50 reads on the fast path) */
+    uint32_t budget = 50 * DMI_POLL_SCAN_TCKS;
+    reads = dmi_poll(0x02, 0xFFFFFFFF, 0, budget, &tcks, &rx);
+    if (reads < 2 || (dmi_fastpath && reads != 50) || rx.buffer_in[2] != 0 || dmi_rdata(&rx, 0) != 0x55AA55AA ||
+        tcks > budget || tcks + DMI_POLL_SCAN_TCKS <= budget) {
+        char msg[112];
+        snprintf(msg, sizeof(msg), "Timed-out poll: reads=%d matched=%u rdata=0x%08X tcks=%u of %u",
+                 reads, rx.buffer_in[2], dmi_rdata(&rx, 0), tcks, budget);
+        print_fail(msg);
+        return 0;
+    }
+    cmd.cmd = CMD_DMI_POLL;
+    cmd.nb_bits = 0;
+    if (dmi_xfer(&cmd, &rx) != 0 || rx.cmd != CMD_DMI_POLL || rx.nb_bits != 0) {
+        print_fail("Zero-budget CMD_DMI_POLL not answered with an empty response");
+        return 0;
+    }
+    char msg[112];
+    snprintf(msg, sizeof(msg), "Polls stop on match or at the TCK budget (%d reads in %u TCKs, %s)",
+             reads, tcks, dmi_fastpath ? "fast path" : "DTM scans");
+    print_pass(msg);
+    return 1;
+}
+
+/* System bus memory of the debug target (CMD_SBA_READ / CMD_SBA_WRITE) */
+#define CMD_SBA_READ 15
+#define CMD_SBA_WRITE 16
+#define SBA_MEM_SIZE 4096                /* jtag_vpi_top system bus memory */
+#define SBA_WRITE_MAX ((512 - 8) / 4)    /* 32-bit words per CMD_SBA_WRITE */
+#define SBA_READ_MAX (512 / 4)           /* 32-bit words per CMD_SBA_READ */
+#define SBA_FLAG_DTM 0x01                /* header byte 5: DTM scans even with the fast path */
+
+/* Header byte 5 of the CMD_SBA_* sent by sba_xfer */
+static uint8_t sba_flags;
+
+static double now_us(void);
+
+/* One CMD_SBA_READ (wdata NULL) or CMD_SBA_WRITE; returns words done or -1 */
+static int sba_xfer(uint32_t addr, uint8_t size_log2, uint32_t words, const uint8_t *wdata, uint8_t *rdata) {
+    struct cjtag_vpi_cmd cmd = {0}, rx = {0};
+    uint32_t bytes = words << size_log2;
+    cmd.cmd = wdata ? CMD_SBA_WRITE : CMD_SBA_READ;
+    cmd.nb_bits = words;
+    cmd.length = wdata ? 8 + bytes : 8;
+    cmd.buffer_out[0] = addr & 0xFF;
+    cmd.buffer_out[1] = (addr >> 8) & 0xFF;
+    cmd.buffer_out[2] = (addr >> 16) & 0xFF;
+    cmd.buffer_out[3] = (addr >> 24) & 0xFF;
+    cmd.buffer_out[4] = size_log2;
+    cmd.buffer_out[5] = sba_flags;
+    if (wdata)
+        memcpy(cmd.buffer_out + 8, wdata, bytes);
+    if (dmi_xfer(&cmd, &rx) != 0 || rx.cmd != cmd.cmd)
+        return -1;
+    if (rdata)
+        memcpy(rdata, rx.buffer_in, rx.nb_bits << size_log2);
+    return (int)rx.nb_bits;
+}
+
+/* Move a whole image in packets of up to `per_pkt` 32-bit words */
+static int sba_image(int write, uint8_t *img, uint32_t per_pkt) {
+    for (uint32_t off = 0; off < SBA_MEM_SIZE;) {
+        uint32_t words = (SBA_MEM_SIZE - off) / 4;
+        if (words > per_pkt)
+            words = per_pkt;
+        if (sba_xfer(off, 2, words, write ? img + off : NULL, write ? NULL : img + off) != (int)words)
+            return -1;
+        off += words * 4;
+    }
+    return 0;
+}
+
+/* Write and read back the whole memory; KB/s of both into *wr_kbs / *rd_kbs */
+static int sba_round_trip(const uint8_t *image, double *wr_kbs, double *rd_kbs) {
+    static uint8_t back[SBA_MEM_SIZE];
+    memset(back, 0, sizeof(back));
+    double t0 = now_us();
+    if (sba_image(1, (uint8_t *)image, SBA_WRITE_MAX) != 0) {
+        print_fail("CMD_SBA_WRITE failed");
+        return 0;
+    }
+    double t1 = now_us();
+    if (sba_image(0, back, SBA_READ_MAX) != 0) {
+        print_fail("CMD_SBA_READ failed");
+        return 0;
+    }
+    double t2 = now_us();
+    if (memcmp(image, back, SBA_MEM_SIZE) != 0) {
+        print_fail("Read-back differs from the written image");
+        return 0;
+    }
+    *wr_kbs = SBA_MEM_SIZE / 1024.0 / ((t1 - t0) / 1e6);
+    *rd_kbs = SBA_MEM_SIZE / 1024.0 / ((t2 - t1) / 1e6);
+    return 1;
+}
+
+static int test_sba_download(void) {
+    print_test("SBA: 4 KiB image written and read back in full packets, as DTM scans and on the fast path");
+    static uint8_t image[SBA_MEM_SIZE];
+    double dtm_wr, dtm_rd, fast_wr = 0, fast_rd = 0, word_wr = 0;
+    for (int i = 0; i < SBA_MEM_SIZE; i++)
+        image[i] = (uint8_t)(i * 37 + 11);
+
+    /* DTM dmi scans (forced when the server also has the fast path) */
+    sba_flags = SBA_FLAG_DTM;
+    int ok = sba_round_trip(image, &dtm_wr, &dtm_rd);
+    sba_flags = 0;
+    if (!ok)
+        return 0;
+    if (dmi_fastpath) {
+        /* A different image, so the fast path cannot pass on the DTM's data */
+        for (int i = 0; i < SBA_MEM_SIZE; i++)
+            image[i] = (uint8_t)(i * 53 + 7);
+        if (!sba_round_trip(image, &fast_wr, &fast_rd))
+            return 0;
+        /* The same download one 32-bit word per round trip, as a baseline */
+        double t0 = now_us();
+        if (sba_image(1, image, 1) != 0) {
+            print_fail("Single-word CMD_SBA_WRITE failed");
+            return 0;
+        }
+        word_wr = SBA_MEM_SIZE / 1024.0 / ((now_us() - t0) / 1e6);
+    }
+
+    char msg[200];
+    if (dmi_fastpath)
+        snprintf(msg, sizeof(msg),
+                 "DTM scans: write %.0f KB/s, read %.0f KB/s; fast path: write %.0f KB/s, read %.0f KB/s, "
+                 "one word per packet: write %.0f KB/s",
+                 dtm_wr, dtm_rd, fast_wr, fast_rd, word_wr);
+    else
+        snprintf(msg, sizeof(msg), "DTM scans: write %.0f KB/s, read %.0f KB/s", dtm_wr, dtm_rd);
+    print_pass(msg);
+    return 1;
+}
+
+static int test_sba_sizes(void) {
+    print_test("SBA: byte writes inside a word, then unsupported size and oversized count");
+    uint8_t zero[4] = {0}, bytes[3] = {0x11, 0x22, 0x33}, word[4] = {0};
+    if (sba_xfer(0x200, 2, 1, zero, NULL) != 1 || sba_xfer(0x201, 0, 3, bytes, NULL) != 3 ||
+        sba_xfer(0x200, 2, 1, NULL, word) != 1) {
+        print_fail("Byte access failed");
+        return 0;
+    }
+    if (word[0] != 0 || word[1] != 0x11 || word[2] != 0x22 || word[3] != 0x33) {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "Word at 0x200 is %02X %02X %02X %02X", word[0], word[1], word[2], word[3]);
+        print_fail(msg);
+        return 0;
+    }
+    if (sba_xfer(0x200, 3, 1, NULL, word) != 0 || sba_xfer(0, 2, SBA_READ_MAX + 1, NULL, NULL) != 0 ||
+        sba_xfer(0, 2, SBA_WRITE_MAX + 1, zero, NULL) != 0) {
+        print_fail("Bad size / count not answered with an empty response");
+        return 0;
+    }
+    print_pass("Sub-word writes land in place, bad requests rejected");
+    return 1;
+}
+
+static int run_dmi_tests(void) {
+    int ok = 1;
+
+    ok &= test_dmi_caps();
+    if (dmi_fastpath) {
+        ok &= test_dmi_read_patterns();
+        ok &= test_dmi_bulk();
+    }
+    ok &= test_dmi_poll();
+    ok &= test_sba_download();
+    ok &= test_sba_sizes();
+
+    return ok;
+}
+
+/* -------------------------------------------------------------------------- */
+/* Server-side TAP navigation (CMD_TAP_GOTO, CMD_SCAN_IR / CMD_SCAN_DR)        */
+/* -------------------------------------------------------------------------- */
+
+#define CMD_TAP_GOTO 11
+#define CMD_SCAN_IR 12
+#define CMD_SCAN_DR 13
+#define VPI_CAP_TAP (1u << 5)
+#define TAP_IDLE 1
+#define TAP_DR_CAPTURE 3
+
+static int tap_goto(uint8_t state, struct cjtag_vpi_cmd *rx) {
+    struct cjtag_vpi_cmd cmd = {0};
+    cmd.cmd = CMD_TAP_GOTO;
+    cmd.buffer_out[0] = state;
+    if (dmi_xfer(&cmd, rx) != 0 || rx->cmd != CMD_TAP_GOTO)
+        return -1;
+    return 0;
+}
+
+/* IR or DR access from wherever the TAP is, ending in Run-Test/Idle */
+static int tap_scan(uint32_t which, const uint8_t *tdi, uint32_t nb_bits, uint32_t idle, uint8_t *tdo) {
+    struct cjtag_vpi_cmd cmd = {0}, rx = {0};
+    cmd.cmd = which;
+    cmd.nb_bits = nb_bits;
+    cmd.length = idle;
+    memcpy(cmd.buffer_out, tdi, (nb_bits + 7) / 8);
+    if (dmi_xfer(&cmd, &rx) != 0 || rx.cmd != which || rx.nb_bits != nb_bits || rx.length != (nb_bits + 7) / 8)
+        return -1;
+    memcpy(tdo, rx.buffer_in, (nb_bits + 7) / 8);
+    return 0;
+}
+
+static uint32_t tap_le32(const uint8_t *b) {
+    return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static int test_tap_caps(void) {
+    print_test("TAP: capability query advertises CMD_TAP_GOTO / CMD_SCAN_IR/DR");
+    struct cjtag_vpi_cmd cmd = {0}, rx = {0};
+    cmd.cmd = 1; /* CMD_TMS_SEQ, nb_bits = 0 */
+    memcpy(cmd.buffer_out, "JVPI_CAPS", 10);
+    if (dmi_xfer(&cmd, &rx) != 0 || memcmp(rx.buffer_in, "JVPI_CAPS", 10) != 0) {
+        print_fail("Capability query failed");
+        return 0;
+    }
+    if (!(tap_le32(rx.buffer_in + 16) & VPI_CAP_TAP)) {
+        print_fail("TAP commands not advertised");
+        return 0;
+    }
+    print_pass("TAP commands available");
+    return 1;
+}
+
+static int test_tap_goto(void) {
+    print_test("TAP: CMD_RESET, CMD_TAP_GOTO Capture-DR, then a plain 32-bit scan reads IDCODE");
+    struct cjtag_vpi_cmd cmd = {0}, rx = {0};
+    if (dmi_xfer(&cmd, &rx) != 0) { /* CMD_RESET */
+        print_fail("Reset failed");
+        return 0;
+    }
+    /* Test-Logic-Reset -> Idle -> Select-DR -> Capture-DR: TMS 0, 1, 0 */
+    if (tap_goto(TAP_DR_CAPTURE, &rx) != 0 || rx.buffer_in[0] != TAP_DR_CAPTURE || rx.buffer_in[1] != 3) {
+        print_fail("Goto Capture-DR not answered with a 3-bit path");
+        return 0;
+    }
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.cmd = 2; /* CMD_SCAN_CHAIN, first TCK leaves Capture-DR, stays in Shift-DR */
+    cmd.nb_bits = 32;
+    cmd.length = 4;
+    if (dmi_xfer(&cmd, &rx) != 0 || tap_le32(rx.buffer_in) != 0x1DEAD3FF) {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "IDCODE mismatch: got 0x%08X", tap_le32(rx.buffer_in));
+        print_fail(msg);
+        return 0;
+    }
+    /* Shift-DR -> Exit1-DR -> Update-DR -> Idle */
+    if (tap_goto(TAP_IDLE, &rx) != 0 || rx.buffer_in[1] != 3) {
+        print_fail("Goto Run-Test/Idle did not take 3 TCKs from Shift-DR");
+        return 0;
+    }
+    print_pass("Shortest paths taken, IDCODE 0x1DEAD3FF");
+    return 1;
+}
+
+static int test_tap_scan_macros(void) {
+    print_test("TAP: CMD_SCAN_IR DTMCS + CMD_SCAN_DR, two commands instead of six");
+    uint8_t ir = 0x10, tdo[8] = {0}, zero[8] = {0};
+    if (tap_scan(CMD_SCAN_IR, &ir, 5, 0, tdo) != 0) {
+        print_fail("CMD_SCAN_IR failed");
+        return 0;
+    }
+    /* IR capture value is 01 in the low bits */
+    if ((tdo[0] & 0x3) != 0x1) {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "IR capture 0x%02X, expected ...01", tdo[0]);
+        print_fail(msg);
+        return 0;
+    }
+    if (tap_scan(CMD_SCAN_DR, zero, 32, 1, tdo) != 0) {
+        print_fail("CMD_SCAN_DR failed");
+        return 0;
+    }
+    uint32_t dtmcs = tap_le32(tdo);
+    if ((dtmcs & 0xF) != 1 || ((dtmcs >> 4) & 0x3F) != 7) {
+        char msg[80];
+        snprintf(msg, sizeof(msg), "DTMCS 0x%08X: expected version 1, abits 7", dtmcs);
+        print_fail(msg);
+        return 0;
+    }
+    /* The macros leave the TAP in Run-Test/Idle */
+    struct cjtag_vpi_cmd rx = {0};
+    if (tap_goto(TAP_IDLE, &rx) != 0 || rx.buffer_in[1] != 0) {
+        print_fail("TAP not left in Run-Test/Idle");
+        return 0;
+    }
+    uint8_t idcode_ir = 0x01;
+    if (tap_scan(CMD_SCAN_IR, &idcode_ir, 5, 0, tdo) != 0 || tap_scan(CMD_SCAN_DR, zero, 32, 0, tdo) != 0 ||
+        tap_le32(tdo) != 0x1DEAD3FF) {
+        print_fail("IDCODE through CMD_SCAN_IR/DR mismatch");
+        return 0;
+    }
+    char msg[80];
+    snprintf(msg, sizeof(msg), "DTMCS 0x%08X, IDCODE 0x1DEAD3FF", dtmcs);
+    print_pass(msg);
+    return 1;
+}
+
+static int test_tap_bad_requests(void) {
+    print_test("TAP: bad state and oversized scan are rejected, connection stays up");
+    struct cjtag_vpi_cmd cmd = {0}, rx = {0};
+    if (tap_goto(16, &rx) != 0 || rx.buffer_in[0] != 0xFF) {
+        print_fail("Invalid goto target not rejected");
+        return 0;
+    }
+    cmd.cmd = CMD_SCAN_DR;
+    cmd.nb_bits = 4096; /* no room left for the TMS path */
+    if (dmi_xfer(&cmd, &rx) != 0 || rx.cmd != CMD_SCAN_DR || rx.nb_bits != 0) {
+        print_fail("Oversized CMD_SCAN_DR not answered with an empty reply");
+        return 0;
+    }
+    for (uint32_t c = CMD_SCAN_IR; c <= CMD_SCAN_DR; c++) {
+        memset(&cmd, 0, sizeof(cmd));
+        cmd.cmd = c;
+        cmd.nb_bits = 0xFFFFFFFE; /* path + nb_bits + 3 wraps in 32 bits */
+        if (dmi_xfer(&cmd, &rx) != 0 || rx.cmd != c || rx.nb_bits != 0) {
+            print_fail("CMD_SCAN_IR/DR with nb_bits 0xFFFFFFFE not rejected");
+            return 0;
+        }
+    }
+    if (tap_goto(TAP_IDLE, &rx) != 0 || rx.buffer_in[0] != TAP_IDLE) {
+        print_fail("Connection unusable after rejected requests");
+        return 0;
+    }
+    print_pass("Rejected with empty replies");
+    return 1;
+}
+
+static int run_tap_tests(void) {
+    int ok = 1;
+
+    ok &= test_tap_caps();
+    ok &= test_tap_goto();
+    ok &= test_tap_scan_macros();
+    ok &= test_tap_bad_requests();
+
+    return ok;
+}
+
+/* -------------------------------------------------------------------------- */
+/* Per-command metrics (CMD_STATS)                                            */
+/* -------------------------------------------------------------------------- */
+
+#define CMD_STATS 17
+#define VPI_CAP_STATS (1u << 8)
+#define STATS_CLASS_RESET 0
+#define STATS_CLASS_SCAN 2
+
+static uint64_t stats_le64(const uint8_t *b) {
+    return tap_le32(b) | ((uint64_t)tap_le32(b + 4) << 32);
+}
+
+/* Metrics of one command class; u64 field i sits at buffer_in[16 + 8 * i] */
+static int stats_query(uint8_t cls, int clear, struct cjtag_vpi_cmd *rx) {
+    struct cjtag_vpi_cmd cmd = {0};
+    cmd.cmd = CMD_STATS;
+    cmd.buffer_out[0] = cls;
+    cmd.buffer_out[1] = clear ? 1 : 0;
+    if (dmi_xfer(&cmd, rx) != 0 || rx->cmd != CMD_STATS)
+        return -1;
+    return 0;
+}
+
+static uint64_t stats_field(const struct cjtag_vpi_cmd *rx, int i) {
+    return stats_le64(rx->buffer_in + 16 + 8 * i);
+}
+
+static int test_stats_caps(void) {
+    print_test("Stats: capability query advertises CMD_STATS");
+    struct cjtag_vpi_cmd cmd = {0}, rx = {0};
+    cmd.cmd = 1; /* CMD_TMS_SEQ, nb_bits = 0 */
+    memcpy(cmd.buffer_out, "JVPI_CAPS", 10);
+    if (dmi_xfer(&cmd, &rx) != 0 || memcmp(rx.buffer_in, "JVPI_CAPS", 10) != 0) {
+        print_fail("Capability query failed");
+        return 0;
+    }
+    if (!(tap_le32(rx.buffer_in + 16) & VPI_CAP_STATS)) {
+        print_fail("CMD_STATS not advertised");
+        return 0;
+    }
+    print_pass("CMD_STATS available");
+    return 1;
+}
+
+static int test_stats_classes(void) {
+    print_test("Stats: query past the last class lists the class count, each class is named");
+    struct cjtag_vpi_cmd rx = {0};
+    if (stats_query(0xFF, 0, &rx) != 0 || rx.length != 0 || rx.nb_bits == 0) {
+        print_fail("Out-of-range class not answered with an empty reply");
+        return 0;
+    }
+    uint32_t classes = rx.nb_bits;
+    for (uint32_t c = 0; c < classes; c++) {
+        if (stats_query((uint8_t)c, 0, &rx) != 0 || rx.length != 144 || rx.buffer_in[0] == 0) {
+            print_fail("Class reply malformed");
+            return 0;
+        }
+    }
+    char msg[64];
+    snprintf(msg, sizeof(msg), "%u classes, last \"%.15s\"", classes, (const char *)rx.buffer_in);
+    print_pass(msg);
+    return 1;
+}
+
+static int test_stats_counts(void) {
+    print_test("Stats: 3 resets and 2 32-bit scans counted with bits, TCKs and latencies");
+    struct cjtag_vpi_cmd cmd = {0}, rx = {0};
+    if (stats_query(0, 1, &rx) != 0) { /* clear everything */
+        print_fail("Clearing the counters failed");
+        return 0;
+    }
+    for (int i = 0; i < 3; i++) {
+        memset(&cmd, 0, sizeof(cmd)); /* CMD_RESET */
+        if (dmi_xfer(&cmd, &rx) != 0) {
+            print_fail("Reset failed");
+            return 0;
+        }
+    }
+    for (int i = 0; i < 2; i++) {
+        memset(&cmd, 0, sizeof(cmd));
+        cmd.cmd = 2; /* CMD_SCAN_CHAIN */
+        cmd.nb_bits = 32;
+        cmd.length = 4;
+        if (dmi_xfer(&cmd, &rx) != 0) {
+            print_fail("Scan failed");
+            return 0;
+        }
+    }
+
+    if (stats_query(STATS_CLASS_RESET, 0, &rx) != 0 || strcmp((const char *)rx.buffer_in, "reset") != 0 ||
+        stats_field(&rx, 0) != 3 || stats_field(&rx, 2) < 3 * 5) {
+        char msg[80];
+        snprintf(msg, sizeof(msg), "reset: count %llu, tck %llu", (unsigned long long)stats_field(&rx, 0),
+                 (unsigned long long)stats_field(&rx, 2));
+        print_fail(msg);
+        return 0;
+    }
+    if (stats_query(STATS_CLASS_SCAN, 0, &rx) != 0 || strcmp((const char *)rx.buffer_in, "scan") != 0 ||
+        stats_field(&rx, 0) != 2 || stats_field(&rx, 1) != 64 || stats_field(&rx, 2) != 64) {
+        char msg[96];
+        snprintf(msg, sizeof(msg), "scan: count %llu, bits %llu, tck %llu", (unsigned long long)stats_field(&rx, 0),
+                 (unsigned long long)stats_field(&rx, 1), (unsigned long long)stats_field(&rx, 2));
+        print_fail(msg);
+        return 0;
+    }
+    /* wall ns: min, p50, p90, p99, max, sum at fields 3-8; sim ps at 9-14 */
+    uint64_t wmin = stats_field(&rx, 3), wp50 = stats_field(&rx, 4), wmax = stats_field(&rx, 7);
+    uint64_t sp50 = stats_field(&rx, 10), smax = stats_field(&rx, 13);
+    if (wmin == 0 || wmin > wp50 || wp50 > wmax || stats_field(&rx, 8) < wmax || smax == 0 || sp50 > smax) {
+        print_fail("Latency histogram out of order");
+        return 0;
+    }
+    char msg[120];
+    snprintf(msg, sizeof(msg), "scan p50 %.1f us wall, %.1f ns simulated", wp50 / 1e3, sp50 / 1e3);
+    print_pass(msg);
+    return 1;
+}
+
+static int run_stats_tests(void) {
+    int ok = 1;
+
+    ok &= test_stats_caps();
+    ok &= test_stats_classes();
+    ok &= test_stats_counts();
+
+    return ok;
+}
+
+/* -------------------------------------------------------------------------- */
+/* Batched ops (CMD_BATCH)                                                    */
+/* -------------------------------------------------------------------------- */
+
+#define CMD_BATCH 8
+#define VPI_CAP_BATCH (1u << 1)
+#define BATCH_MAX_BYTES 65536
+#define BATCH_TMS_SEQ 0
+#define BATCH_SCAN 1
+#define BATCH_SCAN_FLIP 2
+#define BATCH_IDLE 3
+#define BATCH_TDI_ONES 0x40
+#define BATCH_NO_TDO 0x80
+
+static void batch_le32(uint8_t *b, uint32_t v) {
+    b[0] = v & 0xFF;
+    b[1] = (v >> 8) & 0xFF;
+    b[2] = (v >> 16) & 0xFF;
+    b[3] = (v >> 24) & 0xFF;
+}
+
+/* Append one op (opcode, LE bit count, TMS/TDI bytes) at pos; returns the new end */
+static size_t batch_op(uint8_t *ops, size_t pos, uint8_t op, uint32_t bits, const uint8_t *data, size_t data_len) {
+    ops[pos] = op;
+    batch_le32(ops + pos + 1, bits);
+    if (data_len)
+        memcpy(ops + pos + 5, data, data_len);
+    return pos + 5 + data_len;
+}
+
+/* Send one CMD_BATCH frame and read its reply; returns the TDO length from
+ * the reply header, or -1 */
+static int batch_xfer(const uint8_t *ops, uint32_t len, uint8_t *tdo, uint32_t tdo_max) {
+    uint8_t hdr[8];
+    batch_le32(hdr, CMD_BATCH);
+    batch_le32(hdr + 4, len);
+    if (send_all(sock_fd, hdr, sizeof(hdr)) < 0 || send_all(sock_fd, ops, len) < 0 ||
+        recv_all(sock_fd, hdr, sizeof(hdr)) < 0)
+        return -1;
+    uint32_t tdo_len = tap_le32(hdr + 4);
+    if (tap_le32(hdr) != CMD_BATCH || tdo_len > tdo_max || (tdo_len && recv_all(sock_fd, tdo, tdo_len) < 0))
+        return -1;
+    return (int)tdo_len;
+}
+
+static int test_batch_caps(void) {
+    print_test("Batch: capability query enables CMD_BATCH");
+    struct cjtag_vpi_cmd cmd = {0}, rx = {0};
+    cmd.cmd = 1; /* CMD_TMS_SEQ, nb_bits = 0 */
+    memcpy(cmd.buffer_out, "JVPI_CAPS", 10);
+    if (dmi_xfer(&cmd, &rx) != 0 || memcmp(rx.buffer_in, "JVPI_CAPS", 10) != 0) {
+        print_fail("Capability query failed");
+        return 0;
+    }
+    if (!(tap_le32(rx.buffer_in + 16) & VPI_CAP_BATCH)) {
+        print_fail("CMD_BATCH not advertised");
+        return 0;
+    }
+    if (tap_le32(rx.buffer_in + 20) != BATCH_MAX_BYTES) {
+        print_fail("Frame size limit is not 64 KiB");
+        return 0;
+    }
+    print_pass("CMD_BATCH available, 64 KiB frames");
+    return 1;
+}
+
+static int test_batch_idcode(void) {
+    print_test("Batch: TMS_SEQ, SCAN, SCAN_FLIP, TMS_SEQ and IDLE in one frame read IDCODE");
+    uint8_t ops[64], tdo[16] = {0}, zero[4] = {0}, tms;
+    size_t len = 0;
+    tms = 0x5F; /* 5 x TMS 1 to Test-Logic-Reset, then 0, 1, 0 to Capture-DR */
+    len = batch_op(ops, len, BATCH_TMS_SEQ, 8, &tms, 1);
+    len = batch_op(ops, len, BATCH_SCAN, 32, zero, sizeof(zero));
+    len = batch_op(ops, len, BATCH_SCAN_FLIP | BATCH_TDI_ONES, 32, NULL, 0);
+    tms = 0x01; /* Exit1-DR -> Update-DR -> Run-Test/Idle */
+    len = batch_op(ops, len, BATCH_TMS_SEQ, 2, &tms, 1);
+    len = batch_op(ops, len, BATCH_IDLE, 8, NULL, 0);
+
+    int tdo_len = batch_xfer(ops, (uint32_t)len, tdo, sizeof(tdo));
+    if (tdo_len < 0) {
+        print_fail("CMD_BATCH not answered");
+        return 0;
+    }
+    /* Only the two scans return TDO, 4 bytes each */
+    if (tdo_len != 8 || tap_le32(tdo) != 0x1DEAD3FF) {
+        char msg[80];
+        snprintf(msg, sizeof(msg), "Reply of %d TDO bytes, IDCODE 0x%08X (expected 8, 0x1DEAD3FF)",
+                 tdo_len, tap_le32(tdo));
+        print_fail(msg);
+        return 0;
+    }
+    /* The flip scan shifts out the zeros the first scan shifted in */
+    if ((tap_le32(tdo + 4) & 0x7FFFFFFF) != 0) {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "SCAN_FLIP TDO 0x%08X, expected the zeros shifted in", tap_le32(tdo + 4));
+        print_fail(msg);
+        return 0;
+    }
+    print_pass("IDCODE 0x1DEAD3FF, 8 TDO bytes in one reply");
+    return 1;
+}
+
+static int test_batch_no_tdo(void) {
+    print_test("Batch: BATCH_NO_TDO scans clock the TAP but return nothing");
+    uint8_t ops[64], tdo[16] = {0}, zero[4] = {0}, tms;
+    size_t len = 0;
+    tms = 0x01; /* Run-Test/Idle -> Select-DR -> Capture-DR */
+    len = batch_op(ops, len, BATCH_TMS_SEQ, 2, &tms, 1);
+    len = batch_op(ops, len, BATCH_SCAN_FLIP | BATCH_TDI_ONES | BATCH_NO_TDO, 32, NULL, 0);
+    tms = 0x03; /* Exit1-DR -> Update-DR -> Select-DR -> Capture-DR */
+    len = batch_op(ops, len, BATCH_TMS_SEQ, 3, &tms, 1);
+    len = batch_op(ops, len, BATCH_SCAN_FLIP, 32, zero, sizeof(zero));
+    tms = 0x01; /* Exit1-DR -> Update-DR -> Run-Test/Idle */
+    len = batch_op(ops, len, BATCH_TMS_SEQ, 2, &tms, 1);
+
+    int tdo_len = batch_xfer(ops, (uint32_t)len, tdo, sizeof(tdo));
+    if (tdo_len < 0) {
+        print_fail("CMD_BATCH not answered");
+        return 0;
+    }
+    /* IDCODE from the second scan proves the first one ran to Exit1-DR */
+    if (tdo_len != 4 || tap_le32(tdo) != 0x1DEAD3FF) {
+        char msg[80];
+        snprintf(msg, sizeof(msg), "Reply of %d TDO bytes, IDCODE 0x%08X (expected 4, 0x1DEAD3FF)",
+                 tdo_len, tap_le32(tdo));
+        print_fail(msg);
+        return 0;
+    }
+    print_pass("Only the capturing scan's 4 TDO bytes returned, IDCODE 0x1DEAD3FF");
+    return 1;
+}
+
+/* Send a CMD_BATCH header and ops the server must refuse; passes if it closes
+ * the connection and a new session (with batching re-enabled) answers a reset */
+static int batch_expect_close(const uint8_t *hdr, const uint8_t *ops, size_t len) {
+    if (send_all(sock_fd, hdr, 8) < 0 || (len && send_all(sock_fd, ops, len) < 0))
+        return 0;
+    fd_set rset;
+    FD_ZERO(&rset);
+    FD_SET(sock_fd, &rset);
+    struct timeval tv = {.tv_sec = TIMEOUT_SEC, .tv_usec = 0};
+    uint8_t b;
+    if (select(sock_fd + 1, &rset, NULL, NULL, &tv) <= 0 || recv(sock_fd, &b, 1, 0) != 0)
+        return 0;
+
+    /* The server keeps accepting; a new session answers a reset */
+    close(sock_fd);
+    sock_fd = connect_vpi();
+    struct cjtag_vpi_cmd cmd = {0}, rx = {0};
+    if (sock_fd < 0 || dmi_xfer(&cmd, &rx) != 0 || rx.cmd != 0)
+        return 0;
+    cmd.cmd = 1; /* capability query re-enables CMD_BATCH */
+    memcpy(cmd.buffer_out, "JVPI_CAPS", 10);
+    return dmi_xfer(&cmd, &rx) == 0 && memcmp(rx.buffer_in, "JVPI_CAPS", 10) == 0;
+}
+
+static int test_batch_oversize(void) {
+    print_test("Batch: oversized frames and ops close the connection");
+    uint8_t hdr[8], ops[16], data[1] = {0};
+    batch_le32(hdr, CMD_BATCH);
+    batch_le32(hdr + 4, BATCH_MAX_BYTES + 1);
+    if (!batch_expect_close(hdr, NULL, 0)) {
+        print_fail("Frame over 64 KiB not refused");
+        return 0;
+    }
+
+    /* A bit count whose byte size wraps a 32-bit (bits + 7) / 8 */
+    static const struct {
+        uint8_t op;
+        uint32_t bits;
+        size_t data_len;
+        const char *what;
+    } cases[] = {
+        {BATCH_SCAN | BATCH_TDI_ONES, 0xFFFFFFFF, 0, "0xFFFFFFFF-bit scan (TDO over the limit)"},
+        {BATCH_SCAN | BATCH_NO_TDO, 0xFFFFFFFF, 1, "0xFFFFFFFF-bit scan (data past the frame)"},
+        {BATCH_TMS_SEQ, 0xFFFFFFF9, 1, "0xFFFFFFF9-bit TMS_SEQ"},
+        {BATCH_IDLE, 0xFFFFFFFF, 0, "0xFFFFFFFF-cycle IDLE"},
+        {BATCH_SCAN | BATCH_TDI_ONES | BATCH_NO_TDO, (1u << 20) + 1, 0, "TCK count over the frame limit"},
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        size_t len = batch_op(ops, 0, cases[i].op, cases[i].bits, data, cases[i].data_len);
+        batch_le32(hdr + 4, (uint32_t)len);
+        if (!batch_expect_close(hdr, ops, len)) {
+            char msg[96];
+            snprintf(msg, sizeof(msg), "%s not refused", cases[i].what);
+            print_fail(msg);
+            return 0;
+        }
+    }
+    print_pass("Connection closed, server still accepts sessions");
+    return 1;
+}
+
+static int run_batch_tests(void) {
+    int ok = 1;
+
+    ok &= test_batch_caps();
+    ok &= test_batch_idcode();
+    ok &= test_batch_no_tdo();
+    ok &= test_batch_oversize();
+
+    return ok;
+}
+
+/* -------------------------------------------------------------------------- */
+/* Multi-client sessions (several connections to one server)                  */
+/* -------------------------------------------------------------------------- */
+
+/* Queue one 1036-byte CMD_SCAN_CHAIN of nb_bits on socket s (reply not read) */
+static int ocd_scan_send(int s, uint32_t nb_bits, uint8_t pattern) {
+    struct cjtag_vpi_cmd tx = {0};
+    tx.cmd = TO_LE32(2); /* CMD_SCAN_CHAIN */
+    tx.length = TO_LE32((nb_bits + 7) / 8);
+    tx.nb_bits = TO_LE32(nb_bits);
+    memset(tx.buffer_out, pattern, (nb_bits + 7) / 8);
+    return send_all(s, &tx, sizeof(tx));
+}
+
+/* Read one CMD_SCAN_CHAIN reply from s and check it answers an nb_bits scan */
+static int ocd_scan_recv(int s, uint32_t nb_bits) {
+    struct cjtag_vpi_cmd rx = {0};
+    if (recv_all(s, &rx, sizeof(rx)) < 0)
+        return -1;
+    if (FROM_LE32(rx.cmd) != 2 || FROM_LE32(rx.nb_bits) != nb_bits)
+        return -1;
+    return 0;
+}
+
+static int test_multi_two_sessions(void) {
+    print_test("Multi: second client served while the first stays connected");
+    int b = connect_vpi();
+    if (b < 0) {
+        print_fail("Second connection refused");
+        return 0;
+    }
+    int ok = ocd_scan_send(sock_fd, 32, 0xA5) == 0 && ocd_scan_send(b, 16, 0x5A) == 0 &&
+             ocd_scan_recv(b, 16) == 0 && ocd_scan_recv(sock_fd, 32) == 0;
+    close(b);
+    if (!ok) {
+        print_fail("Interleaved scans on two sessions not both answered");
+        return 0;
+    }
+    print_pass("Both sessions got their scan responses");
+    return 1;
+}
+
+static int test_multi_pipelined_fairness(void) {
+    print_test("Multi: 8 pipelined scans on one session, 1 scan on another");
+    int b = connect_vpi();
+    if (b < 0) {
+        print_fail("Second connection refused");
+        return 0;
+    }
+    int ok = 1;
+    for (int i = 0; i < 8 && ok; i++)
+        ok = ocd_scan_send(sock_fd, 64, (uint8_t)i) == 0;
+    ok = ok && ocd_scan_send(b, 8, 0xFF) == 0 && ocd_scan_recv(b, 8) == 0;
+    for (int i = 0; i < 8 && ok; i++)
+        ok = ocd_scan_recv(sock_fd, 64) == 0;
+    close(b);
+    if (!ok) {
+        print_fail("Responses missing or out of order");
+        return 0;
+    }
+    print_pass("All 9 scans answered, in order per session");
+    return 1;
+}
+
+static int test_multi_close_one(void) {
+    print_test("Multi: closing one session leaves the others running");
+    int b = connect_vpi();
+    int c = connect_vpi();
+    if (b < 0 || c < 0) {
+        print_fail("Extra connections refused");
+        if (b >= 0)
+            close(b);
+        if (c >= 0)
+            close(c);
+        return 0;
+    }
+    int ok = ocd_scan_send(b, 8, 0x00) == 0 && ocd_scan_recv(b, 8) == 0;
+    close(b);
+    ok = ok && ocd_scan_send(c, 8, 0x11) == 0 && ocd_scan_send(sock_fd, 8, 0x22) == 0 &&
+         ocd_scan_recv(c, 8) == 0 && ocd_scan_recv(sock_fd, 8) == 0;
+    close(c);
+    if (!ok) {
+        print_fail("Session stopped answering after a peer disconnected");
+        return 0;
+    }
+    print_pass("Remaining sessions unaffected by a disconnect");
+    return 1;
+}
+
+static int run_multi_tests(void) {
+    int ok = 1;
+
+    ok &= test_multi_two_sessions();
+    ok &= test_multi_pipelined_fairness();
+    ok &= test_multi_close_one();
+
+    return ok;
+}
+
+/* -------------------------------------------------------------------------- */
+/* Transport latency benchmark                                               */
+/* -------------------------------------------------------------------------- */
+
+#define BENCH_WARMUP 100
+#define BENCH_ROUNDS 2000
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static int test_bench_round_trip(void) {
+    print_test("Bench: 1036-byte capability query round trips");
+    /* CMD_TMS_SEQ with nb_bits = 0 is answered without clocking the TAP, so
+     * this measures the socket path and the server's poll loop only. */
+    static double lat[BENCH_ROUNDS];
+    struct cjtag_vpi_cmd cmd = {0}, rx;
+    cmd.cmd = TO_LE32(1);
+    memcpy(cmd.buffer_out, "JVPI_CAPS", 10);
+
+    for (int i = 0; i < BENCH_WARMUP + BENCH_ROUNDS; i++) {
+        double t0 = now_us();
+        if (send_all(sock_fd, &cmd, sizeof(cmd)) < 0 || recv_all(sock_fd, &rx, sizeof(rx)) < 0) {
+            print_fail("Round trip failed");
+            return 0;
+        }
+        if (i >= BENCH_WARMUP)
+            lat[i - BENCH_WARMUP] = now_us() - t0;
+    }
+
+    double sum = 0;
+    for (int i = 0; i < BENCH_ROUNDS; i++)
+        sum += lat[i];
+    qsort(lat, BENCH_ROUNDS, sizeof(lat[0]), cmp_double);
+    char msg[160];
+    snprintf(msg, sizeof(msg), "%s: avg %.1f us, min %.1f, p50 %.1f, p99 %.1f (%d rounds, %.0f cmd/s)",
+             vpi_unix_path ? (vpi_abstract ? "unix (abstract)" : "unix") : "tcp",
+             sum / BENCH_ROUNDS, lat[0], lat[BENCH_ROUNDS / 2], lat[BENCH_ROUNDS * 99 / 100],
+             BENCH_ROUNDS, BENCH_ROUNDS * 1e6 / sum);
+    print_pass(msg);
+    return 1;
+}
+
+static int test_bench_small_scans(void) {
+    print_test("Bench: 5-bit CMD_SCAN_CHAIN round trips (IR-sized)");
+    /* Small scans dominate OpenOCD traffic; the reply is a full 1036-byte
+     * packet carrying a single TDO byte. */
+    static double lat[BENCH_ROUNDS];
+    double t_start = now_us();
+    for (int i = 0; i < BENCH_WARMUP + BENCH_ROUNDS; i++) {
+        double t0 = now_us();
+        if (ocd_scan_send(sock_fd, 5, (uint8_t)i) < 0 || ocd_scan_recv(sock_fd, 5) < 0) {
+            print_fail("Scan round trip failed");
+            return 0;
+        }
+        if (i >= BENCH_WARMUP)
+            lat[i - BENCH_WARMUP] = now_us() - t0;
+    }
+    double total = now_us() - t_start;
+
+    qsort(lat, BENCH_ROUNDS, sizeof(lat[0]), cmp_double);
+    char msg[160];
+    snprintf(msg, sizeof(msg), "%s: p50 %.1f us, p99 %.1f (%.0f scans/s)",
+             vpi_unix_path ? (vpi_abstract ? "unix (abstract)" : "unix") : "tcp",
+             lat[BENCH_ROUNDS / 2], lat[BENCH_ROUNDS * 99 / 100],
+             (BENCH_WARMUP + BENCH_ROUNDS) * 1e6 / total);
+    print_pass(msg);
+    return 1;
+}
+
+static int run_bench_tests(void) {
+    int ok = 1;
+
+    ok &= test_bench_round_trip();
+    ok &= test_bench_small_scans();
+
+    return ok;
+}
+
+/* -------------------------------------------------------------------------- */
+/* Shared-memory transport (server started with --unix / --abstract)         */
+/* -------------------------------------------------------------------------- */
+
+#define SHM_TIMEOUT_MS (TIMEOUT_SEC * 1000)
+#define VPI_CAP_SCAN_STREAM (1u << 0)
+
+static jvpi_shm_t shm_link;
+
+/* Post cmd (host order) into the next command slot; the reply is not read */
+static int shm_post(const struct cjtag_vpi_cmd *cmd) {
+    struct cjtag_vpi_cmd *slot = jvpi_shm_cmd_slot(&shm_link);
+    if (!slot)
+        return -1;
+    *slot = *cmd;
+    slot->cmd = TO_LE32(cmd->cmd);
+    slot->length = TO_LE32(cmd->length);
+    slot->nb_bits = TO_LE32(cmd->nb_bits);
+    jvpi_shm_post(&shm_link);
+    return 0;
+}
+
+/* Take the oldest reply out of the response ring (host order) */
+static int shm_recv(struct cjtag_vpi_cmd *rx) {
+    const struct cjtag_vpi_cmd *slot = jvpi_shm_resp(&shm_link, SHM_TIMEOUT_MS);
+    if (!slot)
+        return -1;
+    *rx = *slot;
+    jvpi_shm_resp_done(&shm_link);
+    rx->cmd = FROM_LE32(rx->cmd);
+    rx->length = FROM_LE32(rx->length);
+    rx->nb_bits = FROM_LE32(rx->nb_bits);
+    return 0;
+}
+
+/* RESET, TMS 0-1-0 to Capture-DR, 32-bit SCAN_FLIP of IDCODE (as in the
+ * jtag suite, TDO is sampled after each clock, so the scan's first clock
+ * enters Shift-DR and returns IDCODE bit 0) */
+static int shm_post_idcode_read(void) {
+    struct cjtag_vpi_cmd cmd = {0};
+    if (shm_post(&cmd) < 0)
+        return -1;
+    cmd.cmd = 1;
+    cmd.nb_bits = 3;
+    cmd.length = 1;
+    cmd.buffer_out[0] = 0x02;
+    if (shm_post(&cmd) < 0)
+        return -1;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.cmd = 3;
+    cmd.nb_bits = 32;
+    cmd.length = 4;
+    return shm_post(&cmd);
+}
+
+/* Read the three replies of shm_post_idcode_read(); returns the IDCODE */
+static int shm_recv_idcode_read(uint32_t *idcode) {
+    struct cjtag_vpi_cmd rx;
+    if (shm_recv(&rx) < 0 || rx.cmd != 0 || shm_recv(&rx) < 0 || rx.cmd != 1 ||
+        shm_recv(&rx) < 0 || rx.cmd != 3 || rx.nb_bits != 32)
+        return -1;
+    *idcode = rx.buffer_in[0] | (rx.buffer_in[1] << 8) | (rx.buffer_in[2] << 16) | ((uint32_t)rx.buffer_in[3] << 24);
+    return 0;
+}
+
+static int test_shm_attach(void) {
+    print_test("SHM: negotiate the shared-memory rings");
+    if (!vpi_unix_path) {
+        print_fail("Needs --unix <path> or --abstract <name> (descriptors only pass over AF_UNIX)");
+        return 0;
+    }
+    if (jvpi_shm_attach(&shm_link, sock_fd) != 0) {
+        print_fail("Server declined the shared-memory transport");
+        return 0;
+    }
+    print_pass("Region and doorbells received");
+    return 1;
+}
+
+static int test_shm_caps(void) {
+    print_test("SHM: capability query answered on the rings");
+    struct cjtag_vpi_cmd cmd = {0}, rx;
+    cmd.cmd = 1; /* CMD_TMS_SEQ, nb_bits = 0 */
+    memcpy(cmd.buffer_out, "JVPI_CAPS", 10);
+    if (shm_post(&cmd) < 0 || shm_recv(&rx) < 0 || memcmp(rx.buffer_in, "JVPI_CAPS", 10) != 0) {
+        print_fail("Capability query failed");
+        return 0;
+    }
+    uint32_t caps = rx.buffer_in[16] | (rx.buffer_in[17] << 8) | (rx.buffer_in[18] << 16) |
+                    ((uint32_t)rx.buffer_in[19] << 24);
+    if (caps & (VPI_CAP_SCAN_STREAM | VPI_CAP_BATCH)) {
+        print_fail("Streams/batches advertised, but they cannot travel over the rings");
+        return 0;
+    }
+    print_pass("Answered, socket-only extensions withheld");
+    return 1;
+}
+
+static int test_shm_idcode(void) {
+    print_test("SHM: read IDCODE (RESET, TMS_SEQ, SCAN_FLIP)");
+    uint32_t idcode = 0;
+    if (shm_post_idcode_read() < 0 || shm_recv_idcode_read(&idcode) < 0) {
+        print_fail("Command sequence not answered in order");
+        return 0;
+    }
+    if (!validate_u32("IDCODE", idcode, 0x1DEAD3FF))
+        return 0;
+    print_pass("IDCODE 0x1DEAD3FF");
+    return 1;
+}
+
+static int test_shm_pipelined(void) {
+    print_test("SHM: 5 IDCODE reads (15 commands) posted before any reply");
+    for (int i = 0; i < 5; i++) {
+        if (shm_post_idcode_read() < 0) {
+            print_fail("Command ring full before 15 commands");
+            return 0;
+        }
+    }
+    for (int i = 0; i < 5; i++) {
+        uint32_t idcode = 0;
+        if (shm_recv_idcode_read(&idcode) < 0 || idcode != 0x1DEAD3FF) {
+            print_fail("Replies missing, out of order or wrong");
+            return 0;
+        }
+    }
+    print_pass("15 replies in order, every IDCODE correct");
+    return 1;
+}
+
+static int test_shm_round_trip(void) {
+    print_test("SHM: 1036-byte capability query round trips");
+    static double lat[BENCH_ROUNDS];
+    struct cjtag_vpi_cmd cmd = {0}, rx;
+    cmd.cmd = 1;
+    memcpy(cmd.buffer_out, "JVPI_CAPS", 10);
+
+    for (int i = 0; i < BENCH_WARMUP + BENCH_ROUNDS; i++) {
+        double t0 = now_us();
+        if (jvpi_shm_xfer(&shm_link, &cmd, &rx, SHM_TIMEOUT_MS) < 0) {
+            print_fail("Round trip failed");
+            return 0;
+        }
+        if (i >= BENCH_WARMUP)
+            lat[i - BENCH_WARMUP] = now_us() - t0;
+    }
+
+    double sum = 0;
+    for (int i = 0; i < BENCH_ROUNDS; i++)
+        sum += lat[i];
+    qsort(lat, BENCH_ROUNDS, sizeof(lat[0]), cmp_double);
+    char msg[160];
+    snprintf(msg, sizeof(msg), "shm: avg %.1f us, min %.1f, p50 %.1f, p99 %.1f (%d rounds, %.0f cmd/s)",
+             sum / BENCH_ROUNDS, lat[0], lat[BENCH_ROUNDS / 2], lat[BENCH_ROUNDS * 99 / 100],
+             BENCH_ROUNDS, BENCH_ROUNDS * 1e6 / sum);
+    print_pass(msg);
+    return 1;
+}
+
+static int run_shm_tests(void) {
+    int ok = 1;
+
+    if (!test_shm_attach())
+        return 0;
+    ok &= test_shm_caps();
+    ok &= test_shm_idcode();
+    ok &= test_shm_pipelined();
+    ok &= test_shm_round_trip();
+
+    jvpi_shm_detach(&shm_link);
+    return ok;
+}
+
+/* -------------------------------------------------------------------------- */
+/* GDB RSP stub (server started with --gdb-port 3334)                         */
+/* -------------------------------------------------------------------------- */
+
+static int gdb_fd = -1;
+
+static int gdb_send(const char *payload) {
+    char pkt[600];
+    unsigned sum = 0;
+    for (const char *p = payload; *p; p++)
+        sum += (uint8_t)*p;
+    int n = snprintf(pkt, sizeof(pkt), "$%s#%02x", payload, sum & 0xFF);
+    return send_all(gdb_fd, pkt, (size_t)n);
+}
+
+/* Receive one packet payload, skipping acks. Returns payload length or -1. */
+static int gdb_recv(char *buf, size_t size) {
+    char c;
+    size_t len = 0;
+    do {
+        if (recv_all(gdb_fd, &c, 1) < 0)
+            return -1;
+    } while (c != '$');
+    for (;;) {
+        if (recv_all(gdb_fd, &c, 1) < 0)
+            return -1;
+        if (c == '#')
+            break;
+        if (len + 1 < size)
+            buf[len++] = c;
+    }
+    buf[len] = '\0';
+    char sum[2];
+    if (recv_all(gdb_fd, sum, 2) < 0)
+        return -1;
+    return (int)len;
+}
+
+/* Send a packet and compare the reply against an expected prefix */
+static int gdb_expect(const char *name, const char *req, const char *expect, char *reply, size_t size) {
+    print_test(name);
+    if (gdb_send(req) < 0 || gdb_recv(reply, size) < 0) {
+        print_fail("No reply from GDB stub");
+        return 0;
+    }
+    if (strncmp(reply, expect, strlen(expect)) != 0) {
+        char msg[160];
+        snprintf(msg, sizeof(msg), "'%s' -> '%.60s' (expected '%s')", req, reply, expect);
+        print_fail(msg);
+        return 0;
+    }
+    char msg[64];
+    snprintf(msg, sizeof(msg), "%.48s%s", reply[0] ? reply : "(empty)", strlen(reply) > 48 ? "..." : "");
+    print_pass(msg);
+    return 1;
+}
+
+static int run_gdb_tests(void) {
+    char reply[600];
+    int ok = 1;
+
+    gdb_fd = connect_port(GDB_PORT);
+    if (gdb_fd < 0) {
+        print_test("GDB: connect to stub");
+        print_fail("Could not connect (server started without --gdb-port 3334?)");
+        return 0;
+    }
+
+    ok &= gdb_expect("GDB: qSupported", "qSupported:swbreak+", "PacketSize=", reply, sizeof(reply));
+    ok &= gdb_expect("GDB: stop reason halts the hart", "?", "S05", reply, sizeof(reply));
+    ok &= gdb_expect("GDB: write x1", "P1=78563412", "OK", reply, sizeof(reply));
+    ok &= gdb_expect("GDB: read x1 back", "p1", "78563412", reply, sizeof(reply));
+    ok &= gdb_expect("GDB: write pc (dpc)", "P20=00100080", "OK", reply, sizeof(reply));
+
+    ok &= gdb_expect("GDB: read all registers", "g", "00000000", reply, sizeof(reply));
+    if (strlen(reply) != 33 * 8 || strncmp(reply + 8, "78563412", 8) != 0 ||
+        strncmp(reply + 32 * 8, "00100080", 8) != 0) {
+        print_fail("'g' reply does not hold x1 and pc as written");
+        ok = 0;
+    }
+
+    ok &= gdb_expect("GDB: write memory (words)", "M100,8:efbeaddebebafeca", "OK", reply, sizeof(reply));
+    ok &= gdb_expect("GDB: read memory (words)", "m100,8", "efbeaddebebafeca", reply, sizeof(reply));
+    ok &= gdb_expect("GDB: read memory (unaligned bytes)", "m101,3", "beadde", reply, sizeof(reply));
+    ok &= gdb_expect("GDB: bad hex in memory write rejected", "M100,4:efbeadzz", "E01", reply, sizeof(reply));
+    ok &= gdb_expect("GDB: memory left unchanged", "m100,4", "efbeadde", reply, sizeof(reply));
+    ok &= gdb_expect("GDB: register read without a number rejected", "p", "E01", reply, sizeof(reply));
+    ok &= gdb_expect("GDB: register write without a number rejected", "P=00000000", "E01", reply, sizeof(reply));
+    ok &= gdb_expect("GDB: single step", "s", "S05", reply, sizeof(reply));
+
+    print_test("GDB: continue, then Ctrl-C stops the hart");
+    if (gdb_send("c") < 0 || send_all(gdb_fd, "\x03", 1) < 0 || gdb_recv(reply, sizeof(reply)) < 0 ||
+        strcmp(reply, "S02") != 0) {
+        print_fail("No S02 stop reply after interrupt");
+        ok = 0;
+    } else {
+        print_pass("S02");
+    }
+
+    ok &= gdb_expect("GDB: detach", "D", "OK", reply, sizeof(reply));
+    close(gdb_fd);
+    return ok;
+}
+
+/* -------------------------------------------------------------------------- */
+/* Main                                                                       */
+/* -------------------------------------------------------------------------- */
+
+int main(int argc, char **argv) {
+    const char *mode = "jtag";
+
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "--unix") == 0 || strcmp(argv[i], "--abstract") == 0) && i + 1 < argc) {
+            vpi_abstract = (strcmp(argv[i], "--abstract") == 0);
+            vpi_unix_path = argv[++i];
+        } else {
+            mode = argv[i];
+        }
+    }
 
     printf("\n=== Unified Protocol Test Client ===\n");
     printf("Mode: %s\n", mode);
-    printf("Target: %s:%d\n\n", VPI_ADDR, VPI_PORT);
+    if (vpi_unix_path)
+        printf("Target: unix:%s%s\n\n", vpi_abstract ? "@" : "", vpi_unix_path);
+    else
+        printf("Target: %s:%d\n\n", VPI_ADDR, VPI_PORT);
 
     sock_fd = connect_vpi();
     if (sock_fd < 0) {
@@ -1985,6 +3612,22 @@ int main(int argc, char **argv) {
         ok = run_legacy_tests();
     } else if (strcmp(mode, "combo") == 0) {
         ok = run_combo_tests();
+    } else if (strcmp(mode, "dmi") == 0) {
+        ok = run_dmi_tests();
+    } else if (strcmp(mode, "gdb") == 0) {
+        ok = run_gdb_tests();
+    } else if (strcmp(mode, "tap") == 0) {
+        ok = run_tap_tests();
+    } else if (strcmp(mode, "stats") == 0) {
+        ok = run_stats_tests();
+    } else if (strcmp(mode, "batch") == 0) {
+        ok = run_batch_tests();
+    } else if (strcmp(mode, "multi") == 0) {
+        ok = run_multi_tests();
+    } else if (strcmp(mode, "bench") == 0) {
+        ok = run_bench_tests();
+    } else if (strcmp(mode, "shm") == 0) {
+        ok = run_shm_tests();
     } else {
         ok = run_jtag_tests();
     }
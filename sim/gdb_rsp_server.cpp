@@ -0,0 +1,597 @@
+/**
+ * GDB Remote Serial Protocol Stub
+ * Serves GDB directly from the simulator: run control, register access via
+ * abstract commands and memory access via system bus access, all issued as
+ * DMI requests through the harness (no OpenOCD, no TAP shifting)
+ */
+
+#include "gdb_rsp_server.h"
+#include "riscv_dm_regs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+
+// Debug macros - controlled by debug_level
+#define DBG_PRINT(level, ...) \
+    do { if (debug_level >= (level)) { printf(__VA_ARGS__); fflush(stdout); } } while(0)
+
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+static int hex_val(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// 32-bit register value as GDB expects it: target (little-endian) byte order
+static void append_le32_hex(std::string& out, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        uint8_t b = (v >> (8 * i)) & 0xFF;
+        out += HEX_DIGITS[b >> 4];
+        out += HEX_DIGITS[b & 0xF];
+    }
+}
+
+static bool parse_le32_hex(const char* p, uint32_t* v) {
+    uint32_t r = 0;
+    for (int i = 0; i < 4; i++) {
+        int hi = hex_val(p[2 * i]), lo = hex_val(p[2 * i + 1]);
+        if (hi < 0 || lo < 0) {
+            return false;
+        }
+        r |= (uint32_t)((hi << 4) | lo) << (8 * i);
+    }
+    *v = r;
+    return true;
+}
+
+GdbRspServer::GdbRspServer(int port)
+    : port(port),
+      server_sock(-1),
+      client_sock(-1),
+      debug_level(0),
+      poll_interval(16),
+      poll_countdown(0),
+      halt_check(0),
+      no_ack(false),
+      running(false) {
+}
+
+GdbRspServer::~GdbRspServer() {
+    close_connection();
+    if (server_sock >= 0) {
+        close(server_sock);
+    }
+}
+
+bool GdbRspServer::init() {
+    struct sockaddr_in addr;
+
+    server_sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_sock < 0) {
+        printf("[GDB] Failed to create socket\n");
+        return false;
+    }
+
+    int opt = 1;
+    setsockopt(server_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    int flags = fcntl(server_sock, F_GETFL, 0);
+    fcntl(server_sock, F_SETFL, flags | O_NONBLOCK);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    addr.sin_port = htons(port);
+
+    if (bind(server_sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        printf("[GDB] Failed to bind to port %d\n", port);
+        close(server_sock);
+        server_sock = -1;
+        return false;
+    }
+    if (listen(server_sock, 1) < 0) {
+        printf("[GDB] Failed to listen\n");
+        close(server_sock);
+        server_sock = -1;
+        return false;
+    }
+
+    printf("[GDB] Stub listening on 127.0.0.1:%d (target remote :%d)\n", port, port);
+    return true;
+}
+
+void GdbRspServer::accept_client() {
+    struct sockaddr_in client_addr;
+    socklen_t client_len = sizeof(client_addr);
+
+    client_sock = accept(server_sock, (struct sockaddr*)&client_addr, &client_len);
+    if (client_sock < 0) {
+        return;
+    }
+    printf("[GDB] Client connected from %s:%d\n",
+           inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+    fflush(stdout);
+    int flags = fcntl(client_sock, F_GETFL, 0);
+    fcntl(client_sock, F_SETFL, flags | O_NONBLOCK);
+    int nodelay = 1;
+    setsockopt(client_sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    no_ack = false;
+    running = false;
+    rx_buf.clear();
+    if (!dm_activate()) {
+        printf("[GDB] Warning: debug module did not respond to activation\n");
+    }
+}
+
+void GdbRspServer::close_connection() {
+    if (client_sock >= 0) {
+        close(client_sock);
+        client_sock = -1;
+        printf("[GDB] Client disconnected\n");
+        fflush(stdout);
+    }
+    running = false;
+    rx_buf.clear();
+}
+
+// Called from the simulation loop. Socket checks are spread out like the VPI
+// server's; while the target runs, DMSTATUS is sampled every few checks so a
+// halt (e.g. ebreak on a real hart) is reported to GDB.
+void GdbRspServer::poll() {
+    if (server_sock < 0) {
+        return;
+    }
+    if (--poll_countdown > 0) {
+        return;
+    }
+    poll_countdown = poll_interval;
+
+    struct pollfd pfd;
+    pfd.fd = (client_sock >= 0) ? client_sock : server_sock;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (::poll(&pfd, 1, 0) > 0) {
+        if (client_sock < 0) {
+            accept_client();
+            return;
+        }
+        char buf[1024];
+        ssize_t n = recv(client_sock, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            close_connection();
+            return;
+        }
+        if (n > 0) {
+            rx_buf.append(buf, (size_t)n);
+            handle_input();
+        }
+    }
+
+    if (running && client_sock >= 0 && ++halt_check >= 64) {
+        halt_check = 0;
+        if (is_halted()) {
+            running = false;
+            send_stop(5);  // SIGTRAP
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Debug module access
+// ---------------------------------------------------------------------------
+
+bool GdbRspServer::dmi_read(uint32_t addr, uint32_t* val) {
+    if (!dmi_driver) {
+        return false;
+    }
+    return dmi_driver(1, addr, 0, val) == 0;
+}
+
+// riscv_debug_module reports BUSY for the request that starts an abstract
+// command (the response reflects the state after the write); only FAILED is
+// an error here, command completion is checked through ABSTRACTCS.
+bool GdbRspServer::dmi_write(uint32_t addr, uint32_t val) {
+    uint32_t unused;
+    if (!dmi_driver) {
+        return false;
+    }
+    return dmi_driver(2, addr, val, &unused) != 2;
+}
+
+bool GdbRspServer::dm_activate() {
+    return dmi_write(riscv_dm::DMCONTROL, riscv_dm::DMCONTROL_DMACTIVE);
+}
+
+bool GdbRspServer::is_halted() {
+    uint32_t status = 0;
+    return dmi_read(riscv_dm::DMSTATUS, &status) && (status & riscv_dm::DMSTATUS_ALLHALTED);
+}
+
+bool GdbRspServer::halt() {
+    bool halted = false;
+    if (!dmi_write(riscv_dm::DMCONTROL, riscv_dm::DMCONTROL_HALTREQ | riscv_dm::DMCONTROL_DMACTIVE)) {
+        return false;
+    }
+    for (int i = 0; i < DM_POLL_LIMIT && !halted; i++) {
+        halted = is_halted();
+    }
+    dmi_write(riscv_dm::DMCONTROL, riscv_dm::DMCONTROL_DMACTIVE);
+    DBG_PRINT(1, "[GDB] Halt %s\n", halted ? "ok" : "timed out");
+    return halted;
+}
+
+// Single step sets dcsr.step and resumes; a hart that does not implement
+// stepping (the jtag_vpi_top hart model) is halted explicitly afterwards.
+bool GdbRspServer::resume(bool step) {
+    uint32_t dcsr = 0;
+    if (step) {
+        if (!reg_read(GDB_REG_CSR0 + CSR_DCSR, &dcsr) || !reg_write(GDB_REG_CSR0 + CSR_DCSR, dcsr | DCSR_STEP)) {
+            return false;
+        }
+    }
+    if (!dmi_write(riscv_dm::DMCONTROL, riscv_dm::DMCONTROL_RESUMEREQ | riscv_dm::DMCONTROL_DMACTIVE)) {
+        return false;
+    }
+    if (!step) {
+        return true;
+    }
+    bool halted = false;
+    for (int i = 0; i < DM_POLL_LIMIT && !halted; i++) {
+        halted = is_halted();
+    }
+    if (!halted && !halt()) {
+        return false;
+    }
+    return reg_write(GDB_REG_CSR0 + CSR_DCSR, dcsr & ~DCSR_STEP);
+}
+
+bool GdbRspServer::abstract_reg(uint32_t regno, bool write) {
+    uint32_t cs = 0;
+    if (!dmi_write(riscv_dm::COMMAND, AC_ACCESS_REG | (write ? AC_WRITE : 0) | regno)) {
+        return false;
+    }
+    for (int i = 0; i < DM_POLL_LIMIT; i++) {
+        if (!dmi_read(riscv_dm::ABSTRACTCS, &cs)) {
+            return false;
+        }
+        if (!(cs & riscv_dm::ABSTRACTCS_BUSY)) {
+            break;
+        }
+    }
+    if (cs & (riscv_dm::ABSTRACTCS_BUSY | riscv_dm::ABSTRACTCS_CMDERR)) {
+        DBG_PRINT(1, "[GDB] Abstract command regno=0x%04x failed: abstractcs=0x%08x\n", regno, cs);
+        dmi_write(riscv_dm::ABSTRACTCS, riscv_dm::ABSTRACTCS_CMDERR);  // W1C
+        return false;
+    }
+    return true;
+}
+
+// GDB register number to abstract command regno
+static bool gdb_to_regno(int gdb_reg, uint32_t* regno) {
+    if (gdb_reg >= 0 && gdb_reg < 32) {
+        *regno = 0x1000 + gdb_reg;
+    } else if (gdb_reg == 32) {
+        *regno = 0x7B1;  // pc is dpc while halted
+    } else if (gdb_reg >= 65 && gdb_reg < 65 + 4096) {
+        *regno = gdb_reg - 65;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool GdbRspServer::reg_read(int regno, uint32_t* val) {
+    uint32_t ac_regno;
+    return gdb_to_regno(regno, &ac_regno) && abstract_reg(ac_regno, false) && dmi_read(riscv_dm::DATA0, val);
+}
+
+bool GdbRspServer::reg_write(int regno, uint32_t val) {
+    uint32_t ac_regno;
+    return gdb_to_regno(regno, &ac_regno) && dmi_write(riscv_dm::DATA0, val) && abstract_reg(ac_regno, true);
+}
+
+// Word accesses when aligned, byte accesses otherwise. Reads use
+// sbreadonaddr (one SBADDRESS0 write per access), writes sbautoincrement.
+bool GdbRspServer::mem_read(uint32_t addr, uint8_t* buf, uint32_t len) {
+    uint32_t size = ((addr | len) & 3) ? 1 : 4;
+    uint32_t sbaccess = (size == 4) ? 2 : 0;
+    if (!dmi_write(riscv_dm::SBCS, (sbaccess << riscv_dm::SBCS_SBACCESS_SHIFT) | riscv_dm::SBCS_SBREADONADDR)) {
+        return false;
+    }
+    for (uint32_t off = 0; off < len; off += size) {
+        uint32_t data = 0;
+        if (!dmi_write(riscv_dm::SBADDRESS0, addr + off) || !dmi_read(riscv_dm::SBDATA0, &data)) {
+            return false;
+        }
+        for (uint32_t i = 0; i < size; i++) {
+            buf[off + i] = (data >> (8 * i)) & 0xFF;
+        }
+    }
+    return true;
+}
+
+bool GdbRspServer::mem_write(uint32_t addr, const uint8_t* buf, uint32_t len) {
+    uint32_t size = ((addr | len) & 3) ? 1 : 4;
+    uint32_t sbaccess = (size == 4) ? 2 : 0;
+    if (!dmi_write(riscv_dm::SBCS, (sbaccess << riscv_dm::SBCS_SBACCESS_SHIFT) | riscv_dm::SBCS_SBAUTOINCREMENT) ||
+        !dmi_write(riscv_dm::SBADDRESS0, addr)) {
+        return false;
+    }
+    for (uint32_t off = 0; off < len; off += size) {
+        uint32_t data = 0;
+        for (uint32_t i = 0; i < size; i++) {
+            data |= (uint32_t)buf[off + i] << (8 * i);
+        }
+        if (!dmi_write(riscv_dm::SBDATA0, data)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Remote serial protocol
+// ---------------------------------------------------------------------------
+
+void GdbRspServer::send_raw(const char* data, size_t len) {
+    while (len > 0 && client_sock >= 0) {
+        ssize_t n = send(client_sock, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                // Replies are small; wait for the socket rather than buffering
+                struct pollfd pfd = {client_sock, POLLOUT, 0};
+                ::poll(&pfd, 1, 100);
+                continue;
+            }
+            close_connection();
+            return;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+}
+
+void GdbRspServer::send_packet(const std::string& payload) {
+    uint8_t sum = 0;
+    for (char c : payload) {
+        sum += (uint8_t)c;
+    }
+    std::string pkt;
+    pkt.reserve(payload.size() + 4);
+    pkt += '$';
+    pkt += payload;
+    pkt += '#';
+    pkt += HEX_DIGITS[sum >> 4];
+    pkt += HEX_DIGITS[sum & 0xF];
+    DBG_PRINT(2, "[GDB] -> %s\n", pkt.c_str());
+    send_raw(pkt.data(), pkt.size());
+}
+
+void GdbRspServer::send_stop(int signal) {
+    char reply[4];
+    snprintf(reply, sizeof(reply), "S%02x", signal);
+    send_packet(reply);
+}
+
+// Split rx_buf into acks, interrupts and complete $...#xx packets
+void GdbRspServer::handle_input() {
+    size_t pos = 0;
+    while (pos < rx_buf.size() && client_sock >= 0) {
+        char c = rx_buf[pos];
+        if (c == '+' || c == '-') {
+            pos++;
+        } else if (c == 0x03) {
+            // Ctrl-C: stop a running target
+            pos++;
+            if (running) {
+                running = false;
+                halt();
+                send_stop(2);  // SIGINT
+            }
+        } else if (c == '$') {
+            size_t hash = rx_buf.find('#', pos);
+            if (hash == std::string::npos || hash + 2 >= rx_buf.size()) {
+                break;  // Incomplete packet
+            }
+            std::string payload = rx_buf.substr(pos + 1, hash - pos - 1);
+            uint8_t sum = 0;
+            for (char p : payload) {
+                sum += (uint8_t)p;
+            }
+            int hi = hex_val(rx_buf[hash + 1]), lo = hex_val(rx_buf[hash + 2]);
+            pos = hash + 3;
+            if (!no_ack) {
+                bool ok = (hi >= 0 && lo >= 0 && ((hi << 4) | lo) == sum);
+                send_raw(ok ? "+" : "-", 1);
+                if (!ok) {
+                    continue;
+                }
+            }
+            DBG_PRINT(2, "[GDB] <- %s\n", payload.c_str());
+            handle_packet(payload);
+        } else {
+            pos++;  // Noise between packets
+        }
+    }
+    rx_buf.erase(0, pos);
+}
+
+void GdbRspServer::handle_packet(const std::string& pkt) {
+    const char* args = pkt.c_str() + 1;
+    std::string reply;
+    uint32_t val;
+
+    switch (pkt.empty() ? 0 : pkt[0]) {
+    case '?':
+        // Attach: report the target stopped
+        if (!is_halted()) {
+            halt();
+        }
+        send_stop(5);
+        return;
+
+    case 'g':
+        for (int r = 0; r <= GDB_REG_PC; r++) {
+            if (!reg_read(r, &val)) {
+                send_packet("E01");
+                return;
+            }
+            append_le32_hex(reply, val);
+        }
+        send_packet(reply);
+        return;
+
+    case 'G':
+        if (pkt.size() < 1 + 8 * (GDB_REG_PC + 1)) {
+            send_packet("E01");
+            return;
+        }
+        for (int r = 1; r <= GDB_REG_PC; r++) {  // x0 is hardwired
+            if (!parse_le32_hex(args + 8 * r, &val) || !reg_write(r, val)) {
+                send_packet("E01");
+                return;
+            }
+        }
+        send_packet("OK");
+        return;
+
+    case 'p': {
+        char* end;
+        int r = (int)strtol(args, &end, 16);
+        if (end == args || !reg_read(r, &val)) {
+            send_packet("E01");
+            return;
+        }
+        append_le32_hex(reply, val);
+        send_packet(reply);
+        return;
+    }
+
+    case 'P': {
+        char* end;
+        int r = (int)strtol(args, &end, 16);
+        if (end == args || *end != '=' || !parse_le32_hex(end + 1, &val) || !reg_write(r, val)) {
+            send_packet("E01");
+            return;
+        }
+        send_packet("OK");
+        return;
+    }
+
+    case 'm': {
+        char* end;
+        uint32_t addr = (uint32_t)strtoul(args, &end, 16);
+        uint32_t len = (*end == ',') ? (uint32_t)strtoul(end + 1, nullptr, 16) : 0;
+        if (len > GDB_PACKET_SIZE / 2) {
+            len = GDB_PACKET_SIZE / 2;
+        }
+        std::string data(len, '\0');
+        if (!mem_read(addr, (uint8_t*)&data[0], len)) {
+            send_packet("E01");
+            return;
+        }
+        for (unsigned char b : data) {
+            reply += HEX_DIGITS[b >> 4];
+            reply += HEX_DIGITS[b & 0xF];
+        }
+        send_packet(reply);
+        return;
+    }
+
+    case 'M': {
+        char* end;
+        uint32_t addr = (uint32_t)strtoul(args, &end, 16);
+        uint32_t len = (*end == ',') ? (uint32_t)strtoul(end + 1, &end, 16) : 0;
+        if (*end != ':' || strlen(end + 1) < 2 * (size_t)len) {
+            send_packet("E01");
+            return;
+        }
+        std::string data(len, '\0');
+        for (uint32_t i = 0; i < len; i++) {
+            int hi = hex_val(end[1 + 2 * i]), lo = hex_val(end[2 + 2 * i]);
+            if (hi < 0 || lo < 0) {
+                send_packet("E01");
+                return;
+            }
+            data[i] = (char)((hi << 4) | lo);
+        }
+        send_packet(mem_write(addr, (const uint8_t*)data.data(), len) ? "OK" : "E01");
+        return;
+    }
+
+    case 'c':
+    case 's':
+        if (*args && !reg_write(GDB_REG_PC, (uint32_t)strtoul(args, nullptr, 16))) {
+            send_packet("E01");
+            return;
+        }
+        if (pkt[0] == 's') {
+            send_stop(resume(true) ? 5 : 2);
+            return;
+        }
+        if (!resume(false)) {
+            send_packet("E01");
+            return;
+        }
+        running = true;  // Stop reply follows on halt or Ctrl-C
+        return;
+
+    case 'D':
+        resume(false);
+        send_packet("OK");
+        close_connection();
+        return;
+
+    case 'k':
+        close_connection();
+        return;
+
+    case 'H':
+    case 'T':
+        send_packet("OK");  // Single thread
+        return;
+
+    case 'q':
+        if (pkt.compare(0, 10, "qSupported") == 0) {
+            char buf[64];
+            snprintf(buf, sizeof(buf), "PacketSize=%zx;QStartNoAckMode+", GDB_PACKET_SIZE);
+            send_packet(buf);
+        } else if (pkt == "qAttached") {
+            send_packet("1");
+        } else if (pkt == "qC") {
+            send_packet("QC1");
+        } else if (pkt == "qfThreadInfo") {
+            send_packet("m1");
+        } else if (pkt == "qsThreadInfo") {
+            send_packet("l");
+        } else {
+            send_packet("");
+        }
+        return;
+
+    case 'Q':
+        if (pkt == "QStartNoAckMode") {
+            send_packet("OK");
+            no_ack = true;
+        } else {
+            send_packet("");
+        }
+        return;
+
+    default:
+        // Unsupported (vCont, Z breakpoints, X, ...): GDB falls back to the
+        // basic packets above
+        send_packet("");
+        return;
+    }
+}
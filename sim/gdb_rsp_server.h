@@ -0,0 +1,80 @@
+/**
+ * GDB Remote Serial Protocol Stub Header
+ * In-process GDB server that debugs riscv_debug_module over the DMI fast path
+ */
+
+#ifndef GDB_RSP_SERVER_H
+#define GDB_RSP_SERVER_H
+
+#include "jtag_vpi_server.h"
+#include <stdint.h>
+#include <string>
+
+class GdbRspServer {
+public:
+    // Same contract as the JtagVpiServer DMI executor: one DMI request on the
+    // debug module, returns the DMI response code with the read data in *rdata.
+    typedef JtagVpiServer::DmiDriver DmiDriver;
+
+    GdbRspServer(int port = 3334);
+    ~GdbRspServer();
+
+    bool init();
+    void poll();
+    void set_dmi_executor(DmiDriver drv) { dmi_driver = drv; }
+    void set_debug_level(int level) { debug_level = level; }
+    void set_poll_interval(int n) { poll_interval = (n > 0) ? n : 1; }
+    bool is_client_connected() const { return client_sock >= 0; }
+
+private:
+    // Abstract command: access register, 32-bit, transfer
+    static constexpr uint32_t AC_ACCESS_REG = (2u << 20) | (1u << 17);
+    static constexpr uint32_t AC_WRITE = 1u << 16;
+    static constexpr uint32_t REGNO_GPR0 = 0x1000;
+    static constexpr uint32_t CSR_DCSR = 0x7B0;
+    static constexpr uint32_t CSR_DPC = 0x7B1;
+    static constexpr uint32_t DCSR_STEP = 1u << 2;
+
+    // GDB riscv register numbers: x0-x31, pc, then CSRs from 65
+    static constexpr int GDB_REG_PC = 32;
+    static constexpr int GDB_REG_CSR0 = 65;
+
+    static constexpr int DM_POLL_LIMIT = 1000;  // DMI reads before a halt/command wait gives up
+    static constexpr size_t GDB_PACKET_SIZE = 4096;
+
+    // DM access
+    bool dmi_read(uint32_t addr, uint32_t* val);
+    bool dmi_write(uint32_t addr, uint32_t val);
+    bool dm_activate();
+    bool is_halted();
+    bool halt();
+    bool resume(bool step);
+    bool reg_read(int regno, uint32_t* val);
+    bool reg_write(int regno, uint32_t val);
+    bool abstract_reg(uint32_t regno, bool write);
+    bool mem_read(uint32_t addr, uint8_t* buf, uint32_t len);
+    bool mem_write(uint32_t addr, const uint8_t* buf, uint32_t len);
+
+    // RSP
+    void accept_client();
+    void close_connection();
+    void handle_input();
+    void handle_packet(const std::string& pkt);
+    void send_packet(const std::string& payload);
+    void send_raw(const char* data, size_t len);
+    void send_stop(int signal);
+
+    int port;
+    int server_sock;
+    int client_sock;
+    int debug_level;
+    int poll_interval;
+    int poll_countdown;
+    int halt_check;         // Polls since DMSTATUS was last sampled while running
+    bool no_ack;            // QStartNoAckMode negotiated
+    bool running;           // Target resumed by 'c', stop reply owed
+    std::string rx_buf;     // Unparsed bytes from the client
+    DmiDriver dmi_driver;
+};
+
+#endif // GDB_RSP_SERVER_H
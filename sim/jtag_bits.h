@@ -0,0 +1,74 @@
+/**
+ * JTAG bit-stream helpers
+ * Word-wide access to LSB-first TMS/TDI/TDO bit buffers, and byte bit-order
+ * reversal for --msb-first
+ */
+
+#ifndef JTAG_BITS_H
+#define JTAG_BITS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace jtag_bits {
+
+// Bit-reversed value of every byte, built at compile time
+struct ReverseTable {
+    uint8_t v[256];
+    constexpr ReverseTable() : v() {
+        for (int i = 0; i < 256; i++) {
+            uint8_t r = 0;
+            for (int b = 0; b < 8; b++) {
+                r |= ((i >> b) & 1) << (7 - b);
+            }
+            v[i] = r;
+        }
+    }
+};
+static constexpr ReverseTable reverse_table{};
+
+// Mirror the bit order of n bytes in place (MSB-first <-> LSB-first)
+static inline void reverse_bytes(uint8_t* buf, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        buf[i] = reverse_table.v[buf[i]];
+    }
+}
+
+// Bit i of an LSB-first buffer
+static inline uint8_t get_bit(const uint8_t* buf, uint32_t i) {
+    return (buf[i >> 3] >> (i & 7)) & 1;
+}
+
+// Copy n bits from bit src_off of src to bit dst_off of dst. dst may be src
+// as long as dst_off <= src_off.
+static inline void copy_bits(uint8_t* dst, uint32_t dst_off, const uint8_t* src, uint32_t src_off, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t d = dst_off + i;
+        uint8_t mask = (uint8_t)(1u << (d & 7));
+        dst[d >> 3] = get_bit(src, src_off + i) ? (dst[d >> 3] | mask) : (dst[d >> 3] & ~mask);
+    }
+}
+
+// 64 bits starting at byte p, bit 0 = LSB of p[0]
+static inline uint64_t load_word(const uint8_t* p) {
+    uint64_t w;
+    memcpy(&w, p, sizeof(w));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    w = __builtin_bswap64(w);
+#endif
+    return w;
+}
+
+// Store the low `bits` bits of w (1..64) from byte p on; whole bytes only,
+// so the buffer is written up to (bits + 7) / 8 bytes
+static inline void store_word(uint8_t* p, uint64_t w, uint32_t bits) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    w = __builtin_bswap64(w);
+#endif
+    memcpy(p, &w, (bits + 7) / 8);
+}
+
+} // namespace jtag_bits
+
+#endif // JTAG_BITS_H
@@ -4,15 +4,29 @@
  */
 
 #include "jtag_vpi_server.h"
+#include "jtag_bits.h"
+#include "riscv_dm_regs.h"
+#include "../vpi/jtag_vpi_shm.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <stddef.h>
+#include <poll.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+#include <algorithm>
+#include <chrono>
 
 // Debug macros - controlled by debug_level
 #define DBG_PRINT(level, ...) \
@@ -57,33 +71,93 @@ JtagVpiServer::JtagVpiServer(int port)
     pending_tms = 0;
     pending_tdi = 0;
     pending_mode_select = 0;  // Will be set by set_mode() from command-line
-    pending_tck_pulse = false;
-    reset_pulses_remaining = 0;
+    tck_ops.reserve(TCK_QUEUE_DEPTH);
     tckc_state = 0;
-    pending_tckc_toggle = false;
     tckc_toggle_consumed = false;  // Initialize SF0 synchronization flag
     // Initialize command buffer
     memset(cmd_buf, 0, sizeof(cmd_buf));
     cmd_bytes_received = 0;
     // Init OpenOCD vpi packet state
-    memset(&vpi_cmd_rx, 0, sizeof(vpi_cmd_rx));
     memset(&vpi_cmd_tx, 0, sizeof(vpi_cmd_tx));
     memset(&minimal_cmd_rx, 0, sizeof(minimal_cmd_rx));
     minimal_rx_bytes = 0;
+    vpi_rx_ring.resize(VPI_RX_DEPTH);
+    vpi_rx_payload.resize(VPI_RX_DEPTH);
+    vpi_rx_pkt = &vpi_rx_ring[0];
 }
 
 JtagVpiServer::~JtagVpiServer() {
     close_connection();
+    while (!parked.empty()) {
+        swap_session(parked.back());
+        parked.pop_back();
+        close_connection();
+    }
+    if (io_thread.joinable()) {
+        io_stop = true;
+        io_sleeping = true;  // force the wake byte out
+        io_kick();
+        io_thread.join();
+        io_close_client();
+        close(io_wake[0]);
+        close(io_wake[1]);
+    }
     if (server_sock >= 0) {
         close(server_sock);
+        if (!unix_path.empty() && !unix_abstract) {
+            unlink(unix_path.c_str());
+        }
+    }
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+    }
+}
+
+void JtagVpiServer::set_unix_socket(const std::string& path, bool abstract) {
+    unix_path = path;
+    unix_abstract = abstract;
+}
+
+// Listen address for messages: 127.0.0.1:3333, unix:/path or unix:@name
+std::string JtagVpiServer::listen_address() const {
+    if (unix_path.empty()) {
+        return "127.0.0.1:" + std::to_string(port);
     }
+    return std::string("unix:") + (unix_abstract ? "@" : "") + unix_path;
 }
 
 bool JtagVpiServer::init() {
     struct sockaddr_in addr;
+    struct sockaddr_un uaddr;
+    socklen_t uaddr_len = 0;
+
+    if (!unix_path.empty()) {
+        // AF_UNIX: a filesystem path, or a Linux abstract name (leading NUL,
+        // not NUL-terminated, gone with the last reference to the socket)
+        if (unix_path.size() + 1 > sizeof(uaddr.sun_path)) {
+            printf("[VPI] Unix socket name too long: %s\n", unix_path.c_str());
+            return false;
+        }
+#ifndef __linux__
+        if (unix_abstract) {
+            printf("[VPI] Abstract unix sockets are only available on Linux\n");
+            return false;
+        }
+#endif
+        memset(&uaddr, 0, sizeof(uaddr));
+        uaddr.sun_family = AF_UNIX;
+        if (unix_abstract) {
+            memcpy(uaddr.sun_path + 1, unix_path.data(), unix_path.size());
+            uaddr_len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 + unix_path.size());
+        } else {
+            memcpy(uaddr.sun_path, unix_path.data(), unix_path.size());
+            uaddr_len = (socklen_t)sizeof(uaddr);
+            unlink(unix_path.c_str());  // stale socket from an earlier run
+        }
+    }
 
     // Create socket
-    server_sock = socket(AF_INET, SOCK_STREAM, 0);
+    server_sock = socket(unix_path.empty() ? AF_INET : AF_UNIX, SOCK_STREAM, 0);
     if (server_sock < 0) {
         printf("[VPI] Failed to create socket\n");
         return false;
@@ -91,351 +165,1186 @@ bool JtagVpiServer::init() {
 
     // Set socket options
     int opt = 1;
-    setsockopt(server_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (unix_path.empty()) {
+        setsockopt(server_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    }
 
     // Make socket non-blocking
     int flags = fcntl(server_sock, F_GETFL, 0);
     fcntl(server_sock, F_SETFL, flags | O_NONBLOCK);
 
     // Bind
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
-    addr.sin_port = htons(port);
-
-    if (bind(server_sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-        printf("[VPI] Failed to bind to port %d\n", port);
+    int ret;
+    if (unix_path.empty()) {
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+        addr.sin_port = htons(port);
+        ret = bind(server_sock, (struct sockaddr*)&addr, sizeof(addr));
+    } else {
+        ret = bind(server_sock, (struct sockaddr*)&uaddr, uaddr_len);
+    }
+    if (ret < 0) {
+        printf("[VPI] Failed to bind to %s: %s\n", listen_address().c_str(), strerror(errno));
         close(server_sock);
         server_sock = -1;
         return false;
     }
 
     // Listen
-    if (listen(server_sock, 1) < 0) {
+    if (listen(server_sock, MAX_SESSIONS) < 0) {
         printf("[VPI] Failed to listen\n");
         close(server_sock);
         server_sock = -1;
         return false;
     }
 
-    printf("[VPI] Server listening on 127.0.0.1:%d\n", port);
+#ifdef __linux__
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        printf("[VPI] Failed to create epoll instance: %s\n", strerror(errno));
+        close(server_sock);
+        server_sock = -1;
+        return false;
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = server_sock;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_sock, &ev);
+#endif
+
+    printf("[VPI] Server listening on %s\n", listen_address().c_str());
     return true;
 }
 
-void JtagVpiServer::poll() {
-    // Try to accept new connection if not connected
-    if (client_sock < 0) {
-        struct sockaddr_in client_addr;
-        socklen_t client_len = sizeof(client_addr);
-
-        client_sock = accept(server_sock, (struct sockaddr*)&client_addr, &client_len);
-        if (client_sock >= 0) {
-            printf("[VPI] Client connected from %s:%d\n",
-                   inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
-            fflush(stdout);
-            // Keep socket non-blocking
-            int flags = fcntl(client_sock, F_GETFL, 0);
-            fcntl(client_sock, F_SETFL, flags | O_NONBLOCK);
+// Collect readiness for the listen and client sockets. Never blocks when
+// timeout_ms is 0; only sets flags, the state machines do the actual I/O.
+void JtagVpiServer::wait_events(int timeout_ms) {
+    if (replay) {
+        // Never blocks: the next recorded receive (or the end of the
+        // session) is always ready, and the next session once one closes
+        if (client_sock < 0) {
+            accept_ready = !replay->finished();
+        } else {
+            rx_ready = true;
         }
         return;
     }
-
-    // Continue any ongoing operations
-    // For OpenOCD VPI mode, always use continue_vpi_work() which handles scans
-    if (protocol_mode == PROTO_OPENOCD_VPI) {
-        continue_vpi_work();
+    if (io_threaded) {
+        // The network thread did the syscalls; readiness is just ring state.
+        // A blocking wait sleeps on sim_wake until it reports something.
+        if (timeout_ms > 0 && !io_events_pending()) {
+            std::unique_lock<std::mutex> lock(sim_wake_mutex);
+            sim_sleeping = true;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            sim_wake.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                              [this] { return io_events_pending(); });
+            sim_sleeping = false;
+        }
+        if (client_sock < 0) {
+            accept_ready = (io_state.load() == IO_PENDING);
+        } else {
+            if (io_eof.load() || io_rx.readable() > 0) rx_ready = true;
+            if (io_tx.writable() > 0) tx_ready = true;
+        }
         return;
     }
-
-    // For legacy protocol: check scan state and call continue_scan()
-    if (scan_state != SCAN_IDLE) {
-        continue_scan();
+#ifdef __linux__
+    struct epoll_event events[2 * MAX_SESSIONS + 1];
+    int n = epoll_wait(epoll_fd, events, 2 * MAX_SESSIONS + 1, timeout_ms);
+    for (int i = 0; i < n; i++) {
+        uint32_t ev = events[i].events;
+        int fd = events[i].data.fd;
+        if (fd == server_sock) {
+            accept_ready = true;
+            continue;
+        }
+        if ((shm && fd == shm->doorbell) ||
+            std::any_of(parked.begin(), parked.end(),
+                        [fd](const Session& sess) { return sess.shm && sess.shm->doorbell == fd; })) {
+            // Shared-memory doorbell: only wakes us, the rings themselves are
+            // checked wherever a socket's readiness would be
+            uint64_t count;
+            ssize_t r = read(fd, &count, sizeof(count));
+            (void)r;
+            continue;
+        }
+        // HUP/ERR are reported as readable so recv() sees the EOF/error
+        bool rx = (ev & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0;
+        bool tx = (ev & (EPOLLOUT | EPOLLERR)) != 0;
+        if (fd == client_sock) {
+            rx_ready |= rx;
+            tx_ready |= tx;
+            continue;
+        }
+        for (Session& sess : parked) {
+            if (sess.client_sock == fd) {
+                sess.rx_ready |= rx;
+                sess.tx_ready |= tx;
+                break;
+            }
+        }
+    }
+#else
+    struct pollfd fds[MAX_SESSIONS + 2];
+    int nfds = 0;
+    fds[nfds].fd = server_sock;
+    fds[nfds].events = POLLIN;
+    fds[nfds].revents = 0;
+    nfds++;
+    if (client_sock >= 0) {
+        fds[nfds].fd = client_sock;
+        fds[nfds].events = POLLIN | (tx_armed ? POLLOUT : 0);
+        fds[nfds].revents = 0;
+        nfds++;
+    }
+    for (const Session& sess : parked) {
+        fds[nfds].fd = sess.client_sock;
+        fds[nfds].events = POLLIN | (sess.tx_armed ? POLLOUT : 0);
+        fds[nfds].revents = 0;
+        nfds++;
+    }
+    if (::poll(fds, nfds, timeout_ms) <= 0) {
         return;
     }
+    if (fds[0].revents & POLLIN) accept_ready = true;
+    int k = 1;
+    if (client_sock >= 0) {
+        if (fds[k].revents & (POLLIN | POLLHUP | POLLERR)) rx_ready = true;
+        if (fds[k].revents & (POLLOUT | POLLERR)) tx_ready = true;
+        k++;
+    }
+    for (Session& sess : parked) {
+        if (fds[k].revents & (POLLIN | POLLHUP | POLLERR)) sess.rx_ready = true;
+        if (fds[k].revents & (POLLOUT | POLLERR)) sess.tx_ready = true;
+        k++;
+    }
+#endif
+}
 
-    // Auto-detect protocol if unknown: read some bytes and infer (use small buffer)
-    if (protocol_mode == PROTO_UNKNOWN) {
-        DBG_PRINT(2, "[VPI][DBG] Protocol detection: minimal_rx_bytes=%d\n", minimal_rx_bytes);
-        if (minimal_rx_bytes < sizeof(minimal_cmd_rx)) {
-            ssize_t ret = recv(client_sock, ((uint8_t*)&minimal_cmd_rx) + minimal_rx_bytes,
-                               sizeof(minimal_cmd_rx) - minimal_rx_bytes, MSG_DONTWAIT);
-            if (ret < 0) {
-                if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                    printf("[VPI] Connection error during protocol detection: %s\n", strerror(errno));
-                    fflush(stdout);
-                    close_connection();
-                }
-                return;
-            }
-            if (ret == 0) {
-                printf("[VPI] Client disconnected during protocol detection\n");
-                fflush(stdout);
-                close_connection();
-                return;
-            }
-            minimal_rx_bytes += ret;
-            DBG_PRINT(2, "[VPI][DBG] Received %zd bytes, total=%d\n", ret, minimal_rx_bytes);
-        }
+bool JtagVpiServer::is_quiescent() const {
+    if (accept_ready || others_waiting()) {
+        return false;
+    }
+    if (client_sock < 0) {
+        return true;
+    }
+    return !rx_ready && tx_idle() && !vpi_tx_pending && vpi_rx_count == 0 && !shm_ready(shm.get()) &&
+           scan_state == SCAN_IDLE && !tms_seq_active && sf0_state == SF0_IDLE &&
+           tck_ops.empty() && signal_mode == current_mode;
+}
 
-        if (minimal_rx_bytes >= 1) {
-            uint8_t cmd_byte = minimal_cmd_rx.cmd;
-            DBG_PRINT(2, "[VPI][DBG] Protocol detection: cmd_byte=0x%02x, bytes=%d\n", cmd_byte, minimal_rx_bytes);
+bool JtagVpiServer::wait_for_activity(int timeout_ms) {
+    if (!is_quiescent()) {
+        return true;
+    }
+    metrics_check();  // do not time the sleep into the last command
+    // Shared-memory clients ring the doorbell only while we are marked asleep
+    if (!shm_arm_sleep(true)) {
+        wait_events(timeout_ms);
+    }
+    shm_arm_sleep(false);
+    // Handle whatever woke us on the very next poll()
+    poll_countdown = 0;
+    return !is_quiescent() || (!tx_idle() && tx_ready);
+}
 
-            if (minimal_rx_bytes >= sizeof(minimal_cmd_rx)) {
-                // Have at least 8 bytes - decide between minimal 8-byte flow vs full 1036-byte OpenOCD packet
-                uint8_t peek_buf[16];
-                ssize_t peek_ret = recv(client_sock, peek_buf, sizeof(peek_buf), MSG_DONTWAIT | MSG_PEEK);
-                bool more_data_available = (peek_ret > 0);
+// Accept one pending client, non-blocking and (over TCP) with TCP_NODELAY.
+// Returns the socket or -1; peer gets a printable client address.
+static int accept_nonblocking(int server_sock, std::string* peer) {
+    struct sockaddr_storage client_addr;
+    socklen_t client_len = sizeof(client_addr);
+    int sock = accept(server_sock, (struct sockaddr*)&client_addr, &client_len);
+    if (sock < 0) {
+        return -1;
+    }
+    // Keep socket non-blocking
+    int flags = fcntl(sock, F_GETFL, 0);
+    fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+    if (client_addr.ss_family == AF_INET) {
+        const struct sockaddr_in* in = (const struct sockaddr_in*)&client_addr;
+        *peer = std::string(inet_ntoa(in->sin_addr)) + ":" + std::to_string(ntohs(in->sin_port));
+        // Pipelined responses are small back-to-back writes: don't let Nagle
+        // hold them until the client's delayed ACK
+        int nodelay = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    } else {
+        *peer = "unix socket";
+    }
+    return sock;
+}
 
-                protocol_mode = PROTO_OPENOCD_VPI;
+void JtagVpiServer::accept_client() {
 
-                if (more_data_available) {
-                    // More data already buffered on the socket - treat as full OpenOCD packet
-                    DBG_PRINT(1, "[VPI][DBG] OpenOCD protocol detected (cmd=0x%02x), waiting for full packet\n", cmd_byte);
-                    memcpy(&vpi_cmd_rx, &minimal_cmd_rx, sizeof(minimal_cmd_rx));
-                    vpi_rx_bytes = sizeof(minimal_cmd_rx);
-                    minimal_rx_bytes = 0;
-                    memset(&minimal_cmd_rx, 0, sizeof(minimal_cmd_rx));
-                    vpi_minimal_mode = false;  // Expect 1036-byte packet
-                } else {
-                    // No extra data yet - stay in minimal (8-byte) mode for legacy/simple clients
-                    DBG_PRINT(1, "[VPI][DBG] Minimal 8-byte protocol detected (cmd=0x%02x)\n", cmd_byte);
-                    vpi_minimal_mode = true;
-                }
-            } else {
-                return;
-            }
-        } else {
+    accept_ready = false;
+    if (replay) {
+        if (client_sock < 0 && replay->next_session(sim_clock ? sim_clock() : 0)) {
+            begin_session(REPLAY_SOCK);
+            printf("[VPI] Replaying session %d\n", session_id);
+            fflush(stdout);
+        }
+        return;
+    }
+    if (io_threaded) {
+        // Adopt the socket the network thread accepted; it starts moving bytes
+        // once it sees IO_CONNECTED
+        if (io_state.load() != IO_PENDING) {
             return;
         }
+        io_rx.discard();
+        begin_session(io_client.load());
+        io_state = IO_CONNECTED;
+        io_kick();
+        return;
+    }
+    std::string peer;
+    int sock = accept_nonblocking(server_sock, &peer);
+    if (sock < 0) {
+        return;
+    }
+    if ((int)session_count() >= MAX_SESSIONS) {
+        printf("[VPI] Session limit (%d) reached, refusing %s\n", MAX_SESSIONS, peer.c_str());
+        fflush(stdout);
+        close(sock);
+        return;
+    }
+#ifdef __linux__
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = sock;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &ev);
+#endif
+
+    // A client arriving while another is active waits parked for its turn
+    if (client_sock >= 0) {
+        parked.emplace_back();
+        swap_session(parked.back());
+        begin_session(sock);
+        swap_session(parked.back());
+    } else {
+        begin_session(sock);
     }
+    printf("[VPI] Client connected from %s (session %d, %zu active)\n", peer.c_str(),
+           parked.empty() ? session_id : parked.back().session_id, session_count());
+    fflush(stdout);
+}
 
-    // After detection, continue with the detected protocol
-    // Handle OpenOCD VPI mode (continue if just detected)
-    if (protocol_mode == PROTO_OPENOCD_VPI) {
-        // OpenOCD mode can accept both:
-        // 1. Minimal 8-byte commands (cmd + pad + length)
-        // 2. Full 1036-byte packets with data buffers
+int JtagVpiServer::accept_for_fork(int timeout_ms, std::string* peer, int* session) {
+    struct pollfd pfd;
+    pfd.fd = server_sock;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (::poll(&pfd, 1, timeout_ms) <= 0) {
+        return -1;
+    }
+    int sock = accept_nonblocking(server_sock, peer);
+    if (sock >= 0) {
+        *session = next_session_id++;
+    }
+    return sock;
+}
 
-        // Minimal path: process immediately when flagged
-        if (vpi_minimal_mode) {
-            if (minimal_rx_bytes < sizeof(minimal_cmd_rx)) {
-                ssize_t ret = recv(client_sock, ((uint8_t*)&minimal_cmd_rx) + minimal_rx_bytes,
-                                   sizeof(minimal_cmd_rx) - minimal_rx_bytes, MSG_DONTWAIT);
-                if (ret < 0) {
-                    if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                        printf("[VPI] Connection error (minimal): %s\n", strerror(errno));
-                        close_connection();
-                    }
-                    return;
-                }
-                if (ret == 0) {
-                    printf("[VPI] Client disconnected (minimal)\n");
-                    close_connection();
-                    return;
-                }
-                minimal_rx_bytes += ret;
-            }
+// The listener and the epoll instance came from the parent, and an epoll set
+// is shared across fork(), so the child drops both and watches sock alone.
+// server_sock = -1 also keeps the child from unlinking the parent's socket path.
+bool JtagVpiServer::adopt_forked_client(int sock, int session, const std::string& peer) {
+    close(server_sock);
+    server_sock = -1;
+#ifdef __linux__
+    close(epoll_fd);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        printf("[VPI] Failed to create epoll instance: %s\n", strerror(errno));
+        close(sock);
+        return false;
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = sock;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &ev);
+#endif
+    next_session_id = session;
+    begin_session(sock);
+    printf("[VPI] Client connected from %s (session %d, pid %d)\n", peer.c_str(), session_id, (int)getpid());
+    fflush(stdout);
+    return true;
+}
 
-            if (minimal_rx_bytes < sizeof(minimal_cmd_rx)) {
-                return; // wait for complete minimal packet
-            }
+// Start a fresh session for sock in the per-session members
+void JtagVpiServer::begin_session(int sock) {
+    client_sock = sock;
+    session_id = next_session_id++;
+    session_stats = SessionStats();
+    session_stats.since = std::chrono::steady_clock::now();
+    turn_commands = 0;
+    rx_ready = false;
+    tx_ready = true;
+    tx_armed = false;
+    if (recorder) {
+        record_io(vpi_record::REC_OPEN, nullptr, 0);
+    }
+}
 
-            process_vpi_packet();
-            DBG_PRINT(2, "[VPI][DBG] Minimal packet processed, resetting rx buffer\n");
-            minimal_rx_bytes = 0;
-            memset(&minimal_cmd_rx, 0, sizeof(minimal_cmd_rx));
-            return;
-        }
+void JtagVpiServer::swap_session(Session& s) {
+    std::swap(session_id, s.session_id);
+    std::swap(client_sock, s.client_sock);
+    std::swap(rx_ready, s.rx_ready);
+    std::swap(tx_ready, s.tx_ready);
+    std::swap(tx_armed, s.tx_armed);
+    std::swap(tx_ring.buf, s.tx_ring.buf);
+    std::swap(tx_ring.head, s.tx_ring.head);
+    std::swap(tx_ring.tail, s.tx_ring.tail);
+    std::swap(protocol_mode, s.protocol_mode);
+    std::swap(cmd_buf, s.cmd_buf);
+    std::swap(cmd_bytes_received, s.cmd_bytes_received);
+    vpi_rx_ring.swap(s.vpi_rx_ring);
+    vpi_rx_payload.swap(s.vpi_rx_payload);
+    std::swap(vpi_rx_head, s.vpi_rx_head);
+    std::swap(vpi_rx_tail, s.vpi_rx_tail);
+    std::swap(vpi_rx_count, s.vpi_rx_count);
+    std::swap(vpi_rx_bytes, s.vpi_rx_bytes);
+    std::swap(vpi_rx_hold, s.vpi_rx_hold);
+    std::swap(vpi_batch_enabled, s.vpi_batch_enabled);
+    std::swap(vpi_minimal_mode, s.vpi_minimal_mode);
+    std::swap(minimal_cmd_rx, s.minimal_cmd_rx);
+    std::swap(minimal_rx_bytes, s.minimal_rx_bytes);
+    std::swap(vpi_rx_since, s.vpi_rx_since);
+    std::swap(cmd_rx_since, s.cmd_rx_since);
+    std::swap(session_stats, s.session_stats);
+    shm.swap(s.shm);
+}
 
-        // Read until we have at least 8 bytes (minimum OpenOCD command)
-        if (vpi_rx_bytes < 8) {
-            ssize_t ret = recv(client_sock, ((uint8_t*)&vpi_cmd_rx) + vpi_rx_bytes,
-                               8 - vpi_rx_bytes, MSG_DONTWAIT);
-            if (ret < 0) {
-                if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                    printf("[VPI] Connection error: %s\n", strerror(errno));
-                    close_connection();
-                }
-                return;
-            }
-            if (ret == 0) {
-                printf("[VPI] Client disconnected\n");
-                close_connection();
-                return;
-            }
-            vpi_rx_bytes += ret;
-            if (vpi_rx_bytes < 8) {
-                return; // wait for rest of minimal command
-            }
-        }
+// A parked session wants a turn: input waiting or queued, or unsent output
+// the socket can take
+bool JtagVpiServer::session_has_work(const Session& s) const {
+    return s.rx_ready || s.vpi_rx_count > 0 || shm_ready(s.shm.get()) || (s.tx_ring.used() > 0 && s.tx_ready);
+}
 
-        // We have at least 8 bytes - continue reading until we have full packet
-        // OpenOCD VPI packets are 1036 bytes, not 8 bytes
-        // DO NOT treat 8 bytes as complete - must read full packet
-        if (vpi_rx_bytes < VPI_PKT_SIZE) {
-            ssize_t ret = recv(client_sock, ((uint8_t*)&vpi_cmd_rx) + vpi_rx_bytes,
-                               VPI_PKT_SIZE - vpi_rx_bytes, MSG_DONTWAIT);
-            if (ret < 0) {
-                if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                    printf("[VPI] Connection error: %s\n", strerror(errno));
-                    close_connection();
-                }
-                return;
-            }
-            if (ret == 0) {
-                printf("[VPI] Client disconnected\n");
-                close_connection();
-                return;
-            }
-            vpi_rx_bytes += ret;
-            if (vpi_rx_bytes < VPI_PKT_SIZE) {
-                return; // wait for rest of packet
-            }
+bool JtagVpiServer::others_waiting() const {
+    for (const Session& sess : parked) {
+        if (session_has_work(sess)) {
+            return true;
         }
-
-        // Full packet received
-        DBG_PRINT(2, "[VPI][DBG] Full VPI packet received, processing...\n");
-        process_vpi_packet();
-        DBG_PRINT(2, "[VPI][DBG] Packet processed, resetting buffer\n");
-        vpi_rx_bytes = 0;
-        memset(&vpi_cmd_rx, 0, sizeof(vpi_cmd_rx));
-        return;
     }
+    return false;
+}
 
-    // Legacy protocol: Process new commands, handling partial reads of the 8-byte header
-    if (cmd_bytes_received < sizeof(vpi_cmd)) {
-        ssize_t ret = recv(client_sock, cmd_buf + cmd_bytes_received,
-                           sizeof(vpi_cmd) - cmd_bytes_received, MSG_DONTWAIT);
-        if (ret < 0) {
-            if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                printf("[VPI] Connection error: %s\n", strerror(errno));
-                close_connection();
-            }
+// Nothing of the active session's current command is still in flight on the
+// DUT; only its queued input and unsent output remain (both per-session)
+bool JtagVpiServer::at_command_boundary() const {
+    return scan_state == SCAN_IDLE && !tms_seq_active && sf0_state == SF0_IDLE &&
+           !vpi_tx_pending && tck_ops.empty();
+}
+
+// Pick the session that runs next. A closed active session is replaced right
+// away; otherwise the active one keeps the DUT until it has run a command (or
+// has nothing to do) and someone else is waiting, then goes to the back of
+// the line.
+void JtagVpiServer::schedule() {
+    if (client_sock >= 0) {
+        if (!at_command_boundary()) {
             return;
         }
-        if (ret == 0) {
-            printf("[VPI] Client disconnected\n");
-            close_connection();
+        bool idle = !rx_ready && vpi_rx_count == 0 && !shm_ready(shm.get()) && (tx_idle() || !tx_ready);
+        if (turn_commands == 0 && !idle) {
             return;
         }
-        cmd_bytes_received += ret;
-        if (cmd_bytes_received < sizeof(vpi_cmd)) {
-            // Wait for remaining bytes of the command
+        if (!others_waiting()) {
+            turn_commands = 0;
             return;
         }
     }
-
-    // We have a full command header buffered
-    vpi_cmd cmd;
-    memcpy(&cmd, cmd_buf, sizeof(cmd));
-    // Reset for next command header
-    cmd_bytes_received = 0;
-
-    // Process command
-    vpi_resp resp;
-    process_command(&cmd, &resp);
+    size_t next = 0;
+    for (size_t i = 0; i < parked.size(); i++) {
+        if (session_has_work(parked[i])) {
+            next = i;
+            break;
+        }
+    }
+    metrics_check();  // the active session is at a command boundary here
+    swap_session(parked[next]);
+    if (parked[next].client_sock < 0) {
+        parked.erase(parked.begin() + next);
+    } else {
+        std::rotate(parked.begin() + next, parked.begin() + next + 1, parked.end());
+    }
+    turn_commands = 0;
+    DBG_PRINT(2, "[VPI][DBG] Session %d active (%zu waiting)\n", session_id, parked.size());
 }
 
-static inline uint32_t le32_to_host(const uint8_t b[4]) {
-    return (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+// Enable/disable EPOLLOUT on the client socket (only while a backlog exists,
+// otherwise an idle writable socket would wake every wait)
+void JtagVpiServer::watch_writable(bool on) {
+    if (io_threaded || replay || tx_armed == on || client_sock < 0) {
+        return;
+    }
+    tx_armed = on;
+#ifdef __linux__
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | (on ? (uint32_t)EPOLLOUT : 0u);
+    ev.data.fd = client_sock;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client_sock, &ev);
+#endif
 }
 
-static inline void host_to_le32(uint8_t b[4], uint32_t v) {
-    b[0] = (uint8_t)(v & 0xFF);
-    b[1] = (uint8_t)((v >> 8) & 0xFF);
-    b[2] = (uint8_t)((v >> 16) & 0xFF);
-    b[3] = (uint8_t)((v >> 24) & 0xFF);
+// Receive from the client (or from the recording being replayed), recording
+// what arrived when --record is on
+ssize_t JtagVpiServer::sock_recv(void* buf, size_t len, int flags) {
+    bool peek = (flags & MSG_PEEK) != 0;
+    if (replay) {
+        bool drained;
+        ssize_t ret = replay->recv(buf, len, peek, sim_clock ? sim_clock() : 0, &drained);
+        if (ret > 0 && !peek) {
+            session_stats.rx_bytes += (uint64_t)ret;
+        }
+        if (drained) {
+            rx_ready = false;  // like a short read: wait_events() reports the next receive
+        }
+        return ret;
+    }
+    ssize_t ret = transport_recv(buf, len, flags);
+    if (recorder) {
+        if (peek) {
+            record_io(vpi_record::REC_PEEK, nullptr, ret > 0 ? (size_t)ret : 0);
+        } else if (ret >= 0) {
+            record_io(vpi_record::REC_RX, buf, (size_t)ret);
+        }
+    }
+    return ret;
 }
 
-static inline uint32_t be32_to_host(const uint8_t b[4]) {
-    // Minimal 8-byte protocol uses network order (big-endian) for length
-    return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | (uint32_t)b[3];
+// Non-blocking recv() gated on readiness: returns -1/EAGAIN without a syscall
+// when the last wait did not report the socket readable. A short read or
+// EAGAIN means the kernel buffer is drained, so readiness is cleared until the
+// next wait reports it again.
+ssize_t JtagVpiServer::transport_recv(void* buf, size_t len, int flags) {
+    if (io_threaded) {
+        // Same contract served from io_rx: EAGAIN while empty, 0 once the peer
+        // has closed and everything it sent has been consumed
+        bool eof = io_eof.load();
+        size_t avail = io_rx.readable();
+        if (avail == 0) {
+            if (eof) {
+                return 0;
+            }
+            rx_ready = false;
+            errno = EAGAIN;
+            return -1;
+        }
+        size_t n = io_rx.read((uint8_t*)buf, len, (flags & MSG_PEEK) != 0);
+        if (!(flags & MSG_PEEK)) {
+            session_stats.rx_bytes += n;
+            if (avail == io_rx.buf.size()) {
+                io_kick();  // the network thread stops reading while io_rx is full
+            }
+        }
+        return (ssize_t)n;
+    }
+    if (!rx_ready) {
+        errno = EAGAIN;
+        return -1;
+    }
+    ssize_t ret = recv(client_sock, buf, len, flags | MSG_DONTWAIT);
+    if (ret > 0 && !(flags & MSG_PEEK)) {
+        session_stats.rx_bytes += (uint64_t)ret;
+    }
+    if (ret < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            rx_ready = false;
+        }
+    } else if (!(flags & MSG_PEEK) && ret > 0 && (size_t)ret < len) {
+        rx_ready = false;
+    }
+    return ret;
 }
 
-// Send a minimal 4-byte response (for test_protocol compatibility)
-void JtagVpiServer::send_minimal_response(uint8_t response, uint8_t tdo_val, uint8_t mode, uint8_t status) {
-    MinimalVpiResp resp;
-    resp.response = response;
-    resp.tdo_val = tdo_val;
-    resp.mode = mode;
-    resp.status = status;
+void JtagVpiServer::TxRing::push(const uint8_t* p, size_t n) {
+    if (buf.size() - used() < n) {
+        // Grow to the next power of two that fits, unwrapping the pending bytes
+        size_t cap = buf.empty() ? TX_RING_SIZE : buf.size();
+        while (cap - used() < n) {
+            cap *= 2;
+        }
+        std::vector<uint8_t> grown(cap);
+        size_t pending = used();
+        for (size_t i = 0; i < pending; i++) {
+            grown[i] = buf[(head + i) & (buf.size() - 1)];
+        }
+        buf.swap(grown);
+        head = 0;
+        tail = pending;
+    }
+    size_t mask = buf.size() - 1;
+    while (n > 0) {
+        size_t off = tail & mask;
+        size_t chunk = buf.size() - off;
+        if (chunk > n) chunk = n;
+        memcpy(&buf[off], p, chunk);
+        tail += chunk;
+        p += chunk;
+        n -= chunk;
+    }
+}
 
-    // Send with non-blocking approach - avoid blocking/busy-wait that can cause timeouts
-    size_t sent_total = 0;
-    int retry_count = 0;
-    const int MAX_RETRIES = 1000;  // Prevent infinite busy-wait
+size_t JtagVpiServer::TxRing::span(const uint8_t** p) const {
+    if (used() == 0) {
+        return 0;
+    }
+    size_t off = head & (buf.size() - 1);
+    size_t len = buf.size() - off;
+    *p = &buf[off];
+    return (len < used()) ? len : used();
+}
 
-    DBG_PRINT(2, "[VPI][DBG] Sending minimal response: resp=0x%02x, tdo=0x%02x, mode=0x%02x, status=0x%02x\n",
-              response, tdo_val, mode, status);
+// Send bytes in stream order. Whatever the socket does not accept right away is
+// appended to the TX ring and flushed from poll() once EPOLLOUT fires.
+// Returns false if the connection was closed.
+bool JtagVpiServer::queue_tx(const void* data, size_t len) {
+    struct iovec iov = {const_cast<void*>(data), len};
+    return queue_txv(&iov, 1);
+}
+
+// Gathered queue_tx(): the segments leave in one sendmsg() and only the part
+// the socket refuses is copied (into the TX ring).
+bool JtagVpiServer::queue_txv(const struct iovec* iov, int cnt) {
+    size_t len = 0;
+    size_t sent = 0;
+
+    if (client_sock < 0) {
+        return false;
+    }
+    for (int i = 0; i < cnt; i++) {
+        len += iov[i].iov_len;
+    }
+    session_stats.tx_bytes += len;
+    bool unchecked = tx_unchecked;
+    tx_unchecked = false;
+    if (replay) {
+        replay->check(iov, cnt, session_id);
+        return true;
+    }
+    if (recorder) {
+        recorder->record_iov(unchecked ? vpi_record::REC_TX_UNCHECKED : vpi_record::REC_TX, session_id,
+                             sim_clock ? sim_clock() : 0, iov, cnt, len);
+    }
+    if (shm) {
+        shm_push_resp(iov, cnt);
+        return true;
+    }
+    if (io_threaded) {
+        if (tx_idle()) {
+            for (int i = 0; i < cnt; i++) {
+                size_t n = io_tx.write((const uint8_t*)iov[i].iov_base, iov[i].iov_len);
+                sent += n;
+                if (n < iov[i].iov_len) {
+                    break;
+                }
+            }
+            if (sent > 0) {
+                io_kick();
+            }
+            if (sent == len) {
+                return true;
+            }
+        }
+        DBG_PRINT(2, "[VPI][DBG] TX ring full, %zu bytes held back\n", len - sent);
+        responses_held++;
+        hold_tx(iov, cnt, sent);
+        tx_ready = false;
+        return true;
+    }
+    if (tx_idle() && tx_ready) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = const_cast<struct iovec*>(iov);
+        msg.msg_iovlen = cnt;
+        ssize_t n = sendmsg(client_sock, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                DBG_PRINT(1, "[VPI][WARN] Send error: errno=%d, %s, closing connection\n", errno, strerror(errno));
+                close_connection();
+                return false;
+            }
+            n = 0;
+        }
+        sent = (size_t)n;
+        if (sent == len) {
+            return true;
+        }
+        tx_ready = false;
+    }
 
-    while (sent_total < sizeof(resp) && retry_count < MAX_RETRIES) {
-        ssize_t sent = send(client_sock, ((uint8_t*)&resp) + sent_total,
-                           sizeof(resp) - sent_total, MSG_DONTWAIT);
-        if (sent > 0) {
-            sent_total += sent;
-            DBG_PRINT(2, "[VPI][DBG] Sent %zd bytes, total=%zu/%zu\n", sent, sent_total, sizeof(resp));
-        } else if (sent < 0) {
+    DBG_PRINT(2, "[VPI][DBG] Socket full, %zu bytes queued until writable\n", len - sent);
+    responses_held++;
+    hold_tx(iov, cnt, sent);
+    watch_writable(true);
+    return true;
+}
+
+// Append the segments to the TX ring, less the first `skip` bytes already sent
+void JtagVpiServer::hold_tx(const struct iovec* iov, int cnt, size_t skip) {
+    for (int i = 0; i < cnt; i++) {
+        if (skip >= iov[i].iov_len) {
+            skip -= iov[i].iov_len;
+            continue;
+        }
+        tx_ring.push((const uint8_t*)iov[i].iov_base + skip, iov[i].iov_len - skip);
+        skip = 0;
+    }
+}
+
+// Drain the TX ring while the socket stays writable. Returns false if the
+// connection was closed.
+bool JtagVpiServer::flush_tx() {
+    if (io_threaded) {
+        bool moved = false;
+        while (!tx_idle()) {
+            const uint8_t* p;
+            size_t len = tx_ring.span(&p);
+            size_t n = io_tx.write(p, len);
+            tx_ring.consume(n);
+            moved |= (n > 0);
+            if (n < len) {
+                tx_ready = false;
+                break;
+            }
+        }
+        if (moved) {
+            io_kick();
+        }
+        return true;
+    }
+    while (!tx_idle() && tx_ready) {
+        const uint8_t* p;
+        size_t len = tx_ring.span(&p);
+        ssize_t sent = send(client_sock, p, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                retry_count++;
-                if (retry_count >= MAX_RETRIES) {
-                    DBG_PRINT(1, "[VPI][WARN] Send timeout after %d retries, but keeping connection alive\n", MAX_RETRIES);
-                    return;  // Don't close connection on timeout
+                tx_ready = false;
+                break;
+            }
+            DBG_PRINT(1, "[VPI][WARN] Send error: errno=%d, %s, closing connection\n", errno, strerror(errno));
+            close_connection();
+            return false;
+        }
+        tx_ring.consume((size_t)sent);
+    }
+    if (tx_idle()) {
+        watch_writable(false);
+    }
+    return true;
+}
+
+size_t JtagVpiServer::SpscRing::write(const uint8_t* p, size_t n) {
+    size_t written = 0;
+    while (written < n) {
+        uint8_t* dst;
+        size_t room = write_span(&dst);
+        if (room == 0) {
+            break;
+        }
+        if (room > n - written) room = n - written;
+        memcpy(dst, p + written, room);
+        commit(room);
+        written += room;
+    }
+    return written;
+}
+
+size_t JtagVpiServer::SpscRing::write_span(uint8_t** p) const {
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t room = buf.size() - (t - head.load(std::memory_order_acquire));
+    size_t off = t & (buf.size() - 1);
+    size_t len = buf.size() - off;
+    *p = const_cast<uint8_t*>(&buf[off]);
+    return (len < room) ? len : room;
+}
+
+size_t JtagVpiServer::SpscRing::read(uint8_t* p, size_t n, bool peek) {
+    size_t h = head.load(std::memory_order_relaxed);
+    size_t avail = tail.load(std::memory_order_acquire) - h;
+    if (n > avail) n = avail;
+    size_t mask = buf.size() - 1;
+    size_t first = buf.size() - (h & mask);
+    if (first > n) first = n;
+    memcpy(p, &buf[h & mask], first);
+    memcpy(p + first, &buf[0], n - first);
+    if (!peek) {
+        head.store(h + n, std::memory_order_release);
+    }
+    return n;
+}
+
+size_t JtagVpiServer::SpscRing::read_span(const uint8_t** p) const {
+    size_t h = head.load(std::memory_order_relaxed);
+    size_t avail = tail.load(std::memory_order_acquire) - h;
+    size_t off = h & (buf.size() - 1);
+    size_t len = buf.size() - off;
+    *p = &buf[off];
+    return (len < avail) ? len : avail;
+}
+
+bool JtagVpiServer::start_io_thread() {
+    if (io_threaded) {
+        return true;
+    }
+    if (server_sock < 0 || client_sock >= 0) {
+        printf("[VPI] I/O thread must be started after init() and before a client connects\n");
+        return false;
+    }
+    if (pipe(io_wake) < 0) {
+        printf("[VPI] Failed to create I/O thread wake pipe: %s\n", strerror(errno));
+        return false;
+    }
+    for (int i = 0; i < 2; i++) {
+        int flags = fcntl(io_wake[i], F_GETFL, 0);
+        fcntl(io_wake[i], F_SETFL, flags | O_NONBLOCK);
+    }
+    io_rx.init(IO_RING_SIZE);
+    io_tx.init(IO_RING_SIZE);
+    io_threaded = true;
+    io_thread = std::thread(&JtagVpiServer::io_loop, this);
+    printf("[VPI] Socket I/O on a dedicated network thread\n");
+    return true;
+}
+
+// Sim thread: something was pushed to io_tx, io_rx was drained from full, or
+// the connection state changed. Costs a write() only while the network thread
+// sleeps in poll(); while it is busy-polling the rings this is a fence and a load.
+void JtagVpiServer::io_kick() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (io_sleeping.load()) {
+        char c = 1;
+        if (write(io_wake[1], &c, 1) < 0) {
+            // Pipe already full: a wakeup is pending anyway
+        }
+    }
+}
+
+// Network thread: io_rx got data, io_tx got room, or a client arrived/left
+void JtagVpiServer::sim_kick() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sim_sleeping.load()) {
+        std::lock_guard<std::mutex> lock(sim_wake_mutex);
+        sim_wake.notify_one();
+    }
+}
+
+// Sim thread: would wait_events() report anything right now?
+bool JtagVpiServer::io_events_pending() const {
+    if (client_sock < 0) {
+        return io_state.load() == IO_PENDING;
+    }
+    return io_eof.load() || io_rx.readable() > 0 || (!tx_idle() && io_tx.writable() > 0);
+}
+
+void JtagVpiServer::io_close_client() {
+    int fd = io_client.load();
+    if (fd < 0) {
+        return;
+    }
+    int socket_error = 0;
+    socklen_t len = sizeof(socket_error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &socket_error, &len) == 0 && socket_error != 0) {
+        DBG_PRINT(1, "[VPI][INFO] Socket error status: %s\n", strerror(socket_error));
+    }
+    close(fd);
+    io_client = -1;
+}
+
+// Network thread: owns server_sock and the client socket. Moves bytes between
+// the socket and the SPSC rings, busy-polling for IO_SPIN_US after the last
+// activity (a response usually follows a request within microseconds) and then
+// blocking in poll() on the sockets and the wake pipe.
+void JtagVpiServer::io_loop() {
+    auto last_activity = std::chrono::steady_clock::now();
+
+    while (!io_stop.load()) {
+        bool busy = false;
+        int state = io_state.load();
+        int fd = io_client.load();
+
+        if (state == IO_CLOSING) {
+            io_close_client();
+            io_tx.discard();
+            io_eof = false;
+            io_state = IO_LISTENING;
+            state = IO_LISTENING;
+            busy = true;
+        }
+
+        if (state == IO_LISTENING) {
+            std::string peer;
+            int sock = accept_nonblocking(server_sock, &peer);
+            if (sock >= 0) {
+                printf("[VPI] Client connected from %s\n", peer.c_str());
+                fflush(stdout);
+                io_client = sock;
+                io_state = IO_PENDING;
+                sim_kick();
+                busy = true;
+            }
+        } else if (state == IO_CONNECTED && !io_eof.load()) {
+            uint8_t* dst;
+            size_t room = io_rx.write_span(&dst);
+            if (room > 0) {
+                ssize_t n = recv(fd, dst, room, MSG_DONTWAIT);
+                if (n > 0) {
+                    io_rx.commit((size_t)n);
+                    busy = true;
+                } else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                    DBG_PRINT(1, "[VPI][INFO] Network thread: client %s\n", n == 0 ? "closed" : strerror(errno));
+                    io_eof = true;
+                    busy = true;
                 }
-                // Small delay to prevent busy-wait CPU consumption
-                usleep(100); // 100 microseconds
-            } else {
-                // Classify different error types
-                const char* error_type = "UNKNOWN";
-                bool should_close = true;
+            }
+            const uint8_t* src;
+            size_t len = io_tx.read_span(&src);
+            if (len > 0 && !io_eof.load()) {
+                ssize_t sent = send(fd, src, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+                if (sent > 0) {
+                    io_tx.consume((size_t)sent);
+                    busy = true;
+                } else if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    DBG_PRINT(1, "[VPI][WARN] Send error: errno=%d, %s, closing connection\n", errno, strerror(errno));
+                    io_eof = true;
+                    busy = true;
+                }
+            }
+            if (busy) {
+                sim_kick();
+            }
+        }
 
-                switch (errno) {
-                    case EPIPE:
-                        error_type = "BROKEN_PIPE";
-                        break;
-                    case ECONNRESET:
-                        error_type = "CONNECTION_RESET";
-                        break;
-                    case ENOTCONN:
-                        error_type = "NOT_CONNECTED";
-                        break;
-                    case EINTR:
-                        error_type = "INTERRUPTED";
-                        should_close = false;  // Recoverable
-                        break;
-                    default:
-                        error_type = "OTHER";
-                        should_close = (errno != EINTR);  // Be more tolerant
-                        break;
+        auto now = std::chrono::steady_clock::now();
+        if (busy) {
+            last_activity = now;
+            continue;
+        }
+        if (now - last_activity < std::chrono::microseconds(IO_SPIN_US)) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        // Going to sleep: publish io_sleeping before re-reading the state the
+        // sim thread may have changed, so either we see its update or it sees
+        // the flag and writes the wake pipe
+        io_sleeping = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        state = io_state.load();
+        fd = io_client.load();
+        struct pollfd fds[3];
+        int nfds = 0;
+        fds[nfds].fd = io_wake[0];
+        fds[nfds].events = POLLIN;
+        fds[nfds].revents = 0;
+        nfds++;
+        if (state == IO_LISTENING) {
+            fds[nfds].fd = server_sock;
+            fds[nfds].events = POLLIN;
+            fds[nfds].revents = 0;
+            nfds++;
+        } else if (state == IO_CONNECTED && !io_eof.load()) {
+            fds[nfds].fd = fd;
+            fds[nfds].events = (io_rx.writable() > 0 ? POLLIN : 0) | (io_tx.readable() > 0 ? POLLOUT : 0);
+            fds[nfds].revents = 0;
+            nfds++;
+        }
+        if (state != IO_CLOSING && !io_stop.load()) {
+            ::poll(fds, nfds, 100);
+        }
+        io_sleeping = false;
+        char drain[64];
+        while (read(io_wake[0], drain, sizeof(drain)) > 0) {
+        }
+        last_activity = std::chrono::steady_clock::now();
+    }
+}
+
+void JtagVpiServer::poll() {
+    // Check socket readiness once every poll_interval calls; in between, the
+    // state machines below only touch sockets that were reported ready.
+    if (--poll_countdown <= 0) {
+        poll_countdown = poll_interval;
+        wait_events(0);
+        if (!tx_idle() && !flush_tx()) {
+            return;
+        }
+    }
+    metrics_check();
+
+    // Accept new clients; with several connected, hand the DUT to the next
+    // session at a command boundary
+    if (accept_ready) {
+        accept_client();
+    }
+    if (!parked.empty()) {
+        schedule();
+    }
+    if (client_sock < 0) {
+        return;
+    }
+
+    // Continue any ongoing operations
+    // For OpenOCD VPI mode, always use continue_vpi_work() which handles scans
+    if (protocol_mode == PROTO_OPENOCD_VPI) {
+        continue_vpi_work();
+        return;
+    }
+
+    // For legacy protocol: check scan state and call continue_scan()
+    if (scan_state != SCAN_IDLE) {
+        continue_scan();
+        return;
+    }
+
+    // Auto-detect protocol if unknown: read some bytes and infer (use small buffer)
+    if (protocol_mode == PROTO_UNKNOWN) {
+        DBG_PRINT(2, "[VPI][DBG] Protocol detection: minimal_rx_bytes=%d\n", minimal_rx_bytes);
+        if (minimal_rx_bytes < sizeof(minimal_cmd_rx)) {
+            ssize_t ret = sock_recv(((uint8_t*)&minimal_cmd_rx) + minimal_rx_bytes,
+                                    sizeof(minimal_cmd_rx) - minimal_rx_bytes);
+            if (ret < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    printf("[VPI] Connection error during protocol detection: %s\n", strerror(errno));
+                    fflush(stdout);
+                    close_connection();
                 }
+                return;
+            }
+            if (ret == 0) {
+                printf("[VPI] Client disconnected during protocol detection\n");
+                fflush(stdout);
+                close_connection();
+                return;
+            }
+            if (minimal_rx_bytes == 0) {
+                cmd_rx_since = vpi_metrics::now_ns();
+            }
+            minimal_rx_bytes += ret;
+            DBG_PRINT(2, "[VPI][DBG] Received %zd bytes, total=%d\n", ret, minimal_rx_bytes);
+        }
 
-                DBG_PRINT(1, "[VPI][WARN] Send error (%s): errno=%d, %s%s\n",
-                          error_type, errno, strerror(errno), should_close ? ", closing connection" : ", retrying");
+        if (minimal_rx_bytes >= 1) {
+            uint8_t cmd_byte = minimal_cmd_rx.cmd;
+            DBG_PRINT(2, "[VPI][DBG] Protocol detection: cmd_byte=0x%02x, bytes=%d\n", cmd_byte, minimal_rx_bytes);
 
-                if (should_close) {
+            if (minimal_rx_bytes >= sizeof(minimal_cmd_rx)) {
+                // Have at least 8 bytes - decide between minimal 8-byte flow vs full 1036-byte OpenOCD packet
+                uint8_t peek_buf[16];
+                ssize_t peek_ret = sock_recv(peek_buf, sizeof(peek_buf), MSG_PEEK);
+                bool more_data_available = (peek_ret > 0);
+
+                protocol_mode = PROTO_OPENOCD_VPI;
+
+                if (more_data_available) {
+                    // More data already buffered on the socket - treat as full OpenOCD packet
+                    DBG_PRINT(1, "[VPI][DBG] OpenOCD protocol detected (cmd=0x%02x), waiting for full packet\n", cmd_byte);
+                    memcpy(&vpi_rx_ring[vpi_rx_tail], &minimal_cmd_rx, sizeof(minimal_cmd_rx));
+                    vpi_rx_since[vpi_rx_tail] = cmd_rx_since;
+                    vpi_rx_bytes = sizeof(minimal_cmd_rx);
+                    minimal_rx_bytes = 0;
+                    memset(&minimal_cmd_rx, 0, sizeof(minimal_cmd_rx));
+                    vpi_minimal_mode = false;  // Expect 1036-byte packet
+                } else {
+                    // No extra data yet - stay in minimal (8-byte) mode for legacy/simple clients
+                    DBG_PRINT(1, "[VPI][DBG] Minimal 8-byte protocol detected (cmd=0x%02x)\n", cmd_byte);
+                    vpi_minimal_mode = true;
+                }
+            } else {
+                return;
+            }
+        } else {
+            return;
+        }
+    }
+
+    // After detection, continue with the detected protocol
+    // Handle OpenOCD VPI mode (continue if just detected)
+    if (protocol_mode == PROTO_OPENOCD_VPI) {
+        // OpenOCD mode can accept both:
+        // 1. Minimal 8-byte commands (cmd + pad + length)
+        // 2. Full 1036-byte packets with data buffers
+
+        // Minimal path: process immediately when flagged
+        if (vpi_minimal_mode) {
+            if (turn_over()) {
+                return;
+            }
+            if (minimal_rx_bytes < sizeof(minimal_cmd_rx)) {
+                ssize_t ret = sock_recv(((uint8_t*)&minimal_cmd_rx) + minimal_rx_bytes,
+                                        sizeof(minimal_cmd_rx) - minimal_rx_bytes);
+                if (ret < 0) {
+                    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                        printf("[VPI] Connection error (minimal): %s\n", strerror(errno));
+                        close_connection();
+                    }
+                    return;
+                }
+                if (ret == 0) {
+                    printf("[VPI] Client disconnected (minimal)\n");
                     close_connection();
                     return;
-                } else {
-                    retry_count++;
-                    usleep(1000); // 1ms delay for recoverable errors
                 }
+                if (minimal_rx_bytes == 0) {
+                    cmd_rx_since = vpi_metrics::now_ns();
+                }
+                minimal_rx_bytes += ret;
             }
+
+            if (minimal_rx_bytes < sizeof(minimal_cmd_rx)) {
+                return; // wait for complete minimal packet
+            }
+
+            process_vpi_packet();
+            DBG_PRINT(2, "[VPI][DBG] Minimal packet processed, resetting rx buffer\n");
+            minimal_rx_bytes = 0;
+            memset(&minimal_cmd_rx, 0, sizeof(minimal_cmd_rx));
+            return;
+        }
+
+        // Full 1036-byte packets: received ahead into the RX ring and executed in order
+        continue_vpi_work();
+        return;
+    }
+
+    // Legacy protocol: Process new commands, handling partial reads of the 8-byte header
+    if (turn_over()) {
+        return;
+    }
+    if (cmd_bytes_received < sizeof(vpi_cmd)) {
+        ssize_t ret = sock_recv(cmd_buf + cmd_bytes_received,
+                                sizeof(vpi_cmd) - cmd_bytes_received);
+        if (ret < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                printf("[VPI] Connection error: %s\n", strerror(errno));
+                close_connection();
+            }
+            return;
+        }
+        if (ret == 0) {
+            printf("[VPI] Client disconnected\n");
+            close_connection();
+            return;
+        }
+        if (cmd_bytes_received == 0) {
+            cmd_rx_since = vpi_metrics::now_ns();
+        }
+        cmd_bytes_received += ret;
+        if (cmd_bytes_received < sizeof(vpi_cmd)) {
+            // Wait for remaining bytes of the command
+            return;
         }
     }
 
-    if (sent_total < sizeof(resp)) {
-        DBG_PRINT(1, "[VPI][WARN] Incomplete send: %zu/%zu bytes sent, but keeping connection alive\n", sent_total, sizeof(resp));
-        // Don't close connection for incomplete sends - may be recoverable
-    } else {
-        DBG_PRINT(2, "[VPI][DBG] Minimal response sent successfully\n");
-        vpi_minimal_mode = true;
+    // We have a full command header buffered
+    vpi_cmd cmd;
+    memcpy(&cmd, cmd_buf, sizeof(cmd));
+    // Reset for next command header
+    cmd_bytes_received = 0;
+
+    // Process command
+    vpi_resp resp;
+    process_command(&cmd, &resp);
+}
+
+static inline uint32_t le32_to_host(const uint8_t b[4]) {
+    return (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static inline void host_to_le32(uint8_t b[4], uint32_t v) {
+    b[0] = (uint8_t)(v & 0xFF);
+    b[1] = (uint8_t)((v >> 8) & 0xFF);
+    b[2] = (uint8_t)((v >> 16) & 0xFF);
+    b[3] = (uint8_t)((v >> 24) & 0xFF);
+}
+
+static inline uint32_t be32_to_host(const uint8_t b[4]) {
+    // Minimal 8-byte protocol uses network order (big-endian) for length
+    return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | (uint32_t)b[3];
+}
+
+// Capability query (see process_vpi_packet, CMD_TMS_SEQ)
+static const char VPI_CAPS_MAGIC[] = "JVPI_CAPS";
+static const uint32_t VPI_CAPS_VERSION = 1;
+static const uint32_t VPI_CAP_SCAN_STREAM = 1u << 0;  // CMD_SCAN_STREAM / _FLIP_TMS (6, 7)
+static const uint32_t VPI_CAP_BATCH = 1u << 1;        // CMD_BATCH (8)
+static const uint32_t VPI_CAP_OSCAN1_BULK = 1u << 2;  // CMD_OSCAN1_BULK (9)
+static const uint32_t VPI_CAP_CJTAG_ENCODE = 1u << 3; // RESET/TMS_SEQ/SCAN* sent as SF0 in cJTAG mode
+static const uint32_t VPI_CAP_DMI = 1u << 4;          // CMD_DMI (10), only with a DMI executor
+static const uint32_t VPI_CAP_TAP = 1u << 5;          // CMD_TAP_GOTO, CMD_SCAN_IR/DR (11-13)
+static const uint32_t VPI_CAP_DMI_POLL = 1u << 6;     // CMD_DMI_POLL (14)
+static const uint32_t VPI_CAP_SBA = 1u << 7;          // CMD_SBA_READ/WRITE (15, 16), with a DM executor or DTM select
+static const uint32_t VPI_CAP_STATS = 1u << 8;        // CMD_STATS (17)
+
+// Send a minimal 4-byte response (for test_protocol compatibility)
+void JtagVpiServer::send_minimal_response(uint8_t response, uint8_t tdo_val, uint8_t mode, uint8_t status) {
+    MinimalVpiResp resp;
+    resp.response = response;
+    resp.tdo_val = tdo_val;
+    resp.mode = mode;
+    resp.status = status;
+
+    DBG_PRINT(2, "[VPI][DBG] Sending minimal response: resp=0x%02x, tdo=0x%02x, mode=0x%02x, status=0x%02x\n",
+              response, tdo_val, mode, status);
+
+    // Bytes the socket cannot take now are flushed on EPOLLOUT, in order
+    if (queue_tx(&resp, sizeof(resp))) {
+        vpi_minimal_mode = true;
+    }
+}
+
+// buffer_out and the unused tail of buffer_in in every response
+static const uint8_t vpi_zero_page[512] = {};
+
+// Start the response to the command being executed: header and trailer, plus
+// the first in_bytes of buffer_in cleared for the handler to fill. Nothing
+// else of vpi_cmd_tx is touched (see response_iov).
+void JtagVpiServer::begin_response(uint32_t cmd, uint32_t length, uint32_t nb_bits, uint32_t in_bytes) {
+    if (in_bytes > sizeof(vpi_cmd_tx.buffer_in)) {
+        in_bytes = sizeof(vpi_cmd_tx.buffer_in);
+    }
+    host_to_le32(vpi_cmd_tx.cmd_buf, cmd);
+    host_to_le32(vpi_cmd_tx.length_buf, length);
+    host_to_le32(vpi_cmd_tx.nb_bits_buf, nb_bits);
+    memset(vpi_cmd_tx.buffer_in, 0, in_bytes);
+    vpi_tx_in = vpi_cmd_tx.buffer_in;
+    vpi_tx_in_bytes = in_bytes;
+}
+
+// The 1036-byte response as segments: cmd, zeroed buffer_out, the populated
+// part of buffer_in, its zeroed remainder, then length and nb_bits.
+int JtagVpiServer::response_iov(struct iovec* iov) const {
+    static_assert(offsetof(OcdVpiCmd, nb_bits_buf) == offsetof(OcdVpiCmd, length_buf) + 4,
+                  "length and nb_bits must be adjacent");
+    static_assert(sizeof(vpi_zero_page) >= sizeof(OcdVpiCmd::buffer_out), "zero page too small");
+    int n = 0;
+    iov[n++] = {const_cast<uint8_t*>(vpi_cmd_tx.cmd_buf), sizeof(vpi_cmd_tx.cmd_buf)};
+    iov[n++] = {const_cast<uint8_t*>(vpi_zero_page), sizeof(vpi_cmd_tx.buffer_out)};
+    if (vpi_tx_in_bytes > 0) {
+        iov[n++] = {const_cast<uint8_t*>(vpi_tx_in), vpi_tx_in_bytes};
+    }
+    if (vpi_tx_in_bytes < sizeof(vpi_cmd_tx.buffer_in)) {
+        iov[n++] = {const_cast<uint8_t*>(vpi_zero_page), sizeof(vpi_cmd_tx.buffer_in) - vpi_tx_in_bytes};
     }
+    iov[n++] = {const_cast<uint8_t*>(vpi_cmd_tx.length_buf), 8};
+    return n;
 }
 
 // Handle a full OpenOCD VPI packet
 void JtagVpiServer::process_vpi_packet() {
     uint32_t cmd, length, nb_bits;
 
+    turn_commands++;
+    session_stats.commands++;
+
     // In minimal mode, parse the 8-byte MinimalVpiCmd structure
     if (vpi_minimal_mode) {
         // MinimalVpiCmd: cmd(1) + pad(3) + length(4) = 8 bytes
@@ -443,245 +1352,867 @@ void JtagVpiServer::process_vpi_packet() {
         if (minimal_rx_bytes >= sizeof(MinimalVpiCmd)) {
             memcpy(&min_cmd, &minimal_cmd_rx, sizeof(MinimalVpiCmd));
         } else {
-            memcpy(&min_cmd, &vpi_cmd_rx, sizeof(MinimalVpiCmd));
+            memcpy(&min_cmd, vpi_rx_pkt, sizeof(MinimalVpiCmd));
         }
         cmd = min_cmd.cmd;
 
         // Minimal protocol should be network-order, but some clients may send host-order.
         uint32_t len_be = be32_to_host(reinterpret_cast<uint8_t*>(&min_cmd.length));
         uint32_t len_le = le32_to_host(reinterpret_cast<uint8_t*>(&min_cmd.length));
-        length = (len_be <= 4096) ? len_be : len_le;
+        // Streaming scans have no length limit, so always take network order there
+        length = (len_be <= 4096 || cmd == 6 || cmd == 7) ? len_be : len_le;
         nb_bits = length;  // In minimal mode, length==nb_bits
         DBG_PRINT(2, "[VPI][DBG] Minimal mode parse: cmd=%u, length_be=%u, length_le=%u, chosen=%u, nb_bits=%u\n",
                   cmd, len_be, len_le, length, nb_bits);
     } else {
         // Full OpenOCD mode: parse the full 1036-byte OcdVpiCmd structure
-        cmd = le32_to_host(vpi_cmd_rx.cmd_buf);
-        length = le32_to_host(vpi_cmd_rx.length_buf);
-        nb_bits = le32_to_host(vpi_cmd_rx.nb_bits_buf);
+        cmd = le32_to_host(vpi_rx_pkt->cmd_buf);
+        length = le32_to_host(vpi_rx_pkt->length_buf);
+        nb_bits = le32_to_host(vpi_rx_pkt->nb_bits_buf);
+    }
+
+    DBG_PRINT(1, "[VPI][DBG] process_vpi_packet: cmd=%u, length=%u, nb_bits=%u\n", cmd, length, nb_bits);
+
+    uint8_t cls = CLASS_OTHER;
+    uint64_t bits = 0;
+    switch (cmd) {
+        case 0: cls = CLASS_RESET; break;
+        case 1: cls = CLASS_TMS_SEQ; break;
+        case 2: cls = CLASS_SCAN; bits = nb_bits; break;
+        case 3: cls = vpi_minimal_mode ? CLASS_OTHER : CLASS_SCAN; bits = nb_bits; break;  // SET_PORT in minimal mode
+        case 5: cls = CLASS_OSCAN1; bits = 1; break;
+        case 6:
+        case 7: cls = CLASS_STREAM; bits = nb_bits; break;
+        case CMD_BATCH: cls = CLASS_BATCH; break;  // scan bits added by start_batch()
+        case CMD_OSCAN1_BULK: cls = CLASS_OSCAN1; bits = nb_bits; break;
+        case CMD_TAP_GOTO: cls = CLASS_TAP; break;
+        case CMD_SCAN_IR:
+        case CMD_SCAN_DR: cls = CLASS_TAP; bits = nb_bits; break;
+        case CMD_DMI:
+        case CMD_DMI_POLL: cls = CLASS_DMI; break;
+        case CMD_SBA_READ:
+        case CMD_SBA_WRITE: cls = CLASS_SBA; break;
+        default: break;
+    }
+    metrics_begin(cls, bits, cmd, nb_bits);
+
+    switch (cmd) {
+        case 0: { // CMD_RESET
+            if (!execute_reset()) {
+                tck_ops.push_pulses(1, 0, RESET_TCK_PULSES);
+            }
+
+            // Send immediate response for minimal mode
+            if (vpi_minimal_mode) {
+                send_minimal_response(0x00, 0, current_mode, 0);
+                // Clear any pending operations so next command can proceed cleanly
+                tck_ops.clear();
+                signal_mode = pending_mode_select;
+            } else {
+                // Full OpenOCD mode - send empty response packet
+                begin_response(cmd, 0, 0, 0);
+                vpi_tx_pending = true;
+                tap_state = TAP_RESET;  // where any queued reset pulses end up
+            }
+            break;
+        }
+        case 1: { // CMD_TMS_SEQ
+            // Minimal mode: ACK, then the client streams `length` bytes of TMS.
+            // Reuse the scan engine with TDI held low and no TDO returned.
+            if (vpi_minimal_mode) {
+                send_minimal_response(0x00, current_tdo, current_mode, 0);
+                if (length == 0 || length > sizeof(scan_tms_buf)) {
+                    break;
+                }
+                scan_num_bits = length * 8;
+                scan_num_bytes = length;
+                scan_bit_index = 0;
+                scan_bytes_received = 0;
+                scan_bytes_sent = 0;
+                scan_is_legacy = true;
+                scan_tms_only = true;
+                memset(scan_tdi_buf, 0, scan_num_bytes);  // TMS is received in full
+                memset(scan_tdo_buf, 0, scan_num_bytes);
+                scan_state = SCAN_RECEIVING_TMS;
+                break;
+            }
+
+            // Shared-memory handshake, shaped like the capability query below. The
+            // accepted reply goes out with the descriptors attached; a declined
+            // one is the zeroed packet any other server would send.
+            if (nb_bits == 0 && memcmp(vpi_rx_pkt->buffer_out, JVPI_SHM_MAGIC, sizeof(JVPI_SHM_MAGIC)) == 0) {
+                cmd_sample.cls = CLASS_OTHER;
+                if (!start_shm()) {
+                    begin_response(cmd, 0, 0, 0);
+                    vpi_tx_pending = true;
+                    DBG_PRINT(1, "[VPI][DBG] Shared-memory transport declined\n");
+                }
+                break;
+            }
+
+            // Capability query: zero-length TMS sequence carrying VPI_CAPS_MAGIC.
+            // Answered in buffer_in; servers without extensions return it zeroed.
+            // Streams and batches need the socket, so shm sessions don't get them.
+            if (nb_bits == 0 && memcmp(vpi_rx_pkt->buffer_out, VPI_CAPS_MAGIC, sizeof(VPI_CAPS_MAGIC)) == 0) {
+                cmd_sample.cls = CLASS_OTHER;
+                begin_response(cmd, 0, 0, 28);
+                memcpy(vpi_cmd_tx.buffer_in, VPI_CAPS_MAGIC, sizeof(VPI_CAPS_MAGIC));
+                host_to_le32(vpi_cmd_tx.buffer_in + 12, VPI_CAPS_VERSION);
+                host_to_le32(vpi_cmd_tx.buffer_in + 16, (shm ? 0 : VPI_CAP_SCAN_STREAM | VPI_CAP_BATCH) |
+                                                        VPI_CAP_OSCAN1_BULK | VPI_CAP_CJTAG_ENCODE | VPI_CAP_TAP | VPI_CAP_STATS |
+                                                        VPI_CAP_DMI_POLL | (dmi_driver ? VPI_CAP_DMI : 0) |
+                                                        (dm_driver || dtm_target_select ? VPI_CAP_SBA : 0));
+                host_to_le32(vpi_cmd_tx.buffer_in + 20, shm ? 0 : BATCH_MAX_BYTES);
+                host_to_le32(vpi_cmd_tx.buffer_in + 24, pending_mode_select);
+                vpi_tx_pending = true;
+                vpi_batch_enabled = !shm;
+                tx_unchecked = (shm != nullptr);  // a replay declines shm and offers the socket extensions
+                DBG_PRINT(1, "[VPI][DBG] Capability query answered, CMD_BATCH enabled\n");
+                break;
+            }
+
+            // Copy TMS bits and start sequence
+            tms_seq_active = true;
+            tms_seq_num_bits = nb_bits;
+            tms_seq_bit_index = 0;
+            uint32_t nb_bytes = (nb_bits + 7) / 8;
+            if (nb_bytes > sizeof(tms_seq_buf)) nb_bytes = sizeof(tms_seq_buf);
+            memcpy(tms_seq_buf, vpi_rx_pkt->buffer_out, nb_bytes);
+
+            // Send response packet
+            if (!vpi_minimal_mode) {
+                begin_response(cmd, 0, 0, 0);
+                vpi_tx_pending = true;
+            }
+            break;
+        }
+        case 2: // CMD_SCAN_CHAIN
+        case 3: { // CMD_SCAN_CHAIN_FLIP_TMS (or CMD_SET_PORT in minimal mode)
+            // In minimal mode, cmd=0x03 is CMD_SET_PORT (mode query), not SCAN_CHAIN_FLIP_TMS
+            if (vpi_minimal_mode && cmd == 3) {
+                // Mode query - just return current mode
+                send_minimal_response(0x00, current_tdo, current_mode, 0);
+                break;
+            }
+
+            // In minimal mode, use legacy-style protocol (send response, then TMS/TDI/TDO exchange)
+            if (vpi_minimal_mode) {
+                // Send immediate response
+                send_minimal_response(0x00, current_tdo, current_mode, 0);
+                // Enter legacy scan state machine
+                if (nb_bits == 0 || nb_bits > 4096) {
+                    break;
+                }
+                scan_num_bits = nb_bits;
+                scan_num_bytes = (nb_bits + 7) / 8;
+                scan_bit_index = 0;
+                scan_bytes_received = 0;
+                scan_bytes_sent = 0;
+                scan_is_legacy = true;  // TDO bytes go straight back, no 1036-byte packet
+                scan_tms_only = false;
+                memset(scan_tdo_buf, 0, scan_num_bytes);  // TMS and TDI are received in full
+                scan_state = SCAN_RECEIVING_TMS;
+                break;
+            }
+
+            // Full OpenOCD VPI mode: Initialize scan using RX data; reuse legacy scan state machine
+            DBG_PRINT(1, "[VPI][DBG] SCAN command: nb_bits=%u, cmd=%u (flip_tms=%d)\n", nb_bits, cmd, (cmd == 3));
+            if (nb_bits > 8 * sizeof(scan_tdi_buf)) {
+                DBG_PRINT(1, "[VPI][WARN] SCAN: %u bits do not fit one packet\n", nb_bits);
+                begin_response(cmd, 0, 0, 0);
+                vpi_tx_pending = true;
+                break;
+            }
+            scan_num_bits = nb_bits;
+            scan_num_bytes = (nb_bits + 7) / 8;
+            scan_bit_index = 0;
+            scan_bytes_received = scan_num_bytes; // mark buffers as ready
+            scan_bytes_sent = 0;
+            scan_is_legacy = false;  // OpenOCD mode - don't send TDO bytes directly
+            scan_tms_only = false;
+            scan_tdo_bits = 0;
+            memset(scan_tdo_buf, 0, scan_num_bytes);
+            // For OpenOCD, TMS is 0 for all bits, except last bit when cmd==3
+            memset(scan_tms_buf, 0x00, scan_num_bytes);
+            if (cmd == 3 && nb_bits > 0) {
+                uint32_t last = nb_bits - 1;
+                scan_tms_buf[last / 8] |= (1u << (last % 8));
+            }
+            memcpy(scan_tdi_buf, vpi_rx_pkt->buffer_out, scan_num_bytes);
+            // Debug TDI for small scans (likely IR)
+            if (scan_num_bytes <= 4) {
+                DBG_PRINT(1, "[VPI][DBG] SCAN TDI: ");
+                for (uint32_t i = 0; i < scan_num_bytes; i++) {
+                    DBG_PRINT(1, "0x%02x ", scan_tdi_buf[i]);
+                }
+                DBG_PRINT(1, "\n");
+            }
+            // The engine shifts LSB-first; TMS above is already in that order
+            if (msb_first) {
+                jtag_bits::reverse_bytes(scan_tdi_buf, scan_num_bytes);
+            }
+            // Enter processing state (legacy engine)
+            DBG_PRINT(2, "[VPI][DBG] Entering SCAN_PROCESSING state\n");
+            scan_state = SCAN_PROCESSING;
+            // Prepare TX packet header; the TDO is attached when the scan completes
+            begin_response(cmd, scan_num_bytes, nb_bits, 0);
+            vpi_tx_pending = false;
+            break;
+        }
+        case 6:   // CMD_SCAN_STREAM
+        case 7: { // CMD_SCAN_STREAM_FLIP_TMS
+            if (vpi_minimal_mode) {
+                // Minimal framing: ACK, then (TMS, TDI) byte pairs in and TDO bytes out
+                send_minimal_response(0x00, current_tdo, current_mode, 0);
+                start_stream(nb_bits, true, false);
+                break;
+            }
+            // Extended OpenOCD command: nb_bits of TDI follow the header as raw bytes,
+            // TMS is low except on the final bit for cmd 7. TDO comes back as raw
+            // bytes, chunk by chunk; there is no 1036-byte response packet.
+            start_stream(nb_bits, false, cmd == 7);
+            break;
+        }
+        case CMD_BATCH: {
+            // Only reaches here as a variable-length frame (see receive_ahead)
+            if (vpi_minimal_mode || !vpi_batch_enabled) {
+                break;
+            }
+            if (!start_batch()) {
+                printf("[VPI] Malformed CMD_BATCH op list (%zu bytes), closing connection\n", batch_ops.size());
+                close_connection();
+            }
+            break;
+        }
+        case 4: { // CMD_STOP_SIMU
+            // Optionally close connection
+            close_connection();
+            break;
+        }
+        case 5:                  // CMD_OSCAN1 - one two-wire cJTAG/OScan1 SF0 cycle
+        case CMD_OSCAN1_BULK: {  // up to SF0_BULK_MAX SF0 cycles in one packet
+            // OScan1 SF0 protocol:
+            // - Sends TMS on TCKC rising edge (pair bit 1 = TMS)
+            // - Sends TDI on TCKC falling edge (pair bit 0 = TDI)
+            // - Returns captured TDO on TMSC (response.buffer_in bit k = TDO of pair k)
+            // CMD_OSCAN1 carries one pair in buffer_out[0]; CMD_OSCAN1_BULK carries
+            // nb_bits pairs packed two bits each, LSB first.
+            uint32_t pairs = (cmd == 5) ? 1 : nb_bits;
+
+            if (pairs == 0 || pairs > SF0_BULK_MAX) {
+                DBG_PRINT(1, "[VPI][WARN] CMD_OSCAN1_BULK: bad pair count %u (max %u)\n", pairs, SF0_BULK_MAX);
+                begin_response(cmd, 0, 0, 0);
+                vpi_tx_pending = true;
+                break;
+            }
+
+            // Prepare response packet - filled with TDO as the pairs complete
+            begin_response(cmd, (cmd == 5) ? 1 : (pairs + 7) / 8, (cmd == 5) ? 2 : pairs, (pairs + 7) / 8);
+
+            // Switch to cJTAG two-wire mode. The client encodes OScan1 itself, so
+            // take its own OAC/JScan sequence as having brought the adapter up.
+            // Its SF0 cycles are not tracked: the TAP state is unknown afterwards.
+            if (pending_mode_select != 1) {
+                tck_ops.push({TCK_OP_MODE, 1, 0, 0, 0});
+                pending_mode_select = 1;
+            }
+            oscan1_online = true;
+            tap_state = TAP_UNKNOWN;
+
+            tck_cycles += pairs;  // one TCKC cycle per SF0 pair, not seen by tap_step()
+            memcpy(sf0_pairs, vpi_rx_pkt->buffer_out, (2 * pairs + 7) / 8);
+            sf0_num_pairs = pairs;
+            sf0_index = 0;
+            DBG_PRINT(1, "[VPI] CMD_OSCAN1%s: %u SF0 pair(s), buffer_out[0]=0x%02x, current_tdo=%d\n",
+                      (cmd == 5) ? "" : "_BULK", pairs, vpi_rx_pkt->buffer_out[0], current_tdo);
+
+            // Response is queued once every pair has completed
+            vpi_tx_pending = false;
+            if (sf0_executor_ready()) {
+                execute_sf0();
+            } else {
+                start_sf0_pair();
+            }
+            break;
+        }
+        case CMD_TAP_GOTO: {
+            // Synthesize the TMS path and run it like a TMS_SEQ
+            if (vpi_minimal_mode) {
+                break;
+            }
+            uint8_t target = vpi_rx_pkt->buffer_out[0];
+            begin_response(cmd, 0, 0, 2);
+            vpi_tx_pending = true;
+            if (target >= TAP_NUM_STATES) {
+                DBG_PRINT(1, "[VPI][WARN] CMD_TAP_GOTO: bad state %u\n", target);
+                vpi_cmd_tx.buffer_in[0] = TAP_UNKNOWN;
+                break;
+            }
+            memset(tms_seq_buf, 0, TAP_PATH_MAX / 8);
+            uint32_t bits = tap_path(tap_state, target, tms_seq_buf);
+            DBG_PRINT(1, "[VPI][DBG] CMD_TAP_GOTO: %u -> %u in %u TCK\n", tap_state, target, bits);
+            tms_seq_active = bits > 0;
+            tms_seq_num_bits = bits;
+            tms_seq_bit_index = 0;
+            vpi_cmd_tx.buffer_in[0] = target;
+            vpi_cmd_tx.buffer_in[1] = (uint8_t)bits;
+            break;
+        }
+        case CMD_SCAN_IR:
+        case CMD_SCAN_DR: {
+            // A whole IR or DR access as one scan through the scan engine: the TMS
+            // path to Capture-IR/-DR, one clock into Shift, the data (TMS high on
+            // its last bit, to Exit1), then TMS 1, 0 through Update to
+            // Run-Test/Idle and `length` idle clocks. TDO is sampled after each
+            // clock, so the data's TDO starts with the clock that leaves Capture
+            // and TDI one clock later; only those nb_bits of TDO are returned.
+            if (vpi_minimal_mode) {
+                break;
+            }
+            uint8_t path[TAP_PATH_MAX / 8] = {};
+            uint32_t pre = tap_path(tap_state, (cmd == CMD_SCAN_IR) ? TAP_IR_CAPTURE : TAP_DR_CAPTURE, path);
+            // Bound each term before adding so the sum cannot wrap
+            if (nb_bits == 0 || nb_bits > 8 * sizeof(scan_tdi_buf) || length > 8 * sizeof(scan_tms_buf) ||
+                pre + nb_bits + 3 + length > 8 * sizeof(scan_tms_buf)) {
+                DBG_PRINT(1, "[VPI][WARN] CMD_SCAN_%s: bad bit count %u\n", (cmd == CMD_SCAN_IR) ? "IR" : "DR", nb_bits);
+                begin_response(cmd, 0, 0, 0);
+                vpi_tx_pending = true;
+                break;
+            }
+            uint32_t total = pre + nb_bits + 3 + length;
+            uint32_t data_bytes = (nb_bits + 7) / 8;
+            scan_num_bits = total;
+            scan_num_bytes = (total + 7) / 8;
+            scan_bit_index = 0;
+            scan_bytes_received = scan_num_bytes;
+            scan_bytes_sent = 0;
+            scan_is_legacy = false;
+            scan_tms_only = false;
+            scan_tdo_skip = pre;
+            scan_tdo_bits = nb_bits;
+            memset(scan_tms_buf, 0, scan_num_bytes);
+            memset(scan_tdi_buf, 0, scan_num_bytes);
+            memset(scan_tdo_buf, 0, scan_num_bytes);
+            jtag_bits::copy_bits(scan_tms_buf, 0, path, 0, pre);
+            uint32_t last = pre + nb_bits;  // last Shift clock
+            scan_tms_buf[last >> 3] |= (uint8_t)(1u << (last & 7));
+            scan_tms_buf[(last + 1) >> 3] |= (uint8_t)(1u << ((last + 1) & 7));
+            uint8_t tdi[sizeof(scan_tdi_buf)];
+            memcpy(tdi, vpi_rx_pkt->buffer_out, data_bytes);
+            if (msb_first) {
+                jtag_bits::reverse_bytes(tdi, data_bytes);
+            }
+            jtag_bits::copy_bits(scan_tdi_buf, pre + 1, tdi, 0, nb_bits);
+            DBG_PRINT(1, "[VPI][DBG] CMD_SCAN_%s: %u bits after a %u-bit path\n",
+                      (cmd == CMD_SCAN_IR) ? "IR" : "DR", nb_bits, pre);
+            begin_response(cmd, data_bytes, nb_bits, 0);
+            vpi_tx_pending = false;
+            scan_state = SCAN_PROCESSING;
+            break;
+        }
+        case CMD_DMI: {
+            // Direct DMI transactions: no TAP/DTM shifting, each entry is one
+            // request on the debug module interface through the harness.
+            if (vpi_minimal_mode) {
+                break;
+            }
+            begin_response(cmd, 0, 0, 0);
+            vpi_tx_pending = true;
+            if (!dmi_driver || nb_bits == 0 || nb_bits > DMI_MAX_OPS) {
+                // Empty response: fast path not enabled, or bad transaction count
+                DBG_PRINT(1, "[VPI][WARN] CMD_DMI: %s (%u transactions)\n",
+                          dmi_driver ? "bad transaction count" : "DMI fast path not enabled", nb_bits);
+                break;
+            }
+            begin_response(cmd, nb_bits * DMI_ENTRY_SIZE, nb_bits, nb_bits * DMI_ENTRY_SIZE);
+            for (uint32_t i = 0; i < nb_bits; i++) {
+                const uint8_t* req = vpi_rx_pkt->buffer_out + i * DMI_ENTRY_SIZE;
+                uint8_t* rsp = vpi_cmd_tx.buffer_in + i * DMI_ENTRY_SIZE;
+                uint32_t rdata = 0;
+                rsp[0] = dmi_driver(req[0] & 0x3, req[1] & 0x7f, le32_to_host(req + 4), &rdata);
+                rsp[1] = req[1];
+                host_to_le32(rsp + 4, rdata);
+            }
+            DBG_PRINT(1, "[VPI] CMD_DMI: %u transaction(s), first addr=0x%02x resp=%u\n",
+                      nb_bits, vpi_rx_pkt->buffer_out[1], vpi_cmd_tx.buffer_in[0]);
+            break;
+        }
+        case CMD_DMI_POLL: {
+            // Busy-wait on a DMI register (abstractcs.busy, sbcs.sbbusy,
+            // dmstatus.allhalted) without a client round trip per read: DMI
+            // scans through the DTM, or reads on the fast path if it is on
+            if (vpi_minimal_mode) {
+                break;
+            }
+            begin_response(cmd, 0, 0, 0);
+            vpi_tx_pending = true;
+            if (nb_bits == 0 || nb_bits > DMI_POLL_MAX_TCKS) {
+                DBG_PRINT(1, "[VPI][WARN] CMD_DMI_POLL: bad TCK budget (%u)\n", nb_bits);
+                break;
+            }
+            const uint8_t* req = vpi_rx_pkt->buffer_out;
+            dtm_poll_addr = req[1] & 0x7f;
+            dtm_poll_expect = le32_to_host(req + 4);
+            dtm_poll_mask = le32_to_host(req + 8);
+            dtm_poll_budget = nb_bits;
+            dtm_poll_reads = 0;
+            begin_response(cmd, 16, nb_bits, 16);
+            if (!dmi_driver) {
+                // One scan per read; dtm_continue() decides on each result
+                dtm_job = DTM_POLL;
+                dtm_tck_start = tck_cycles;
+                dtm_scans = 0;
+                batch_ops.clear();
+                dtm_select_dmi();
+                dtm_push_scan(1, dtm_poll_addr, 0);
+                vpi_tx_pending = false;
+                run_batch();
+                break;
+            }
+            // The fast path has no TCKs of its own: each read costs what its scan would
+            uint32_t rdata = 0;
+            uint8_t resp = 0;
+            bool matched = false;
+            while (!matched && (dtm_poll_reads == 0 || (dtm_poll_reads + 1) * DTM_SCAN_TCKS <= nb_bits)) {
+                resp = dmi_driver(1, dtm_poll_addr, 0, &rdata);
+                dtm_poll_reads++;
+                if (resp == 2) {
+                    break;  // DMI_RESP_FAILED: polling again will not help
+                }
+                matched = (resp == 0) && ((rdata & dtm_poll_mask) == dtm_poll_expect);
+            }
+            dmi_poll_reply(resp, matched, rdata, dtm_poll_reads * DTM_SCAN_TCKS);
+            break;
+        }
+        case CMD_SBA_READ:
+        case CMD_SBA_WRITE: {
+            // Memory dumps and downloads: one round trip per packet of words
+            // instead of two or three DMI scans per word
+            if (vpi_minimal_mode) {
+                break;
+            }
+            begin_response(cmd, 0, 0, 0);
+            vpi_tx_pending = true;
+            bool write = (cmd == CMD_SBA_WRITE);
+            uint32_t addr = le32_to_host(vpi_rx_pkt->buffer_out);
+            uint32_t size_log2 = vpi_rx_pkt->buffer_out[4];
+            bool dtm = !dm_driver || (vpi_rx_pkt->buffer_out[5] & SBA_FLAG_DTM);
+            uint32_t room = write ? sizeof(vpi_rx_pkt->buffer_out) - SBA_HDR_SIZE : sizeof(vpi_cmd_tx.buffer_in);
+            if ((dtm && !dtm_target_select) || size_log2 > 2 || nb_bits == 0 || nb_bits > (room >> size_log2)) {
+                DBG_PRINT(1, "[VPI][WARN] CMD_SBA_%s: %s (%u words of %u bytes)\n", write ? "WRITE" : "READ",
+                          (dtm && !dtm_target_select) ? "no debug module path" : "bad word count or size",
+                          nb_bits, 1u << (size_log2 & 7));
+                break;
+            }
+            uint32_t in_bytes = write ? 0 : nb_bits << size_log2;
+            begin_response(cmd, in_bytes, nb_bits, in_bytes);  // reads land in buffer_in
+            // Build the sequence now: the request packet is not kept while DTM scans run
+            sba_requests(addr, size_log2, nb_bits, write ? vpi_rx_pkt->buffer_out + SBA_HDR_SIZE : nullptr,
+                         &dtm_sba_reqs);
+            if (dtm) {
+                // Probe dmcontrol first; dtm_sba_step() queues the rest
+                dtm_job = DTM_SBA;
+                dtm_tck_start = tck_cycles;
+                dtm_scans = 0;
+                dtm_sba_size_log2 = size_log2;
+                dtm_target_select(true);
+                batch_ops.clear();
+                dtm_select_dmi();
+                dtm_push_scan(1, riscv_dm::DMCONTROL, 0);
+                dtm_push_scan(0, 0, 0);
+                vpi_tx_pending = false;
+                run_batch();
+                DBG_PRINT(1, "[VPI] CMD_SBA_%s: %u words of %u bytes at 0x%08x as DTM scans\n",
+                          write ? "WRITE" : "READ", nb_bits, 1u << size_log2, addr);
+                break;
+            }
+            uint32_t done = sba_access(size_log2, dtm_sba_reqs, write ? nullptr : vpi_cmd_tx.buffer_in);
+            if (done < nb_bits) {
+                // Short transfer: report only the words that made it
+                host_to_le32(vpi_cmd_tx.nb_bits_buf, done);
+                if (!write) {
+                    host_to_le32(vpi_cmd_tx.length_buf, done << size_log2);
+                    vpi_tx_in_bytes = done << size_log2;
+                }
+            }
+            DBG_PRINT(1, "[VPI] CMD_SBA_%s: %u/%u words of %u bytes at 0x%08x\n", write ? "WRITE" : "READ",
+                      done, nb_bits, 1u << size_log2, addr);
+            break;
+        }
+        case CMD_STATS: {
+            if (vpi_minimal_mode) {
+                break;
+            }
+            stats_reply(vpi_rx_pkt->buffer_out[0], (vpi_rx_pkt->buffer_out[1] & 1) != 0);
+            break;
+        }
+        default:
+            // Unknown - ignore
+            break;
+    }
+}
+
+const char* const JtagVpiServer::cmd_class_names[NUM_CMD_CLASSES] = {
+    "reset", "tms_seq", "scan", "stream", "batch", "oscan1", "tap", "dmi", "sba", "other", "legacy",
+};
+
+// Open the metrics sample of the command about to run, closing the previous
+// one: a new command is only taken at a command boundary
+void JtagVpiServer::metrics_begin(uint8_t cls, uint64_t bits, uint32_t cmd, uint32_t nb_bits) {
+    if (cmd_sample.open) {
+        metrics_end();
+    }
+    uint64_t now = vpi_metrics::now_ns();
+    cmd_sample.open = true;
+    cmd_sample.cls = cls;
+    cmd_sample.cmd = cmd;
+    cmd_sample.nb_bits = nb_bits;
+    cmd_sample.bits = bits;
+    cmd_sample.tck_start = tck_cycles;
+    cmd_sample.wall_start = (cmd_rx_since != 0 && cmd_rx_since <= now) ? cmd_rx_since : now;
+    cmd_sample.sim_start = sim_clock ? sim_clock() : 0;
+    cmd_rx_since = 0;
+    if (command_tracer) {
+        CommandTrace t = {cmd, nb_bits, cmd_class_names[cls], 0,
+                          cmd_sample.wall_start, 0, cmd_sample.sim_start, 0};
+        command_tracer(t, false);
+    }
+}
+
+void JtagVpiServer::metrics_end() {
+    vpi_metrics::CommandStats& st = cmd_stats[cmd_sample.cls];
+    uint64_t wall_end = vpi_metrics::now_ns();
+    uint64_t sim_end = sim_clock ? sim_clock() : 0;
+    st.count++;
+    st.bits += cmd_sample.bits;
+    st.tck_cycles += tck_cycles - cmd_sample.tck_start;
+    st.wall_ns.record(wall_end - cmd_sample.wall_start);
+    if (sim_clock) {
+        st.sim_ps.record(sim_end - cmd_sample.sim_start);
+    }
+    cmd_sample.open = false;
+    if (command_tracer) {
+        CommandTrace t = {cmd_sample.cmd, cmd_sample.nb_bits, cmd_class_names[cmd_sample.cls],
+                          tck_cycles - cmd_sample.tck_start,
+                          cmd_sample.wall_start, wall_end, cmd_sample.sim_start, sim_end};
+        command_tracer(t, true);
+    }
+}
+
+static inline void host_to_le64(uint8_t b[8], uint64_t v) {
+    host_to_le32(b, (uint32_t)v);
+    host_to_le32(b + 4, (uint32_t)(v >> 32));
+}
+
+// CMD_STATS reply for one command class (layout in jtag_vpi_server.h)
+void JtagVpiServer::stats_reply(uint8_t cls, bool clear) {
+    if (cls >= NUM_CMD_CLASSES) {
+        begin_response(CMD_STATS, 0, NUM_CMD_CLASSES, 0);
+    } else {
+        begin_response(CMD_STATS, STATS_REPLY_SIZE, NUM_CMD_CLASSES, STATS_REPLY_SIZE);
+        strncpy((char*)vpi_cmd_tx.buffer_in, cmd_class_names[cls], STATS_NAME_SIZE - 1);
+        const vpi_metrics::CommandStats& st = cmd_stats[cls];
+        uint64_t v[16];
+        int n = 0;
+        v[n++] = st.count;
+        v[n++] = st.bits;
+        v[n++] = st.tck_cycles;
+        for (const vpi_metrics::Histogram* h : {&st.wall_ns, &st.sim_ps}) {
+            v[n++] = h->min();
+            v[n++] = h->percentile(50);
+            v[n++] = h->percentile(90);
+            v[n++] = h->percentile(99);
+            v[n++] = h->max();
+            v[n++] = h->sum;
+        }
+        v[n++] = responses_held;
+        for (int i = 0; i < n; i++) {
+            host_to_le64(vpi_cmd_tx.buffer_in + STATS_NAME_SIZE + 8 * i, v[i]);
+        }
+    }
+    if (clear) {
+        for (vpi_metrics::CommandStats& st : cmd_stats) {
+            st.clear();
+        }
+        responses_held = 0;
+    }
+    tx_unchecked = true;  // timings differ from run to run
+    vpi_tx_pending = true;
+}
+
+static void write_histogram_json(FILE* f, const char* name, const vpi_metrics::Histogram& h) {
+    fprintf(f, "\"%s\": {\"min\": %llu, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"max\": %llu, \"mean\": %llu}",
+            name, (unsigned long long)h.min(), (unsigned long long)h.percentile(50),
+            (unsigned long long)h.percentile(90), (unsigned long long)h.percentile(99),
+            (unsigned long long)h.max(), (unsigned long long)h.mean());
+}
+
+bool JtagVpiServer::write_stats(const std::string& path) const {
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) {
+        return false;
+    }
+    fprintf(f, "{\n  \"tck_cycles\": %llu,\n  \"responses_held\": %llu,\n  \"commands\": {\n",
+            (unsigned long long)tck_cycles, (unsigned long long)responses_held);
+    for (int c = 0; c < NUM_CMD_CLASSES; c++) {
+        const vpi_metrics::CommandStats& st = cmd_stats[c];
+        fprintf(f, "    \"%s\": {\"count\": %llu, \"bits\": %llu, \"tck_cycles\": %llu,\n      ",
+                cmd_class_names[c], (unsigned long long)st.count, (unsigned long long)st.bits,
+                (unsigned long long)st.tck_cycles);
+        write_histogram_json(f, "wall_ns", st.wall_ns);
+        fprintf(f, ",\n      ");
+        write_histogram_json(f, "sim_ps", st.sim_ps);
+        fprintf(f, "}%s\n", (c + 1 < NUM_CMD_CLASSES) ? "," : "");
+    }
+    fprintf(f, "  }\n}\n");
+    return fclose(f) == 0;
+}
+
+void JtagVpiServer::record_io(uint8_t type, const void* data, size_t len) {
+    recorder->record(type, session_id, sim_clock ? sim_clock() : 0, data, len);
+}
+
+bool JtagVpiServer::start_recording(const std::string& path) {
+    uint32_t flags = (pending_mode_select ? vpi_record::FLAG_CJTAG : 0) |
+                     (msb_first ? vpi_record::FLAG_MSB_FIRST : 0) |
+                     (dmi_driver ? vpi_record::FLAG_DMI_FASTPATH : 0) |
+                     (tck_driver ? 0 : vpi_record::FLAG_PER_BIT_SCAN);
+    std::unique_ptr<vpi_record::Writer> w(new vpi_record::Writer);
+    if (!w->open(path.c_str(), flags)) {
+        return false;
+    }
+    recorder = std::move(w);
+    return true;
+}
+
+void JtagVpiServer::stop_recording() {
+    if (recorder) {
+        recorder->close();
+        recorder.reset();
+    }
+}
+
+bool JtagVpiServer::start_replay(const std::string& path, uint32_t* flags) {
+    std::unique_ptr<vpi_record::Player> p(new vpi_record::Player);
+    std::string error;
+    if (!p->load(path.c_str(), &error)) {
+        printf("[VPI] Cannot replay %s: %s\n", path.c_str(), error.c_str());
+        return false;
     }
+    if (p->truncated) {
+        printf("[VPI] %s ends inside a record; replaying what precedes it\n", path.c_str());
+    }
+    printf("[VPI] Replaying %s: %zu session(s), %.3f ms simulated time recorded\n",
+           path.c_str(), p->sessions.size(), p->sim_end / 1e9);
+    fflush(stdout);
+    *flags = p->flags;
+    replay = std::move(p);
+    return true;
+}
 
-    DBG_PRINT(1, "[VPI][DBG] process_vpi_packet: cmd=%u, length=%u, nb_bits=%u\n", cmd, length, nb_bits);
+bool JtagVpiServer::finish_replay() {
+    if (!replay) {
+        return true;
+    }
+    printf("[VPI] Replay: %llu response(s) checked, %llu differ from the recording, %llu recorded byte(s) never sent\n",
+           (unsigned long long)replay->responses, (unsigned long long)replay->mismatches,
+           (unsigned long long)replay->missing_bytes);
+    if (!replay_done()) {
+        printf("[VPI] Replay stopped before the end of the recording\n");
+    }
+    fflush(stdout);
+    return replay_done() && replay->mismatches == 0 && replay->missing_bytes == 0;
+}
 
-    switch (cmd) {
-        case 0: { // CMD_RESET
-            reset_pulses_remaining = 6;
-            pending_tms = 1;
-            pending_tdi = 0;
-            pending_tck_pulse = true;
+bool JtagVpiServer::save_checkpoint(Checkpoint* cp) const {
+    if (is_client_connected() || !is_quiescent() || !tck_ops.empty() || signal_mode != current_mode ||
+        sf0_state != SF0_IDLE) {
+        return false;
+    }
+    memset(cp, 0, sizeof(*cp));
+    cp->idcode = current_idcode;
+    cp->next_session_id = (uint32_t)next_session_id;
+    cp->oscan1_preamble_edge = oscan1_preamble_edge;
+    cp->tdo = current_tdo;
+    cp->tdo_en = current_tdo_en;
+    cp->mode = current_mode;
+    cp->pending_tms = pending_tms;
+    cp->pending_tdi = pending_tdi;
+    cp->pending_mode_select = pending_mode_select;
+    cp->signal_mode = signal_mode;
+    cp->tckc_state = tckc_state;
+    cp->tckc_toggle_consumed = tckc_toggle_consumed;
+    cp->oscan1_online = oscan1_online;
+    cp->sf0_pulse_falling = sf0_pulse_falling;
+    cp->tap_state = tap_state;
+    return true;
+}
 
-            // Send immediate response for minimal mode
-            if (vpi_minimal_mode) {
-                send_minimal_response(0x00, 0, current_mode, 0);
-                // Clear any pending operations so next command can proceed cleanly
-                reset_pulses_remaining = 0;
-                pending_tck_pulse = false;
-            } else {
-                // Full OpenOCD mode - send empty response packet
-                memset(&vpi_cmd_tx, 0, sizeof(vpi_cmd_tx));
-                host_to_le32(vpi_cmd_tx.cmd_buf, cmd);
-                host_to_le32(vpi_cmd_tx.length_buf, 0);
-                host_to_le32(vpi_cmd_tx.nb_bits_buf, 0);
-                vpi_tx_pending = true;
-                vpi_tx_bytes = 0;
-            }
-            break;
-        }
-        case 1: { // CMD_TMS_SEQ
-            // Copy TMS bits and start sequence
-            tms_seq_active = true;
-            tms_seq_num_bits = nb_bits;
-            tms_seq_bit_index = 0;
-            uint32_t nb_bytes = (nb_bits + 7) / 8;
-            if (nb_bytes > sizeof(tms_seq_buf)) nb_bytes = sizeof(tms_seq_buf);
-            memcpy(tms_seq_buf, vpi_cmd_rx.buffer_out, nb_bytes);
+void JtagVpiServer::restore_checkpoint(const Checkpoint& cp) {
+    current_idcode = cp.idcode;
+    next_session_id = (int)cp.next_session_id;
+    oscan1_preamble_edge = cp.oscan1_preamble_edge;
+    current_tdo = cp.tdo;
+    current_tdo_en = cp.tdo_en;
+    current_mode = cp.mode;
+    pending_tms = cp.pending_tms;
+    pending_tdi = cp.pending_tdi;
+    pending_mode_select = cp.pending_mode_select;
+    signal_mode = cp.signal_mode;
+    tckc_state = cp.tckc_state;
+    tckc_toggle_consumed = cp.tckc_toggle_consumed != 0;
+    oscan1_online = cp.oscan1_online != 0;
+    sf0_pulse_falling = cp.sf0_pulse_falling != 0;
+    tap_state = cp.tap_state;
+    DBG_PRINT(1, "[VPI] Restored: mode %s, TAP state %u, next session %d\n",
+              pending_mode_select ? "cJTAG" : "JTAG", tap_state, next_session_id);
+}
 
-            // Send response packet
-            if (!vpi_minimal_mode) {
-                memset(&vpi_cmd_tx, 0, sizeof(vpi_cmd_tx));
-                host_to_le32(vpi_cmd_tx.cmd_buf, cmd);
-                host_to_le32(vpi_cmd_tx.length_buf, 0);
-                host_to_le32(vpi_cmd_tx.nb_bits_buf, 0);
-                vpi_tx_pending = true;
-                vpi_tx_bytes = 0;
+// System bus access through riscv_debug_module, as the GDB stub does it:
+// writes set sbautoincrement once and then cost one SBDATA0 write per word;
+// reads need an SBADDRESS0 write (sbreadonaddr) and an SBDATA0 read per
+// word, since this debug module's sbreadondata only re-reads after a write.
+// Writes from wdata when given, else reads. Every word has exactly one
+// SBDATA0 access, which is how both executors count the words done.
+void JtagVpiServer::sba_requests(uint32_t addr, uint32_t size_log2, uint32_t words, const uint8_t* wdata,
+                                 std::vector<DmiReq>* reqs) const {
+    bool write = (wdata != nullptr);
+    uint32_t size = 1u << size_log2;
+    uint32_t sbcs = (size_log2 << riscv_dm::SBCS_SBACCESS_SHIFT) |
+                    (write ? riscv_dm::SBCS_SBAUTOINCREMENT : riscv_dm::SBCS_SBREADONADDR);
+    reqs->clear();
+    reqs->push_back({2, riscv_dm::SBCS, sbcs});
+    if (write) {
+        reqs->push_back({2, riscv_dm::SBADDRESS0, addr});
+    }
+    for (uint32_t i = 0; i < words; i++) {
+        if (write) {
+            uint32_t word = 0;
+            for (uint32_t b = 0; b < size; b++) {
+                word |= (uint32_t)wdata[i * size + b] << (8 * b);
             }
-            break;
+            reqs->push_back({2, riscv_dm::SBDATA0, word});
+        } else {
+            reqs->push_back({2, riscv_dm::SBADDRESS0, addr + i * size});
+            reqs->push_back({1, riscv_dm::SBDATA0, 0});
         }
-        case 2: // CMD_SCAN_CHAIN
-        case 3: { // CMD_SCAN_CHAIN_FLIP_TMS (or CMD_SET_PORT in minimal mode)
-            // In minimal mode, cmd=0x03 is CMD_SET_PORT (mode query), not SCAN_CHAIN_FLIP_TMS
-            if (vpi_minimal_mode && cmd == 3) {
-                // Mode query - just return current mode
-                send_minimal_response(0x00, current_tdo, current_mode, 0);
-                break;
-            }
+    }
+}
 
-            // In minimal mode, use legacy-style protocol (send response, then TMS/TDI/TDO exchange)
-            if (vpi_minimal_mode) {
-                // Send immediate response
-                send_minimal_response(0x00, current_tdo, current_mode, 0);
-                // Enter legacy scan state machine
-                if (nb_bits == 0 || nb_bits > 4096) {
-                    break;
-                }
-                scan_num_bits = nb_bits;
-                scan_num_bytes = (nb_bits + 7) / 8;
-                scan_bit_index = 0;
-                scan_bytes_received = 0;
-                scan_bytes_sent = 0;
-                memset(scan_tms_buf, 0, sizeof(scan_tms_buf));
-                memset(scan_tdi_buf, 0, sizeof(scan_tdi_buf));
-                memset(scan_tdo_buf, 0, sizeof(scan_tdo_buf));
-                scan_state = SCAN_RECEIVING_TMS;
-                break;
-            }
+// Word i of an SBA read, packed LE
+static void sba_store(uint8_t* rdata, uint32_t i, uint32_t size, uint32_t word) {
+    for (uint32_t b = 0; b < size; b++) {
+        rdata[i * size + b] = (word >> (8 * b)) & 0xFF;
+    }
+}
 
-            // Full OpenOCD VPI mode: Initialize scan using RX data; reuse legacy scan state machine
-            DBG_PRINT(1, "[VPI][DBG] SCAN command: nb_bits=%u, cmd=%u (flip_tms=%d)\n", nb_bits, cmd, (cmd == 3));
-            scan_num_bits = nb_bits;
-            scan_num_bytes = (nb_bits + 7) / 8;
-            scan_bit_index = 0;
-            scan_bytes_received = scan_num_bytes; // mark buffers as ready
-            scan_bytes_sent = 0;
-            scan_is_legacy = false;  // OpenOCD mode - don't send TDO bytes directly
-            memset(scan_tdo_buf, 0, sizeof(scan_tdo_buf));
-            // For OpenOCD, TMS is 0 for all bits, except last bit when cmd==3
-            memset(scan_tms_buf, 0x00, scan_num_bytes);
-            if (cmd == 3 && nb_bits > 0) {
-                uint32_t last = nb_bits - 1;
-                scan_tms_buf[last / 8] |= (1u << (last % 8));
-            }
-            memcpy(scan_tdi_buf, vpi_cmd_rx.buffer_out, scan_num_bytes);
-            // Debug TDI for small scans (likely IR)
-            if (scan_num_bytes <= 4) {
-                DBG_PRINT(1, "[VPI][DBG] SCAN TDI: ");
-                for (uint32_t i = 0; i < scan_num_bytes; i++) {
-                    DBG_PRINT(1, "0x%02x ", scan_tdi_buf[i]);
-                }
-                DBG_PRINT(1, "\n");
+// Run an sba_requests() sequence on the debug module executor, read words
+// into rdata. Returns the words transferred before the first DMI request
+// that failed.
+uint32_t JtagVpiServer::sba_access(uint32_t size_log2, const std::vector<DmiReq>& reqs, uint8_t* rdata) {
+    uint32_t unused = 0;
+    // The module ignores SBCS/SBADDRESS0/SBDATA0 writes until dmactive is set;
+    // set it only if needed, so a halt request from the GDB stub stays put
+    uint32_t dmcontrol = 0;
+    if (dm_driver(1, riscv_dm::DMCONTROL, 0, &dmcontrol) != 0 ||
+        (!(dmcontrol & riscv_dm::DMCONTROL_DMACTIVE) &&
+         dm_driver(2, riscv_dm::DMCONTROL, riscv_dm::DMCONTROL_DMACTIVE, &unused) != 0)) {
+        return 0;
+    }
+    uint32_t words = 0;
+    for (const DmiReq& r : reqs) {
+        uint32_t word = 0;
+        if (dm_driver(r.op, r.addr, r.wdata, &word) != 0) {
+            return words;
+        }
+        if (r.addr == riscv_dm::SBDATA0) {
+            if (r.op == 1) {
+                sba_store(rdata, words, 1u << size_log2, word);
             }
-            // Enter processing state (legacy engine)
-            DBG_PRINT(2, "[VPI][DBG] Entering SCAN_PROCESSING state\n");
-            scan_state = SCAN_PROCESSING;
-            // Prepare TX packet header for when we send the response
-            memset(&vpi_cmd_tx, 0, sizeof(vpi_cmd_tx));
-            host_to_le32(vpi_cmd_tx.cmd_buf, cmd);
-            host_to_le32(vpi_cmd_tx.length_buf, scan_num_bytes);
-            host_to_le32(vpi_cmd_tx.nb_bits_buf, nb_bits);
-            vpi_tx_bytes = 0;
-            vpi_tx_pending = false;
-            break;
+            words++;
         }
-        case 4: { // CMD_STOP_SIMU
-            // Optionally close connection
-            close_connection();
+    }
+    return words;
+}
+
+// Advance OpenOCD work items. Steps repeat while they make progress without
+// waiting on the simulation (scan executor path), so queued commands run back
+// to back; a pending TCK/TCKC edge or an idle step ends the burst.
+void JtagVpiServer::continue_vpi_work() {
+    for (uint32_t i = 0; i < 4 * VPI_RX_DEPTH; i++) {
+        uint32_t rx_count = vpi_rx_count;
+        bool tms_seq = tms_seq_active;
+        bool tx_pending = vpi_tx_pending;
+        ScanState scan = scan_state;
+        SF0State sf0 = sf0_state;
+
+        receive_ahead();
+        vpi_work_step();
+
+        if (client_sock < 0 || !tck_ops.empty()) {
             break;
         }
-        case 5: { // CMD_OSCAN1 - two-wire cJTAG/OScan1 operation
-            // OScan1 SF0 protocol:
-            // - Sends TMS on TCKC rising edge (cmd.buffer_out[0] bit 1 = TMS)
-            // - Sends TDI on TCKC falling edge (cmd.buffer_out[0] bit 0 = TDI)
-            // - Returns captured TDO on TMSC (response.buffer_in[0] = TDO)
-
-            // Extract SF0 control bits from command
-            uint8_t tdi = vpi_cmd_rx.buffer_out[0] & 1;      // Bit 0: TDI (falling edge)
-            uint8_t tms = (vpi_cmd_rx.buffer_out[0] >> 1) & 1; // Bit 1: TMS (rising edge)
-
-            // Switch to cJTAG two-wire mode
-            pending_mode_select = 1;
-
-            // Debug logging for all commands
-            DBG_PRINT(1, "[VPI] CMD_OSCAN1: buffer_out[0]=0x%02x → TMS=%d, TDI=%d, current_tdo=%d\n",
-                      vpi_cmd_rx.buffer_out[0], tms, tdi, current_tdo);
-
-            // Initialize SF0 state machine for this operation
-            // Step 1: Rising edge with TMS bit
-            pending_tms = tms;
-            pending_tdi = 0;        // During rising edge, TDI is not active
-            pending_tckc_toggle = true;  // Create rising edge
-            sf0_state = JtagVpiServer::SF0_SEND_TMS;
-            sf0_tms = tms;
-            sf0_tdi = tdi;
-            sf0_tdo = 0;
-
-            DBG_PRINT(1, "[VPI] CMD_OSCAN1: Initializing SF0 state machine (TMS=%d, TDI=%d)\n", tms, tdi);
-
-            // Prepare response packet - will be filled with TDO when complete
-            memset(&vpi_cmd_tx, 0, sizeof(vpi_cmd_tx));
-            host_to_le32(vpi_cmd_tx.cmd_buf, 5);
-            host_to_le32(vpi_cmd_tx.length_buf, 1);
-            host_to_le32(vpi_cmd_tx.nb_bits_buf, 2);
-            vpi_cmd_tx.buffer_in[0] = 0;  // Will be updated with TDO
-
-            // Queue response
-            vpi_tx_pending = false;  // Don't send yet - wait for SF0 to complete
-            vpi_tx_bytes = 0;
+        if (rx_count == vpi_rx_count && tms_seq == tms_seq_active && tx_pending == vpi_tx_pending &&
+            scan == scan_state && sf0 == sf0_state) {
             break;
         }
-        default:
-            // Unknown - ignore
-            break;
     }
+    metrics_check();
 }
 
-// Advance OpenOCD work items (TMS_SEQ/SCAN processing and TX)
-void JtagVpiServer::continue_vpi_work() {
-    // 1) If sending a response, try to flush it first
+// One pass over the OpenOCD work items (TMS_SEQ/SCAN processing and TX)
+void JtagVpiServer::vpi_work_step() {
+    // 1) Hand a completed response to the TX path (flushed on EPOLLOUT if the socket is full)
     if (vpi_tx_pending && client_sock >= 0) {
-        ssize_t sent = send(client_sock, ((uint8_t*)&vpi_cmd_tx) + vpi_tx_bytes,
-                            VPI_PKT_SIZE - vpi_tx_bytes, MSG_DONTWAIT);
-        if (sent > 0) {
-            vpi_tx_bytes += sent;
-            DBG_PRINT(2, "[VPI][DBG] Sent %zd bytes, total=%d/%d\n", sent, vpi_tx_bytes, VPI_PKT_SIZE);
-            if (vpi_tx_bytes >= VPI_PKT_SIZE) {
-                DBG_PRINT(1, "[VPI][DBG] Response packet sent completely\n");
-                vpi_tx_pending = false;
-                vpi_tx_bytes = 0;
-            }
-        } else if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
-            close_connection();
+        vpi_tx_pending = false;
+        struct iovec iov[5];
+        if (!queue_txv(iov, response_iov(iov))) {
             return;
         }
+        DBG_PRINT(1, "[VPI][DBG] Response packet queued\n");
     }
 
     // 2) Process OScan1 SF0 state machine (two-phase TCKC/TMSC protocol)
     if (sf0_state != SF0_IDLE) {
-        DBG_PRINT(2, "[VPI][DBG] SF0 state machine: state=%d, pending_tckc_toggle=%d, tckc_toggle_consumed=%d, current_tdo=%d\n",
-                  sf0_state, pending_tckc_toggle, tckc_toggle_consumed, current_tdo);
+        DBG_PRINT(2, "[VPI][DBG] SF0 state machine: state=%d, queued_ops=%u, tckc_toggle_consumed=%d, current_tdo=%d\n",
+                  sf0_state, tck_ops.size(), tckc_toggle_consumed, current_tdo);
 
         if (sf0_state == SF0_SEND_TMS) {
-            // Wait for rising edge to complete (pending_tckc_toggle to be consumed by get_pending_signals)
-            DBG_PRINT(2, "[VPI][DBG] SF0_SEND_TMS: pending=%d, consumed=%d\n", pending_tckc_toggle, tckc_toggle_consumed);
-            if (pending_tckc_toggle || !tckc_toggle_consumed) {
+            // Wait for rising edge to complete (its TCKC op handed out by get_pending_signals)
+            DBG_PRINT(2, "[VPI][DBG] SF0_SEND_TMS: queued=%u, consumed=%d\n", tck_ops.size(), tckc_toggle_consumed);
+            if (!tck_ops.empty() || !tckc_toggle_consumed) {
                 DBG_PRINT(2, "[VPI][DBG] SF0_SEND_TMS: Waiting for rising edge to complete\n");
                 return;  // Still waiting for toggle to be consumed
             }
             // Rising edge complete - now set up falling edge with TDI
             DBG_PRINT(1, "[VPI][DBG] SF0_SEND_TMS: Rising edge complete, setting up falling edge\n");
-            pending_tdi = sf0_tdi;
-            pending_tms = 0;      // TMS only on rising edge
-            pending_tckc_toggle = true;  // Create falling edge
+            tck_ops.push({TCK_OP_TCKC, sf0_tdi, sf0_tdi, 0, 1});  // falling edge: TMSC carries TDI
             tckc_toggle_consumed = false;  // Reset the consumed flag
             sf0_state = SF0_SEND_TDI;
             return;  // Let simulation execute the falling edge
         } else if (sf0_state == SF0_SEND_TDI) {
-            // Wait for falling edge to complete (pending_tckc_toggle to be consumed by get_pending_signals)
-            DBG_PRINT(2, "[VPI][DBG] SF0_SEND_TDI: pending=%d, consumed=%d\n", pending_tckc_toggle, tckc_toggle_consumed);
-            if (pending_tckc_toggle || !tckc_toggle_consumed) {
+            // Wait for falling edge to complete (its TCKC op handed out by get_pending_signals)
+            DBG_PRINT(2, "[VPI][DBG] SF0_SEND_TDI: queued=%u, consumed=%d\n", tck_ops.size(), tckc_toggle_consumed);
+            if (!tck_ops.empty() || !tckc_toggle_consumed) {
                 DBG_PRINT(2, "[VPI][DBG] SF0_SEND_TDI: Waiting for falling edge to complete\n");
                 return;  // Still waiting for toggle to be consumed
             }
-            // Both edges complete - capture TDO and queue response
+            // Both edges complete - capture TDO
             DBG_PRINT(1, "[VPI][DBG] SF0_SEND_TDI: Falling edge complete, capturing TDO=%d\n", current_tdo);
             sf0_tdo = current_tdo & 1;
 
             // Update response with captured TDO
-            vpi_cmd_tx.buffer_in[0] = sf0_tdo;
-            DBG_PRINT(1, "[VPI][DBG] SF0 SF0_SEND_TDI: Queueing response with TDO=0x%02x\n", sf0_tdo);
+            if (sf0_tdo) {
+                vpi_cmd_tx.buffer_in[sf0_index / 8] |= (1 << (sf0_index % 8));
+            }
+            if (++sf0_index < sf0_num_pairs) {
+                start_sf0_pair();  // next pair of a CMD_OSCAN1_BULK packet
+                return;
+            }
+            DBG_PRINT(1, "[VPI][DBG] SF0 SF0_SEND_TDI: Queueing response with TDO[0]=0x%02x\n", vpi_cmd_tx.buffer_in[0]);
 
             // Queue response for transmission
             vpi_tx_pending = true;
-            vpi_tx_bytes = 0;
             sf0_state = SF0_IDLE;
             return;  // Response will be sent in next poll
         }
@@ -689,14 +2220,17 @@ void JtagVpiServer::continue_vpi_work() {
 
     // 3) Process TMS sequence (no response expected)
     if (tms_seq_active) {
-        if (pending_tck_pulse) return; // wait for pulse to complete
+        if (executor_ready()) {
+            execute_tms_seq();
+            return;
+        }
+        if (!tck_ops.empty()) return; // wait for earlier pulses, or our own, to go out
         if (tms_seq_bit_index < tms_seq_num_bits) {
-            uint32_t i = tms_seq_bit_index;
-            uint8_t bit = (tms_seq_buf[i / 8] >> (i % 8)) & 1;
-            pending_tms = bit;
-            pending_tdi = 0;
-            pending_tck_pulse = true;
-            tms_seq_bit_index++;
+            // No TDO to collect: queue the rest of the sequence as runs
+            while (tms_seq_bit_index < tms_seq_num_bits) {
+                uint32_t i = tms_seq_bit_index++;
+                tck_ops.push_pulses((tms_seq_buf[i / 8] >> (i % 8)) & 1, 0, 1);
+            }
         } else {
             tms_seq_active = false;
         }
@@ -708,15 +2242,16 @@ void JtagVpiServer::continue_vpi_work() {
     if (scan_state != SCAN_IDLE) {
         DBG_PRINT(2, "[VPI][DBG] continue_vpi_work: scan_state=%d (1=RX_TMS, 2=RX_TDI, 3=PROC, 4=SEND)\n", scan_state);
         // Run legacy per-bit engine
-        if (scan_state == SCAN_PROCESSING && pending_tck_pulse) return;
+        if (scan_state == SCAN_PROCESSING && !tck_ops.empty()) return;
         continue_scan();
         DBG_PRINT(2, "[VPI][DBG] After continue_scan: scan_state=%d, vpi_tx_pending=%d\n",
             scan_state, vpi_tx_pending);
         // When legacy finishes sending TDO bytes, prepare and queue full response
-        if (scan_state == SCAN_IDLE && !vpi_tx_pending && client_sock >= 0) {
+        if (scan_state == SCAN_IDLE && !scan_is_legacy && !vpi_tx_pending && client_sock >= 0) {
             DBG_PRINT(2, "[VPI][DBG] Scan complete, preparing response packet\n");
-            // Fill TX buffer_in with captured TDO
-            memcpy(vpi_cmd_tx.buffer_in, scan_tdo_buf, scan_num_bytes);
+            // Send the captured TDO as buffer_in straight from the scan buffer
+            vpi_tx_in = scan_tdo_buf;
+            vpi_tx_in_bytes = scan_num_bytes;
             // Debug: Show first few bytes of TDO response
             if (scan_num_bytes >= 4) {
                 DBG_PRINT(1, "[VPI][DBG] SCAN response TDO[0-3]=0x%02x 0x%02x 0x%02x 0x%02x\n",
@@ -727,18 +2262,53 @@ void JtagVpiServer::continue_vpi_work() {
             }
             // Transmit full packet (OpenOCD expects fixed-size)
             vpi_tx_pending = true;
-            vpi_tx_bytes = 0;
         }
         return;
     }
 
-    // 4) If idle and not sending, try to receive next command packet
-    if (!vpi_tx_pending && client_sock >= 0) {
+    // 4) If idle, take the next command (minimal: straight off the socket; full: from the RX ring),
+    //    unless this session's turn is over and another one is waiting
+    if (!vpi_tx_pending && client_sock >= 0 && !turn_over()) {
+        // Shared memory: execute the command in its slot, then hand the slot back
+        if (shm) {
+            if (rx_ready) {
+                // Nothing but EOF is expected on the socket after the handshake
+                uint8_t junk[64];
+                ssize_t ret = sock_recv(junk, sizeof(junk));
+                if (ret == 0 || (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                    DBG_PRINT(1, "[VPI][INFO] Shared-memory client disconnected\n");
+                    close_connection();
+                    return;
+                }
+            }
+            if (!shm_ready(shm.get())) {
+                return;
+            }
+            jvpi_shm_ring& ring = shm->region->cmd;
+            vpi_rx_pkt = reinterpret_cast<const OcdVpiCmd*>(shm->region->cmd_slot[ring.head % JVPI_SHM_SLOTS]);
+            uint32_t cmd = le32_to_host(vpi_rx_pkt->cmd_buf);
+            if (cmd == 6 || cmd == 7 || cmd == CMD_BATCH) {
+                printf("[VPI] Command %u is not available over shared memory, closing session %d\n", cmd, session_id);
+                close_connection();
+                return;
+            }
+            session_stats.rx_bytes += VPI_PKT_SIZE;
+            cmd_rx_since = vpi_metrics::now_ns();
+            if (recorder) {
+                record_io(vpi_record::REC_RX, vpi_rx_pkt, VPI_PKT_SIZE);  // replayed as a socket packet
+            }
+            process_vpi_packet();
+            if (shm) {
+                jvpi_shm_store(&ring.head, ring.head + 1);
+            }
+            return;
+        }
+
         // Minimal mode uses a separate 8-byte buffer
         if (vpi_minimal_mode) {
             if (minimal_rx_bytes < sizeof(minimal_cmd_rx)) {
-                ssize_t ret = recv(client_sock, ((uint8_t*)&minimal_cmd_rx) + minimal_rx_bytes,
-                                   sizeof(minimal_cmd_rx) - minimal_rx_bytes, MSG_DONTWAIT);
+                ssize_t ret = sock_recv(((uint8_t*)&minimal_cmd_rx) + minimal_rx_bytes,
+                                        sizeof(minimal_cmd_rx) - minimal_rx_bytes);
                 if (ret < 0) {
                     if (errno != EAGAIN && errno != EWOULDBLOCK) {
                         // Classify different error types
@@ -779,6 +2349,9 @@ void JtagVpiServer::continue_vpi_work() {
                     close_connection();
                     return;
                 }
+                if (minimal_rx_bytes == 0) {
+                    cmd_rx_since = vpi_metrics::now_ns();
+                }
                 minimal_rx_bytes += ret;
                 DBG_PRINT(2, "[VPI][DBG] Received %zd bytes (minimal), total=%d\n", ret, minimal_rx_bytes);
                 if (minimal_rx_bytes < sizeof(minimal_cmd_rx)) {
@@ -794,126 +2367,303 @@ void JtagVpiServer::continue_vpi_work() {
             return;
         }
 
-        // Full OpenOCD path: ensure we have at least 8 bytes (already buffered during detection for first packet)
-        if (vpi_rx_bytes < 8) {
-            ssize_t ret = recv(client_sock, ((uint8_t*)&vpi_cmd_rx) + vpi_rx_bytes,
-                               VPI_PKT_SIZE - vpi_rx_bytes, MSG_DONTWAIT);
-            if (ret < 0) {
-                if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                    DBG_PRINT(1, "[VPI][DBG] Recv error in continue_vpi_work: %s\n", strerror(errno));
-                    close_connection();
-                }
-                return;
-            }
-            if (ret == 0) {
-                DBG_PRINT(1, "[VPI][DBG] Client disconnected in continue_vpi_work\n");
-                close_connection();
-                return;
-            }
-            vpi_rx_bytes += ret;
-            DBG_PRINT(2, "[VPI][DBG] Received %zd bytes in continue_vpi_work, total=%d\n", ret, vpi_rx_bytes);
-            if (vpi_rx_bytes < 8) {
-                return; // wait for minimal command
-            }
-        }
-
-        // We have at least 8 bytes - check if more data is coming (minimal mode detection for follow-on commands)
-        if (vpi_rx_bytes >= 8 && vpi_rx_bytes < VPI_PKT_SIZE) {
-            // Peek to see if more data is available
+        // Follow-on switch to minimal commands: exactly one 8-byte header queued
+        // and nothing behind it on the socket
+        if (vpi_rx_count == 0 && vpi_rx_bytes == 8 &&
+            !(vpi_batch_enabled && le32_to_host(vpi_rx_ring[vpi_rx_tail].cmd_buf) == CMD_BATCH)) {
             uint8_t temp_buf[16];
-            ssize_t peek_ret = recv(client_sock, temp_buf, sizeof(temp_buf), MSG_DONTWAIT | MSG_PEEK);
-
-            if (vpi_rx_bytes == 8 && peek_ret <= 0 && (errno == EAGAIN || errno == EWOULDBLOCK || peek_ret == 0)) {
-                // Exactly 8 bytes, no more data available - minimal mode for next packets
+            ssize_t peek_ret = sock_recv(temp_buf, sizeof(temp_buf), MSG_PEEK);
+            if (peek_ret <= 0 && (peek_ret == 0 || errno == EAGAIN || errno == EWOULDBLOCK)) {
                 DBG_PRINT(2, "[VPI][DBG] Minimal mode detected in continue_vpi_work: 8 bytes, no more data\n");
                 vpi_minimal_mode = true;
-                // Copy header into minimal buffer and process as minimal
-                memcpy(&minimal_cmd_rx, &vpi_cmd_rx, sizeof(minimal_cmd_rx));
+                memcpy(&minimal_cmd_rx, &vpi_rx_ring[vpi_rx_tail], sizeof(minimal_cmd_rx));
+                cmd_rx_since = vpi_rx_since[vpi_rx_tail];
                 minimal_rx_bytes = sizeof(minimal_cmd_rx);
                 vpi_rx_bytes = 0;
-                memset(&vpi_cmd_rx, 0, sizeof(vpi_cmd_rx));
                 process_vpi_packet();
                 DBG_PRINT(2, "[VPI][DBG] Minimal packet processed in continue_vpi_work\n");
                 minimal_rx_bytes = 0;
                 memset(&minimal_cmd_rx, 0, sizeof(minimal_cmd_rx));
                 return;
-            } else if (peek_ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
-                // Peek error (not EAGAIN) - connection issue
+            } else if (peek_ret < 0) {
                 DBG_PRINT(1, "[VPI][DBG] Peek error in continue_vpi_work: %s\n", strerror(errno));
                 close_connection();
                 return;
             }
+        }
 
-            // More data available or already buffered - full OpenOCD mode
-            vpi_minimal_mode = false;
+        // Execute the oldest queued packet; responses queue behind earlier ones
+        if (vpi_rx_count == 0 || tx_ring.used() >= VPI_RX_DEPTH * VPI_PKT_SIZE) {
+            return;
+        }
+        vpi_rx_pkt = &vpi_rx_ring[vpi_rx_head];  // stays intact until receive_ahead() refills it
+        if (vpi_batch_enabled && le32_to_host(vpi_rx_pkt->cmd_buf) == CMD_BATCH) {
+            batch_ops.swap(vpi_rx_payload[vpi_rx_head]);
         }
+        cmd_rx_since = vpi_rx_since[vpi_rx_head];
+        vpi_rx_head = (vpi_rx_head + 1) % VPI_RX_DEPTH;
+        vpi_rx_count--;
+        DBG_PRINT(2, "[VPI][DBG] Executing queued packet (%u more queued)\n", vpi_rx_count);
+        process_vpi_packet();
+    }
+}
 
-        // Continue filling until we have full packet (only if NOT in minimal mode)
-        if (!vpi_minimal_mode && vpi_rx_bytes < VPI_PKT_SIZE) {
-            ssize_t ret = recv(client_sock, ((uint8_t*)&vpi_cmd_rx) + vpi_rx_bytes,
-                               VPI_PKT_SIZE - vpi_rx_bytes, MSG_DONTWAIT);
-            if (ret < 0) {
-                if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                    // Classify different error types
-                    const char* error_type = "UNKNOWN";
-                    bool should_close = true;
-
-                    switch (errno) {
-                        case ECONNRESET:
-                            error_type = "CONNECTION_RESET";
-                            break;
-                        case ENOTCONN:
-                            error_type = "NOT_CONNECTED";
-                            break;
-                        case EINTR:
-                            error_type = "INTERRUPTED";
-                            should_close = false;  // Recoverable
-                            break;
-                        case ETIMEDOUT:
-                            error_type = "TIMEOUT";
-                            should_close = false;  // May be recoverable
-                            break;
-                        default:
-                            error_type = "OTHER";
-                            break;
-                    }
+// Pull complete OpenOCD packets off the socket into the RX ring while earlier
+// commands are still executing. Parsing pauses after a CMD_SCAN_STREAM header,
+// since raw TDI follows it, and resumes once that stream has been consumed.
+// Once a client has sent the capability query, each packet is read header first
+// so that variable-length CMD_BATCH frames can be told apart from full packets.
+void JtagVpiServer::receive_ahead() {
+    while (client_sock >= 0 && !shm && !vpi_minimal_mode && !vpi_rx_hold && vpi_rx_count < VPI_RX_DEPTH) {
+        OcdVpiCmd& slot = vpi_rx_ring[vpi_rx_tail];
+        std::vector<uint8_t>& payload = vpi_rx_payload[vpi_rx_tail];
+        bool batch = vpi_batch_enabled && vpi_rx_bytes >= BATCH_HDR_SIZE && le32_to_host(slot.cmd_buf) == CMD_BATCH;
+        uint32_t frame = batch ? BATCH_HDR_SIZE + (uint32_t)payload.size() : VPI_PKT_SIZE;
+        uint32_t want = (vpi_batch_enabled && vpi_rx_bytes < BATCH_HDR_SIZE) ? BATCH_HDR_SIZE : frame;
+        uint8_t* dst = batch ? payload.data() + (vpi_rx_bytes - BATCH_HDR_SIZE) : ((uint8_t*)&slot) + vpi_rx_bytes;
+        ssize_t ret = sock_recv(dst, want - vpi_rx_bytes);
+        if (ret < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                // Classify different error types
+                const char* error_type = "UNKNOWN";
+                bool should_close = true;
+
+                switch (errno) {
+                    case ECONNRESET:
+                        error_type = "CONNECTION_RESET";
+                        break;
+                    case ENOTCONN:
+                        error_type = "NOT_CONNECTED";
+                        break;
+                    case EINTR:
+                        error_type = "INTERRUPTED";
+                        should_close = false;  // Recoverable
+                        break;
+                    case ETIMEDOUT:
+                        error_type = "TIMEOUT";
+                        should_close = false;  // May be recoverable
+                        break;
+                    default:
+                        error_type = "OTHER";
+                        break;
+                }
 
-                    DBG_PRINT(1, "[VPI][WARN] Recv error (%s) in full packet mode: errno=%d, %s, rx_bytes=%d/%d%s\n",
-                              error_type, errno, strerror(errno), vpi_rx_bytes, VPI_PKT_SIZE,
-                              should_close ? ", closing connection" : ", continuing");
+                DBG_PRINT(1, "[VPI][WARN] Recv error (%s) in full packet mode: errno=%d, %s, rx_bytes=%d/%d%s\n",
+                          error_type, errno, strerror(errno), vpi_rx_bytes, VPI_PKT_SIZE,
+                          should_close ? ", closing connection" : ", continuing");
 
-                    if (should_close) {
-                        close_connection();
-                    }
+                if (should_close) {
+                    close_connection();
                 }
-                return;
             }
-            if (ret == 0) {
-                DBG_PRINT(1, "[VPI][INFO] Client gracefully disconnected (rx_bytes=%d/%d)\n", vpi_rx_bytes, VPI_PKT_SIZE);
+            return;
+        }
+        if (ret == 0) {
+            DBG_PRINT(1, "[VPI][INFO] Client gracefully disconnected (rx_bytes=%d/%d)\n", vpi_rx_bytes, VPI_PKT_SIZE);
+            close_connection();
+            return;
+        }
+        if (vpi_rx_bytes == 0) {
+            vpi_rx_since[vpi_rx_tail] = vpi_metrics::now_ns();
+        }
+        vpi_rx_bytes += ret;
+        DBG_PRINT(2, "[VPI][DBG] Received %zd bytes in continue_vpi_work, total=%d\n", ret, vpi_rx_bytes);
+        uint32_t cmd = le32_to_host(slot.cmd_buf);
+        if (vpi_rx_bytes == BATCH_HDR_SIZE && vpi_batch_enabled && !batch && cmd == CMD_BATCH) {
+            // Batch header complete: the op list length follows cmd
+            uint32_t len = le32_to_host(slot.buffer_out);
+            if (len > BATCH_MAX_BYTES) {
+                printf("[VPI] CMD_BATCH frame too large (%u > %u bytes), closing connection\n", len, BATCH_MAX_BYTES);
                 close_connection();
                 return;
             }
-            vpi_rx_bytes += ret;
-            DBG_PRINT(2, "[VPI][DBG] Received %zd bytes in continue_vpi_work, total=%d\n", ret, vpi_rx_bytes);
-            if (vpi_rx_bytes < VPI_PKT_SIZE) {
+            payload.resize(len);
+            frame = BATCH_HDR_SIZE + len;
+        }
+        if (vpi_rx_bytes < frame) {
+            if (vpi_rx_bytes < want) {
                 return; // wait for rest of packet
             }
+            continue;   // header complete, read the body
         }
 
-        // Full packet received - process it
-        DBG_PRINT(2, "[VPI][DBG] Full packet received in continue_vpi_work, processing...\n");
-        process_vpi_packet();
-        DBG_PRINT(2, "[VPI][DBG] Packet processed in continue_vpi_work, resetting buffer\n");
         vpi_rx_bytes = 0;
-        memset(&vpi_cmd_rx, 0, sizeof(vpi_cmd_rx));
+        vpi_rx_tail = (vpi_rx_tail + 1) % VPI_RX_DEPTH;
+        vpi_rx_count++;
+        if (cmd == 6 || cmd == 7) {
+            vpi_rx_hold = true;
+        }
+        DBG_PRINT(2, "[VPI][DBG] Packet queued (cmd=%u, depth=%u)\n", cmd, vpi_rx_count);
+    }
+}
+
+JtagVpiServer::ShmLink::~ShmLink() {
+    if (region) {
+        munmap(region, sizeof(jvpi_shm_region));
+    }
+    if (doorbell >= 0) {
+        close(doorbell);
+    }
+    if (client_bell >= 0) {
+        close(client_bell);
+    }
+}
+
+// Shared-memory handshake: map a fresh region and send it, with the two
+// doorbells, attached to the reply. Returns false (reply left to the caller)
+// when this session cannot switch: TCP, network thread, or socket traffic
+// still queued in either direction.
+bool JtagVpiServer::start_shm() {
+#ifdef __linux__
+    if (unix_path.empty() || io_threaded || shm || !tx_idle() || vpi_rx_count > 0 || vpi_rx_bytes > 0) {
+        return false;
+    }
+    std::unique_ptr<ShmLink> link(new ShmLink);
+    int memfd = memfd_create("jtag_vpi_shm", MFD_CLOEXEC);
+    if (memfd < 0) {
+        printf("[VPI] memfd_create failed: %s\n", strerror(errno));
+        return false;
+    }
+    void* map = MAP_FAILED;
+    if (ftruncate(memfd, sizeof(jvpi_shm_region)) == 0) {
+        map = mmap(nullptr, sizeof(jvpi_shm_region), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    }
+    if (map != MAP_FAILED) {
+        link->region = static_cast<jvpi_shm_region*>(map);
+    }
+    link->doorbell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    link->client_bell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (!link->region || link->doorbell < 0 || link->client_bell < 0) {
+        printf("[VPI] Shared-memory setup failed: %s\n", strerror(errno));
+        close(memfd);
+        return false;
+    }
+    memcpy(link->region->magic, JVPI_SHM_MAGIC, sizeof(link->region->magic));
+    link->region->version = JVPI_SHM_VERSION;
+    link->region->slots = JVPI_SHM_SLOTS;
+
+    begin_response(1, 0, 0, 20);
+    memcpy(vpi_cmd_tx.buffer_in, JVPI_SHM_MAGIC, sizeof(JVPI_SHM_MAGIC));
+    host_to_le32(vpi_cmd_tx.buffer_in + 12, JVPI_SHM_VERSION);
+    host_to_le32(vpi_cmd_tx.buffer_in + 16, JVPI_SHM_SLOTS);
+
+    int fds[3] = {memfd, link->doorbell, link->client_bell};
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(fds))];
+    } ctl;
+    memset(&ctl, 0, sizeof(ctl));
+    struct iovec iov[5];
+    int iov_cnt = response_iov(iov);
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iov_cnt;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+    struct cmsghdr* c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(c), fds, sizeof(fds));
+    if (recorder) {
+        // A replay has no shared memory to offer and declines instead
+        recorder->record_iov(vpi_record::REC_TX_UNCHECKED, session_id, sim_clock ? sim_clock() : 0,
+                             iov, iov_cnt, VPI_PKT_SIZE);
+    }
+    ssize_t sent = sendmsg(client_sock, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+    close(memfd);  // the mapping and the client's copy keep the region alive
+    if (sent <= 0) {
+        DBG_PRINT(1, "[VPI][WARN] Shared-memory reply not sent: %s\n", strerror(errno));
+        return false;
+    }
+    session_stats.tx_bytes += VPI_PKT_SIZE;
+    if ((size_t)sent < VPI_PKT_SIZE) {
+        // The descriptors went with the first byte; the rest is ordinary data
+        hold_tx(iov, iov_cnt, (size_t)sent);
+        tx_ready = false;
+        watch_writable(true);
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = link->doorbell;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, link->doorbell, &ev);
+    shm = std::move(link);
+    printf("[VPI] Session %d switched to shared memory (%d-slot rings)\n", session_id, JVPI_SHM_SLOTS);
+    fflush(stdout);
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool JtagVpiServer::shm_ready(const ShmLink* link) {
+    if (!link) {
+        return false;
+    }
+    const jvpi_shm_region* r = link->region;
+    return jvpi_shm_load(&r->cmd.tail) != r->cmd.head &&
+           r->resp.tail - jvpi_shm_load(&r->resp.head) < JVPI_SHM_SLOTS;
+}
+
+// Mark every shm session asleep (or awake again). Arming returns true if a
+// command was posted before a client could see the flag, so the caller must
+// not block.
+bool JtagVpiServer::shm_arm_sleep(bool sleeping) {
+    bool any = false;
+    if (shm) {
+        jvpi_shm_store(&shm->region->cmd.sleeping, sleeping);
+        any = true;
+    }
+    for (Session& sess : parked) {
+        if (sess.shm) {
+            jvpi_shm_store(&sess.shm->region->cmd.sleeping, sleeping);
+            any = true;
+        }
+    }
+    if (!sleeping || !any) {
+        return false;
+    }
+    jvpi_shm_fence();
+    return shm_ready(shm.get()) || others_waiting();
+}
+
+// Publish one response packet and ring the client if it sleeps on the ring.
+// vpi_work_step() only takes a command while the resp ring has room.
+void JtagVpiServer::shm_push_resp(const struct iovec* iov, int cnt) {
+    jvpi_shm_ring& ring = shm->region->resp;
+    size_t len = 0;
+    for (int i = 0; i < cnt; i++) {
+        len += iov[i].iov_len;
+    }
+    if (len != VPI_PKT_SIZE || ring.tail - jvpi_shm_load(&ring.head) >= JVPI_SHM_SLOTS) {
+        DBG_PRINT(1, "[VPI][WARN] Shared-memory response dropped (%zu bytes)\n", len);
+        return;
+    }
+    uint8_t* slot = shm->region->resp_slot[ring.tail % JVPI_SHM_SLOTS];
+    for (int i = 0; i < cnt; i++) {
+        memcpy(slot, iov[i].iov_base, iov[i].iov_len);
+        slot += iov[i].iov_len;
+    }
+    jvpi_shm_store(&ring.tail, ring.tail + 1);
+    jvpi_shm_fence();
+    if (jvpi_shm_load(&ring.sleeping)) {
+        uint64_t one = 1;
+        ssize_t r = write(shm->client_bell, &one, sizeof(one));
+        (void)r;
     }
 }
 
 void JtagVpiServer::process_command(vpi_cmd* cmd, vpi_resp* resp) {
     memset(resp, 0, sizeof(*resp));
+    turn_commands++;
+    session_stats.commands++;
 
     // Convert length from network byte order (big-endian) to host byte order
     uint32_t length = ntohl(cmd->length);
+    metrics_begin(CLASS_LEGACY, (cmd->cmd == 0x02 || cmd->cmd == 0x06) ? length : 0, cmd->cmd, length);
 
     static int debug_cmds = 0;
     if (debug_cmds < 10) {
@@ -922,7 +2672,7 @@ void JtagVpiServer::process_command(vpi_cmd* cmd, vpi_resp* resp) {
     }
 
     // Validate command - if we see garbage commands with huge lengths, we're out of sync
-    if (cmd->cmd > 0x0F || (length > 4096 && cmd->cmd != 0x02)) {
+    if (cmd->cmd > 0x0F || (length > 4096 && cmd->cmd != 0x02 && cmd->cmd != 0x06)) {
         resp->response = 1;  // Error
         return;
     }
@@ -931,10 +2681,9 @@ void JtagVpiServer::process_command(vpi_cmd* cmd, vpi_resp* resp) {
     switch (cmd->cmd) {
         case 0x00:  // CMD_RESET - JTAG reset
             // Reset JTAG state machine - set TMS high for 5+ clocks
-            reset_pulses_remaining = 6;
-            pending_tms = 1;
-            pending_tdi = 0;
-            pending_tck_pulse = true;  // kick off the first pulse immediately
+            if (!execute_reset()) {
+                tck_ops.push_pulses(1, 0, RESET_TCK_PULSES);
+            }
             // Send simple ACK response
             resp->response = 0;  // OK
             resp->tdo_val = current_tdo;
@@ -958,6 +2707,12 @@ void JtagVpiServer::process_command(vpi_cmd* cmd, vpi_resp* resp) {
             resp->response = 0;  // OK
             break;
 
+        case 0x06:  // CMD_SCAN_STREAM - unbounded scan, (TMS, TDI) byte pairs follow
+            start_stream(length, true, false);
+            resp->response = 0;  // OK
+            resp->tdo_val = current_tdo;
+            break;
+
         case 0x05:  // CMD_OSCAN1 - two-wire operation (legacy protocol path)
             // In legacy 8-byte protocol, we don't have payload yet
             // For now, just ACK and let higher level handle it
@@ -970,23 +2725,9 @@ void JtagVpiServer::process_command(vpi_cmd* cmd, vpi_resp* resp) {
             break;
     }
 
-    // Send response back to client (non-blocking with timeout)
+    // Send response back to client (queued until EPOLLOUT if the socket is full)
     if (send_resp && client_sock >= 0) {
-        ssize_t ret = send(client_sock, resp, sizeof(*resp), MSG_DONTWAIT);
-        if (ret < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                // Socket buffer full - try again after a small delay
-                usleep(1000); // 1ms delay
-                ret = send(client_sock, resp, sizeof(*resp), MSG_DONTWAIT);
-                if (ret < 0) {
-                    DBG_PRINT(1, "[VPI][DBG] Send retry failed: %s, closing connection\n", strerror(errno));
-                    close_connection();
-                }
-            } else {
-                DBG_PRINT(1, "[VPI][DBG] Send error: %s, closing connection\n", strerror(errno));
-                close_connection();
-            }
-        }
+        queue_tx(resp, sizeof(*resp));
     }
 }
 
@@ -1001,9 +2742,8 @@ void JtagVpiServer::process_scan(uint32_t num_bits) {
     scan_bytes_received = 0;
     scan_bytes_sent = 0;
     scan_is_legacy = true;  // Legacy protocol mode
-    memset(scan_tms_buf, 0, sizeof(scan_tms_buf));
-    memset(scan_tdi_buf, 0, sizeof(scan_tdi_buf));
-    memset(scan_tdo_buf, 0, sizeof(scan_tdo_buf));
+    scan_tms_only = false;
+    memset(scan_tdo_buf, 0, scan_num_bytes);  // TMS and TDI are received in full
 
     scan_state = SCAN_RECEIVING_TMS;
 }
@@ -1014,13 +2754,18 @@ void JtagVpiServer::continue_scan() {
     switch (scan_state) {
         case SCAN_RECEIVING_TMS:
             // Try to receive TMS buffer
-            ret = recv(client_sock, scan_tms_buf + scan_bytes_received,
-                      scan_num_bytes - scan_bytes_received, MSG_DONTWAIT);
+            ret = sock_recv(scan_tms_buf + scan_bytes_received,
+                           scan_num_bytes - scan_bytes_received);
             if (ret > 0) {
                 scan_bytes_received += ret;
                 if (scan_bytes_received >= scan_num_bytes) {
                     scan_bytes_received = 0;
-                    scan_state = SCAN_RECEIVING_TDI;
+                    scan_bit_index = 0;
+                    if (msb_first) {
+                        jtag_bits::reverse_bytes(scan_tms_buf, scan_num_bytes);
+                    }
+                    // TMS-only sequences have no TDI buffer: shift with TDI low
+                    scan_state = scan_tms_only ? SCAN_PROCESSING : SCAN_RECEIVING_TDI;
                 }
             } else if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
                 scan_state = SCAN_IDLE;
@@ -1030,12 +2775,15 @@ void JtagVpiServer::continue_scan() {
 
         case SCAN_RECEIVING_TDI:
             // Try to receive TDI buffer
-            ret = recv(client_sock, scan_tdi_buf + scan_bytes_received,
-                      scan_num_bytes - scan_bytes_received, MSG_DONTWAIT);
+            ret = sock_recv(scan_tdi_buf + scan_bytes_received,
+                           scan_num_bytes - scan_bytes_received);
             if (ret > 0) {
                 scan_bytes_received += ret;
                 if (scan_bytes_received >= scan_num_bytes) {
                     scan_bit_index = 0;
+                    if (msb_first) {
+                        jtag_bits::reverse_bytes(scan_tdi_buf, scan_num_bytes);
+                    }
                     scan_state = SCAN_PROCESSING;
                 }
             } else if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
@@ -1045,45 +2793,40 @@ void JtagVpiServer::continue_scan() {
             break;
 
         case SCAN_PROCESSING:
+            // The buffers are LSB-first here whatever --msb-first says (they are
+            // reordered once on the way in, and TDO once on the way out).
             // State machine for processing bits:
-            // 1. If pending_tck_pulse is true: TCK pulse is in progress, wait for it to complete
-            // 2. If pending_tck_pulse is false and scan_bit_index > 0: capture TDO from last bit
-            // 3. Request TCK pulse for next bit
+            // 1. If tck_ops is not empty: TCK pulse is in progress, wait for it to complete
+            // 2. Once it is empty and scan_bit_index > 0: capture TDO from last bit
+            // 3. Queue the TCK pulse for the next bit
 
-            DBG_PRINT(2, "[VPI][DBG] SCAN_PROCESSING: bit_index=%u/%u, pending_tck=%d\n",
-                scan_bit_index, scan_num_bits, pending_tck_pulse);
+            DBG_PRINT(2, "[VPI][DBG] SCAN_PROCESSING: bit_index=%u/%u, queued_ops=%u\n",
+                scan_bit_index, scan_num_bits, tck_ops.size());
+
+            // Whole-scan execution: shift every bit inline through the harness pin driver
+            if (scan_bit_index == 0 && executor_ready()) {
+                execute_scan();
+            }
 
             // If a TCK pulse is still pending, wait for simulation to complete it
-            if (pending_tck_pulse) {
+            if (!tck_ops.empty()) {
                 return;
             }
 
             // TCK pulse from previous bit has completed - capture the TDO value
             if (scan_bit_index > 0) {
                 uint32_t prev_bit = scan_bit_index - 1;
-                uint32_t prev_byte_idx = prev_bit / 8;
-                uint32_t prev_bit_idx = prev_bit % 8;
-                uint32_t prev_bit_pos = msb_first ? (7 - prev_bit_idx) : prev_bit_idx;
                 if (current_tdo) {
-                    scan_tdo_buf[prev_byte_idx] |= (1 << prev_bit_pos);
+                    scan_tdo_buf[prev_bit >> 3] |= (1 << (prev_bit & 7));
                 } else {
-                    scan_tdo_buf[prev_byte_idx] &= ~(1 << prev_bit_pos);
+                    scan_tdo_buf[prev_bit >> 3] &= ~(1 << (prev_bit & 7));
                 }
             }
 
-            while (scan_bit_index < scan_num_bits && pending_tck_pulse == false) {
-                uint32_t byte_idx = scan_bit_index / 8;
-                uint32_t bit_idx = scan_bit_index % 8;
-                uint32_t bit_pos = msb_first ? (7 - bit_idx) : bit_idx;
-
-                // Extract TMS and TDI from buffers
-                uint8_t tms_bit = (scan_tms_buf[byte_idx] >> bit_pos) & 1;
-                uint8_t tdi_bit = (scan_tdi_buf[byte_idx] >> bit_pos) & 1;
-
+            while (scan_bit_index < scan_num_bits && tck_ops.empty()) {
                 // Request TCK pulse for this bit
-                pending_tms = tms_bit;
-                pending_tdi = tdi_bit;
-                pending_tck_pulse = true;
+                tck_ops.push_pulses(jtag_bits::get_bit(scan_tms_buf, scan_bit_index),
+                                    jtag_bits::get_bit(scan_tdi_buf, scan_bit_index), 1);
                 scan_bit_index++;
                 return;  // Return to let simulation execute the TCK pulse
             }
@@ -1093,18 +2836,32 @@ void JtagVpiServer::continue_scan() {
                 // Capture the last TDO bit
                 if (scan_bit_index > 0) {
                     uint32_t last_bit = scan_bit_index - 1;
-                    uint32_t last_byte_idx = last_bit / 8;
-                    uint32_t last_bit_idx = last_bit % 8;
-                    uint32_t last_bit_pos = msb_first ? (7 - last_bit_idx) : last_bit_idx;
                     if (current_tdo) {
-                        scan_tdo_buf[last_byte_idx] |= (1 << last_bit_pos);
+                        scan_tdo_buf[last_bit >> 3] |= (1 << (last_bit & 7));
                     } else {
-                        scan_tdo_buf[last_byte_idx] &= ~(1 << last_bit_pos);
+                        scan_tdo_buf[last_bit >> 3] &= ~(1 << (last_bit & 7));
                     }
                 }
                 DBG_PRINT(2, "[VPI][DBG] SCAN_PROCESSING complete: %u bits processed\n", scan_bit_index);
+                if (scan_tdo_bits > 0 && !scan_is_legacy) {
+                    // CMD_SCAN_IR/DR: drop the TDO of the path bits around the data
+                    jtag_bits::copy_bits(scan_tdo_buf, 0, scan_tdo_buf, scan_tdo_skip, scan_tdo_bits);
+                    scan_num_bits = scan_tdo_bits;
+                    scan_num_bytes = (scan_tdo_bits + 7) / 8;
+                    if (scan_tdo_bits & 7) {
+                        scan_tdo_buf[scan_num_bytes - 1] &= (uint8_t)((1u << (scan_tdo_bits & 7)) - 1);
+                    }
+                    scan_tdo_bits = 0;
+                }
+                if (msb_first && !scan_tms_only) {
+                    jtag_bits::reverse_bytes(scan_tdo_buf, scan_num_bytes);
+                }
 
-                if (scan_is_legacy) {
+                if (scan_tms_only) {
+                    // TMS sequence: nothing to return
+                    scan_tms_only = false;
+                    scan_state = SCAN_IDLE;
+                } else if (scan_is_legacy) {
                     // Legacy protocol: Send TDO bytes directly over socket
                     scan_bytes_sent = 0;
                     scan_state = SCAN_SENDING_TDO;
@@ -1118,61 +2875,32 @@ void JtagVpiServer::continue_scan() {
 
         case SCAN_SENDING_TDO:
             DBG_PRINT(2, "[VPI][DBG] SCAN_SENDING_TDO: %u/%u bytes sent\n", scan_bytes_sent, scan_num_bytes);
-            // Send TDO buffer as response packets
-            // Send up to all bytes in one go since non-blocking might handle it
-            ret = send(client_sock, scan_tdo_buf + scan_bytes_sent,
-                      scan_num_bytes - scan_bytes_sent, MSG_DONTWAIT);
-            if (ret > 0) {
-                scan_bytes_sent += ret;
-                if (scan_bytes_sent >= scan_num_bytes) {
-                    DBG_PRINT(2, "[VPI][DBG] SCAN_SENDING_TDO complete: %u bytes sent\n", scan_bytes_sent);
-                    static int debug_scans = 0;
-                    if (debug_scans < 3) {
-                        printf("[VPI][DBG] SCAN bits=%u bytes=%u TDO[0]=0x%02x TDO[1]=0x%02x\n",
-                               scan_num_bits,
-                               scan_num_bytes,
-                               scan_tdo_buf[0],
-                               scan_tdo_buf[1]);
-                        debug_scans++;
-                    }
-                    scan_state = SCAN_IDLE;
-                }
-            } else if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
-                // Classify different error types
-                const char* error_type = "UNKNOWN";
-                bool should_close = true;
-
-                switch (errno) {
-                    case EPIPE:
-                        error_type = "BROKEN_PIPE";
-                        break;
-                    case ECONNRESET:
-                        error_type = "CONNECTION_RESET";
-                        break;
-                    case ENOTCONN:
-                        error_type = "NOT_CONNECTED";
-                        break;
-                    case EINTR:
-                        error_type = "INTERRUPTED";
-                        should_close = false;  // Recoverable
-                        break;
-                    default:
-                        error_type = "OTHER";
-                        break;
+            // Send TDO buffer as one response; any remainder drains on EPOLLOUT
+            if (!queue_tx(scan_tdo_buf, scan_num_bytes)) {
+                break;
+            }
+            scan_bytes_sent = scan_num_bytes;
+            DBG_PRINT(2, "[VPI][DBG] SCAN_SENDING_TDO complete: %u bytes sent\n", scan_bytes_sent);
+            {
+                static int debug_scans = 0;
+                if (debug_scans < 3) {
+                    printf("[VPI][DBG] SCAN bits=%u bytes=%u TDO[0]=0x%02x TDO[1]=0x%02x\n",
+                           scan_num_bits,
+                           scan_num_bytes,
+                           scan_tdo_buf[0],
+                           scan_tdo_buf[1]);
+                    debug_scans++;
                 }
+            }
+            scan_state = SCAN_IDLE;
+            break;
 
-                DBG_PRINT(1, "[VPI][WARN] TDO send error (%s) during SCAN: errno=%d, %s, sent=%u/%u bytes%s\n",
-                          error_type, errno, strerror(errno), scan_bytes_sent, scan_num_bytes,
-                          should_close ? ", closing connection" : ", retrying");
+        case SCAN_STREAMING:
+            continue_stream();
+            break;
 
-                if (should_close) {
-                    scan_state = SCAN_IDLE;
-                    close_connection();
-                } else {
-                    // For recoverable errors, don't change scan state and try again later
-                    usleep(1000); // 1ms delay
-                }
-            }
+        case SCAN_BATCH:
+            continue_batch();
             break;
 
         default:
@@ -1181,13 +2909,669 @@ void JtagVpiServer::continue_scan() {
     }
 }
 
+void JtagVpiServer::start_stream(uint32_t num_bits, bool tms_explicit, bool flip_tms) {
+    if (num_bits == 0) {
+        vpi_rx_hold = false;  // no payload follows
+        return;
+    }
+
+    stream_tms_explicit = tms_explicit;
+    stream_flip_tms = flip_tms;
+    stream_num_bits = num_bits;
+    stream_bits_done = 0;
+    stream_chunk_bits = 0;
+    stream_chunk_pos = 0;
+    stream_pulse_issued = false;
+    stream_in_bytes = 0;
+    scan_is_legacy = true;  // TDO goes back as raw bytes
+    scan_tms_only = false;
+    scan_state = SCAN_STREAMING;
+    DBG_PRINT(1, "[VPI][DBG] Streaming scan: %u bits (%s)\n", num_bits,
+              tms_explicit ? "TMS/TDI pairs" : (flip_tms ? "TDI, TMS on last bit" : "TDI"));
+}
+
+// TMS/TDI for bit `pos` of the loaded stream chunk (LSB-first, see continue_stream)
+void JtagVpiServer::stream_bit(uint32_t pos, uint8_t* tms, uint8_t* tdi) const {
+    uint32_t byte_idx = pos >> 3;
+    uint32_t bit_pos = pos & 7;
+
+    if (stream_tms_explicit) {
+        *tms = (stream_in_buf[2 * byte_idx] >> bit_pos) & 1;
+        *tdi = (stream_in_buf[2 * byte_idx + 1] >> bit_pos) & 1;
+    } else {
+        *tms = (stream_flip_tms && stream_bits_done + pos == stream_num_bits - 1) ? 1 : 0;
+        *tdi = (stream_in_buf[byte_idx] >> bit_pos) & 1;
+    }
+}
+
+// Advance a streaming scan: shift the loaded chunk, hand its TDO to the TX path,
+// then pull the next chunk off the socket. Only one chunk of input and at most
+// STREAM_CHUNK bytes of unsent TDO are ever held, whatever the scan length.
+void JtagVpiServer::continue_stream() {
+    const uint32_t step = stream_tms_explicit ? 2 : 1;
+    uint8_t tms, tdi;
+
+    // 1) Shift the loaded chunk
+    if (stream_chunk_pos < stream_chunk_bits) {
+        if (!stream_pulse_issued && executor_ready()) {
+            while (stream_chunk_pos < stream_chunk_bits) {
+                stream_bit(stream_chunk_pos, &tms, &tdi);
+                current_tdo = clock_tck(tms, tdi);
+                scan_tdo_buf[stream_chunk_pos >> 3] |= (current_tdo & 1) << (stream_chunk_pos & 7);
+                stream_chunk_pos++;
+            }
+        } else {
+            if (!tck_ops.empty()) {
+                return;
+            }
+            // Pulse for stream_chunk_pos has completed - capture its TDO
+            if (stream_pulse_issued) {
+                scan_tdo_buf[stream_chunk_pos >> 3] |= (current_tdo & 1) << (stream_chunk_pos & 7);
+                stream_pulse_issued = false;
+                stream_chunk_pos++;
+            }
+            if (stream_chunk_pos < stream_chunk_bits) {
+                stream_bit(stream_chunk_pos, &tms, &tdi);
+                tck_ops.push_pulses(tms, tdi, 1);
+                stream_pulse_issued = true;
+                return;
+            }
+        }
+    }
+
+    // 2) Chunk shifted: return its TDO and drop the consumed input
+    if (stream_chunk_bits > 0) {
+        uint32_t chunk_bytes = (stream_chunk_bits + 7) / 8;
+        if (msb_first) {
+            jtag_bits::reverse_bytes(scan_tdo_buf, chunk_bytes);
+        }
+        if (!queue_tx(scan_tdo_buf, chunk_bytes)) {
+            return;
+        }
+        stream_bits_done += stream_chunk_bits;
+        stream_in_bytes -= chunk_bytes * step;
+        memmove(stream_in_buf, stream_in_buf + chunk_bytes * step, stream_in_bytes);
+        stream_chunk_bits = 0;
+        stream_chunk_pos = 0;
+        if (stream_bits_done >= stream_num_bits) {
+            DBG_PRINT(1, "[VPI][DBG] Streaming scan complete: %u bits\n", stream_bits_done);
+            scan_state = SCAN_IDLE;
+            vpi_rx_hold = false;  // payload consumed, packets follow again
+            return;
+        }
+    }
+
+    // 3) Let the client drain TDO before consuming more input
+    if (tx_ring.used() >= STREAM_CHUNK) {
+        return;
+    }
+
+    // 4) Receive input for the next chunk
+    // 64-bit: near 0xFFFFFFFF bits the + 7 would wrap to 0 and stall the stream
+    uint64_t bytes_left = ((uint64_t)stream_num_bits - stream_bits_done + 7) / 8;
+    uint32_t want = (bytes_left < STREAM_CHUNK ? (uint32_t)bytes_left : STREAM_CHUNK) * step;
+    if (stream_in_bytes < want) {
+        ssize_t ret = sock_recv(stream_in_buf + stream_in_bytes, want - stream_in_bytes);
+        if (ret == 0) {
+            DBG_PRINT(1, "[VPI][INFO] Client disconnected during streaming scan (%u/%u bits)\n",
+                      stream_bits_done, stream_num_bits);
+            close_connection();
+            return;
+        }
+        if (ret < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                DBG_PRINT(1, "[VPI][WARN] Recv error during streaming scan: %s\n", strerror(errno));
+                close_connection();
+                return;
+            }
+        } else {
+            stream_in_bytes += ret;
+        }
+    }
+
+    // Start shifting as soon as whole bytes are available; the rest follows later
+    uint32_t ready = stream_in_bytes / step;
+    if (ready == 0) {
+        return;
+    }
+    uint32_t bits_left = stream_num_bits - stream_bits_done;
+    stream_chunk_bits = (ready * 8 < bits_left) ? ready * 8 : bits_left;
+    stream_chunk_pos = 0;
+    memset(scan_tdo_buf, 0, (stream_chunk_bits + 7) / 8);
+    // Shift the chunk LSB-first; its TDO is put back in order before sending
+    if (msb_first) {
+        jtag_bits::reverse_bytes(stream_in_buf, (stream_chunk_bits + 7) / 8 * step);
+    }
+}
+
+// Bytes of TMS/TDI data that follow an op header
+uint32_t JtagVpiServer::batch_data_bytes(uint8_t op, uint32_t bits) {
+    switch (op & BATCH_OP_MASK) {
+        case BATCH_TMS_SEQ:
+            return (uint32_t)(((uint64_t)bits + 7) / 8);
+        case BATCH_SCAN:
+        case BATCH_SCAN_FLIP:
+            return (op & BATCH_TDI_ONES) ? 0 : (uint32_t)(((uint64_t)bits + 7) / 8);
+        default:
+            return 0;
+    }
+}
+
+// Bytes of TDO an op contributes to the reply
+uint32_t JtagVpiServer::batch_tdo_bytes(uint8_t op, uint32_t bits) {
+    uint8_t kind = op & BATCH_OP_MASK;
+    if ((kind != BATCH_SCAN && kind != BATCH_SCAN_FLIP) || (op & BATCH_NO_TDO)) {
+        return 0;
+    }
+    return (uint32_t)(((uint64_t)bits + 7) / 8);
+}
+
+// Validate the received op list and enter SCAN_BATCH. Returns false if the list
+// is truncated, holds an unknown op, or asks for more than BATCH_MAX_BYTES of
+// TDO or BATCH_MAX_CLOCKS cycles.
+bool JtagVpiServer::start_batch() {
+    size_t pos = 0;
+    size_t tdo_bytes = 0;
+    uint64_t clocks = 0;
+    uint32_t num_ops = 0;
+    while (pos < batch_ops.size()) {
+        if (batch_ops.size() - pos < 5 || (batch_ops[pos] & BATCH_OP_MASK) > BATCH_IDLE) {
+            return false;
+        }
+        uint8_t op = batch_ops[pos];
+        uint32_t bits = le32_to_host(&batch_ops[pos + 1]);
+        size_t data = batch_data_bytes(op, bits);
+        if (batch_ops.size() - pos - 5 < data) {
+            return false;
+        }
+        tdo_bytes += batch_tdo_bytes(op, bits);
+        clocks += bits;
+        if (tdo_bytes > BATCH_MAX_BYTES || clocks > BATCH_MAX_CLOCKS) {
+            return false;
+        }
+        if ((op & BATCH_OP_MASK) == BATCH_SCAN || (op & BATCH_OP_MASK) == BATCH_SCAN_FLIP) {
+            cmd_sample.bits += bits;
+        }
+        // Scan data follows --msb-first; shift it LSB-first like TMS_SEQ data
+        if (msb_first && (op & BATCH_OP_MASK) != BATCH_TMS_SEQ) {
+            jtag_bits::reverse_bytes(&batch_ops[pos + 5], data);
+        }
+        pos += 5 + data;
+        num_ops++;
+    }
+
+    run_batch();
+    DBG_PRINT(1, "[VPI][DBG] CMD_BATCH: %u ops, %zu TDO bytes\n", num_ops, tdo_bytes);
+    return true;
+}
+
+// Enter SCAN_BATCH for the op list in batch_ops (already validated)
+void JtagVpiServer::run_batch() {
+    size_t tdo_bytes = 0;
+    for (size_t pos = 0; pos < batch_ops.size();) {
+        uint32_t bits = le32_to_host(&batch_ops[pos + 1]);
+        tdo_bytes += batch_tdo_bytes(batch_ops[pos], bits);
+        pos += 5 + batch_data_bytes(batch_ops[pos], bits);
+    }
+    batch_tdo.assign(tdo_bytes, 0);
+    batch_op_pos = 0;
+    batch_bit_index = 0;
+    batch_tdo_pos = 0;
+    batch_pulse_issued = false;
+    batch_advance();
+    scan_is_legacy = true;  // reply is sent by continue_batch(), not as a 1036-byte packet
+    scan_tms_only = false;
+    scan_state = SCAN_BATCH;
+}
+
+// Append one op to batch_ops (server-built lists, LSB-first data)
+void JtagVpiServer::batch_push(uint8_t op, uint32_t bits, const uint8_t* data, uint32_t len) {
+    uint8_t hdr[5] = {op};
+    host_to_le32(hdr + 1, bits);
+    batch_ops.insert(batch_ops.end(), hdr, hdr + sizeof(hdr));
+    if (len) {
+        batch_ops.insert(batch_ops.end(), data, data + len);
+    }
+}
+
+// TMS/TDI for the next bit of the batch; false once every op has run
+bool JtagVpiServer::batch_bit(uint8_t* tms, uint8_t* tdi) const {
+    if (batch_op_pos >= batch_ops.size()) {
+        return false;
+    }
+    const uint8_t* p = &batch_ops[batch_op_pos];
+    const uint8_t* data = p + 5;
+    uint32_t bits = le32_to_host(p + 1);
+    uint32_t i = batch_bit_index;
+
+    switch (p[0] & BATCH_OP_MASK) {
+        case BATCH_TMS_SEQ:
+            *tms = (data[i / 8] >> (i % 8)) & 1;
+            *tdi = 0;
+            break;
+        case BATCH_IDLE:
+            *tms = 0;
+            *tdi = 0;
+            break;
+        default: {
+            *tdi = (p[0] & BATCH_TDI_ONES) ? 1 : jtag_bits::get_bit(data, i);
+            *tms = ((p[0] & BATCH_OP_MASK) == BATCH_SCAN_FLIP && i == bits - 1) ? 1 : 0;
+            break;
+        }
+    }
+    return true;
+}
+
+// Record TDO for the bit just shifted and step to the next one
+void JtagVpiServer::batch_capture(uint8_t tdo) {
+    const uint8_t* p = &batch_ops[batch_op_pos];
+    if (tdo && batch_tdo_bytes(p[0], 1)) {
+        uint32_t i = batch_bit_index;
+        batch_tdo[batch_tdo_pos + (i >> 3)] |= (1 << (i & 7));
+    }
+    batch_bit_index++;
+    batch_advance();
+}
+
+// Move past completed (and zero-length) ops
+void JtagVpiServer::batch_advance() {
+    while (batch_op_pos < batch_ops.size()) {
+        uint8_t op = batch_ops[batch_op_pos];
+        uint32_t bits = le32_to_host(&batch_ops[batch_op_pos + 1]);
+        if (batch_bit_index < bits) {
+            return;
+        }
+        batch_op_pos += 5 + batch_data_bytes(op, bits);
+        batch_tdo_pos += batch_tdo_bytes(op, bits);
+        batch_bit_index = 0;
+    }
+}
+
+// Run a CMD_BATCH op list, then return every captured TDO byte in one reply
+void JtagVpiServer::continue_batch() {
+    uint8_t tms, tdi;
+
+    if (!batch_pulse_issued && executor_ready()) {
+        while (batch_bit(&tms, &tdi)) {
+            current_tdo = clock_tck(tms, tdi);
+            batch_capture(current_tdo);
+        }
+    } else {
+        if (!tck_ops.empty()) {
+            return;
+        }
+        if (batch_pulse_issued) {
+            batch_capture(current_tdo);
+            batch_pulse_issued = false;
+        }
+        if (batch_bit(&tms, &tdi)) {
+            tck_ops.push_pulses(tms, tdi, 1);
+            batch_pulse_issued = true;
+            return;
+        }
+    }
+
+    if (dtm_job != DTM_NONE) {
+        dtm_continue();  // the server's own DMI scans: no CMD_BATCH reply
+        return;
+    }
+    if (msb_first) {
+        jtag_bits::reverse_bytes(batch_tdo.data(), batch_tdo.size());
+    }
+    uint8_t hdr[BATCH_HDR_SIZE];
+    host_to_le32(hdr, CMD_BATCH);
+    host_to_le32(hdr + 4, (uint32_t)batch_tdo.size());
+    struct iovec iov[2] = {{hdr, sizeof(hdr)}, {batch_tdo.data(), batch_tdo.size()}};
+    if (!queue_txv(iov, batch_tdo.empty() ? 1 : 2)) {
+        return;
+    }
+    DBG_PRINT(1, "[VPI][DBG] CMD_BATCH complete: %zu TDO bytes\n", batch_tdo.size());
+    scan_state = SCAN_IDLE;
+}
+
+// Batch ops that load DMI into the IR, from wherever the TAP is to Run-Test/Idle.
+// As in CMD_SCAN_IR/DR, the clock leaving Capture shifts nothing, so the TDI
+// bits go one clock later.
+void JtagVpiServer::dtm_select_dmi() {
+    uint8_t path[TAP_PATH_MAX / 8] = {};
+    uint32_t pre = tap_path(tap_state, TAP_IR_CAPTURE, path);
+    uint8_t ir = DTM_IR_DMI << 1;
+    uint8_t update = 0x01;  // TMS 1, 0: Update-IR, Run-Test/Idle
+    batch_push(BATCH_TMS_SEQ, pre, path, (pre + 7) / 8);
+    batch_push(BATCH_SCAN_FLIP | BATCH_NO_TDO, DTM_IR_BITS + 1, &ir, 1);
+    batch_push(BATCH_TMS_SEQ, 2, &update, 1);
+}
+
+// Batch ops for one DMI request: Run-Test/Idle to Capture-DR, the 41-bit DMI
+// register, Update-DR and dtmcs.idle cycles back in Run-Test/Idle
+void JtagVpiServer::dtm_push_scan(uint8_t op, uint8_t addr, uint32_t wdata) {
+    uint64_t dmi = ((uint64_t)(addr & 0x7f) << 34) | ((uint64_t)wdata << 2) | (op & 3);
+    uint8_t tdi[6];
+    for (int i = 0; i < 6; i++) {
+        tdi[i] = (uint8_t)((dmi << 1) >> (8 * i));
+    }
+    uint8_t tms = 0x01;  // TMS 1, 0: Select-DR, Capture-DR (then Update-DR, Run-Test/Idle)
+    batch_push(BATCH_TMS_SEQ, 2, &tms, 1);
+    batch_push(BATCH_SCAN_FLIP, DTM_DMI_BITS + 1, tdi, sizeof(tdi));
+    batch_push(BATCH_TMS_SEQ, 2, &tms, 1);
+    batch_push(BATCH_IDLE, DTM_IDLE_CYCLES, nullptr, 0);
+}
+
+// Data field of the DMI register captured by DR scan `scan` of the batch just
+// run. jtag_dtm captures the op there, not a status, so there is no response.
+uint32_t JtagVpiServer::dtm_rdata(uint32_t scan) const {
+    const uint8_t* tdo = &batch_tdo[scan * 6];
+    uint64_t dmi = 0;
+    for (int i = 0; i < 6; i++) {
+        dmi |= (uint64_t)tdo[i] << (8 * i);
+    }
+    return (uint32_t)(dmi >> 2);
+}
+
+// A DTM job's batch has run: take its results, then queue more scans or reply
+void JtagVpiServer::dtm_continue() {
+    if (dtm_job == DTM_SBA) {
+        dtm_sba_step();
+    } else {
+        dtm_poll_step();
+    }
+}
+
+void JtagVpiServer::dtm_poll_step() {
+    uint32_t tcks = (uint32_t)(tck_cycles - dtm_tck_start);
+    uint32_t rdata = 0;
+    bool matched = false;
+    // Each poll batch is one read; from the second on it returns the previous one
+    if (dtm_scans++ > 0) {
+        rdata = dtm_rdata(0);
+        dtm_poll_reads++;
+        matched = (rdata & dtm_poll_mask) == dtm_poll_expect;
+    }
+    if (!matched && (dtm_poll_reads == 0 || tcks + DTM_SCAN_TCKS <= dtm_poll_budget)) {
+        batch_ops.clear();
+        dtm_push_scan(1, dtm_poll_addr, 0);
+        run_batch();
+        return;
+    }
+    dmi_poll_reply(0, matched, rdata, tcks);
+    dtm_end();
+}
+
+// CMD_SBA_* in two batches: the dmcontrol probe, then the whole sequence
+// (after a dmactive write if the probe found it clear) and a NOP scan that
+// collects the last read. jtag_dtm reports no failed or busy requests, so
+// every word counts as done.
+void JtagVpiServer::dtm_sba_step() {
+    if (dtm_scans++ == 0) {
+        uint32_t dmcontrol = dtm_rdata(1);
+        batch_ops.clear();
+        dtm_sba_first = 0;
+        if (!(dmcontrol & riscv_dm::DMCONTROL_DMACTIVE)) {
+            dtm_push_scan(2, riscv_dm::DMCONTROL, riscv_dm::DMCONTROL_DMACTIVE);
+            dtm_sba_first = 1;
+        }
+        for (const DmiReq& r : dtm_sba_reqs) {
+            dtm_push_scan(r.op, r.addr, r.wdata);
+        }
+        dtm_push_scan(0, 0, 0);
+        run_batch();
+        return;
+    }
+    uint32_t words = 0;
+    for (uint32_t k = 0; k < dtm_sba_reqs.size(); k++) {
+        const DmiReq& r = dtm_sba_reqs[k];
+        if (r.addr == riscv_dm::SBDATA0) {
+            if (r.op == 1) {
+                sba_store(vpi_cmd_tx.buffer_in, words, 1u << dtm_sba_size_log2, dtm_rdata(dtm_sba_first + k + 1));
+            }
+            words++;
+        }
+    }
+    DBG_PRINT(1, "[VPI] CMD_SBA: %u words in %zu DTM scans, %llu TCK\n", words, dtm_sba_reqs.size() + 3 + dtm_sba_first,
+              (unsigned long long)(tck_cycles - dtm_tck_start));
+    dtm_end();
+}
+
+// A DTM job is over: the DTM goes back to its default target and the reply
+// begun for the command goes out
+void JtagVpiServer::dtm_end() {
+    if (dtm_job == DTM_SBA) {
+        dtm_target_select(false);
+    }
+    dtm_job = DTM_NONE;
+    scan_state = SCAN_IDLE;
+    vpi_tx_pending = true;
+}
+
+// CMD_DMI_POLL reply in the response begun for it
+void JtagVpiServer::dmi_poll_reply(uint8_t resp, bool matched, uint32_t rdata, uint32_t tcks) {
+    vpi_cmd_tx.buffer_in[0] = resp;
+    vpi_cmd_tx.buffer_in[1] = dtm_poll_addr;
+    vpi_cmd_tx.buffer_in[2] = matched ? 1 : 0;
+    host_to_le32(vpi_cmd_tx.buffer_in + 4, rdata);
+    host_to_le32(vpi_cmd_tx.buffer_in + 8, dtm_poll_reads);
+    host_to_le32(vpi_cmd_tx.buffer_in + 12, tcks);
+    DBG_PRINT(1, "[VPI] CMD_DMI_POLL: addr=0x%02x %s after %u read(s), %u TCK, rdata=0x%08x resp=%u\n",
+              dtm_poll_addr, matched ? "matched" : "gave up", dtm_poll_reads, tcks, rdata, resp);
+}
+
+// Drive the rising TCKC edge (TMS on TMSC) of SF0 pair sf0_index
+void JtagVpiServer::start_sf0_pair() {
+    uint8_t pair = (sf0_pairs[sf0_index / 4] >> (2 * (sf0_index % 4))) & 3;
+    sf0_tdi = pair & 1;
+    sf0_tms = (pair >> 1) & 1;
+    sf0_tdo = 0;
+    tck_ops.push({TCK_OP_TCKC, sf0_tms, 0, 0, 1});  // rising edge: TMSC carries TMS
+    sf0_state = SF0_SEND_TMS;
+}
+
+// Run every remaining SF0 pair inline through the harness TCKC driver and queue
+// the response. TDO is read back on TMSC at the falling edge, as in SF0_SEND_TDI.
+void JtagVpiServer::execute_sf0() {
+    while (sf0_index < sf0_num_pairs) {
+        uint8_t pair = (sf0_pairs[sf0_index / 4] >> (2 * (sf0_index % 4))) & 3;
+        tckc_driver((pair >> 1) & 1);
+        current_tdo = tckc_driver(pair & 1);
+        if (current_tdo & 1) {
+            vpi_cmd_tx.buffer_in[sf0_index / 8] |= (1 << (sf0_index % 8));
+        }
+        sf0_index++;
+    }
+    sf0_state = SF0_IDLE;
+    vpi_tx_pending = true;
+    DBG_PRINT(2, "[VPI][DBG] SF0 executed inline (%u pairs)\n", sf0_num_pairs);
+}
+
+// Next state of jtag_tap_controller.sv for one TCK with the given TMS
+uint8_t JtagVpiServer::tap_next(uint8_t state, uint8_t tms) {
+    static const uint8_t next[TAP_NUM_STATES][2] = {
+        {TAP_IDLE, TAP_RESET},            // TAP_RESET
+        {TAP_IDLE, TAP_DR_SELECT},        // TAP_IDLE
+        {TAP_DR_CAPTURE, TAP_IR_SELECT},  // TAP_DR_SELECT
+        {TAP_DR_SHIFT, TAP_DR_EXIT1},     // TAP_DR_CAPTURE
+        {TAP_DR_SHIFT, TAP_DR_EXIT1},     // TAP_DR_SHIFT
+        {TAP_DR_PAUSE, TAP_DR_UPDATE},    // TAP_DR_EXIT1
+        {TAP_DR_PAUSE, TAP_DR_EXIT2},     // TAP_DR_PAUSE
+        {TAP_DR_SHIFT, TAP_DR_UPDATE},    // TAP_DR_EXIT2
+        {TAP_IDLE, TAP_DR_SELECT},        // TAP_DR_UPDATE
+        {TAP_IR_CAPTURE, TAP_RESET},      // TAP_IR_SELECT
+        {TAP_IR_SHIFT, TAP_IR_EXIT1},     // TAP_IR_CAPTURE
+        {TAP_IR_SHIFT, TAP_IR_EXIT1},     // TAP_IR_SHIFT
+        {TAP_IR_PAUSE, TAP_IR_UPDATE},    // TAP_IR_EXIT1
+        {TAP_IR_PAUSE, TAP_IR_EXIT2},     // TAP_IR_PAUSE
+        {TAP_IR_SHIFT, TAP_IR_UPDATE},    // TAP_IR_EXIT2
+        {TAP_IDLE, TAP_DR_SELECT},        // TAP_IR_UPDATE
+    };
+    if (state >= TAP_NUM_STATES) {
+        return TAP_UNKNOWN;  // five TMS-high clocks are needed to know again
+    }
+    return next[state][tms & 1];
+}
+
+// Shortest TMS sequence from `from` to `to` (breadth-first over the 16 states),
+// LSB-first into tms, which must be zeroed and TAP_PATH_MAX bits long. From an
+// unknown state the path starts with five TMS-high clocks to Test-Logic-Reset.
+uint32_t JtagVpiServer::tap_path(uint8_t from, uint8_t to, uint8_t* tms) {
+    uint32_t n = 0;
+    if (from >= TAP_NUM_STATES) {
+        tms[0] = 0x1F;
+        n = 5;
+        from = TAP_RESET;
+    }
+    uint8_t prev[TAP_NUM_STATES];
+    uint8_t via[TAP_NUM_STATES];
+    uint8_t queue[TAP_NUM_STATES];
+    bool seen[TAP_NUM_STATES] = {};
+    uint32_t head = 0, tail = 0;
+    queue[tail++] = from;
+    seen[from] = true;
+    while (head < tail && !seen[to]) {
+        uint8_t s = queue[head++];
+        for (uint8_t bit = 0; bit < 2; bit++) {
+            uint8_t t = tap_next(s, bit);
+            if (t < TAP_NUM_STATES && !seen[t]) {
+                seen[t] = true;
+                prev[t] = s;
+                via[t] = bit;
+                queue[tail++] = t;
+            }
+        }
+    }
+    uint8_t bits[TAP_NUM_STATES];
+    uint32_t len = 0;
+    for (uint8_t s = to; s != from; s = prev[s]) {
+        bits[len++] = via[s];
+    }
+    while (len > 0) {
+        tms[n >> 3] |= (uint8_t)(bits[--len] << (n & 7));
+        n++;
+    }
+    return n;
+}
+
+// One TCK period through the executors: a 4-wire pulse, or in cJTAG mode one SF0
+// cycle (TMS on the rising TCKC edge, TDI on the falling edge). The first cycle
+// in cJTAG mode is preceded by OAC + JScan OSCAN_ON. Returns TDO (TMSC in cJTAG).
+uint8_t JtagVpiServer::clock_tck(uint8_t tms, uint8_t tdi) {
+    tap_step(tms);
+    if (pending_mode_select == 0) {
+        return tck_driver(tms, tdi);
+    }
+    while (!oscan1_online) {
+        uint8_t tmsc = next_sf0_edge();
+        tckc_driver(tmsc);
+    }
+    tckc_driver(tms);
+    return tckc_driver(tdi);
+}
+
+// TMSC level for the next TCKC edge of the OAC/JScan preamble (per-edge path
+// and clock_tck). oscan1_controller.sv counts 16 edges as OAC, then takes
+// JScan bits LSB first from TMSC sampled one falling edge late: the last OAC
+// edge supplies bit 0 (1) and the next three falling edges bits 1-3 (0), which
+// gives OSCAN_ON on the fifth falling edge.
+uint8_t JtagVpiServer::next_sf0_edge() {
+    uint32_t cycle = oscan1_preamble_edge / 2;
+    uint8_t tmsc = (cycle < OSCAN1_OAC_CYCLES) ? 1 : 0;
+    if (++oscan1_preamble_edge == 2 * (OSCAN1_OAC_CYCLES + OSCAN1_JSCAN_CYCLES)) {
+        oscan1_preamble_edge = 0;
+        oscan1_online = true;
+        DBG_PRINT(1, "[VPI] OScan1 adapter brought up (OAC + JScan OSCAN_ON)\n");
+    }
+    return tmsc;
+}
+
+// Issue the TAP reset sequence (TMS high for 6 TCK) through the scan executor.
+// Returns false when no executor is available so the caller can queue pulses instead.
+bool JtagVpiServer::execute_reset() {
+    if (!executor_ready()) {
+        return false;
+    }
+    for (uint32_t i = 0; i < RESET_TCK_PULSES; i++) {
+        current_tdo = clock_tck(1, 0);
+    }
+    DBG_PRINT(2, "[VPI][DBG] Reset executed inline (6 TCK)\n");
+    return true;
+}
+
+// Run the remaining bits of an OpenOCD TMS sequence in one call
+void JtagVpiServer::execute_tms_seq() {
+    while (tms_seq_bit_index < tms_seq_num_bits) {
+        uint32_t i = tms_seq_bit_index++;
+        uint8_t bit = (tms_seq_buf[i / 8] >> (i % 8)) & 1;
+        current_tdo = clock_tck(bit, 0);
+    }
+    tms_seq_active = false;
+    DBG_PRINT(2, "[VPI][DBG] TMS sequence executed inline (%u bits)\n", tms_seq_num_bits);
+}
+
+// Shift a whole scan through the scan executor. TDO for each bit is sampled after
+// its TCK pulse, exactly as the per-bit engine does in SCAN_PROCESSING.
+void JtagVpiServer::execute_scan() {
+    // 64 bits at a time: TMS/TDI come out of one register each and TDO
+    // collects in another, stored once per word. scan_bit_index is 0 on entry,
+    // so words start on 8-byte boundaries and never read past the buffers.
+    while (scan_bit_index < scan_num_bits) {
+        uint32_t n = scan_num_bits - scan_bit_index;
+        if (n > 64) n = 64;
+        uint64_t tms = jtag_bits::load_word(scan_tms_buf + scan_bit_index / 8);
+        uint64_t tdi = jtag_bits::load_word(scan_tdi_buf + scan_bit_index / 8);
+        uint64_t tdo = 0;
+        for (uint32_t b = 0; b < n; b++) {
+            current_tdo = clock_tck(tms & 1, tdi & 1);
+            tdo |= (uint64_t)(current_tdo & 1) << b;
+            tms >>= 1;
+            tdi >>= 1;
+        }
+        jtag_bits::store_word(scan_tdo_buf + scan_bit_index / 8, tdo, n);
+        scan_bit_index += n;
+    }
+    DBG_PRINT(2, "[VPI][DBG] Scan executed inline (%u bits)\n", scan_num_bits);
+}
+
 void JtagVpiServer::close_connection() {
     DBG_PRINT(1, "[VPI][INFO] Closing connection (socket=%d, protocol=%s, rx_bytes=%d, scan_state=%d, tx_pending=%s)\n",
               client_sock,
               (protocol_mode == PROTO_OPENOCD_VPI) ? "OpenOCD" : (protocol_mode == PROTO_UNKNOWN) ? "Unknown" : "Legacy",
               vpi_rx_bytes, scan_state, vpi_tx_pending ? "true" : "false");
 
+    if (cmd_sample.open) {
+        metrics_end();
+    }
+    cmd_rx_since = 0;
+
     if (client_sock >= 0) {
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - session_stats.since).count();
+        printf("[VPI] Session %d closed: %llu commands, %llu bytes in, %llu bytes out in %.1f s (%.1f KB/s)\n",
+               session_id, (unsigned long long)session_stats.commands,
+               (unsigned long long)session_stats.rx_bytes, (unsigned long long)session_stats.tx_bytes, secs,
+               secs > 0 ? (session_stats.rx_bytes + session_stats.tx_bytes) / 1024.0 / secs : 0.0);
+        fflush(stdout);
+    }
+
+    if (shm) {
+#ifdef __linux__
+        // The client holds the doorbell too, so closing ours would not drop it from epoll
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, shm->doorbell, nullptr);
+#endif
+        shm.reset();
+    }
+
+    if (client_sock >= 0 && recorder) {
+        record_io(vpi_record::REC_CLOSE, nullptr, 0);
+    }
+
+    if (client_sock >= 0 && replay) {
+        replay->end_session();
+        client_sock = -1;
+    } else if (client_sock >= 0 && io_threaded) {
+        // The network thread owns the socket: drop what it already received
+        // and let it close the descriptor
+        io_rx.discard();
+        io_state = IO_CLOSING;
+        io_kick();
+        client_sock = -1;
+    } else if (client_sock >= 0) {
         // Try to get socket error status before closing
         int socket_error = 0;
         socklen_t len = sizeof(socket_error);
@@ -1195,6 +3579,9 @@ void JtagVpiServer::close_connection() {
             DBG_PRINT(1, "[VPI][INFO] Socket error status: %s\n", strerror(socket_error));
         }
 
+#ifdef __linux__
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client_sock, nullptr);
+#endif
         close(client_sock);
         client_sock = -1;
     }
@@ -1204,8 +3591,27 @@ void JtagVpiServer::close_connection() {
     vpi_rx_bytes = 0;
     vpi_tx_pending = false;
     vpi_minimal_mode = false;
+    // Drop queued commands, unsent bytes and readiness for the old socket
+    vpi_rx_head = 0;
+    vpi_rx_tail = 0;
+    vpi_rx_count = 0;
+    vpi_rx_hold = false;
+    tx_ring.head = 0;
+    tx_ring.tail = 0;
+    rx_ready = false;
+    tx_ready = true;
+    tx_armed = false;
     // Reset scan state machine
     scan_state = SCAN_IDLE;
+    stream_chunk_bits = 0;
+    stream_in_bytes = 0;
+    stream_pulse_issued = false;
+    batch_pulse_issued = false;
+    if (dtm_job == DTM_SBA) {
+        dtm_target_select(false);
+    }
+    dtm_job = DTM_NONE;
+    vpi_batch_enabled = false;
     // Reset TMS sequence state
     tms_seq_active = false;
 
@@ -1225,42 +3631,125 @@ void JtagVpiServer::update_signals(uint8_t tdo, uint8_t tdo_en, uint32_t idcode,
     current_mode = mode;
 }
 
+bool JtagVpiServer::has_pending_signals() const {
+    return !tck_ops.empty() || signal_mode != current_mode;
+}
+
+void JtagVpiServer::TckOpQueue::reserve(uint32_t depth) {
+    uint32_t cap = 1;
+    while (cap < depth) {
+        cap <<= 1;
+    }
+    if (cap <= ops.size()) {
+        return;
+    }
+    // Unwrap the live ops into the larger ring
+    std::vector<TckOp> grown(cap);
+    uint32_t n = size();
+    for (uint32_t i = 0; i < n; i++) {
+        grown[i] = ops[(head + i) & (ops.size() - 1)];
+    }
+    ops.swap(grown);
+    head = 0;
+    tail = n;
+}
+
+void JtagVpiServer::TckOpQueue::push(const TckOp& op) {
+    if (size() == ops.size()) {
+        reserve(ops.empty() ? TCK_QUEUE_DEPTH : 2 * (uint32_t)ops.size());
+    }
+    ops[tail++ & (ops.size() - 1)] = op;
+}
+
+void JtagVpiServer::TckOpQueue::push_pulses(uint8_t tms, uint8_t tdi, uint32_t count) {
+    if (!empty()) {
+        TckOp& last = ops[(tail - 1) & (ops.size() - 1)];
+        if (last.kind == TCK_OP_PULSE && last.tms == tms && last.tdi == tdi && last.count <= UINT32_MAX - count) {
+            last.count += count;
+            return;
+        }
+    }
+    push({TCK_OP_PULSE, tms, tdi, 0, count});
+}
+
 bool JtagVpiServer::get_pending_signals(uint8_t* tms, uint8_t* tdi, uint8_t* mode_sel, bool* tck_pulse, bool* tckc_toggle) {
-    // Handle queued reset pulses first
-    if (reset_pulses_remaining > 0) {
-        *tms = 1;
-        *tdi = 0;
-        *mode_sel = pending_mode_select;
-        *tck_pulse = true;
+    // Mode switches take effect in queue order, between the pulses around them
+    while (!tck_ops.empty() && tck_ops.front().kind == TCK_OP_MODE) {
+        signal_mode = tck_ops.front().tms;
+        tck_ops.pop();
+    }
+    if (tck_ops.empty()) {
+        if (signal_mode == current_mode) {
+            return false;
+        }
+        // Only the mode changes; the pins keep their last levels
+        *tms = pending_tms;
+        *tdi = pending_tdi;
+        *mode_sel = signal_mode;
+        *tck_pulse = false;
         if (tckc_toggle) *tckc_toggle = false;
-        reset_pulses_remaining--;
         return true;
     }
 
-    // Check if there's any pending signal change
-    bool has_signal_change = (pending_tck_pulse || pending_tckc_toggle);
-    bool has_mode_change = (pending_mode_select != current_mode);
-
-    if (!has_signal_change && !has_mode_change) {
-        return false;
+    TckOp& op = tck_ops.front();
+    *mode_sel = signal_mode;
+    if (op.kind == TCK_OP_TCKC) {
+        // One edge of the SF0 state machine
+        pending_tms = op.tms;
+        pending_tdi = op.tdi;
+        *tms = op.tms;
+        *tdi = op.tdi;
+        *tck_pulse = false;
+        if (tckc_toggle) *tckc_toggle = true;
+        tckc_toggle_consumed = true;
+        tck_ops.pop();
+        return true;
     }
 
-    *tms = pending_tms;
-    *tdi = pending_tdi;
-    *mode_sel = pending_mode_select;  // Always return current mode setting
-    *tck_pulse = pending_tck_pulse;
-    if (tckc_toggle) *tckc_toggle = pending_tckc_toggle;
-
-    pending_tck_pulse = false;
-    if (pending_tckc_toggle) {
-        tckc_toggle_consumed = true;  // Mark that we just consumed a TCKC toggle
+    // cJTAG mode: hand each requested TCK pulse to the harness as TCKC edges
+    // instead - the OAC/JScan preamble if the adapter is not up yet, then TMS on
+    // the rising and TDI on the falling edge. The pulse stays queued until its
+    // falling edge, so the engines sample TDO after it.
+    if (signal_mode == 1 && tckc_toggle) {
+        uint8_t tmsc;
+        bool done = false;
+        if (!oscan1_online) {
+            tmsc = next_sf0_edge();
+        } else if (!sf0_pulse_falling) {
+            tmsc = op.tms;
+            sf0_pulse_falling = true;
+        } else {
+            tmsc = op.tdi;
+            sf0_pulse_falling = false;
+            tap_step(op.tms);
+            done = true;
+        }
+        pending_tms = pending_tdi = tmsc;
+        *tms = tmsc;
+        *tdi = tmsc;
+        *tck_pulse = false;
+        *tckc_toggle = true;
+        if (done && --op.count == 0) {
+            tck_ops.pop();
+        }
+        return true;
     }
-    pending_tckc_toggle = false;
 
+    pending_tms = op.tms;
+    pending_tdi = op.tdi;
+    *tms = op.tms;
+    *tdi = op.tdi;
+    *tck_pulse = true;
+    if (tckc_toggle) *tckc_toggle = false;
+    tap_step(op.tms);
+    if (--op.count == 0) {
+        tck_ops.pop();
+    }
     return true;
 }
 
 void JtagVpiServer::set_mode(uint8_t mode) {
     pending_mode_select = mode;
+    signal_mode = mode;
     DBG_PRINT(1, "[VPI] Initial mode set to: %s\n", mode ? "cJTAG" : "JTAG");
 }
@@ -6,6 +6,21 @@
 #define JTAG_VPI_SERVER_H
 
 #include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "vpi_metrics.h"
+#include "vpi_record.h"
+
+struct jvpi_shm_region;  // vpi/jtag_vpi_shm.h
 
 class JtagVpiServer {
 public:
@@ -16,19 +31,139 @@ public:
         PROTO_LEGACY_8BYTE,
     };
 
+    // Scan executor: pin-level driver supplied by the simulation harness.
+    // Runs one full TCK period with the given TMS/TDI and returns TDO sampled
+    // after the pulse. When registered, whole scans, TMS sequences and resets
+    // are shifted inside a single poll() instead of one bit per poll.
+    typedef std::function<uint8_t(uint8_t tms, uint8_t tdi)> TckDriver;
+
+    // SF0 executor: drives TMSC and toggles TCKC once (one edge), returning
+    // TMSC as read back at that edge. Lets cJTAG SF0 packets run inline too.
+    typedef std::function<uint8_t(uint8_t tmsc)> TckcDriver;
+
+    // DMI executor (opt-in fast path): performs one DMI request (op, 7-bit addr,
+    // wdata) on the debug module interface directly, bypassing TAP and DTM, and
+    // returns the DMI response code with the read data in *rdata.
+    typedef std::function<uint8_t(uint8_t op, uint32_t addr, uint32_t wdata, uint32_t* rdata)> DmiDriver;
+
+    // DTM target select: routes the DMI requests of JTAG DTM scans to the debug
+    // module (true) or back to the default DMI target (false)
+    typedef std::function<void(bool dm)> DtmTargetSelect;
+
+    // Simulation clock: current simulated time in ps, for per-command metrics
+    typedef std::function<uint64_t()> SimClock;
+
+    // Command tracer: called when a command starts (done = false) and again
+    // when its metrics sample closes (done = true), for timeline export.
+    // Times are now_ns() wall clock and SimClock ps; end fields are valid once done.
+    struct CommandTrace {
+        uint32_t cmd;
+        uint32_t nb_bits;
+        const char* name;       // command class, as reported by CMD_STATS
+        uint64_t tck_cycles;
+        uint64_t wall_start;
+        uint64_t wall_end;
+        uint64_t sim_start;
+        uint64_t sim_end;
+    };
+    typedef std::function<void(const CommandTrace& cmd, bool done)> CommandTracer;
+
     JtagVpiServer(int port = 3333);
     ~JtagVpiServer();
 
+    // Listen on an AF_UNIX socket instead of TCP 127.0.0.1:<port>: a filesystem
+    // path, or (Linux) a name in the abstract namespace. Call before init().
+    void set_unix_socket(const std::string& path, bool abstract);
+    std::string listen_address() const;
+
     bool init();
     void poll();
     void update_signals(uint8_t tdo, uint32_t idcode, uint8_t mode);
     void update_signals(uint8_t tdo, uint8_t tdo_en, uint32_t idcode, uint8_t mode);
     bool get_pending_signals(uint8_t* tms, uint8_t* tdi, uint8_t* mode_sel, bool* tck_pulse, bool* tckc_toggle = nullptr);
     void set_mode(uint8_t mode);  // Set initial mode from command-line
-    bool is_client_connected() const { return client_sock >= 0; }
+    // Per-pulse path tuning: initial op queue capacity (it grows on demand) and
+    // how many queued pulses/edges the harness applies per TCK slot
+    void set_tck_queue_depth(uint32_t depth) { tck_ops.reserve(depth); }
+    void set_tck_drain(uint32_t n) { tck_drain = (n > 0) ? n : 1; }
+    uint32_t tck_drain_width() const { return tck_drain; }
+    bool is_client_connected() const { return client_sock >= 0 || !parked.empty(); }
+    size_t session_count() const { return parked.size() + (client_sock >= 0 ? 1 : 0); }
+    bool has_pending_signals() const;  // get_pending_signals() would return true (no side effects)
     void set_msb_first(bool v) { msb_first = v; }
     void set_protocol_mode(ProtocolMode m) { protocol_mode = m; }
     void set_debug_level(int level) { debug_level = level; }
+    void set_scan_executor(TckDriver drv) { tck_driver = drv; }
+    void set_sf0_executor(TckcDriver drv) { tckc_driver = drv; }
+    void set_dmi_executor(DmiDriver drv) { dmi_driver = drv; }
+    void set_dm_executor(DmiDriver drv) { dm_driver = drv; }  // debug module, for CMD_SBA_*
+    void set_dtm_target_select(DtmTargetSelect sel) { dtm_target_select = sel; }  // CMD_SBA_* as DTM scans
+    void set_poll_interval(int n) { poll_interval = (n > 0) ? n : 1; }
+    void set_sim_clock(SimClock clk) { sim_clock = clk; }
+    void set_command_tracer(CommandTracer t) { command_tracer = t; }
+
+    // Per-command metrics (also readable over the socket with CMD_STATS),
+    // written as JSON; returns false if the file cannot be written
+    bool write_stats(const std::string& path) const;
+
+    // Session recording: every byte clients send and get back, with the
+    // simulated time, to a binary file (vpi_record.h). Call once the mode,
+    // bit order and executors are set.
+    bool start_recording(const std::string& path);
+    void stop_recording();
+
+    // Replay a recording instead of listening (call instead of init()): its
+    // sessions run one after another with no socket, as fast as the model
+    // allows, and every response is compared with the recorded one. *flags
+    // tells how the recording server ran (vpi_record::FLAG_*).
+    bool start_replay(const std::string& path, uint32_t* flags);
+    bool replay_done() const { return replay && replay->finished() && client_sock < 0; }
+    bool finish_replay();  // print the summary; true if all output matched
+
+    // Checkpoints (--save-checkpoint/--restore): the protocol state that
+    // outlives a session, stored by the harness next to the Verilator model.
+    // Only taken with no client connected and nothing in flight, so queues,
+    // scans and per-session buffers are empty and need no saving.
+    struct Checkpoint {
+        uint32_t idcode;
+        uint32_t next_session_id;
+        uint32_t oscan1_preamble_edge;
+        uint8_t tdo;
+        uint8_t tdo_en;
+        uint8_t mode;
+        uint8_t pending_tms;
+        uint8_t pending_tdi;
+        uint8_t pending_mode_select;
+        uint8_t signal_mode;
+        uint8_t tckc_state;
+        uint8_t tckc_toggle_consumed;
+        uint8_t oscan1_online;
+        uint8_t sf0_pulse_falling;
+        uint8_t tap_state;
+    };
+    bool save_checkpoint(Checkpoint* cp) const;  // false while a client is connected or work is in flight
+    void restore_checkpoint(const Checkpoint& cp);
+
+    // Fork-per-session (--fork): the parent only accepts, and each connection
+    // is served alone by a child forked from the parent's model. The parent
+    // calls accept_for_fork() (sock, or -1 after timeout_ms; *session is the
+    // id the child will use) and closes the socket once it has forked; the
+    // child calls adopt_forked_client() and serves until the session closes.
+    int accept_for_fork(int timeout_ms, std::string* peer, int* session);
+    bool adopt_forked_client(int sock, int session, const std::string& peer);
+
+    // Idle-sleep support: true when nothing is in flight (no client, or a client
+    // with no pending scan/TMS sequence/SF0 operation/response), so the harness
+    // may stop evaluating the model. wait_for_activity() then blocks on the
+    // sockets for up to timeout_ms and returns true if one became ready.
+    bool is_quiescent() const;
+    bool wait_for_activity(int timeout_ms);
+
+    // Threaded I/O (opt-in): hand the listen and client sockets to a dedicated
+    // network thread. Call after init() and before the first poll(). From then
+    // on the sim thread only touches the SPSC rings below, never the kernel,
+    // except to wake the network thread when it is asleep.
+    bool start_io_thread();
 
 private:
     // OpenOCD jtag_vpi protocol (packed) structure size: 1036 bytes
@@ -42,6 +177,72 @@ private:
 
     static constexpr uint32_t VPI_PKT_SIZE = sizeof(OcdVpiCmd);
 
+    // CMD_BATCH (8): variable-length frame {cmd, length} (LE) followed by
+    // `length` bytes of ops. Each op is a 1-byte opcode and a 32-bit LE bit
+    // count, then the TMS (TMS_SEQ) or TDI (SCAN*) bits; IDLE clocks the count
+    // with TMS low. The reply is one {cmd, length} header plus the TDO of every
+    // capturing scan, each starting on a byte boundary.
+    static constexpr uint32_t CMD_BATCH = 8;
+    static constexpr uint32_t CMD_OSCAN1_BULK = 9;  // nb_bits SF0 (TMS, TDI) pairs, 2 bits each
+    static constexpr uint32_t SF0_BULK_MAX = 2048;  // pairs that fit in buffer_out
+    // CMD_DMI (10): nb_bits DMI transactions of DMI_ENTRY_SIZE bytes each in
+    // buffer_out {op, addr, 0, 0, wdata (LE)}; buffer_in returns
+    // {resp, addr, 0, 0, rdata (LE)} per transaction. Needs a DMI executor.
+    static constexpr uint32_t CMD_DMI = 10;
+    static constexpr uint32_t DMI_ENTRY_SIZE = 8;
+    static constexpr uint32_t DMI_MAX_OPS = 64;     // entries that fit in buffer_out
+    // CMD_DMI_POLL (14): read DMI register buffer_out[1] until (rdata & mask) ==
+    // expect (entry as for CMD_DMI, mask LE at buffer_out[8]) or nb_bits TCK
+    // cycles are spent. Reads are DTM scans of DTM_SCAN_TCKS each, or requests
+    // on the DMI executor charged as much. Replies one entry plus a match flag
+    // in byte 2, then the reads done and the TCKs spent (LE) at buffer_in[8]
+    // and [12]; a failed read stops the loop.
+    static constexpr uint32_t CMD_DMI_POLL = 14;
+    static constexpr uint32_t DMI_POLL_MAX_TCKS = 1u << 24;
+    // CMD_TAP_GOTO (11): move the TAP to state buffer_out[0] (TapState) along the
+    // shortest TMS path from the shadow state; buffer_in returns {state, path
+    // bits}. CMD_SCAN_IR (12) / CMD_SCAN_DR (13): go to Capture-IR/-DR, shift
+    // the nb_bits of TDI in buffer_out with TMS high on the last, then Update
+    // and Run-Test/Idle, staying there for `length` more TCKs. The reply
+    // carries only the register's TDO, as for CMD_SCAN_CHAIN.
+    static constexpr uint32_t CMD_TAP_GOTO = 11;
+    static constexpr uint32_t CMD_SCAN_IR = 12;
+    static constexpr uint32_t CMD_SCAN_DR = 13;
+    // CMD_SBA_READ (15) / CMD_SBA_WRITE (16): nb_bits words of 1 << buffer_out[4]
+    // bytes (0-2) from address buffer_out[0..3] (LE) on the debug module's
+    // system bus, packed LE in buffer_in (read) or from buffer_out[8] on
+    // (write). The server runs the sbcs/sbaddress0/sbdata0 sequence on the
+    // debug-module DMI executor, or as DTM scans with the DTM switched to the
+    // debug module (always without the executor, or with SBA_FLAG_DTM in
+    // buffer_out[5]); the reply's nb_bits is the words done.
+    static constexpr uint32_t CMD_SBA_READ = 15;
+    static constexpr uint32_t CMD_SBA_WRITE = 16;
+    static constexpr uint32_t SBA_HDR_SIZE = 8;
+    static constexpr uint8_t SBA_FLAG_DTM = 1u << 0;
+    // CMD_STATS (17): metrics of command class buffer_out[0] (see CmdClass);
+    // bit 0 of buffer_out[1] clears every class after the reply. nb_bits of
+    // the reply is the number of classes, so a query past the last one (empty
+    // reply) lists them. buffer_in: class name (16 bytes, NUL-padded), then
+    // LE u64s: count, bits, tck_cycles, wall ns {min, p50, p90, p99, max, sum},
+    // sim ps {min, p50, p90, p99, max, sum}, responses held back by the socket.
+    static constexpr uint32_t CMD_STATS = 17;
+    static constexpr uint32_t STATS_NAME_SIZE = 16;
+    static constexpr uint32_t STATS_REPLY_SIZE = STATS_NAME_SIZE + 16 * 8;
+    static constexpr uint32_t BATCH_HDR_SIZE = 8;
+    static constexpr uint32_t BATCH_MAX_BYTES = 65536;
+    // TCK cycles one frame may clock (all ops together); bounds IDLE and
+    // data-less scans, which run inline in continue_batch()
+    static constexpr uint32_t BATCH_MAX_CLOCKS = 1u << 20;
+    enum BatchOp : uint8_t {
+        BATCH_TMS_SEQ   = 0,
+        BATCH_SCAN      = 1,
+        BATCH_SCAN_FLIP = 2,  // TMS high on the last bit
+        BATCH_IDLE      = 3,
+        BATCH_OP_MASK   = 0x0F,
+        BATCH_TDI_ONES  = 0x40,  // scan without TDI data: shift ones
+        BATCH_NO_TDO    = 0x80,  // scan whose TDO is not returned
+    };
+
     // Minimal OpenOCD VPI protocol structures (used by test_protocol)
     struct __attribute__((packed)) MinimalVpiCmd {
         uint8_t cmd;
@@ -56,11 +257,146 @@ private:
         uint8_t status;
     };
 
-    ProtocolMode protocol_mode = PROTO_UNKNOWN; // start unknown and auto-detect
+    ProtocolMode protocol_mode = PROTO_UNKNOWN; // per-session; start unknown and auto-detect
 
     int port;
+    std::string unix_path;              // empty: TCP
+    bool unix_abstract = false;
     int server_sock;
-    int client_sock;
+    int client_sock;                    // per-session (see Session)
+
+    // Readiness-driven socket I/O: one non-blocking epoll_wait() (poll(2) on
+    // non-Linux hosts) every poll_interval calls to poll(). recv()/accept() are
+    // only issued for descriptors the last wait reported readable; unsent bytes
+    // wait in tx_backlog until EPOLLOUT. Readiness flags and tx_ring are
+    // per-session.
+    int epoll_fd = -1;
+    int poll_interval = 16;
+    int poll_countdown = 0;
+    bool accept_ready = false;
+    bool rx_ready = false;
+    bool tx_ready = true;
+    bool tx_armed = false;              // EPOLLOUT registered for client_sock
+
+    // TX ring: responses are appended in order and drained as the socket accepts
+    // them. Power-of-two capacity; grows only if a burst outruns it.
+    struct TxRing {
+        std::vector<uint8_t> buf;
+        size_t head = 0;  // next byte to send (free-running, masked on access)
+        size_t tail = 0;  // next byte to fill
+        size_t used() const { return tail - head; }
+        void push(const uint8_t* p, size_t n);
+        size_t span(const uint8_t** p) const;  // contiguous bytes ready to send
+        void consume(size_t n) { head += n; if (head == tail) head = tail = 0; }
+    };
+    static constexpr size_t TX_RING_SIZE = 16384;
+    TxRing tx_ring;
+
+    // Multi-client sessions. The members marked per-session belong to the
+    // active session. Every other client is parked in a Session and swapped in
+    // at a command boundary, so the DUT sees whole commands from one client at
+    // a time. Turns go round-robin, one command each, among sessions with
+    // input or output waiting; an uncontended session keeps running back to back.
+    static constexpr int MAX_SESSIONS = 8;
+    struct SessionStats {
+        uint64_t commands = 0;
+        uint64_t rx_bytes = 0;
+        uint64_t tx_bytes = 0;
+        std::chrono::steady_clock::time_point since;
+    };
+    struct Session;
+    int session_id = 0;                 // per-session
+    SessionStats session_stats;         // per-session
+    int next_session_id = 1;
+    uint32_t turn_commands = 0;         // commands the active session ran this turn
+    void swap_session(Session& s);      // exchange the per-session members with s
+    void begin_session(int sock);
+    bool session_has_work(const Session& s) const;
+    bool others_waiting() const;
+    bool turn_over() const { return turn_commands > 0 && others_waiting(); }
+    bool at_command_boundary() const;
+    void schedule();
+
+    void wait_events(int timeout_ms);
+    void accept_client();
+    void watch_writable(bool on);
+    ssize_t sock_recv(void* buf, size_t len, int flags = 0);
+    ssize_t transport_recv(void* buf, size_t len, int flags);
+    bool queue_tx(const void* data, size_t len);
+    bool queue_txv(const struct iovec* iov, int cnt);
+    void hold_tx(const struct iovec* iov, int cnt, size_t skip);
+    bool flush_tx();
+    bool tx_idle() const { return tx_ring.used() == 0; }
+
+    // Threaded I/O: single-producer/single-consumer byte ring with free-running
+    // atomic positions. io_rx is filled by the network thread and drained by the
+    // sim thread; io_tx the other way round. tx_ring stays the sim-side overflow
+    // when io_tx is full.
+    struct SpscRing {
+        std::vector<uint8_t> buf;           // power-of-two capacity, fixed at start
+        std::atomic<size_t> head{0};        // consumer position
+        std::atomic<size_t> tail{0};        // producer position
+        void init(size_t cap) { buf.assign(cap, 0); head = 0; tail = 0; }
+        size_t readable() const { return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire); }
+        size_t writable() const { return buf.size() - readable(); }
+        size_t write(const uint8_t* p, size_t n);                    // producer
+        size_t write_span(uint8_t** p) const;                        // producer: contiguous free bytes
+        void commit(size_t n) { tail.store(tail.load(std::memory_order_relaxed) + n, std::memory_order_release); }
+        size_t read(uint8_t* p, size_t n, bool peek);                // consumer
+        size_t read_span(const uint8_t** p) const;                   // consumer: contiguous pending bytes
+        void consume(size_t n) { head.store(head.load(std::memory_order_relaxed) + n, std::memory_order_release); }
+        void discard() { head.store(tail.load(std::memory_order_acquire), std::memory_order_release); }  // consumer
+    };
+    static constexpr size_t IO_RING_SIZE = 65536;
+    static constexpr int IO_SPIN_US = 200;  // network thread busy-polls this long before sleeping
+
+    // Connection handshake between the threads: the network thread accepts
+    // (LISTENING -> PENDING), the sim thread adopts the client (-> CONNECTED),
+    // and the sim thread's close_connection() asks for the close (-> CLOSING),
+    // which the network thread performs before listening again.
+    enum IoState { IO_LISTENING, IO_PENDING, IO_CONNECTED, IO_CLOSING };
+    bool io_threaded = false;
+    std::thread io_thread;
+    std::atomic<int> io_state{IO_LISTENING};
+    std::atomic<int> io_client{-1};          // socket owned by the network thread
+    std::atomic<bool> io_eof{false};         // peer closed or failed; io_rx holds the rest
+    std::atomic<bool> io_stop{false};
+    std::atomic<bool> io_sleeping{false};    // network thread blocked (or about to block) in poll()
+    std::atomic<bool> sim_sleeping{false};   // sim thread blocked (or about to block) in wait_events()
+    int io_wake[2] = {-1, -1};               // self-pipe that interrupts the network thread's poll()
+    std::mutex sim_wake_mutex;
+    std::condition_variable sim_wake;
+    SpscRing io_rx;
+    SpscRing io_tx;
+
+    void io_loop();
+    void io_close_client();
+    void io_kick();     // sim thread: wake the network thread if it sleeps
+    void sim_kick();    // network thread: wake the sim thread if it sleeps
+    bool io_events_pending() const;
+
+    // Recording and replay (see start_recording() / start_replay())
+    std::unique_ptr<vpi_record::Writer> recorder;
+    std::unique_ptr<vpi_record::Player> replay;
+    bool tx_unchecked = false;                      // next response depends on timing or transport
+    static constexpr int REPLAY_SOCK = 0x7FFFFFFF;  // client_sock while replaying, never a descriptor
+    void record_io(uint8_t type, const void* data, size_t len);
+
+    // Shared-memory transport (vpi/jtag_vpi_shm.h), Linux and AF_UNIX only.
+    // Negotiated per session over the socket, which afterwards only signals
+    // that the client is gone. Commands execute straight out of the cmd ring
+    // slots; responses are copied into the resp ring.
+    struct ShmLink {
+        jvpi_shm_region* region = nullptr;
+        int doorbell = -1;      // eventfd the client rings while we sleep
+        int client_bell = -1;   // eventfd we ring while the client sleeps
+        ~ShmLink();
+    };
+    std::unique_ptr<ShmLink> shm;       // per-session
+    bool start_shm();
+    static bool shm_ready(const ShmLink* link);  // a command waits and its response has room
+    bool shm_arm_sleep(bool sleeping);
+    void shm_push_resp(const struct iovec* iov, int cnt);
 
     // Current signal values
     uint8_t current_tdo;
@@ -71,16 +407,13 @@ private:
     int debug_level;  // 0=off, 1=basic, 2=verbose
 
     // Pending commands from client
-    uint8_t pending_tms;
+    uint8_t pending_tms;           // pin levels last handed to the harness
     uint8_t pending_tdi;
-    uint8_t pending_mode_select;
-    bool pending_tck_pulse;
-    int  reset_pulses_remaining;   // number of TCK pulses to issue for reset
+    uint8_t pending_mode_select;   // mode the producers work in (tck_ops may still hold the switch)
 
     // cJTAG/OScan1 state
     uint8_t tckc_state;            // Current TCKC level (0 or 1)
-    bool pending_tckc_toggle;      // Toggle TCKC for next cycle
-    bool tckc_toggle_consumed;     // Flag set when pending_tckc_toggle was read by get_pending_signals()
+    bool tckc_toggle_consumed;     // Flag set when a TCKC edge was handed out by get_pending_signals()
 
     // OScan1 SF0 state machine
     enum SF0State {
@@ -93,30 +426,137 @@ private:
     uint8_t sf0_tms;    // TMS bit to send on rising edge
     uint8_t sf0_tdi;    // TDI bit to send on falling edge
     uint8_t sf0_tdo;    // TDO bit captured
+    uint8_t sf0_pairs[512];      // packed pairs: bit 2k = TDI, bit 2k+1 = TMS
+    uint32_t sf0_num_pairs = 0;
+    uint32_t sf0_index = 0;      // pair being shifted; TDO goes to buffer_in bit sf0_index
+    void start_sf0_pair();
+
+    // Server-side OScan1 encoding: in cJTAG mode every TCK pulse requested by the
+    // RESET/TMS_SEQ/SCAN engines is driven as one SF0 cycle, after OAC + JScan
+    // OSCAN_ON has brought the adapter into SF0 once.
+    static constexpr uint32_t OSCAN1_OAC_CYCLES = 8;    // 16 TCKC edges, TMSC high
+    static constexpr uint32_t OSCAN1_JSCAN_CYCLES = 5;  // JScan OSCAN_ON, TMSC low
+    bool oscan1_online = false;         // adapter in SF0 (set up by us or by raw CMD_OSCAN1 traffic)
+    uint32_t oscan1_preamble_edge = 0;  // next OAC/JScan edge on the per-edge path
+    bool sf0_pulse_falling = false;     // per-edge path: rising (TMS) edge of this pulse driven
+    uint8_t next_sf0_edge();
+    uint8_t clock_tck(uint8_t tms, uint8_t tdi);
+
+    // Shadow of jtag_tap_controller.sv, same encoding as jtag_tap_pkg::tap_state_t.
+    // Stepped with every TCK the server drives (both scan paths, JTAG and cJTAG);
+    // raw SF0 traffic from the client makes it unknown. DUT-wide, not per-session.
+    enum TapState : uint8_t {
+        TAP_RESET, TAP_IDLE,
+        TAP_DR_SELECT, TAP_DR_CAPTURE, TAP_DR_SHIFT, TAP_DR_EXIT1, TAP_DR_PAUSE, TAP_DR_EXIT2, TAP_DR_UPDATE,
+        TAP_IR_SELECT, TAP_IR_CAPTURE, TAP_IR_SHIFT, TAP_IR_EXIT1, TAP_IR_PAUSE, TAP_IR_EXIT2, TAP_IR_UPDATE,
+        TAP_NUM_STATES,
+        TAP_UNKNOWN = 0xFF
+    };
+    static constexpr uint32_t TAP_PATH_MAX = 16;  // bits: 5 to Test-Logic-Reset, then at most 7
+    uint8_t tap_state = TAP_UNKNOWN;
+    static uint8_t tap_next(uint8_t state, uint8_t tms);
+    static uint32_t tap_path(uint8_t from, uint8_t to, uint8_t* tms);  // LSB-first into zeroed tms, returns bits
+    void tap_step(uint8_t tms) { tap_state = tap_next(tap_state, tms); tck_cycles++; }  // once per TCK driven
 
-    // TCK pulse queue for operations that need multiple cycles (like RESET)
+    // Pin activity for the harness's per-pulse path, in order: runs of TCK
+    // pulses with fixed TMS/TDI (reset, TMS sequences, idle clocks, a scan bit),
+    // single TCKC edges of the SF0 state machine, and pin mode switches. Every
+    // producer appends here; get_pending_signals() hands out one pulse or edge
+    // per call and the harness takes up to tck_drain of them per TCK slot.
+    // Producers that need TDO for a pulse queue one and wait for the queue to
+    // empty. Power-of-two ring with free-running positions; doubles when full.
+    enum TckOpKind : uint8_t { TCK_OP_PULSE, TCK_OP_TCKC, TCK_OP_MODE };
     struct TckOp {
-        uint8_t tms;
+        uint8_t kind;
+        uint8_t tms;     // TMS; TMSC level for TCK_OP_TCKC; mode for TCK_OP_MODE
         uint8_t tdi;
+        uint8_t reserved;
+        uint32_t count;  // TCK_OP_PULSE: pulses left in the run
     };
-    TckOp tck_queue[16];  // Queue for pending TCK operations
-    int tck_queue_head;
-    int tck_queue_tail;
-    int tck_queue_count;
+    struct TckOpQueue {
+        std::vector<TckOp> ops;
+        uint32_t head = 0;  // next op to hand out (free-running, masked on access)
+        uint32_t tail = 0;  // next free slot
+        bool empty() const { return head == tail; }
+        uint32_t size() const { return tail - head; }
+        TckOp& front() { return ops[head & (ops.size() - 1)]; }
+        void pop() { if (++head == tail) head = tail = 0; }
+        void clear() { head = tail = 0; }
+        void reserve(uint32_t depth);
+        void push(const TckOp& op);
+        void push_pulses(uint8_t tms, uint8_t tdi, uint32_t count);  // extends a matching last run
+    };
+    static constexpr uint32_t TCK_QUEUE_DEPTH = 16;
+    static constexpr uint32_t RESET_TCK_PULSES = 6;
+    TckOpQueue tck_ops;
+    uint8_t signal_mode = 0;  // pin mode at the drain end of tck_ops
+    uint32_t tck_drain = 1;
 
-    // Command receive buffer (handle partial TCP reads)
+    // Command receive buffer (handle partial TCP reads), per-session
     uint8_t cmd_buf[8];
     uint32_t cmd_bytes_received;
 
-    // OpenOCD vpi packet receive/send state
-    OcdVpiCmd vpi_cmd_rx;
+    // OpenOCD vpi packet receive/send state. Complete packets are received ahead
+    // into vpi_rx_ring while the current command is still shifting, then executed
+    // in place through vpi_rx_pkt (which points into a shared-memory slot for
+    // shm sessions); vpi_rx_bytes counts the partial packet at vpi_rx_tail. The
+    // receive side (ring, partial packet, minimal command and mode flags) is
+    // per-session; vpi_cmd_tx is scratch for the command being executed.
+    //
+    // Responses are gathered rather than built whole: only the header, the
+    // vpi_tx_in_bytes of buffer_in the command filled and the trailing
+    // length/nb_bits are ever written. buffer_out and the rest of buffer_in go
+    // out from a shared zero page. vpi_tx_in normally points at
+    // vpi_cmd_tx.buffer_in; a finished scan points it straight at scan_tdo_buf.
+    static constexpr uint32_t VPI_RX_DEPTH = 8;
+    std::vector<OcdVpiCmd> vpi_rx_ring;  // VPI_RX_DEPTH slots
+    uint32_t vpi_rx_head = 0;
+    uint32_t vpi_rx_tail = 0;
+    uint32_t vpi_rx_count = 0;
+    bool vpi_rx_hold = false;       // raw CMD_SCAN_STREAM payload follows the last queued packet
+    bool vpi_batch_enabled = false; // client sent the capability query, so CMD_BATCH frames may follow
+    std::vector<std::vector<uint8_t>> vpi_rx_payload;   // CMD_BATCH op list of each slot
+    const OcdVpiCmd* vpi_rx_pkt = nullptr;  // packet being executed
     uint32_t vpi_rx_bytes = 0;
     OcdVpiCmd vpi_cmd_tx;
-    uint32_t vpi_tx_bytes = 0;
+    const uint8_t* vpi_tx_in = nullptr;
+    uint32_t vpi_tx_in_bytes = 0;
     bool vpi_tx_pending = false;
     bool vpi_minimal_mode = false;  // true if using 8-byte cmd / 4-byte resp
     MinimalVpiCmd minimal_cmd_rx;
     uint32_t minimal_rx_bytes = 0;
+    uint64_t vpi_rx_since[VPI_RX_DEPTH] = {};  // first byte of each queued packet (now_ns)
+    uint64_t cmd_rx_since = 0;                 // first byte of the command taken next
+
+    // Per-session members of a parked client (same names as the live ones)
+    struct Session {
+        int session_id = 0;
+        int client_sock = -1;
+        bool rx_ready = false;
+        bool tx_ready = true;
+        bool tx_armed = false;
+        TxRing tx_ring;
+        ProtocolMode protocol_mode = PROTO_UNKNOWN;
+        uint8_t cmd_buf[8] = {};
+        uint32_t cmd_bytes_received = 0;
+        std::vector<OcdVpiCmd> vpi_rx_ring;
+        std::vector<std::vector<uint8_t>> vpi_rx_payload;
+        uint32_t vpi_rx_head = 0;
+        uint32_t vpi_rx_tail = 0;
+        uint32_t vpi_rx_count = 0;
+        uint32_t vpi_rx_bytes = 0;
+        bool vpi_rx_hold = false;
+        bool vpi_batch_enabled = false;
+        bool vpi_minimal_mode = false;
+        MinimalVpiCmd minimal_cmd_rx = {};
+        uint32_t minimal_rx_bytes = 0;
+        uint64_t vpi_rx_since[VPI_RX_DEPTH] = {};
+        uint64_t cmd_rx_since = 0;
+        SessionStats session_stats;
+        std::unique_ptr<ShmLink> shm;
+        Session() : vpi_rx_ring(VPI_RX_DEPTH), vpi_rx_payload(VPI_RX_DEPTH) {}
+    };
+    std::vector<Session> parked;
 
     // TMS sequence state (OpenOCD)
     bool tms_seq_active = false;
@@ -127,16 +567,79 @@ private:
     void enqueue_tck(uint8_t tms, uint8_t tdi);
     bool dequeue_tck(uint8_t* tms, uint8_t* tdi);
 
+    // Per-command metrics, server-wide. A command is timed from its first
+    // byte received until it is done at a command boundary, its response
+    // handed to the transport; bytes the socket does not take at once are
+    // counted in responses_held instead.
+    enum CmdClass : uint8_t {
+        CLASS_RESET, CLASS_TMS_SEQ, CLASS_SCAN, CLASS_STREAM, CLASS_BATCH, CLASS_OSCAN1,
+        CLASS_TAP, CLASS_DMI, CLASS_SBA, CLASS_OTHER, CLASS_LEGACY,
+        NUM_CMD_CLASSES
+    };
+    static const char* const cmd_class_names[NUM_CMD_CLASSES];
+    struct CmdSample {
+        bool open = false;
+        uint8_t cls = CLASS_OTHER;
+        uint32_t cmd = 0;
+        uint32_t nb_bits = 0;
+        uint64_t bits = 0;
+        uint64_t tck_start = 0;
+        uint64_t wall_start = 0;
+        uint64_t sim_start = 0;
+    };
+    vpi_metrics::CommandStats cmd_stats[NUM_CMD_CLASSES];
+    CmdSample cmd_sample;
+    uint64_t tck_cycles = 0;      // every TCK driven for a client, both paths, JTAG and cJTAG
+    uint64_t responses_held = 0;
+    SimClock sim_clock;
+    CommandTracer command_tracer;
+    void metrics_begin(uint8_t cls, uint64_t bits, uint32_t cmd, uint32_t nb_bits);
+    void metrics_end();
+    void metrics_check() {
+        if (cmd_sample.open && (client_sock < 0 || at_command_boundary())) metrics_end();
+    }
+    void stats_reply(uint8_t cls, bool clear);
+
+    // Whole-command execution through the harness pin drivers (SF0 executor in cJTAG mode)
+    TckDriver tck_driver;
+    bool executor_ready() const {
+        return tck_driver && tck_ops.empty() && (pending_mode_select == 0 || tckc_driver);
+    }
+    bool execute_reset();
+    void execute_tms_seq();
+    void execute_scan();
+
+    TckcDriver tckc_driver;
+    DmiDriver dmi_driver;
+    DmiDriver dm_driver;
+    DtmTargetSelect dtm_target_select;
+    // One DMI request of a server-built sequence (op 1 = read, 2 = write)
+    struct DmiReq {
+        uint8_t op;
+        uint8_t addr;
+        uint32_t wdata;
+    };
+    void sba_requests(uint32_t addr, uint32_t size_log2, uint32_t words, const uint8_t* wdata,
+                      std::vector<DmiReq>* reqs) const;
+    uint32_t sba_access(uint32_t size_log2, const std::vector<DmiReq>& reqs, uint8_t* rdata);
+    bool sf0_executor_ready() const { return tckc_driver && tck_ops.empty(); }
+    void execute_sf0();
+
     // Scan operation state
     enum ScanState {
         SCAN_IDLE,
         SCAN_RECEIVING_TMS,
         SCAN_RECEIVING_TDI,
         SCAN_PROCESSING,
-        SCAN_SENDING_TDO
+        SCAN_SENDING_TDO,
+        SCAN_STREAMING,
+        SCAN_BATCH
     };
     ScanState scan_state;
     bool scan_is_legacy;  // true for legacy protocol, false for OpenOCD VPI
+    bool scan_tms_only = false;  // minimal-mode TMS sequence: no TDI buffer, no TDO reply
+    uint32_t scan_tdo_skip = 0;  // CMD_SCAN_IR/DR: TMS path bits ahead of the data
+    uint32_t scan_tdo_bits = 0;  // CMD_SCAN_IR/DR: data bits whose TDO is returned (0: plain scan)
     uint32_t scan_num_bits;
     uint32_t scan_num_bytes;
     uint32_t scan_bit_index;
@@ -146,15 +649,82 @@ private:
     uint32_t scan_bytes_received;
     uint32_t scan_bytes_sent;
 
+    // Streaming scan (CMD_SCAN_STREAM): no length limit, constant memory. Input is
+    // consumed and TDO returned in chunks of up to STREAM_CHUNK bytes while shifting.
+    static constexpr uint32_t STREAM_CHUNK = 512;
+    bool stream_tms_explicit = false;   // (TMS, TDI) byte pairs (legacy) vs TDI bytes only (OpenOCD)
+    bool stream_flip_tms = false;       // TDI-only: raise TMS on the final bit
+    uint32_t stream_num_bits = 0;
+    uint32_t stream_bits_done = 0;      // bits of chunks already returned
+    uint32_t stream_chunk_bits = 0;     // bits in the chunk being shifted
+    uint32_t stream_chunk_pos = 0;
+    bool stream_pulse_issued = false;   // per-bit engine: TCK pulse for stream_chunk_pos in flight
+    uint8_t stream_in_buf[2 * STREAM_CHUNK];
+    uint32_t stream_in_bytes = 0;
+
+    // Batched ops (CMD_BATCH). The op list is validated up front; execution walks
+    // it op by op, inline through the scan executor or one TCK pulse per poll.
+    std::vector<uint8_t> batch_ops;
+    std::vector<uint8_t> batch_tdo;
+    uint32_t batch_op_pos = 0;        // offset of the current op header
+    uint32_t batch_bit_index = 0;     // bit within the current op
+    uint32_t batch_tdo_pos = 0;       // byte offset of the current op's TDO
+    bool batch_pulse_issued = false;  // per-bit engine: TCK pulse in flight
+
+    // DMI requests without a DMI executor: each is one DMI DR scan from and
+    // back to Run-Test/Idle, run as an internal batch op list. A scan's TDO
+    // holds the result of the request before it.
+    static constexpr uint8_t DTM_IR_DMI = 0x11;
+    static constexpr uint32_t DTM_IR_BITS = 5;
+    static constexpr uint32_t DTM_DMI_BITS = 41;     // addr[40:34], data[33:2], op[1:0]
+    static constexpr uint32_t DTM_IDLE_CYCLES = 1;   // dtmcs.idle
+    static constexpr uint32_t DTM_SCAN_TCKS = 2 + DTM_DMI_BITS + 1 + 2 + DTM_IDLE_CYCLES;
+    enum DtmJob : uint8_t { DTM_NONE, DTM_POLL, DTM_SBA };
+    DtmJob dtm_job = DTM_NONE;
+    uint64_t dtm_tck_start = 0;     // tck_cycles when the job started
+    uint32_t dtm_scans = 0;         // DR scans (polls) or batches (SBA) run so far
+    uint8_t dtm_poll_addr = 0;
+    uint32_t dtm_poll_expect = 0;
+    uint32_t dtm_poll_mask = 0;
+    uint32_t dtm_poll_budget = 0;   // TCK cycles
+    uint32_t dtm_poll_reads = 0;
+    std::vector<DmiReq> dtm_sba_reqs;  // sequence after the dmcontrol probe
+    uint32_t dtm_sba_size_log2 = 0;
+    uint32_t dtm_sba_first = 0;        // DR scan of dtm_sba_reqs[0]
+    void dtm_select_dmi();
+    void dtm_push_scan(uint8_t op, uint8_t addr, uint32_t wdata);
+    uint32_t dtm_rdata(uint32_t scan) const;
+    void dtm_continue();
+    void dtm_poll_step();
+    void dtm_sba_step();
+    void dtm_end();
+    void dmi_poll_reply(uint8_t resp, bool matched, uint32_t rdata, uint32_t tcks);
+
     // Legacy protocol handlers
     void process_command(struct vpi_cmd* cmd, struct vpi_resp* resp);
     void process_scan(uint32_t num_bits);
     void continue_scan();
+    void start_stream(uint32_t num_bits, bool tms_explicit, bool flip_tms);
+    void stream_bit(uint32_t pos, uint8_t* tms, uint8_t* tdi) const;
+    void continue_stream();
+    bool start_batch();
+    void run_batch();
+    void batch_push(uint8_t op, uint32_t bits, const uint8_t* data, uint32_t len);
+    bool batch_bit(uint8_t* tms, uint8_t* tdi) const;
+    void batch_capture(uint8_t tdo);
+    void batch_advance();
+    static uint32_t batch_data_bytes(uint8_t op, uint32_t bits);
+    static uint32_t batch_tdo_bytes(uint8_t op, uint32_t bits);
+    void continue_batch();
 
     // OpenOCD protocol handlers
     void process_vpi_packet();
+    void begin_response(uint32_t cmd, uint32_t length, uint32_t nb_bits, uint32_t in_bytes);
+    int response_iov(struct iovec* iov) const;   // fills 5 entries, returns the count
     void send_minimal_response(uint8_t response, uint8_t tdo_val, uint8_t mode, uint8_t status);
     void continue_vpi_work();
+    void vpi_work_step();
+    void receive_ahead();
     void close_connection();
 };
 
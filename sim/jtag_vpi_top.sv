@@ -21,6 +21,18 @@ module jtag_vpi_top
     input  logic jtag_trst_n_i,    // Optional TRST_N
     input  logic mode_select,      // 0=JTAG, 1=cJTAG
 
+    // DMI fast path (opt-in, --dmi-fastpath): the harness issues DMI requests
+    // directly, bypassing TAP and DTM. dmi_fast_valid is held low otherwise.
+    input  logic        dmi_fast_valid,
+    input  logic [1:0]  dmi_fast_op,
+    input  logic [6:0]  dmi_fast_addr,
+    input  logic [31:0] dmi_fast_wdata,
+    input  logic        dmi_fast_dm,       // 1 = request goes to the debug target (GDB stub)
+    output logic        dmi_fast_ready,
+    output logic [31:0] dmi_fast_rdata,
+    output logic [1:0]  dmi_fast_resp,
+    input  logic        dtm_dm,            // 1 = DTM (JTAG) requests go to the debug target
+
     // Expose outputs
     output logic [31:0] idcode,
     output logic active_mode
@@ -35,6 +47,50 @@ module jtag_vpi_top
     logic                      dmi_req_valid;
     logic                      dmi_req_ready;
 
+    // DTM-side request signals (from jtag_top)
+    logic [DMI_ADDR_WIDTH-1:0] dtm_dmi_addr;
+    logic [DMI_DATA_WIDTH-1:0] dtm_dmi_wdata;
+    jtag_dmi_pkg::dmi_op_e     dtm_dmi_op;
+    logic                      dtm_dmi_req_valid;
+    logic [DMI_DATA_WIDTH-1:0] dtm_dmi_rdata;
+    logic [1:0]                dtm_dmi_resp;
+    logic                      dtm_dmi_req_ready;
+
+    // Debug target DMI (riscv_debug_module: fast path with dmi_fast_dm, DTM
+    // with dtm_dm)
+    logic [DMI_ADDR_WIDTH-1:0] dm_addr;
+    logic [DMI_DATA_WIDTH-1:0] dm_wdata;
+    logic [1:0]                dm_op;
+    logic [DMI_DATA_WIDTH-1:0] dm_dmi_rdata;
+    logic [1:0]                dm_dmi_resp;
+    logic                      dm_dmi_req_ready;
+    logic                      dm_req_valid;
+
+    // Request mux: a fast-path request takes its target's DMI over from the
+    // DTM, which goes to the responder or, with dtm_dm, to the debug target.
+    // Responses go to both sides; only the requester that is waiting uses them.
+    logic fast_to_responder, fast_to_dm, dtm_to_dm;
+    assign fast_to_responder = dmi_fast_valid & ~dmi_fast_dm;
+    assign fast_to_dm        = dmi_fast_valid & dmi_fast_dm;
+    assign dtm_to_dm         = dtm_dm & ~fast_to_dm;
+
+    assign dmi_addr       = fast_to_responder ? dmi_fast_addr : dtm_dmi_addr;
+    assign dmi_wdata      = fast_to_responder ? dmi_fast_wdata : dtm_dmi_wdata;
+    assign dmi_op         = fast_to_responder ? jtag_dmi_pkg::dmi_op_e'(dmi_fast_op) : dtm_dmi_op;
+    assign dmi_req_valid  = fast_to_responder | (dtm_dmi_req_valid & ~dtm_dm);
+    assign dmi_fast_ready = dmi_fast_dm ? dm_dmi_req_ready : dmi_req_ready;
+    assign dmi_fast_rdata = dmi_fast_dm ? dm_dmi_rdata : dmi_rdata;
+    assign dmi_fast_resp  = dmi_fast_dm ? dm_dmi_resp : dmi_resp;
+
+    assign dm_addr      = dtm_to_dm ? dtm_dmi_addr : dmi_fast_addr;
+    assign dm_wdata     = dtm_to_dm ? dtm_dmi_wdata : dmi_fast_wdata;
+    assign dm_op        = dtm_to_dm ? dtm_dmi_op : dmi_fast_op;
+    assign dm_req_valid = fast_to_dm | (dtm_to_dm & dtm_dmi_req_valid);
+
+    assign dtm_dmi_rdata     = dtm_dm ? dm_dmi_rdata : dmi_rdata;
+    assign dtm_dmi_resp      = dtm_dm ? dm_dmi_resp : dmi_resp;
+    assign dtm_dmi_req_ready = dtm_dm ? (dtm_to_dm & dm_dmi_req_ready) : dmi_req_ready;
+
     // Test data register for scan chain verification
     // Provides predictable patterns that can be read via JTAG
     logic [31:0] test_data_reg;
@@ -85,19 +141,149 @@ module jtag_vpi_top
         .jtag_pin3_oen(jtag_pin3_oen),
         .jtag_trst_n_i(jtag_trst_n_i),
         .mode_select(mode_select),
-        .dmi_addr(dmi_addr),
-        .dmi_wdata(dmi_wdata),
-        .dmi_rdata(dmi_rdata),
-        .dmi_op(dmi_op),
-        .dmi_resp(dmi_resp),
-        .dmi_req_valid(dmi_req_valid),
-        .dmi_req_ready(dmi_req_ready),
+        .dmi_addr(dtm_dmi_addr),
+        .dmi_wdata(dtm_dmi_wdata),
+        .dmi_rdata(dtm_dmi_rdata),
+        .dmi_op(dtm_dmi_op),
+        .dmi_resp(dtm_dmi_resp),
+        .dmi_req_valid(dtm_dmi_req_valid),
+        .dmi_req_ready(dtm_dmi_req_ready),
         .idcode(idcode),
         .active_mode(active_mode)
     );
 
+    // ========================================
+    // Debug target for the GDB stub (--gdb-port)
+    // ========================================
+    // riscv_debug_module with a register-file-only hart and a 4 KiB byte
+    // addressed system bus memory. The harness reaches it through the DMI fast
+    // path with dmi_fast_dm=1; JTAG scans see it instead of the responder while
+    // dtm_dm=1 (the VPI server's CMD_SBA_* without the fast path).
+    logic [0:0]  hart_halt_req, hart_resume_req, hart_reset_req;
+    logic [0:0]  hart_halted_bus, hart_running_bus;
+    logic [4:0]  hart_gpr_addr;
+    logic [31:0] hart_gpr_wdata, hart_gpr_rdata;
+    logic        hart_gpr_we;
+    logic [11:0] hart_csr_addr;
+    logic [31:0] hart_csr_wdata, hart_csr_rdata;
+    logic        hart_csr_we;
+    logic [31:0] progbuf_insn;
+    logic        progbuf_insn_valid;
+    logic [63:0] sb_address, sb_wdata, sb_rdata;
+    logic [2:0]  sb_size;
+    logic        sb_read_req, sb_write_req;
+    logic        dm_debug_req;
+
+    riscv_debug_module #(
+        .NUM_HARTS(1),
+        .PROGBUF_SIZE(16),
+        .DATA_COUNT(12),
+        .SUPPORT_IMPEBREAK(1)
+    ) debug_module (
+        .clk                (clk),
+        .rst_n              (rst_n),
+        .dmi_addr           (dm_addr),
+        .dmi_wdata          (dm_wdata),
+        .dmi_rdata          (dm_dmi_rdata),
+        .dmi_op             (dm_op),
+        .dmi_resp           (dm_dmi_resp),
+        .dmi_req_valid      (dm_req_valid),
+        .dmi_req_ready      (dm_dmi_req_ready),
+        .hart_reset_req     (hart_reset_req),
+        .hart_halt_req      (hart_halt_req),
+        .hart_resume_req    (hart_resume_req),
+        .hart_halted        (hart_halted_bus),
+        .hart_running       (hart_running_bus),
+        .hart_unavailable   (1'b0),
+        .hart_havereset     (1'b0),
+        .hart_gpr_addr      (hart_gpr_addr),
+        .hart_gpr_wdata     (hart_gpr_wdata),
+        .hart_gpr_rdata     (hart_gpr_rdata),
+        .hart_gpr_we        (hart_gpr_we),
+        .hart_csr_addr      (hart_csr_addr),
+        .hart_csr_wdata     (hart_csr_wdata),
+        .hart_csr_rdata     (hart_csr_rdata),
+        .hart_csr_we        (hart_csr_we),
+        .progbuf_insn       (progbuf_insn),
+        .progbuf_insn_valid (progbuf_insn_valid),
+        .progbuf_insn_done  (progbuf_insn_valid),  // Progbuf "executes" in 1 cycle
+        .progbuf_exception  (1'b0),
+        .sb_address         (sb_address),
+        .sb_wdata           (sb_wdata),
+        .sb_rdata           (sb_rdata),
+        .sb_size            (sb_size),
+        .sb_read_req        (sb_read_req),
+        .sb_write_req       (sb_write_req),
+        .sb_ready           (1'b1),                // Single-cycle memory
+        .sb_error           (1'b0),
+        .debug_req          (dm_debug_req)
+    );
+
+    // Hart model: register file and CSRs only, does not execute instructions
+    logic        hart_state;  // 0=running, 1=halted
+    logic [31:0] hart_gprs [32];
+    logic [31:0] hart_csrs [4096];
+
+    assign hart_halted_bus[0]  = hart_state;
+    assign hart_running_bus[0] = !hart_state;
+    assign hart_gpr_rdata = hart_gprs[hart_gpr_addr];
+    assign hart_csr_rdata = hart_csrs[hart_csr_addr];
+
+    always_ff @(posedge clk or negedge rst_n) begin
+        if (!rst_n) begin
+            hart_state <= 1'b0;
+            for (int i = 0; i < 32; i++) begin
+                hart_gprs[i] <= 32'h0;
+            end
+            hart_csrs[12'h300] <= 32'h00001800;  // mstatus
+            hart_csrs[12'h301] <= 32'h40001104;  // misa (RV32I)
+            hart_csrs[12'h7B0] <= 32'h40000003;  // dcsr (xdebugver=4, prv=M)
+            hart_csrs[12'h7B1] <= 32'h00000000;  // dpc
+        end else begin
+            if (hart_reset_req[0]) begin
+                hart_state <= 1'b0;
+            end else if (hart_halt_req[0]) begin
+                hart_state <= 1'b1;
+            end else if (hart_resume_req[0]) begin
+                hart_state <= 1'b0;
+            end
+            if (hart_gpr_we && hart_state && hart_gpr_addr != 5'h0) begin
+                hart_gprs[hart_gpr_addr] <= hart_gpr_wdata;
+            end
+            if (hart_csr_we && hart_state) begin
+                hart_csrs[hart_csr_addr] <= hart_csr_wdata;
+            end
+        end
+    end
+
+    // System bus memory: 4 KiB, little-endian, address wraps at 4 KiB
+    logic [7:0]  sb_mem [4096];
+    logic [11:0] sb_a;
+    assign sb_a = sb_address[11:0];
+
+    always_comb begin
+        sb_rdata = 64'h0;
+        for (int i = 0; i < 8; i++) begin
+            if (i < (1 << sb_size)) begin
+                sb_rdata[i*8 +: 8] = sb_mem[sb_a + 12'(i)];
+            end
+        end
+    end
+
+    always_ff @(posedge clk) begin
+        if (sb_write_req) begin
+            for (int i = 0; i < 8; i++) begin
+                if (i < (1 << sb_size)) begin
+                    sb_mem[sb_a + 12'(i)] <= sb_wdata[i*8 +: 8];
+                end
+            end
+        end
+    end
+
     // VPI control:
     // Input pins: jtag_pin0_i, jtag_pin1_i, jtag_pin2_i, jtag_trst_n_i, mode_select
     // Output pins: jtag_pin1_o/oen, jtag_pin3_o/oen, idcode, active_mode
+    // DMI fast path: dmi_fast_valid/op/addr/wdata/dm in, dmi_fast_ready/rdata/resp out
+    // DTM target: dtm_dm in
 
 endmodule
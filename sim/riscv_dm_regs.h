@@ -0,0 +1,38 @@
+/**
+ * riscv_debug_module registers
+ * DMI addresses and the register fields the debug module implements, shared
+ * by the VPI server's system bus commands and the GDB stub
+ */
+
+#ifndef RISCV_DM_REGS_H
+#define RISCV_DM_REGS_H
+
+#include <stdint.h>
+
+namespace riscv_dm {
+
+// DMI addresses
+static constexpr uint32_t DATA0 = 0x04;
+static constexpr uint32_t DMCONTROL = 0x10;
+static constexpr uint32_t DMSTATUS = 0x11;
+static constexpr uint32_t ABSTRACTCS = 0x16;
+static constexpr uint32_t COMMAND = 0x17;
+static constexpr uint32_t SBCS = 0x38;
+static constexpr uint32_t SBADDRESS0 = 0x39;
+static constexpr uint32_t SBDATA0 = 0x3C;
+
+// Field positions as riscv_debug_module implements them: DMSTATUS and SBCS do
+// not follow the spec bit layout
+static constexpr uint32_t DMCONTROL_HALTREQ = 1u << 31;
+static constexpr uint32_t DMCONTROL_RESUMEREQ = 1u << 30;
+static constexpr uint32_t DMCONTROL_DMACTIVE = 1u << 0;
+static constexpr uint32_t DMSTATUS_ALLHALTED = 1u << 11;
+static constexpr uint32_t ABSTRACTCS_BUSY = 1u << 12;
+static constexpr uint32_t ABSTRACTCS_CMDERR = 7u << 8;
+static constexpr uint32_t SBCS_SBREADONADDR = 1u << 21;
+static constexpr uint32_t SBCS_SBAUTOINCREMENT = 1u << 16;
+static constexpr int SBCS_SBACCESS_SHIFT = 12;
+
+} // namespace riscv_dm
+
+#endif // RISCV_DM_REGS_H
@@ -18,6 +18,12 @@
 #if ENABLE_VCD
 #include "verilated_vcd_c.h"
 #endif
+#ifndef ENABLE_CHECKPOINT
+#define ENABLE_CHECKPOINT 0
+#endif
+#if ENABLE_CHECKPOINT
+#include "verilated_save.h"
+#endif
 
 #include <iostream>
 #include <iomanip>
@@ -41,10 +47,88 @@ void vl_finish(const char* filename, int linenum, const char* hier) {
 }
 #endif
 #include "jtag_vpi_server.h"
+#include "gdb_rsp_server.h"
+#include "vpi_trace_events.h"
 #include <iostream>
 #include <iomanip>
+#include <cstdio>
 #include <cstring>
+#include <cerrno>
 #include <chrono>
+#include <algorithm>
+#include <csignal>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// SIGINT/SIGTERM end the main loop so the exit summary (and --stats-file) is
+// still written; the handler is one-shot, a second signal terminates at once
+static volatile sig_atomic_t stop_requested = 0;
+static void request_stop(int) {
+    stop_requested = 1;
+}
+
+// --trace-events timeline: one process per time base, one thread per track
+enum { TRACE_PID_WALL = 1, TRACE_PID_SIM = 2 };
+enum { TRACE_TID_COMMANDS = 1, TRACE_TID_IDLE, TRACE_TID_EVAL, TRACE_TID_DUMP, TRACE_TID_WRITER };
+
+// jtag_tap_pkg::tap_state_t
+static const char* const tap_state_names[16] = {
+    "Test-Logic-Reset", "Run-Test/Idle",
+    "Select-DR-Scan", "Capture-DR", "Shift-DR", "Exit1-DR", "Pause-DR", "Exit2-DR", "Update-DR",
+    "Select-IR-Scan", "Capture-IR", "Shift-IR", "Exit1-IR", "Pause-IR", "Exit2-IR", "Update-IR",
+};
+
+// --save-checkpoint/--restore: harness state, written after Verilator's own
+// header and before the model. A checkpoint only loads into the build that
+// wrote it (Verilator checks the model).
+static const char CHECKPOINT_MAGIC[8] = "JVPICKP";
+struct SimCheckpoint {
+    uint32_t sim_state;
+    uint32_t tck_clk_counter;
+    uint64_t time_ps;
+    uint64_t cycle_count;
+    uint8_t cjtag_mode;
+    uint8_t clk_pulse_phase;
+    uint8_t tck_pulse_phase;
+    uint8_t tckc_state;
+    JtagVpiServer::Checkpoint server;
+};
+
+#if ENABLE_CHECKPOINT
+// Written beside the target and renamed over it, so a simulator killed
+// mid-write leaves the previous checkpoint intact
+static bool save_checkpoint(const std::string& path, Vjtag_vpi_top* top, const SimCheckpoint& cp) {
+    std::string tmp = path + ".tmp";
+    VerilatedSave os;
+    os.open(tmp.c_str());
+    if (!os.isOpen()) {
+        return false;
+    }
+    os.write(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    os.write(&cp, sizeof(cp));
+    os << *top;
+    os.close();
+    return rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+static bool load_checkpoint(const std::string& path, Vjtag_vpi_top* top, SimCheckpoint* cp) {
+    VerilatedRestore is;
+    is.open(path.c_str());
+    if (!is.isOpen()) {
+        return false;
+    }
+    char magic[sizeof(CHECKPOINT_MAGIC)];
+    is.read(magic, sizeof(magic));
+    if (memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0) {
+        errno = EINVAL;
+        return false;
+    }
+    is.read(cp, sizeof(*cp));
+    is >> *top;
+    is.close();
+    return true;
+}
+#endif
 
 // Default timeout: 0 = unlimited (no timeout)
 // Can be overridden with --timeout parameter (0 = unlimited, >0 = timeout in seconds)
@@ -67,20 +151,11 @@ int main(int argc, char** argv) {
     top->jtag_pin2_i = 0;
     top->jtag_trst_n_i = 0;
     top->mode_select = 0;
+    top->dmi_fast_valid = 0;
+    top->dmi_fast_dm = 0;
+    top->dtm_dm = 0;
 
-    // Initialize VPI server
     JtagVpiServer vpi_server(3333);
-    if (!vpi_server.init()) {
-        std::cerr << "[VPI] Failed to initialize server on port 3333" << std::endl;
-        std::cerr << "[VPI] Make sure port 3333 is not already in use" << std::endl;
-        delete top;
-        return 1;
-    }
-
-    std::cout << "\n=== JTAG VPI Interactive Simulation ===" << std::endl;
-    std::cout << "[VPI] Server listening on port 3333" << std::endl;
-    std::cout << "[VPI] Waiting for client connections..." << std::endl;
-    std::cout << "[VPI] Connect using: ./build/jtag_vpi_client" << std::endl;
 
     // Parse command line arguments
 
@@ -94,6 +169,24 @@ int main(int argc, char** argv) {
     std::string proto_mode = "auto"; // Default: auto-detect protocol
     uint64_t timeout_seconds = DEFAULT_TIMEOUT_SECONDS;
     int debug_level = 0;  // Default: no debug output
+    bool scan_executor = true;  // Default: run whole scans inline (no per-bit polling)
+    int poll_interval = 16;     // Default: check socket readiness every 16 half-cycles
+    enum { IDLE_OFF, IDLE_FREEZE, IDLE_ADVANCE } idle_mode = IDLE_FREEZE;  // Default: sleep, freeze sim time
+    int idle_timeout_ms = 10;   // Longest single block while idle
+    bool dmi_fastpath = false;  // CMD_DMI: DMI requests straight to the debug module (no TAP timing)
+    int gdb_port = 0;           // GDB RSP stub on this port (0 = off)
+    bool io_thread = false;     // Socket I/O on a dedicated network thread
+    bool fork_sessions = false; // Fork a simulator per connection once reset is done
+    std::string unix_path;      // Listen on AF_UNIX instead of TCP port 3333
+    bool unix_abstract = false; // unix_path is a Linux abstract-namespace name
+    uint32_t tck_queue_depth = 0; // Initial per-pulse op queue capacity (0 = server default)
+    uint32_t tck_drain = 1;     // Queued pulses/edges applied per TCK slot
+    std::string stats_file;     // Per-command metrics as JSON at exit (empty = off)
+    std::string events_file;    // Chrome/Perfetto timeline (empty = off)
+    std::string record_file;    // Log client traffic for --replay (empty = off)
+    std::string replay_file;    // Run a recording instead of listening (empty = off)
+    std::string checkpoint_file;  // Save model + state at idle points (empty = off)
+    std::string restore_file;     // Start from a checkpoint instead of reset (empty = off)
 
     for (int i = 1; i < argc; i++) {
         std::string arg = argv[i];
@@ -127,6 +220,94 @@ int main(int argc, char** argv) {
         } else if (arg == "-d" && i + 1 < argc) {
             // Format: -d 1
             debug_level = std::stoi(argv[++i]);
+        } else if (arg == "--per-bit-scan") {
+            scan_executor = false;
+        } else if (arg == "--dmi-fastpath") {
+            dmi_fastpath = true;
+        } else if ((arg == "--unix" || arg == "--abstract") && i + 1 < argc) {
+            // Format: --unix /tmp/jtag_vpi.sock | --abstract jtag_vpi
+            unix_abstract = (arg == "--abstract");
+            unix_path = argv[++i];
+        } else if (arg == "--io-thread") {
+            io_thread = true;
+        } else if (arg == "--fork") {
+            fork_sessions = true;
+        } else if (arg == "--gdb-port" && i + 1 < argc) {
+            gdb_port = std::stoi(argv[++i]);
+        } else if ((arg == "--idle" && i + 1 < argc) || arg.rfind("--idle=", 0) == 0) {
+            // Format: --idle freeze | --idle=advance
+            std::string mode = (arg == "--idle") ? argv[++i] : arg.substr(7);
+            if (mode == "off") {
+                idle_mode = IDLE_OFF;
+            } else if (mode == "freeze") {
+                idle_mode = IDLE_FREEZE;
+            } else if (mode == "advance") {
+                idle_mode = IDLE_ADVANCE;
+            } else {
+                std::cerr << "[SIM] Unknown --idle mode '" << mode << "' (expected off|freeze|advance)" << std::endl;
+                delete top;
+                return 1;
+            }
+        } else if (arg == "--idle-timeout" && i + 1 < argc) {
+            // Format: --idle-timeout 10
+            idle_timeout_ms = std::stoi(argv[++i]);
+        } else if (arg.rfind("--idle-timeout=", 0) == 0) {
+            // Format: --idle-timeout=10
+            idle_timeout_ms = std::stoi(arg.substr(15));
+        } else if (arg == "--poll-interval" && i + 1 < argc) {
+            // Format: --poll-interval 16
+            poll_interval = std::stoi(argv[++i]);
+        } else if (arg.rfind("--poll-interval=", 0) == 0) {
+            // Format: --poll-interval=16
+            poll_interval = std::stoi(arg.substr(16));
+        } else if (arg == "--tck-queue-depth" && i + 1 < argc) {
+            // Format: --tck-queue-depth 64
+            tck_queue_depth = (uint32_t)std::stoul(argv[++i]);
+        } else if (arg.rfind("--tck-queue-depth=", 0) == 0) {
+            // Format: --tck-queue-depth=64
+            tck_queue_depth = (uint32_t)std::stoul(arg.substr(18));
+        } else if (arg == "--tck-drain" && i + 1 < argc) {
+            // Format: --tck-drain 8
+            tck_drain = (uint32_t)std::stoul(argv[++i]);
+        } else if (arg.rfind("--tck-drain=", 0) == 0) {
+            // Format: --tck-drain=8
+            tck_drain = (uint32_t)std::stoul(arg.substr(12));
+        } else if (arg == "--stats-file" && i + 1 < argc) {
+            // Format: --stats-file stats.json
+            stats_file = argv[++i];
+        } else if (arg.rfind("--stats-file=", 0) == 0) {
+            // Format: --stats-file=stats.json
+            stats_file = arg.substr(13);
+        } else if (arg == "--trace-events" && i + 1 < argc) {
+            // Format: --trace-events timeline.json
+            events_file = argv[++i];
+        } else if (arg.rfind("--trace-events=", 0) == 0) {
+            // Format: --trace-events=timeline.json
+            events_file = arg.substr(15);
+        } else if (arg == "--record" && i + 1 < argc) {
+            // Format: --record session.jvr
+            record_file = argv[++i];
+        } else if (arg.rfind("--record=", 0) == 0) {
+            // Format: --record=session.jvr
+            record_file = arg.substr(9);
+        } else if (arg == "--replay" && i + 1 < argc) {
+            // Format: --replay session.jvr
+            replay_file = argv[++i];
+        } else if (arg.rfind("--replay=", 0) == 0) {
+            // Format: --replay=session.jvr
+            replay_file = arg.substr(9);
+        } else if (arg == "--save-checkpoint" && i + 1 < argc) {
+            // Format: --save-checkpoint warm.ckpt
+            checkpoint_file = argv[++i];
+        } else if (arg.rfind("--save-checkpoint=", 0) == 0) {
+            // Format: --save-checkpoint=warm.ckpt
+            checkpoint_file = arg.substr(18);
+        } else if (arg == "--restore" && i + 1 < argc) {
+            // Format: --restore warm.ckpt
+            restore_file = argv[++i];
+        } else if (arg.rfind("--restore=", 0) == 0) {
+            // Format: --restore=warm.ckpt
+            restore_file = arg.substr(10);
         } else if (arg == "--help" || arg == "-h") {
             std::cout << "\nUsage: " << argv[0] << " [options]" << std::endl;
             std::cout << "Options:" << std::endl;
@@ -139,12 +320,102 @@ int main(int argc, char** argv) {
             std::cout << "  --proto <mode>           Protocol: auto | openocd | legacy (default: auto)" << std::endl;
             std::cout << "  --debug <level>          Debug output: 0=off, 1=basic, 2=verbose (default: 0)" << std::endl;
             std::cout << "  -d <level>               Short form of --debug" << std::endl;
+            std::cout << "  --per-bit-scan           Shift one bit per poll (disable whole-scan executor)" << std::endl;
+            std::cout << "  --dmi-fastpath           Accept CMD_DMI, run CMD_DMI_POLL/CMD_SBA_* on the DMI bus (no TAP/DTM, no TAP timing)" << std::endl;
+            std::cout << "  --gdb-port <port>        GDB stub for the built-in debug target (target remote :<port>)" << std::endl;
+            std::cout << "  --poll-interval <n>      Half-cycles between socket readiness checks (default: 16)" << std::endl;
+            std::cout << "  --tck-queue-depth <n>    Initial per-pulse TCK op queue capacity, grows on demand (default: 16)" << std::endl;
+            std::cout << "  --tck-drain <n>          Queued TCK pulses/edges applied per TCK slot (default: 1)" << std::endl;
+            std::cout << "  --stats-file <path>      Write per-command latency/throughput metrics as JSON at exit" << std::endl;
+            std::cout << "  --trace-events <path>    Write a Chrome/Perfetto timeline of commands, socket idle, eval and dumps" << std::endl;
+            std::cout << "  --record <path>          Record all client traffic (binary) for --replay" << std::endl;
+            std::cout << "  --replay <path>          Run a recording without a socket and check every response" << std::endl;
+            std::cout << "  --save-checkpoint <path> Save the model and server state when idle after reset and each session" << std::endl;
+            std::cout << "  --restore <path>         Start from a checkpoint instead of the reset phases" << std::endl;
+            std::cout << "  --io-thread              Run socket I/O on a separate network thread" << std::endl;
+            std::cout << "  --fork                   After reset, serve each connection in its own forked simulator" << std::endl;
+            std::cout << "  --unix <path>            Listen on a unix domain socket instead of TCP port 3333" << std::endl;
+            std::cout << "  --abstract <name>        Listen on a Linux abstract unix socket (@name)" << std::endl;
+            std::cout << "  --idle <mode>            When no command is pending: off | freeze | advance (default: freeze)" << std::endl;
+            std::cout << "  --idle-timeout <ms>      Longest socket wait while idle (default: 10)" << std::endl;
             std::cout << "  --help, -h               Show this help message" << std::endl;
             delete top;
             return 0;
         }
     }
 
+    // --fork children share nothing but the model state at the fork: per-process
+    // output files, threads and the GDB stub's listener would be shared too
+    if (fork_sessions && (io_thread || gdb_port > 0 || trace_enabled || !replay_file.empty() || !record_file.empty() ||
+                          !stats_file.empty() || !events_file.empty() || !checkpoint_file.empty())) {
+        std::cerr << "[SIM] --fork cannot be combined with --io-thread, --gdb-port, --trace, --replay, --record, "
+                  << "--stats-file, --trace-events or --save-checkpoint" << std::endl;
+        delete top;
+        return 1;
+    }
+
+    // Warm start: the model, simulated time and harness state come from the
+    // checkpoint and the reset phases are skipped; its pin mode wins over --cjtag
+    SimCheckpoint restored;
+    memset(&restored, 0, sizeof(restored));
+    if (!checkpoint_file.empty() || !restore_file.empty()) {
+#if ENABLE_CHECKPOINT
+        if (!restore_file.empty()) {
+            if (!load_checkpoint(restore_file, top, &restored)) {
+                std::cerr << "[SIM] Cannot restore " << restore_file << ": "
+                          << (errno == EINVAL ? "not a jtag_vpi checkpoint" : strerror(errno)) << std::endl;
+                delete top;
+                return 1;
+            }
+            contextp->time(restored.time_ps);
+            cjtag_mode = restored.cjtag_mode != 0;
+            std::cout << "[SIM] Restored " << restore_file << ": cycle " << restored.cycle_count
+                      << ", " << restored.time_ps / 1000 << " ns" << std::endl;
+        }
+#else
+        std::cerr << "[SIM] --save-checkpoint/--restore need a model built with --savable (make CHECKPOINT=1 VERBOSE=0)" << std::endl;
+        delete top;
+        return 1;
+#endif
+    }
+
+    // Initialize VPI server, or load the recording to replay; a replay runs
+    // with the pin mode, bit order, scan engine and DMI fast path it was recorded with
+    if (!replay_file.empty()) {
+        uint32_t flags = 0;
+        if (!record_file.empty() || io_thread) {
+            std::cerr << "[SIM] --replay cannot be combined with --record or --io-thread" << std::endl;
+            delete top;
+            return 1;
+        }
+        if (!vpi_server.start_replay(replay_file, &flags)) {
+            delete top;
+            return 1;
+        }
+        cjtag_mode = (flags & vpi_record::FLAG_CJTAG) != 0;
+        msb_first = (flags & vpi_record::FLAG_MSB_FIRST) != 0;
+        dmi_fastpath = (flags & vpi_record::FLAG_DMI_FASTPATH) != 0;
+        scan_executor = (flags & vpi_record::FLAG_PER_BIT_SCAN) == 0;
+    } else if (!unix_path.empty()) {
+        vpi_server.set_unix_socket(unix_path, unix_abstract);
+    }
+    if (replay_file.empty() && !vpi_server.init()) {
+        std::cerr << "[VPI] Failed to initialize server on " << vpi_server.listen_address() << std::endl;
+        if (unix_path.empty()) {
+            std::cerr << "[VPI] Make sure port 3333 is not already in use" << std::endl;
+        }
+        delete top;
+        return 1;
+    }
+
+    std::cout << "\n=== JTAG VPI Interactive Simulation ===" << std::endl;
+    if (replay_file.empty()) {
+        std::cout << "[VPI] Server listening on " << vpi_server.listen_address() << std::endl;
+        std::cout << "[VPI] Waiting for client connections..." << std::endl;
+        std::cout << "[VPI] Connect using: ./build/jtag_vpi_client"
+                  << (unix_path.empty() ? "" : (unix_abstract ? " --abstract " : " --unix ") + unix_path) << std::endl;
+    }
+
     uint64_t max_cycles = timeout_seconds * 100000000ULL; // 100MHz clock (fallback)
     auto start_time = std::chrono::steady_clock::now();
     auto deadline   = (timeout_seconds == 0) ?
@@ -158,13 +429,44 @@ int main(int argc, char** argv) {
     }
     std::cout << "[SIM] Bit order: " << (msb_first ? "MSB-first" : "LSB-first") << std::endl;
     std::cout << "[SIM] Protocol: " << (proto_mode) << std::endl;
-
-    // Set mode_select based on cjtag_mode flag
-    top->mode_select = cjtag_mode ? 1 : 0;
+    std::cout << "[SIM] Scan engine: " << (scan_executor ? "whole-scan executor" : "per-bit") << std::endl;
+    std::cout << "[SIM] DMI fast path: " << (dmi_fastpath ? "enabled" : "disabled") << std::endl;
+    if (gdb_port > 0) {
+        std::cout << "[SIM] GDB stub: port " << gdb_port << std::endl;
+    }
+    std::cout << "[SIM] Socket poll interval: " << poll_interval << " half-cycles" << std::endl;
+    std::cout << "[SIM] Socket I/O: " << (io_thread ? "network thread" : "inline") << std::endl;
+    std::cout << "[SIM] Idle-sleep: "
+              << (idle_mode == IDLE_OFF ? "off" : idle_mode == IDLE_FREEZE ? "freeze sim time" : "advance sim time")
+              << std::endl;
+
+    // Set mode_select based on cjtag_mode flag. A fresh start applies it after
+    // the power-on TAP reset: in cJTAG mode pin 0 is TCKC, and those pulses
+    // would start an OAC count in oscan1_controller that the server's OAC/JScan
+    // preamble then misses. A restored model is already past the reset.
+    top->mode_select = (cjtag_mode && !restore_file.empty()) ? 1 : 0;
     // Configure VPI server bit order
     vpi_server.set_msb_first(msb_first);
     // Configure debug level
     vpi_server.set_debug_level(debug_level);
+    vpi_server.set_poll_interval(poll_interval);
+    if (tck_queue_depth > 0) {
+        vpi_server.set_tck_queue_depth(tck_queue_depth);
+    }
+    vpi_server.set_tck_drain(tck_drain);
+    vpi_server.set_sim_clock([&]() -> uint64_t { return contextp->time(); });
+    if (!stats_file.empty() || !events_file.empty() || !record_file.empty() || fork_sessions) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = request_stop;
+        sa.sa_flags = SA_RESETHAND;
+        sigaction(SIGINT, &sa, nullptr);
+        sigaction(SIGTERM, &sa, nullptr);
+    }
+    if (io_thread && !vpi_server.start_io_thread()) {
+        delete top;
+        return 1;
+    }
     if (debug_level > 0) {
         std::cout << "[SIM] Debug level: " << debug_level << std::endl;
     }
@@ -178,6 +480,9 @@ int main(int argc, char** argv) {
     }
     // Set initial mode from command-line flag
     vpi_server.set_mode(cjtag_mode ? 1 : 0);
+    if (!restore_file.empty()) {
+        vpi_server.restore_checkpoint(restored.server);
+    }
 
     if (trace_enabled) {
 #if ENABLE_FST
@@ -199,8 +504,51 @@ int main(int argc, char** argv) {
 #endif
     }
 
+    // Timeline export: VPI commands on a wall-clock and a simulated-time track,
+    // plus socket idle, model evaluation and waveform dumping in wall time
+    vpi_trace::TraceWriter events;
+    vpi_trace::BusyTrack eval_track(events, TRACE_PID_WALL, TRACE_TID_EVAL, "eval");
+    vpi_trace::BusyTrack dump_track(events, TRACE_PID_WALL, TRACE_TID_DUMP, "dump");
+    uint8_t cmd_tap_before = 0;
+    if (!events_file.empty()) {
+        if (!events.open(events_file.c_str())) {
+            std::cerr << "[SIM] Could not open " << events_file << ": " << strerror(errno) << std::endl;
+            delete top;
+            return 1;
+        }
+        events.set_flush_track(TRACE_PID_WALL, TRACE_TID_WRITER);
+        events.process_name(TRACE_PID_WALL, "Wall clock");
+        events.thread_name(TRACE_PID_WALL, TRACE_TID_COMMANDS, "VPI commands");
+        events.thread_name(TRACE_PID_WALL, TRACE_TID_IDLE, "Socket idle");
+        events.thread_name(TRACE_PID_WALL, TRACE_TID_EVAL, "Model eval");
+        events.thread_name(TRACE_PID_WALL, TRACE_TID_DUMP, "Waveform dump");
+        events.thread_name(TRACE_PID_WALL, TRACE_TID_WRITER, "Timeline writer");
+        events.process_name(TRACE_PID_SIM, "Simulated time");
+        events.thread_name(TRACE_PID_SIM, TRACE_TID_COMMANDS, "VPI commands");
+        vpi_server.set_command_tracer([&](const JtagVpiServer::CommandTrace& c, bool done) {
+            uint8_t tap = top->rootp->jtag_vpi_top__DOT__dut__DOT__tap_ctrl__DOT__current_state & 0xF;
+            if (!done) {
+                cmd_tap_before = tap;
+                return;
+            }
+            char args[192];
+            snprintf(args, sizeof(args),
+                     "\"cmd\":%u,\"nb_bits\":%u,\"tck\":%llu,\"tap_before\":\"%s\",\"tap_after\":\"%s\"",
+                     c.cmd, c.nb_bits, (unsigned long long)c.tck_cycles,
+                     tap_state_names[cmd_tap_before], tap_state_names[tap]);
+            events.slice(TRACE_PID_WALL, TRACE_TID_COMMANDS, c.name,
+                         events.wall(c.wall_start), c.wall_end - c.wall_start, args);
+            events.slice(TRACE_PID_SIM, TRACE_TID_COMMANDS, c.name,
+                         c.sim_start / 1000, (c.sim_end - c.sim_start) / 1000, args);
+        });
+        std::cout << "[TRACE] Timeline (Chrome/Perfetto): " << events_file << std::endl;
+    }
+
     uint64_t cycle_count = 0;
     uint64_t last_status = 0;
+    uint64_t idle_waits = 0;       // Socket waits taken while idle
+    int quiet_half_cycles = 0;     // Consecutive half-cycles with nothing in flight
+    const int IDLE_SETTLE_HALF_CYCLES = 256;
     bool client_connected_once = false;
 
     // Main VPI simulation state machine
@@ -227,23 +575,365 @@ int main(int argc, char** argv) {
     bool clk_pulse_phase = false;  // false=low, true=high
     bool tck_pulse_phase = false;  // false=low, true=high
     int clk_div_counter = 0;       // For VPI processing timing
+    uint8_t tckc_state = 0;        // cJTAG TCKC level (per-edge path and SF0 executor)
+    if (!restore_file.empty()) {
+        sim_state = (vpi_sim_state_t)restored.sim_state;
+        tck_clk_counter = (int)restored.tck_clk_counter;
+        cycle_count = restored.cycle_count;
+        last_status = cycle_count;
+        clk_pulse_phase = restored.clk_pulse_phase != 0;
+        tck_pulse_phase = restored.tck_pulse_phase != 0;
+        tckc_state = restored.tckc_state;
+    }
+#if ENABLE_CHECKPOINT
+    // --save-checkpoint: taken at the first idle point after the reset phases
+    // and again after each session ends, so the file holds the latest state
+    bool checkpoint_due = !checkpoint_file.empty() && restore_file.empty();
+    bool had_client = false;
+#endif
+
+    // Dump the current signal values to the waveform, if enabled
+    auto dump_waveform = [&]() {
+#if ENABLE_FST || ENABLE_VCD
+        if (!trace) {
+            return;
+        }
+        uint64_t t0 = events.is_open() ? vpi_metrics::now_ns() : 0;
+#if ENABLE_FST
+        static_cast<VerilatedFstC*>(trace)->dump(contextp->time());
+#else
+        static_cast<VerilatedVcdC*>(trace)->dump(contextp->time());
+#endif
+        if (t0) {
+            dump_track.add(t0, vpi_metrics::now_ns());
+        }
+#endif
+    };
+
+    // Advance the model by one CLK half-period (shared by the main loop and the scan executor)
+    auto advance_half_cycle = [&]() {
+        top->clk = clk_pulse_phase ? 1 : 0;
+        contextp->timeInc(CLK_PERIOD/2);
+        if (clk_pulse_phase) {
+            cycle_count++;
+        }
+        clk_pulse_phase = !clk_pulse_phase;
+        if (events.is_open()) {
+            uint64_t t0 = vpi_metrics::now_ns();
+            top->eval();
+            eval_track.add(t0, vpi_metrics::now_ns());
+        } else {
+            top->eval();
+        }
+        dump_waveform();
+    };
+
+    // Scan executor: the VPI server shifts whole scans through this pin driver.
+    // Each call is one full TCK period (TCK high for the first half) at the
+    // TCK/CLK ratio; TDO is sampled after the pulse like the per-bit path.
+    if (scan_executor) {
+        vpi_server.set_scan_executor([&](uint8_t tms, uint8_t tdi) -> uint8_t {
+            top->jtag_pin1_i = tms;
+            top->jtag_pin2_i = tdi;
+            top->jtag_pin0_i = 1;
+            for (int half = 0; half < 2 * TCK_CLK_RATIO; half++) {
+                if (half == TCK_CLK_RATIO) {
+                    top->jtag_pin0_i = 0;
+                }
+                advance_half_cycle();
+            }
+            // oen is active-low: 0=output enabled, 1=tristate
+            return (top->jtag_pin3_oen == 0) ? top->jtag_pin3_o : 1;
+        });
+
+        // cJTAG counterpart: one TCKC edge per call, held for a TCK half-period.
+        // oscan1_controller turns TMSC around for a single CLK a few CLKs after
+        // the falling edge that completes an SF0 cycle, so that edge is held
+        // until TDO shows up on TMSC (bounded, for edges outside SF0).
+        vpi_server.set_sf0_executor([&](uint8_t tmsc) -> uint8_t {
+            top->mode_select = 1;
+            top->jtag_pin1_i = tmsc;
+            tckc_state = !tckc_state;
+            top->jtag_pin0_i = tckc_state;
+            uint8_t tdo = 1;
+            int max_half = tckc_state ? TCK_CLK_RATIO : 4 * TCK_CLK_RATIO;
+            for (int half = 0; half < max_half; half++) {
+                advance_half_cycle();
+                // oen is active-low: 0=output enabled, 1=tristate
+                if (!tckc_state && top->jtag_pin1_oen == 0) {
+                    tdo = top->jtag_pin1_o;
+                    if (half + 1 >= TCK_CLK_RATIO) {
+                        break;
+                    }
+                }
+            }
+            return tdo;
+        });
+    }
+
+    // Per-pulse path: drive one pulse or TCKC edge handed out by
+    // get_pending_signals() and report the TDO sampled after it
+    auto drive_vpi_signals = [&](uint8_t tms, uint8_t tdi, uint8_t mode_sel, bool tck_pulse, bool tckc_toggle) {
+        top->jtag_pin1_i = tms;
+        top->jtag_pin2_i = tdi;
+        top->mode_select = mode_sel;
+
+        uint8_t tdo_value = (top->jtag_pin3_oen == 0) ? top->jtag_pin3_o : 1;
+
+        if (tckc_toggle) {
+            // cJTAG mode: toggle TCKC to create one edge
+            tckc_state = !tckc_state;
+            if (debug_level >= 2) {
+                printf("[VPI][DEBUG] cJTAG TCKC Toggle: state=%d, pin0=%d\n", tckc_state, tckc_state);
+                fflush(stdout);
+            }
+            top->jtag_pin0_i = tckc_state;
+            dump_waveform();
+            // Update TDO after toggle
+            // oen is active-low: 0=output enabled, 1=tristate
+            if (mode_sel == 1) {
+                // cJTAG: TMSC on pin1 (bidirectional)
+                tdo_value = (top->jtag_pin1_oen == 0) ? top->jtag_pin1_o : 1;
+            } else {
+                // JTAG: TDO on pin3
+                tdo_value = (top->jtag_pin3_oen == 0) ? top->jtag_pin3_o : 1;
+            }
+
+            if (debug_level >= 2) {
+                printf("[VPI][DEBUG] VPI Signal Update (cJTAG TCK): tdo=%d, pin3_oen=%d, idcode=0x%08x, active_mode=%d\n",
+                       tdo_value, top->jtag_pin3_oen, top->idcode, top->active_mode);
+                fflush(stdout);
+            }
+
+            vpi_server.update_signals(
+                tdo_value,
+                top->jtag_pin3_oen,
+                top->idcode,
+                top->active_mode
+            );
+        }
+        else if (tck_pulse) {
+            if (debug_level >= 2) {
+                printf("[VPI][DEBUG] JTAG TCK Pulse: Starting 0→1→0 sequence\n");
+                fflush(stdout);
+            }
+            // JTAG mode: Execute TCK pulse (0→1→0)
+            // TCK pulse: 5ns high, 5ns low (10ns total = 100MHz / 10 = 10MHz JTAG clock)
+            top->jtag_pin0_i = 1;
+            dump_waveform();
+            top->jtag_pin0_i = 0;
+            dump_waveform();
+
+            // Update TDO after pulse
+            // oen is active-low: 0=output enabled, 1=tristate
+            if (mode_sel == 1) {
+                // cJTAG: TMSC on pin1 (bidirectional)
+                tdo_value = (top->jtag_pin1_oen == 0) ? top->jtag_pin1_o : 1;
+            } else {
+                // JTAG: TDO on pin3
+                tdo_value = (top->jtag_pin3_oen == 0) ? top->jtag_pin3_o : 1;
+            }
+            if (debug_level >= 2) {
+                printf("[VPI][DEBUG] TCK Pulse Complete: mode=%s, tdo_value=%d\n",
+                       (mode_sel == 1) ? "cJTAG" : "JTAG", tdo_value);
+                fflush(stdout);
+            }
+
+            if (debug_level >= 2) {
+                printf("[VPI][DEBUG] VPI Signal Update: tdo=%d, pin3_oen=%d, idcode=0x%08x, active_mode=%d\n",
+                       tdo_value, top->jtag_pin3_oen, top->idcode, top->active_mode);
+                fflush(stdout);
+            }
+
+            vpi_server.update_signals(
+                tdo_value,
+                top->jtag_pin3_oen,
+                top->idcode,
+                top->active_mode
+            );
+        }
+    };
+
+    // DMI fast path: hold the request on the dmi_fast_* ports until it is
+    // accepted on a rising CLK edge; the registered response is valid then.
+    // dm selects the debug target (GDB stub) instead of the test responder.
+    auto dmi_request = [&](bool dm, uint8_t op, uint32_t addr, uint32_t wdata, uint32_t* rdata) -> uint8_t {
+        const int DMI_TIMEOUT_CYCLES = 1000;
+        top->dmi_fast_dm = dm ? 1 : 0;
+        top->dmi_fast_op = op;
+        top->dmi_fast_addr = addr;
+        top->dmi_fast_wdata = wdata;
+        top->dmi_fast_valid = 1;
+        top->eval();  // Settle ready for the selected target
+        bool accepted = false;
+        for (int half = 0; half < 2 * DMI_TIMEOUT_CYCLES && !accepted; half++) {
+            bool ready = top->dmi_fast_ready;
+            advance_half_cycle();
+            accepted = ready && top->clk;  // clk just rose with ready high
+        }
+        top->dmi_fast_valid = 0;
+        *rdata = top->dmi_fast_rdata;
+        uint8_t resp = accepted ? top->dmi_fast_resp : 3;  // DMI_RESP_BUSY on timeout
+        advance_half_cycle();
+        return resp;
+    };
+    // CMD_SBA_READ/WRITE without the fast path: DTM scans reach the debug target
+    vpi_server.set_dtm_target_select([&](bool dm) {
+        top->dtm_dm = dm ? 1 : 0;
+        top->eval();
+    });
+    if (dmi_fastpath) {
+        vpi_server.set_dmi_executor([&](uint8_t op, uint32_t addr, uint32_t wdata, uint32_t* rdata) -> uint8_t {
+            return dmi_request(false, op, addr, wdata, rdata);
+        });
+        // CMD_SBA_READ/WRITE: system bus memory behind the debug target
+        vpi_server.set_dm_executor([&](uint8_t op, uint32_t addr, uint32_t wdata, uint32_t* rdata) -> uint8_t {
+            return dmi_request(true, op, addr, wdata, rdata);
+        });
+    }
+
+    // GDB stub: debugs the jtag_vpi_top debug target over the same fast path
+    GdbRspServer gdb_server(gdb_port);
+    if (gdb_port > 0) {
+        gdb_server.set_dmi_executor([&](uint8_t op, uint32_t addr, uint32_t wdata, uint32_t* rdata) -> uint8_t {
+            return dmi_request(true, op, addr, wdata, rdata);
+        });
+        gdb_server.set_debug_level(debug_level);
+        gdb_server.set_poll_interval(poll_interval);
+        if (!gdb_server.init()) {
+            std::cerr << "[GDB] Failed to initialize stub on port " << gdb_port << std::endl;
+            delete top;
+            return 1;
+        }
+    }
+
+    if (!record_file.empty()) {
+        if (!vpi_server.start_recording(record_file)) {
+            std::cerr << "[SIM] Could not open " << record_file << ": " << strerror(errno) << std::endl;
+            delete top;
+            return 1;
+        }
+        std::cout << "[SIM] Recording client traffic: " << record_file << std::endl;
+    }
+    auto replay_start = std::chrono::steady_clock::now();
+
+    // --fork parent: once reset is done it only accepts. Each connection gets
+    // a child forked from the model as it stands, which returns true here and
+    // serves it; the parent returns false when told to stop or at the timeout,
+    // after stopping and reaping the children still running.
+    std::vector<pid_t> children;
+    bool forked_child = false;
+    auto fork_server = [&]() -> bool {
+        std::cout << "[SIM] Reset done at cycle " << cycle_count << ", forking a simulator per connection" << std::endl;
+        uint64_t forks = 0;
+        while (!stop_requested) {
+            pid_t done;
+            while ((done = waitpid(-1, nullptr, WNOHANG)) > 0) {
+                children.erase(std::remove(children.begin(), children.end(), done), children.end());
+            }
+            if (timeout_seconds > 0 && std::chrono::steady_clock::now() >= deadline) {
+                std::cout << "\n[SIM] Timeout reached (configured " << timeout_seconds << "s)" << std::endl;
+                break;
+            }
+            std::string peer;
+            int session = 0;
+            int sock = vpi_server.accept_for_fork(100, &peer, &session);
+            if (sock < 0) {
+                continue;
+            }
+            // Or the child prints the parent's buffered output again
+            std::cout.flush();
+            fflush(stdout);
+            pid_t pid = fork();
+            if (pid == 0) {
+                children.clear();
+                if (!vpi_server.adopt_forked_client(sock, session, peer)) {
+                    _exit(1);
+                }
+                start_time = std::chrono::steady_clock::now();
+                if (timeout_seconds > 0) {
+                    deadline = start_time + std::chrono::seconds(timeout_seconds);
+                }
+                return true;
+            }
+            close(sock);
+            if (pid < 0) {
+                std::cerr << "[SIM] fork failed: " << strerror(errno) << std::endl;
+                continue;
+            }
+            children.push_back(pid);
+            forks++;
+            std::cout << "[SIM] Session " << session << " (" << peer << "): pid " << pid
+                      << ", " << children.size() << " running" << std::endl;
+        }
+        for (pid_t pid : children) {
+            kill(pid, SIGTERM);
+        }
+        for (pid_t pid : children) {
+            waitpid(pid, nullptr, 0);
+        }
+        std::cout << "[SIM] Forked " << forks << " session(s)" << std::endl;
+        return false;
+    };
 
     // Release reset after initial system reset cycles
-    std::cout << "[SIM] Starting system reset phase..." << std::endl;
+    if (restore_file.empty()) {
+        std::cout << "[SIM] Starting system reset phase..." << std::endl;
+    } else {
+        std::cout << "[SIM] Resuming at cycle " << cycle_count << ", reset phases skipped" << std::endl;
+    }
 
     // Main simulation loop with integrated reset
     std::cout << "[DEBUG] Entering main simulation loop..." << std::endl;
-    while (!contextp->gotFinish()) {
-        // CRITICAL: Poll VPI server FIRST - ensures continuous socket monitoring
-        // regardless of simulation state (fixes architectural polling limitation)
-        vpi_server.poll();
+    while (!contextp->gotFinish() && !stop_requested) {
+#if ENABLE_CHECKPOINT
+        if (checkpoint_due && (sim_state == SIM_IDLE || sim_state == SIM_VPI_ACTIVE) &&
+            !gdb_server.is_client_connected()) {
+            SimCheckpoint cp;
+            memset(&cp, 0, sizeof(cp));
+            if (vpi_server.save_checkpoint(&cp.server)) {
+                cp.sim_state = sim_state;
+                cp.tck_clk_counter = (uint32_t)tck_clk_counter;
+                cp.time_ps = contextp->time();
+                cp.cycle_count = cycle_count;
+                cp.cjtag_mode = cjtag_mode ? 1 : 0;
+                cp.clk_pulse_phase = clk_pulse_phase ? 1 : 0;
+                cp.tck_pulse_phase = tck_pulse_phase ? 1 : 0;
+                cp.tckc_state = tckc_state;
+                if (save_checkpoint(checkpoint_file, top, cp)) {
+                    std::cout << "[SIM] Checkpoint saved: " << checkpoint_file << " (cycle " << cycle_count << ")" << std::endl;
+                } else {
+                    std::cerr << "[SIM] Could not write " << checkpoint_file << ": " << strerror(errno) << std::endl;
+                }
+                checkpoint_due = false;
+            }
+        }
+#endif
+        if (fork_sessions && !forked_child && sim_state >= SIM_IDLE) {
+            if (!fork_server()) {
+                break;
+            }
+            forked_child = true;
+        }
 
-        // Generate constant 50% duty cycle CLK
-        if (clk_pulse_phase) {
-            top->clk = 1;
-        } else {
-            top->clk = 0;
+        // CRITICAL: Poll VPI server FIRST - ensures continuous socket monitoring
+        // regardless of simulation state (fixes architectural polling limitation).
+        // A replay or a --fork parent starts once the reset phases are over.
+        // A --fork child ends with its session.
+        if ((replay_file.empty() && !fork_sessions) || sim_state >= SIM_IDLE) {
+            vpi_server.poll();
+            if (vpi_server.replay_done() || (forked_child && !vpi_server.is_client_connected())) {
+                break;
+            }
+#if ENABLE_CHECKPOINT
+            bool connected = vpi_server.is_client_connected();
+            if (had_client && !connected) {
+                checkpoint_due = !checkpoint_file.empty();
+            }
+            had_client = connected;
+#endif
         }
+        gdb_server.poll();
 
         // Comprehensive VPI simulation state machine
         switch (sim_state) {
@@ -291,6 +981,7 @@ int main(int argc, char** argv) {
 
                         if (reset_tck_cycles >= JTAG_RESET_TCK_CYCLES) {
                             top->jtag_pin1_i = 0;  // TMS back to low
+                            top->mode_select = cjtag_mode ? 1 : 0;
                             sim_state = SIM_IDLE;
                             std::cout << "[SIM] JTAG TAP reset complete, entering idle state" << std::endl;
                             std::cout << "[SIM] Cycle: " << cycle_count
@@ -308,14 +999,11 @@ int main(int argc, char** argv) {
                 // NOTE: VPI server polling now happens at the beginning of the main loop (line 237)
                 // This ensures continuous polling across all simulation states, not just IDLE
 
-                // Check if VPI server becomes active (has pending operations)
-                uint8_t tms, tdi, mode_sel;
-                bool tck_pulse;
-                if (vpi_server.get_pending_signals(&tms, &tdi, &mode_sel, &tck_pulse)) {
+                // Check if VPI server becomes active (has pending operations).
+                // Only peek: the signals are consumed in SIM_VPI_PROCESSING.
+                if (vpi_server.has_pending_signals()) {
                     if (debug_level >= 2) {
-                        std::cout << "[VPI][DEBUG] SIM_IDLE: VPI signals detected - switching to SIM_VPI_ACTIVE"
-                                  << " (TMS=" << (int)tms << ", TDI=" << (int)tdi
-                                  << ", TCK_pulse=" << (tck_pulse ? "true" : "false") << ")" << std::endl;
+                        std::cout << "[VPI][DEBUG] SIM_IDLE: VPI signals detected - switching to SIM_VPI_ACTIVE" << std::endl;
                     }
                     sim_state = SIM_VPI_ACTIVE;
                 }
@@ -380,14 +1068,8 @@ int main(int argc, char** argv) {
                 }
 
                 // Check for VPI signals and transition to processing
-                {
-                    uint8_t tms, tdi, mode_sel;
-                    bool tck_pulse, tckc_toggle = false;
-                    bool client_connected = vpi_server.is_client_connected();
-
-                    if (client_connected && vpi_server.get_pending_signals(&tms, &tdi, &mode_sel, &tck_pulse, &tckc_toggle)) {
-                        sim_state = SIM_VPI_PROCESSING;
-                    }
+                if (vpi_server.is_client_connected() && vpi_server.has_pending_signals()) {
+                    sim_state = SIM_VPI_PROCESSING;
                 }
                 break;
 
@@ -416,13 +1098,16 @@ int main(int argc, char** argv) {
                     uint8_t tms, tdi, mode_sel;
                     bool tck_pulse, tckc_toggle = false;
                     bool client_connected = vpi_server.is_client_connected();
-                    bool has_pending_signals = client_connected && vpi_server.get_pending_signals(&tms, &tdi, &mode_sel, &tck_pulse, &tckc_toggle);
 
                     // TCK/CLK = 1/4 ratio control: Only process VPI requests every 4 CLK cycles
                     static int clk_div_counter = 0;
                     bool process_vpi_this_cycle = (clk_div_counter == 0);
                     clk_div_counter = (clk_div_counter + 1) % 4;
 
+                    // Fetch (and consume) signals only on cycles that apply them
+                    bool has_pending_signals = client_connected && process_vpi_this_cycle &&
+                                               vpi_server.get_pending_signals(&tms, &tdi, &mode_sel, &tck_pulse, &tckc_toggle);
+
                     if (debug_level >= 2) {
                         std::cout << "[VPI][DEBUG] VPI_PROCESSING: TCK/CLK ratio cycle " << clk_div_counter
                                   << ", process_vpi_this_cycle=" << process_vpi_this_cycle
@@ -435,104 +1120,29 @@ int main(int argc, char** argv) {
                                       << ", TDI=" << (int)tdi << ", mode_sel=" << (int)mode_sel
                                       << ", tck_pulse=" << tck_pulse << ", tckc_toggle=" << tckc_toggle << std::endl;
                         }
-                        top->jtag_pin1_i = tms;
-                        top->jtag_pin2_i = tdi;
-                        top->mode_select = mode_sel;
-
-                        uint8_t tdo_value = (top->jtag_pin3_oen == 0) ? top->jtag_pin3_o : 1;
-
-                        if (tckc_toggle) {
-                            // cJTAG mode: toggle TCKC to create one edge
-                            static uint8_t tckc_state = 0;
-                            tckc_state = !tckc_state;
-                            if (debug_level >= 2) {
-                                printf("[VPI][DEBUG] cJTAG TCKC Toggle: state=%d, pin0=%d\n", tckc_state, tckc_state);
-                                fflush(stdout);
-                            }
-                            top->jtag_pin0_i = tckc_state;
-#if ENABLE_FST
-                            if (trace) static_cast<VerilatedFstC*>(trace)->dump(contextp->time());
-#elif ENABLE_VCD
-                            if (trace) static_cast<VerilatedVcdC*>(trace)->dump(contextp->time());
-#endif
-                            // Update TDO after toggle
-                            // oen is active-low: 0=output enabled, 1=tristate
-                            if (mode_sel == 1) {
-                                // cJTAG: TMSC on pin1 (bidirectional)
-                                tdo_value = (top->jtag_pin1_oen == 0) ? top->jtag_pin1_o : 1;
-                            } else {
-                                // JTAG: TDO on pin3
-                                tdo_value = (top->jtag_pin3_oen == 0) ? top->jtag_pin3_o : 1;
-                            }
-
-                            if (debug_level >= 2) {
-                                printf("[VPI][DEBUG] VPI Signal Update (cJTAG TCK): tdo=%d, pin3_oen=%d, idcode=0x%08x, active_mode=%d\n",
-                                       tdo_value, top->jtag_pin3_oen, top->idcode, top->active_mode);
-                                fflush(stdout);
-                            }
-
-                            vpi_server.update_signals(
-                                tdo_value,
-                                top->jtag_pin3_oen,
-                                top->idcode,
-                                top->active_mode
-                            );
-                        }
-                        else if (tck_pulse) {
-                            if (debug_level >= 2) {
-                                printf("[VPI][DEBUG] JTAG TCK Pulse: Starting 0→1→0 sequence\n");
-                                fflush(stdout);
-                            }
-                            // JTAG mode: Execute TCK pulse (0→1→0)
-                            // TCK pulse: 5ns high, 5ns low (10ns total = 100MHz / 10 = 10MHz JTAG clock)
-                            top->jtag_pin0_i = 1;
-#if ENABLE_FST
-                            if (trace) static_cast<VerilatedFstC*>(trace)->dump(contextp->time());
-#elif ENABLE_VCD
-                            if (trace) static_cast<VerilatedVcdC*>(trace)->dump(contextp->time());
-#endif
-                            top->jtag_pin0_i = 0;
-#if ENABLE_FST
-                            if (trace) static_cast<VerilatedFstC*>(trace)->dump(contextp->time());
-#elif ENABLE_VCD
-                            if (trace) static_cast<VerilatedVcdC*>(trace)->dump(contextp->time());
-#endif
+                        drive_vpi_signals(tms, tdi, mode_sel, tck_pulse, tckc_toggle);
 
-                            // Update TDO after pulse
-                            // oen is active-low: 0=output enabled, 1=tristate
-                            if (mode_sel == 1) {
-                                // cJTAG: TMSC on pin1 (bidirectional)
-                                tdo_value = (top->jtag_pin1_oen == 0) ? top->jtag_pin1_o : 1;
-                            } else {
-                                // JTAG: TDO on pin3
-                                tdo_value = (top->jtag_pin3_oen == 0) ? top->jtag_pin3_o : 1;
-                            }
-                            if (debug_level >= 2) {
-                                printf("[VPI][DEBUG] TCK Pulse Complete: mode=%s, tdo_value=%d\n",
-                                       (mode_sel == 1) ? "cJTAG" : "JTAG", tdo_value);
-                                fflush(stdout);
+                        // --tck-drain: apply further queued pulses/edges in this
+                        // slot, one TCK period apart so the CLK-sampled TAP sees each
+                        for (uint32_t n = 1; n < vpi_server.tck_drain_width(); n++) {
+                            for (int half = 0; half < 2 * TCK_CLK_RATIO; half++) {
+                                advance_half_cycle();
                             }
-
-                            if (debug_level >= 2) {
-                                printf("[VPI][DEBUG] VPI Signal Update: tdo=%d, pin3_oen=%d, idcode=0x%08x, active_mode=%d\n",
-                                       tdo_value, top->jtag_pin3_oen, top->idcode, top->active_mode);
-                                fflush(stdout);
+                            if (!vpi_server.get_pending_signals(&tms, &tdi, &mode_sel, &tck_pulse, &tckc_toggle)) {
+                                break;
                             }
-
-                            vpi_server.update_signals(
-                                tdo_value,
-                                top->jtag_pin3_oen,
-                                top->idcode,
-                                top->active_mode
-                            );
+                            drive_vpi_signals(tms, tdi, mode_sel, tck_pulse, tckc_toggle);
                         }
 
                         // Return to VPI_ACTIVE for next signal check
                         sim_state = SIM_VPI_ACTIVE;
                     } else {
-                        // No VPI client connected or no pending signals: Keep pins in stable state
-                        top->jtag_pin0_i = 0;  // TCK idle (low)
-                        top->jtag_pin1_i = 0;  // TMS=0 (stay in current state)
+                        // No VPI client connected or no pending signals: Keep pins in stable state.
+                        // In cJTAG mode TCKC/TMSC stay where the last edge left them.
+                        if (!top->mode_select) {
+                            top->jtag_pin0_i = 0;  // TCK idle (low)
+                            top->jtag_pin1_i = 0;  // TMS=0 (stay in current state)
+                        }
                         top->jtag_pin2_i = 0;  // TDI=0 (no data input)
 
                         // Return to VPI_ACTIVE for continued polling
@@ -563,28 +1173,57 @@ int main(int argc, char** argv) {
                 break;
         }
 
-        // Advance CLK time: per half-cycle for system clock
-        contextp->timeInc(CLK_PERIOD/2);
-
-        if (clk_pulse_phase) {
-            cycle_count++;
+        // Idle-sleep: once the server has been quiescent for IDLE_SETTLE_HALF_CYCLES,
+        // stop evaluating and block on the sockets until bytes arrive (or the
+        // idle timeout expires). Simulated time is frozen, or fast-forwarded by
+        // the wall-clock time spent blocked at the nominal CLK rate. A connected
+        // GDB client keeps the model evaluating (its socket is not waited on).
+        bool idled = false;
+        if (idle_mode != IDLE_OFF &&
+            (sim_state == SIM_IDLE || sim_state == SIM_VPI_ACTIVE) &&
+            vpi_server.is_quiescent() && !gdb_server.is_client_connected()) {
+            if (quiet_half_cycles < IDLE_SETTLE_HALF_CYCLES) {
+                quiet_half_cycles++;
+            } else {
+                auto idle_start = std::chrono::steady_clock::now();
+                int wait_ms = idle_timeout_ms;
+                if (timeout_seconds > 0) {
+                    // Round up so the final sub-millisecond before the deadline does not spin
+                    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - idle_start).count() + 1;
+                    wait_ms = (int)std::max<int64_t>(0, std::min<int64_t>(wait_ms, remaining));
+                }
+                bool woke = vpi_server.wait_for_activity(wait_ms);
+                if (events.is_open()) {
+                    uint64_t idle_t0 = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        idle_start.time_since_epoch()).count();
+                    events.slice(TRACE_PID_WALL, TRACE_TID_IDLE, woke ? "wait (woke)" : "wait",
+                                 events.wall(idle_t0), vpi_metrics::now_ns() - idle_t0);
+                }
+                if (idle_mode == IDLE_ADVANCE) {
+                    auto idle_ps = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - idle_start).count() * 1000;
+                    uint64_t skipped = (uint64_t)idle_ps / CLK_PERIOD;
+                    contextp->timeInc(skipped * CLK_PERIOD);
+                    cycle_count += skipped;
+                }
+                idle_waits++;
+                if (woke) {
+                    // Resume cycle-exact evaluation
+                    quiet_half_cycles = 0;
+                    if (debug_level >= 2) {
+                        std::cout << "[VPI][DEBUG] Idle-sleep: socket activity, resuming evaluation" << std::endl;
+                    }
+                }
+                idled = true;
+            }
+        } else {
+            quiet_half_cycles = 0;
         }
 
-        clk_pulse_phase = !clk_pulse_phase;
-
-        // Common simulation step operations for all states
-        top->eval();
-
-        // Dump trace
-#if ENABLE_FST
-        if (trace) {
-            static_cast<VerilatedFstC*>(trace)->dump(contextp->time());
-        }
-#elif ENABLE_VCD
-        if (trace) {
-            static_cast<VerilatedVcdC*>(trace)->dump(contextp->time());
+        // Advance CLK time per half-cycle, evaluate and dump trace (common to all states)
+        if (!idled) {
+            advance_half_cycle();
         }
-#endif
 
         // Exit condition: Ctrl+C or wall-clock timeout (with cycle fallback)
         // Skip timeout check if timeout_seconds is 0 (unlimited)
@@ -645,6 +1284,13 @@ int main(int argc, char** argv) {
 
     // Cleanup
 
+    if (events.is_open()) {
+        vpi_server.set_command_tracer(nullptr);  // reads the model, deleted below
+        eval_track.emit();
+        dump_track.emit();
+        events.close();
+    }
+
 #if ENABLE_FST
     if (trace) {
         static_cast<VerilatedFstC*>(trace)->close();
@@ -665,7 +1311,32 @@ int main(int argc, char** argv) {
 
     std::cout << "\n=== VPI Simulation Complete ===" << std::endl;
     std::cout << "Total cycles: " << cycle_count << std::endl;
+    if (idle_mode != IDLE_OFF) {
+        std::cout << "Idle-sleep waits: " << idle_waits << std::endl;
+    }
     std::cout << "Simulation time: " << contextp->time() << " ns" << std::endl;
+    if (!stats_file.empty()) {
+        if (vpi_server.write_stats(stats_file)) {
+            std::cout << "Command metrics: " << stats_file << std::endl;
+        } else {
+            std::cerr << "[SIM] Could not write " << stats_file << ": " << strerror(errno) << std::endl;
+        }
+    }
+    if (!events_file.empty()) {
+        std::cout << "Timeline: " << events_file << std::endl;
+    }
+    if (!record_file.empty()) {
+        vpi_server.stop_recording();
+        std::cout << "Recording: " << record_file << std::endl;
+    }
+    if (!replay_file.empty()) {
+        std::cout << "Replay wall time: " << std::fixed << std::setprecision(3)
+                  << std::chrono::duration<double>(std::chrono::steady_clock::now() - replay_start).count()
+                  << " s" << std::endl;
+        if (!vpi_server.finish_replay()) {
+            exit_code = 1;
+        }
+    }
 
     return exit_code;
 }
@@ -0,0 +1,118 @@
+/**
+ * VPI server metrics
+ * Per-command counters and log-linear (HDR-style) latency histograms
+ */
+
+#ifndef VPI_METRICS_H
+#define VPI_METRICS_H
+
+#include <stdint.h>
+#include <string.h>
+#include <chrono>
+
+namespace vpi_metrics {
+
+// Monotonic wall clock in nanoseconds
+static inline uint64_t now_ns() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Values below 16 are exact; above, every power of two is split into 16
+// linear sub-buckets, so a reported percentile is at most 1/16 above the
+// true value. Values are clamped to 2^48 - 1 (78 hours in ns).
+struct Histogram {
+    static constexpr int SUB_BITS = 4;
+    static constexpr int SUB_COUNT = 1 << SUB_BITS;
+    static constexpr int MAX_BITS = 48;
+    static constexpr int BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_COUNT;
+
+    uint64_t counts[BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t min_value;
+    uint64_t max_value;
+
+    Histogram() { clear(); }
+
+    void clear() {
+        memset(counts, 0, sizeof(counts));
+        total = 0;
+        sum = 0;
+        min_value = UINT64_MAX;
+        max_value = 0;
+    }
+
+    static int bucket(uint64_t v) {
+        if (v < SUB_COUNT) {
+            return (int)v;
+        }
+        int shift = (63 - __builtin_clzll(v)) - SUB_BITS;
+        return ((shift + 1) << SUB_BITS) + (int)((v >> shift) & (SUB_COUNT - 1));
+    }
+
+    // Largest value that lands in bucket b
+    static uint64_t bucket_high(int b) {
+        if (b < SUB_COUNT) {
+            return (uint64_t)b;
+        }
+        int shift = (b >> SUB_BITS) - 1;
+        return ((uint64_t)(SUB_COUNT + (b & (SUB_COUNT - 1))) << shift) + ((1ull << shift) - 1);
+    }
+
+    void record(uint64_t v) {
+        if (v >= (1ull << MAX_BITS)) {
+            v = (1ull << MAX_BITS) - 1;
+        }
+        counts[bucket(v)]++;
+        total++;
+        sum += v;
+        if (v < min_value) min_value = v;
+        if (v > max_value) max_value = v;
+    }
+
+    uint64_t min() const { return total ? min_value : 0; }
+    uint64_t max() const { return max_value; }
+    uint64_t mean() const { return total ? sum / total : 0; }
+
+    // Value at or below which pct percent of the samples fall
+    uint64_t percentile(double pct) const {
+        if (total == 0) {
+            return 0;
+        }
+        uint64_t rank = (uint64_t)(pct / 100.0 * (double)total + 0.999999);
+        if (rank == 0) rank = 1;
+        uint64_t seen = 0;
+        for (int b = 0; b < BUCKETS; b++) {
+            seen += counts[b];
+            if (seen >= rank) {
+                uint64_t v = bucket_high(b);
+                return (v < max_value) ? v : max_value;
+            }
+        }
+        return max_value;
+    }
+};
+
+// One class of commands: how many ran, the scan bits they shifted, the TCKs
+// they drove, and the time from their first byte received until the
+// response was handed to the transport, in wall-clock ns and simulated ps
+struct CommandStats {
+    uint64_t count = 0;
+    uint64_t bits = 0;
+    uint64_t tck_cycles = 0;
+    Histogram wall_ns;
+    Histogram sim_ps;
+
+    void clear() {
+        count = 0;
+        bits = 0;
+        tck_cycles = 0;
+        wall_ns.clear();
+        sim_ps.clear();
+    }
+};
+
+} // namespace vpi_metrics
+
+#endif // VPI_METRICS_H
@@ -0,0 +1,384 @@
+/**
+ * VPI session recording
+ * Compact binary log of everything clients sent to the server and got back,
+ * and a player that feeds it to the server again without a socket
+ */
+
+#ifndef VPI_RECORD_H
+#define VPI_RECORD_H
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace vpi_record {
+
+// File: 8-byte magic, version and flags (LE u32), then records. Each record
+// is a type byte, the session id, the simulated time in ps since the previous
+// record, and a type-specific payload; integers are unsigned LEB128.
+static const char MAGIC[8] = "JVPIREC";
+static constexpr uint32_t VERSION = 1;
+
+// How the server ran while recording
+static constexpr uint32_t FLAG_CJTAG = 1u << 0;
+static constexpr uint32_t FLAG_MSB_FIRST = 1u << 1;
+static constexpr uint32_t FLAG_DMI_FASTPATH = 1u << 2;
+static constexpr uint32_t FLAG_PER_BIT_SCAN = 1u << 3;
+
+enum RecordType : uint8_t {
+    REC_OPEN = 1,          // session connected
+    REC_RX = 2,            // bytes one receive returned: length, data
+    REC_PEEK = 3,          // a MSG_PEEK found this many bytes waiting (0 = none)
+    REC_TX = 4,            // bytes handed to the transport: length, data
+    REC_TX_UNCHECKED = 5,  // same, but timing or transport dependent (CMD_STATS, shm handshake)
+    REC_CLOSE = 6,         // session closed
+};
+
+// Buffered like the timeline writer: records are only written out when the
+// buffer fills and at close
+class Writer {
+public:
+    static constexpr size_t BUFFER_SIZE = 1 << 20;
+
+    Writer() : fp(nullptr), last_sim(0) {}
+    ~Writer() { close(); }
+
+    bool open(const char* path, uint32_t flags) {
+        fp = fopen(path, "wb");
+        if (!fp) {
+            return false;
+        }
+        buf.reserve(BUFFER_SIZE);
+        buf.assign((const uint8_t*)MAGIC, (const uint8_t*)MAGIC + sizeof(MAGIC));
+        put_u32(VERSION);
+        put_u32(flags);
+        last_sim = 0;
+        return true;
+    }
+
+    bool is_open() const { return fp != nullptr; }
+
+    void close() {
+        if (!fp) {
+            return;
+        }
+        flush();
+        fclose(fp);
+        fp = nullptr;
+    }
+
+    // data/len: the bytes of REC_RX/REC_TX*, or (data = nullptr) the count of REC_PEEK
+    void record(uint8_t type, uint32_t session, uint64_t sim_ps, const void* data, size_t len) {
+        struct iovec iov = {const_cast<void*>(data), data ? len : 0};
+        record_iov(type, session, sim_ps, &iov, 1, len);
+    }
+
+    void record_iov(uint8_t type, uint32_t session, uint64_t sim_ps, const struct iovec* iov, int cnt, size_t len) {
+        if (!fp) {
+            return;
+        }
+        size_t bytes = 0;
+        for (int i = 0; i < cnt; i++) {
+            bytes += iov[i].iov_len;
+        }
+        if (buf.size() + 32 + bytes > BUFFER_SIZE) {
+            flush();
+        }
+        buf.push_back(type);
+        put_leb(session);
+        put_leb(sim_ps >= last_sim ? sim_ps - last_sim : 0);
+        last_sim = sim_ps;
+        if (type == REC_RX || type == REC_TX || type == REC_TX_UNCHECKED || type == REC_PEEK) {
+            put_leb(len);
+        }
+        for (int i = 0; i < cnt; i++) {
+            buf.insert(buf.end(), (const uint8_t*)iov[i].iov_base, (const uint8_t*)iov[i].iov_base + iov[i].iov_len);
+        }
+    }
+
+private:
+    FILE* fp;
+    std::vector<uint8_t> buf;
+    uint64_t last_sim;
+
+    void put_u32(uint32_t v) {
+        for (int i = 0; i < 4; i++) {
+            buf.push_back((uint8_t)(v >> (8 * i)));
+        }
+    }
+
+    void put_leb(uint64_t v) {
+        do {
+            uint8_t b = v & 0x7F;
+            v >>= 7;
+            buf.push_back(b | (v ? 0x80 : 0));
+        } while (v);
+    }
+
+    void flush() {
+        fwrite(buf.data(), 1, buf.size(), fp);
+        buf.clear();
+    }
+};
+
+// One client connection, split out of the recording
+struct Session {
+    struct Input {
+        uint8_t type;       // REC_RX or REC_PEEK
+        uint32_t len;       // bytes received, or bytes a peek saw
+        size_t tx_before;   // output the session had produced by then
+        uint64_t sim;       // simulated time since the session opened
+    };
+    uint32_t id = 0;
+    std::vector<Input> input;
+    std::vector<uint8_t> rx;                            // every REC_RX payload in order
+    std::vector<uint8_t> tx;                            // every REC_TX* payload in order
+    std::vector<std::pair<size_t, size_t>> unchecked;   // [begin, end) of tx not compared
+    uint64_t sim_start = 0;
+    uint64_t sim_end = 0;
+};
+
+// Feeds the recorded sessions back one after another, in the order they
+// connected: receives are served from the recorded input, sent bytes are
+// compared with the recorded output
+class Player {
+public:
+    uint32_t flags = 0;
+    std::vector<Session> sessions;
+    uint64_t sim_end = 0;           // simulated time of the last record
+    uint64_t responses = 0;         // transport writes compared
+    uint64_t mismatches = 0;        // of those, differing from the recording
+    uint64_t missing_bytes = 0;     // recorded output that was never produced
+    bool truncated = false;         // the file ends inside a record (recorder killed)
+
+    bool load(const char* path, std::string* error) {
+        FILE* f = fopen(path, "rb");
+        if (!f) {
+            *error = strerror(errno);
+            return false;
+        }
+        std::vector<uint8_t> data;
+        uint8_t chunk[65536];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+            data.insert(data.end(), chunk, chunk + n);
+        }
+        fclose(f);
+        if (data.size() < 16 || memcmp(data.data(), MAGIC, sizeof(MAGIC)) != 0) {
+            *error = "not a jtag_vpi recording";
+            return false;
+        }
+        uint32_t version = get_u32(&data[8]);
+        if (version != VERSION) {
+            *error = "unsupported recording version " + std::to_string(version);
+            return false;
+        }
+        flags = get_u32(&data[12]);
+        size_t pos = 16;
+        uint64_t sim = 0;
+        while (pos < data.size()) {
+            uint8_t type = data[pos++];
+            uint64_t id, delta, len = 0;
+            if (!get_leb(data, &pos, &id) || !get_leb(data, &pos, &delta)) {
+                pos = data.size() + 1;
+                break;
+            }
+            sim += delta;
+            if (type == REC_RX || type == REC_TX || type == REC_TX_UNCHECKED || type == REC_PEEK) {
+                if (!get_leb(data, &pos, &len)) {
+                    pos = data.size() + 1;
+                    break;
+                }
+            }
+            if (type != REC_PEEK && len > data.size() - pos) {
+                pos = data.size() + 1;
+                break;
+            }
+            Session& s = session((uint32_t)id, sim);
+            s.sim_end = sim;
+            switch (type) {
+                case REC_RX:
+                    s.input.push_back({REC_RX, (uint32_t)len, s.tx.size(), sim - s.sim_start});
+                    s.rx.insert(s.rx.end(), data.data() + pos, data.data() + pos + len);
+                    pos += len;
+                    break;
+                case REC_PEEK:
+                    s.input.push_back({REC_PEEK, (uint32_t)len, s.tx.size(), sim - s.sim_start});
+                    break;
+                case REC_TX_UNCHECKED:
+                    s.unchecked.push_back({s.tx.size(), s.tx.size() + len});
+                    // fall through
+                case REC_TX:
+                    s.tx.insert(s.tx.end(), data.data() + pos, data.data() + pos + len);
+                    pos += len;
+                    break;
+                default:
+                    break;
+            }
+        }
+        truncated = (pos != data.size());
+        sim_end = sim;
+        return true;
+    }
+
+    // Start the next session at simulated time now_ps; false once all of them have run
+    bool next_session(uint64_t now_ps) {
+        if (next >= sessions.size()) {
+            return false;
+        }
+        cur = &sessions[next++];
+        origin = now_ps;
+        item = 0;
+        item_pos = 0;
+        rx_pos = 0;
+        tx_pos = 0;
+        return true;
+    }
+
+    bool finished() const { return cur == nullptr && next >= sessions.size(); }
+    bool has_input() const { return cur && item < cur->input.size(); }
+
+    // recv() from the recording at simulated time now_ps. A read stops at the
+    // end of a recorded receive (*drained), like a short read from a socket.
+    // Peeks answer as recorded; 0 once the session's input is used up. Input
+    // the client only sent after seeing a response is held back (EAGAIN) until
+    // the server has produced that much output again, or until STALL_PS past
+    // the time it arrived in the recording if it never does.
+    ssize_t recv(void* buf, size_t len, bool peek, uint64_t now_ps, bool* drained) {
+        *drained = false;
+        if (!cur) {
+            return 0;
+        }
+        if (item < cur->input.size() && item_pos == 0 && tx_pos < cur->input[item].tx_before &&
+            now_ps - origin < cur->input[item].sim + STALL_PS) {
+            *drained = true;
+            errno = EAGAIN;
+            return -1;
+        }
+        if (peek) {
+            size_t seen = cur->rx.size() - rx_pos;
+            if (item < cur->input.size() && cur->input[item].type == REC_PEEK) {
+                seen = cur->input[item++].len;
+            }
+            if (seen == 0 || rx_pos == cur->rx.size()) {
+                *drained = true;
+                errno = EAGAIN;
+                return -1;
+            }
+            size_t n = std::min(std::min(len, seen), cur->rx.size() - rx_pos);
+            memcpy(buf, &cur->rx[rx_pos], n);
+            return (ssize_t)n;
+        }
+        while (item < cur->input.size() && cur->input[item].type == REC_PEEK) {
+            item++;  // a peek this run did not repeat
+        }
+        if (item >= cur->input.size()) {
+            *drained = true;
+            return 0;
+        }
+        size_t n = std::min(len, (size_t)cur->input[item].len - item_pos);
+        memcpy(buf, &cur->rx[rx_pos], n);
+        rx_pos += n;
+        item_pos += n;
+        if (item_pos == cur->input[item].len) {
+            item++;
+            item_pos = 0;
+            *drained = true;
+        }
+        return (ssize_t)n;
+    }
+
+    // Compare one transport write with the recorded output; returns false if it differs
+    bool check(const struct iovec* iov, int cnt, int session_id) {
+        responses++;
+        size_t start = tx_pos;
+        bool same = true;
+        for (int i = 0; i < cnt; i++) {
+            const uint8_t* p = (const uint8_t*)iov[i].iov_base;
+            for (size_t k = 0; k < iov[i].iov_len; k++, tx_pos++) {
+                if (!cur || tx_pos >= cur->tx.size()) {
+                    same = false;
+                } else if (cur->tx[tx_pos] != p[k] && !is_unchecked(tx_pos)) {
+                    same = false;
+                }
+            }
+        }
+        if (!same) {
+            if (mismatches < 10) {
+                printf("[REPLAY] Session %d: output bytes %zu-%zu differ from the recording\n",
+                       session_id, start, tx_pos - 1);
+                fflush(stdout);
+            }
+            mismatches++;
+        }
+        return same;
+    }
+
+    void end_session() {
+        if (cur && tx_pos < cur->tx.size()) {
+            missing_bytes += cur->tx.size() - tx_pos;
+        }
+        cur = nullptr;
+    }
+
+private:
+    static constexpr uint64_t STALL_PS = 1000000000ull;  // 1 ms simulated
+
+    Session* cur = nullptr;
+    size_t next = 0;
+    uint64_t origin = 0;
+    size_t item = 0;
+    size_t item_pos = 0;
+    size_t rx_pos = 0;
+    size_t tx_pos = 0;
+
+    Session& session(uint32_t id, uint64_t sim) {
+        for (Session& s : sessions) {
+            if (s.id == id) {
+                return s;
+            }
+        }
+        sessions.emplace_back();
+        sessions.back().id = id;
+        sessions.back().sim_start = sim;
+        return sessions.back();
+    }
+
+    bool is_unchecked(size_t pos) const {
+        for (const std::pair<size_t, size_t>& r : cur->unchecked) {
+            if (pos >= r.first && pos < r.second) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static uint32_t get_u32(const uint8_t* p) {
+        return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+
+    static bool get_leb(const std::vector<uint8_t>& d, size_t* pos, uint64_t* v) {
+        *v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (*pos >= d.size()) {
+                return false;
+            }
+            uint8_t b = d[(*pos)++];
+            *v |= (uint64_t)(b & 0x7F) << shift;
+            if (!(b & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+} // namespace vpi_record
+
+#endif // VPI_RECORD_H
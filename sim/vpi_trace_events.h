@@ -0,0 +1,178 @@
+/**
+ * VPI timeline export
+ * Buffered writer for the Chrome trace-event JSON format, which Perfetto
+ * (ui.perfetto.dev) and chrome://tracing open directly
+ */
+
+#ifndef VPI_TRACE_EVENTS_H
+#define VPI_TRACE_EVENTS_H
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "vpi_metrics.h"
+
+namespace vpi_trace {
+
+// Events are appended to a memory buffer and only written out when it fills
+// (and at close), so tracing costs no system calls on the simulation path.
+// Each flush is itself recorded as a slice on flush_pid/flush_tid.
+class TraceWriter {
+public:
+    static constexpr size_t BUFFER_SIZE = 1 << 20;
+
+    TraceWriter()
+        : fp(nullptr), len(0), first(true), flush_pid(0), flush_tid(0), origin(0), flush_start(0), flush_ns(0) {}
+    ~TraceWriter() { close(); }
+
+    // Wall-clock slices are placed relative to now_ns() at open
+    bool open(const char* path) {
+        fp = fopen(path, "w");
+        if (!fp) {
+            return false;
+        }
+        buf.resize(BUFFER_SIZE);
+        len = 0;
+        first = true;
+        origin = vpi_metrics::now_ns();
+        append("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+        return true;
+    }
+
+    bool is_open() const { return fp != nullptr; }
+    uint64_t wall(uint64_t now_ns) const { return now_ns > origin ? now_ns - origin : 0; }
+
+    void close() {
+        if (!fp) {
+            return;
+        }
+        append("\n]}\n");
+        fwrite(buf.data(), 1, len, fp);
+        fclose(fp);
+        fp = nullptr;
+    }
+
+    void set_flush_track(int pid, int tid) {
+        flush_pid = pid;
+        flush_tid = tid;
+    }
+
+    void process_name(int pid, const char* name) {
+        event("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}}", pid, name);
+    }
+
+    void thread_name(int pid, int tid, const char* name) {
+        event("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+              pid, tid, name);
+    }
+
+    // Complete event ("X") at ts_ns for dur_ns; args is the body of a JSON
+    // object ("\"k\":1,...") or nullptr
+    void slice(int pid, int tid, const char* name, uint64_t ts_ns, uint64_t dur_ns, const char* args = nullptr) {
+        event("{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%llu.%03u,\"dur\":%llu.%03u,\"args\":{%s}}",
+              name, pid, tid,
+              (unsigned long long)(ts_ns / 1000), (unsigned)(ts_ns % 1000),
+              (unsigned long long)(dur_ns / 1000), (unsigned)(dur_ns % 1000),
+              args ? args : "");
+    }
+
+private:
+    FILE* fp;
+    std::vector<char> buf;
+    size_t len;
+    bool first;
+    int flush_pid;
+    int flush_tid;
+    uint64_t origin;
+    uint64_t flush_start;
+    uint64_t flush_ns;      // last flush, not yet recorded
+
+    void append(const char* s) {
+        size_t n = strlen(s);
+        if (len + n > buf.size()) {
+            flush();
+        }
+        memcpy(buf.data() + len, s, n);
+        len += n;
+    }
+
+    __attribute__((format(printf, 2, 3))) void event(const char* fmt, ...) {
+        if (!fp) {
+            return;
+        }
+        append(first ? "" : ",\n");
+        first = false;
+        for (int pass = 0; pass < 2; pass++) {
+            va_list ap;
+            va_start(ap, fmt);
+            int n = vsnprintf(buf.data() + len, buf.size() - len, fmt, ap);
+            va_end(ap);
+            if (n >= 0 && (size_t)n < buf.size() - len) {
+                len += n;
+                break;
+            }
+            flush();
+        }
+        if (flush_ns != 0 && flush_tid != 0) {
+            uint64_t dur = flush_ns;
+            flush_ns = 0;
+            slice(flush_pid, flush_tid, "flush", wall(flush_start), dur);
+        }
+    }
+
+    void flush() {
+        flush_start = vpi_metrics::now_ns();
+        fwrite(buf.data(), 1, len, fp);
+        len = 0;
+        flush_ns = vpi_metrics::now_ns() - flush_start + 1;
+    }
+};
+
+// Time spent in calls too frequent to trace one by one (model evaluation,
+// waveform dumps), summed per window of wall time. Each window becomes one
+// slice starting at its first call, as long as the busy time it covered, with
+// the call count in its args; the gaps show how much of the window was free.
+class BusyTrack {
+public:
+    static constexpr uint64_t WINDOW_NS = 1000000;
+
+    BusyTrack(TraceWriter& w, int pid, int tid, const char* name)
+        : writer(w), pid(pid), tid(tid), name(name), start(0), busy(0), calls(0) {}
+
+    void add(uint64_t t0, uint64_t t1) {
+        if (calls != 0 && t0 - start >= WINDOW_NS) {
+            emit();
+        }
+        if (calls == 0) {
+            start = t0;
+        }
+        busy += t1 - t0;
+        calls++;
+    }
+
+    void emit() {
+        if (calls == 0) {
+            return;
+        }
+        char args[32];
+        snprintf(args, sizeof(args), "\"calls\":%llu", (unsigned long long)calls);
+        writer.slice(pid, tid, name, writer.wall(start), busy, args);
+        busy = 0;
+        calls = 0;
+    }
+
+private:
+    TraceWriter& writer;
+    int pid;
+    int tid;
+    const char* name;
+    uint64_t start;
+    uint64_t busy;
+    uint64_t calls;
+};
+
+} // namespace vpi_trace
+
+#endif // VPI_TRACE_EVENTS_H
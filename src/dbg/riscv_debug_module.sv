@@ -679,8 +679,14 @@ module riscv_debug_module #(
                                                     cmd_aarsize       <= dmi_wdata[22:20];
                                                     cmd_postincrement <= dmi_wdata[19];
 
+                                                    // Present the register address now so the
+                                                    // read state captures its data, not the
+                                                    // previous command's
+                                                    hart_gpr_addr     <= dmi_wdata[4:0];
+                                                    hart_csr_addr     <= dmi_wdata[11:0];
+
                                                     // Determine register type and start access
-                                                    if (dmi_wdata[15:0] < 16'h1000) begin
+                                                    if (dmi_wdata[15:0] >= 16'h1000) begin
                                                         // GPR access (x0-x31: 0x1000-0x101F)
                                                         if (dmi_wdata[16]) begin
                                                             cmd_state <= CMD_WRITE_GPR;
@@ -1,13 +1,18 @@
 /**
  * Simple OpenOCD-compatible client example
  * Connects to JTAG VPI server and performs basic operations
+ *
+ * Usage: jtag_vpi_client [--unix <path> | --abstract <name>]
+ * (default: TCP 127.0.0.1:3333)
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
@@ -62,6 +67,50 @@ int jtag_vpi_connect(const char *ip, int port) {
     return -1;
 }
 
+/**
+ * Connect to JTAG VPI server over a unix domain socket (sim run with
+ * --unix <path>, or --abstract <name> for the Linux abstract namespace)
+ */
+int jtag_vpi_connect_unix(const char *path, int abstract) {
+    struct sockaddr_un addr;
+    socklen_t len;
+    size_t n = strlen(path);
+    int retries = 0;
+
+    if (n + 1 > sizeof(addr.sun_path)) {
+        fprintf(stderr, "Unix socket name too long: %s\n", path);
+        return -1;
+    }
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (abstract) {
+        memcpy(addr.sun_path + 1, path, n);  // leading NUL: abstract name
+        len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 + n);
+    } else {
+        memcpy(addr.sun_path, path, n);
+        len = (socklen_t)sizeof(addr);
+    }
+
+    // Retry connection a few times
+    while (retries < 10) {
+        if (connect(sock, (struct sockaddr*)&addr, len) == 0) {
+            printf("Connected to JTAG VPI server at unix:%s%s\n", abstract ? "@" : "", path);
+            return 0;
+        }
+        retries++;
+        usleep(500000);  // 500ms
+    }
+
+    perror("connect");
+    return -1;
+}
+
 /**
  * Send JTAG command
  */
@@ -125,16 +174,29 @@ unsigned int jtag_read_idcode(void) {
 /**
  * Main function - example OpenOCD-like operations
  */
-int main(void) {
+int main(int argc, char **argv) {
     unsigned char tdo;
     unsigned int idcode;
+    const char *unix_path = NULL;
+    int abstract = 0;
     int i;
 
+    for (i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "--unix") == 0 || strcmp(argv[i], "--abstract") == 0) && i + 1 < argc) {
+            abstract = (strcmp(argv[i], "--abstract") == 0);
+            unix_path = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [--unix <path> | --abstract <name>]\n", argv[0]);
+            return 1;
+        }
+    }
+
     printf("JTAG VPI Client - OpenOCD-Compatible\n");
     printf("=====================================\n\n");
 
     // Connect to server
-    if (jtag_vpi_connect(SERVER_IP, SERVER_PORT) < 0) {
+    if ((unix_path ? jtag_vpi_connect_unix(unix_path, abstract)
+                   : jtag_vpi_connect(SERVER_IP, SERVER_PORT)) < 0) {
         fprintf(stderr, "Failed to connect to JTAG VPI server\n");
         fprintf(stderr, "Make sure simulation is running with VPI support\n");
         return 1;
@@ -0,0 +1,211 @@
+/**
+ * JTAG VPI shared-memory transport - client side
+ * See jtag_vpi_shm.h for the handshake and ring layout.
+ */
+
+#define _GNU_SOURCE
+#include "jtag_vpi_shm.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#define JVPI_SHM_SPIN_US 100
+
+static double shm_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static inline void shm_cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+int jvpi_shm_attach(jvpi_shm_t *s, int sock) {
+    uint8_t pkt[JVPI_SHM_PKT_SIZE];
+    int fds[3] = {-1, -1, -1};
+    size_t got = 0;
+
+    memset(s, 0, sizeof(*s));
+    s->sock = sock;
+    s->server_bell = -1;
+    s->client_bell = -1;
+    /* Spinning only pays off when the server has a CPU of its own */
+    s->spin_us = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? JVPI_SHM_SPIN_US : 0;
+
+    /* CMD_TMS_SEQ (1), nb_bits = 0, magic in buffer_out */
+    memset(pkt, 0, sizeof(pkt));
+    pkt[0] = 1;
+    memcpy(pkt + 4, JVPI_SHM_MAGIC, sizeof(JVPI_SHM_MAGIC));
+    for (size_t off = 0; off < sizeof(pkt);) {
+        ssize_t n = send(sock, pkt + off, sizeof(pkt) - off, 0);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        off += (size_t)n;
+    }
+
+    /* The descriptors travel with the first byte of the reply */
+    while (got < sizeof(pkt)) {
+        union {
+            struct cmsghdr hdr;
+            char buf[CMSG_SPACE(sizeof(fds))];
+        } ctl;
+        struct iovec iov = {pkt + got, sizeof(pkt) - got};
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = ctl.buf;
+        msg.msg_controllen = sizeof(ctl.buf);
+        ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+            goto fail;
+        }
+        for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+            if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS &&
+                c->cmsg_len == CMSG_LEN(sizeof(fds))) {
+                memcpy(fds, CMSG_DATA(c), sizeof(fds));
+            }
+        }
+        got += (size_t)n;
+    }
+
+    /* buffer_in (offset 516): magic, then version and slot count (LE) */
+    const uint8_t *in = pkt + 4 + 512;
+    uint32_t version = in[12] | (in[13] << 8) | (in[14] << 16) | ((uint32_t)in[15] << 24);
+    uint32_t slots = in[16] | (in[17] << 8) | (in[18] << 16) | ((uint32_t)in[19] << 24);
+    if (memcmp(in, JVPI_SHM_MAGIC, sizeof(JVPI_SHM_MAGIC)) != 0 || fds[0] < 0 ||
+        version != JVPI_SHM_VERSION || slots != JVPI_SHM_SLOTS) {
+        goto fail;
+    }
+
+    void *map = mmap(NULL, sizeof(struct jvpi_shm_region), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    if (map == MAP_FAILED)
+        goto fail;
+    close(fds[0]);
+    s->region = (struct jvpi_shm_region *)map;
+    s->server_bell = fds[1];
+    s->client_bell = fds[2];
+    return 0;
+
+fail:
+    for (int i = 0; i < 3; i++) {
+        if (fds[i] >= 0)
+            close(fds[i]);
+    }
+    return -1;
+}
+
+void jvpi_shm_detach(jvpi_shm_t *s) {
+    if (s->region) {
+        munmap(s->region, sizeof(struct jvpi_shm_region));
+        s->region = NULL;
+    }
+    if (s->server_bell >= 0)
+        close(s->server_bell);
+    if (s->client_bell >= 0)
+        close(s->client_bell);
+    s->server_bell = -1;
+    s->client_bell = -1;
+}
+
+void *jvpi_shm_cmd_slot(jvpi_shm_t *s) {
+    struct jvpi_shm_ring *r = &s->region->cmd;
+    uint32_t tail = r->tail;
+    if (tail - jvpi_shm_load(&r->head) >= JVPI_SHM_SLOTS)
+        return NULL;
+    return s->region->cmd_slot[tail % JVPI_SHM_SLOTS];
+}
+
+void jvpi_shm_post(jvpi_shm_t *s) {
+    struct jvpi_shm_ring *r = &s->region->cmd;
+    jvpi_shm_store(&r->tail, r->tail + 1);
+    jvpi_shm_fence();
+    if (jvpi_shm_load(&r->sleeping)) {
+        uint64_t one = 1;
+        (void)!write(s->server_bell, &one, sizeof(one));
+    }
+}
+
+const void *jvpi_shm_resp(jvpi_shm_t *s, int timeout_ms) {
+    struct jvpi_shm_ring *r = &s->region->resp;
+    uint32_t head = r->head;
+    double start = shm_now_us();
+
+    for (;;) {
+        if (jvpi_shm_load(&r->tail) != head)
+            return s->region->resp_slot[head % JVPI_SHM_SLOTS];
+        double waited = shm_now_us() - start;
+        if (waited < s->spin_us) {
+            shm_cpu_relax();
+            continue;
+        }
+
+        /* Sleep on the doorbell; re-check after publishing the flag so a
+         * response posted in between is not missed */
+        jvpi_shm_store(&r->sleeping, 1);
+        jvpi_shm_fence();
+        if (jvpi_shm_load(&r->tail) != head) {
+            jvpi_shm_store(&r->sleeping, 0);
+            continue;
+        }
+        int wait_ms = -1;
+        if (timeout_ms >= 0) {
+            wait_ms = timeout_ms - (int)(waited / 1000);
+            if (wait_ms < 0)
+                wait_ms = 0;
+        }
+        struct pollfd pfd[2] = {{s->client_bell, POLLIN, 0}, {s->sock, POLLIN, 0}};
+        int n = poll(pfd, 2, wait_ms);
+        jvpi_shm_store(&r->sleeping, 0);
+        if (n < 0 && errno != EINTR)
+            return NULL;
+        if (n > 0 && (pfd[0].revents & POLLIN)) {
+            uint64_t count;
+            (void)!read(s->client_bell, &count, sizeof(count));
+        }
+        if (n > 0 && (pfd[1].revents & (POLLIN | POLLHUP | POLLERR)) && jvpi_shm_load(&r->tail) == head)
+            return NULL;  /* server closed the session */
+        if (n == 0 && jvpi_shm_load(&r->tail) == head)
+            return NULL;  /* timed out */
+    }
+}
+
+void jvpi_shm_resp_done(jvpi_shm_t *s) {
+    struct jvpi_shm_ring *r = &s->region->resp;
+    struct jvpi_shm_ring *c = &s->region->cmd;
+    jvpi_shm_store(&r->head, r->head + 1);
+    /* A server stalled on a full resp ring sleeps with commands still queued */
+    jvpi_shm_fence();
+    if (jvpi_shm_load(&c->sleeping) && c->tail != jvpi_shm_load(&c->head)) {
+        uint64_t one = 1;
+        (void)!write(s->server_bell, &one, sizeof(one));
+    }
+}
+
+int jvpi_shm_xfer(jvpi_shm_t *s, const void *cmd, void *resp, int timeout_ms) {
+    void *slot = jvpi_shm_cmd_slot(s);
+    if (!slot)
+        return -1;
+    memcpy(slot, cmd, JVPI_SHM_PKT_SIZE);
+    jvpi_shm_post(s);
+    const void *r = jvpi_shm_resp(s, timeout_ms);
+    if (!r)
+        return -1;
+    memcpy(resp, r, JVPI_SHM_PKT_SIZE);
+    jvpi_shm_resp_done(s);
+    return 0;
+}
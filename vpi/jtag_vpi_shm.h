@@ -0,0 +1,90 @@
+/**
+ * JTAG VPI shared-memory transport
+ *
+ * Same-host clients can move their 1036-byte jtag_vpi packets through a
+ * memfd region instead of the socket. The client connects over the server's
+ * AF_UNIX socket (--unix / --abstract) and sends a CMD_TMS_SEQ with
+ * nb_bits = 0 and JVPI_SHM_MAGIC in buffer_out. A server that supports the
+ * transport answers with the magic, version and slot count in buffer_in and
+ * passes three descriptors with the reply (SCM_RIGHTS): the region, the
+ * server doorbell and the client doorbell (eventfds). Any other reply has a
+ * zeroed buffer_in and the socket carries on as a normal connection.
+ *
+ * After the handshake commands go into the cmd ring and responses come back
+ * in the resp ring, one packet per slot, in order. The socket stays open
+ * only to tell either side that the other one is gone. A consumer sets
+ * `sleeping` before it blocks on its doorbell, and producers only ring a
+ * doorbell that has a sleeper, so a busy link makes no system calls.
+ *
+ * Streaming scans (6, 7) and CMD_BATCH (8) are not carried over the rings;
+ * the capability query answered on the rings does not advertise them.
+ */
+
+#ifndef JTAG_VPI_SHM_H
+#define JTAG_VPI_SHM_H
+
+#include <stdint.h>
+
+#define JVPI_SHM_MAGIC "JVPI_SHM"
+#define JVPI_SHM_VERSION 1
+#define JVPI_SHM_SLOTS 16            /* per ring, power of two */
+#define JVPI_SHM_PKT_SIZE 1036       /* OpenOCD jtag_vpi packet */
+#define JVPI_SHM_SLOT_SIZE 1088      /* packet rounded up to whole cache lines */
+
+/* One direction. The producer owns tail, the consumer owns head and sleeping;
+ * positions are free-running (slot = pos % JVPI_SHM_SLOTS). Each field sits
+ * on its own cache line so the two sides do not write the same line. */
+struct jvpi_shm_ring {
+    uint32_t head;
+    uint8_t pad0[60];
+    uint32_t tail;
+    uint8_t pad1[60];
+    uint32_t sleeping;
+    uint8_t pad2[60];
+};
+
+struct jvpi_shm_region {
+    char magic[8];
+    uint32_t version;
+    uint32_t slots;
+    uint8_t pad[48];
+    struct jvpi_shm_ring cmd;        /* client -> server */
+    struct jvpi_shm_ring resp;       /* server -> client */
+    uint8_t cmd_slot[JVPI_SHM_SLOTS][JVPI_SHM_SLOT_SIZE];
+    uint8_t resp_slot[JVPI_SHM_SLOTS][JVPI_SHM_SLOT_SIZE];
+};
+
+/* Cross-process ring accesses (both sides are built with GCC or Clang) */
+static inline uint32_t jvpi_shm_load(const uint32_t *p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+static inline void jvpi_shm_store(uint32_t *p, uint32_t v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+static inline void jvpi_shm_fence(void) { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+
+#ifndef __cplusplus
+/* Client library (jtag_vpi_shm.c) */
+typedef struct {
+    struct jvpi_shm_region *region;
+    int sock;           /* connection the transport was negotiated on */
+    int server_bell;    /* rung when the server sleeps on an empty cmd ring */
+    int client_bell;    /* rung by the server when we sleep on an empty resp ring */
+    int spin_us;        /* busy-wait this long for a response before sleeping (0 on one CPU) */
+} jvpi_shm_t;
+
+/* Negotiate the transport on a freshly connected AF_UNIX socket.
+ * Returns 0, or -1 if the server declined (the socket is still usable). */
+int jvpi_shm_attach(jvpi_shm_t *s, int sock);
+void jvpi_shm_detach(jvpi_shm_t *s);
+
+/* Next free command slot, or NULL while the cmd ring is full */
+void *jvpi_shm_cmd_slot(jvpi_shm_t *s);
+/* Hand the slot from jvpi_shm_cmd_slot() to the server */
+void jvpi_shm_post(jvpi_shm_t *s);
+/* Oldest unread response; NULL on timeout (ms, < 0 waits forever) or when the
+ * server has gone away. Release it with jvpi_shm_resp_done(). */
+const void *jvpi_shm_resp(jvpi_shm_t *s, int timeout_ms);
+void jvpi_shm_resp_done(jvpi_shm_t *s);
+
+/* One command, one response: copies cmd in and the response out */
+int jvpi_shm_xfer(jvpi_shm_t *s, const void *cmd, void *resp, int timeout_ms);
+#endif
+
+#endif /* JTAG_VPI_SHM_H */